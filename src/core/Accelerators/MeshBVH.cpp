@@ -0,0 +1,271 @@
+#include "Accelerators/MeshBVH.h"
+
+#include "Shape/QuadShape.h"
+#include "Utils/Interaction.h"
+
+#include <algorithm>
+
+namespace RT
+{
+	//-------------------------------------------MeshBVH-------------------------------------
+
+	MeshBVH::MeshBVH(TriangleMesh *mesh, Transform *objectToWorld, Transform *worldToObject, const Material *material)
+		: m_mesh(mesh), m_objectToWorld(objectToWorld), m_worldToObject(worldToObject), m_material(material)
+	{
+		const int nTriangles = (int)m_mesh->numTriangles();
+		const int nPrims = nTriangles + (int)m_mesh->numQuads();
+		CHECK_GT(nPrims, 0);
+
+		// Bounds of the primitives, read through the geometry cache
+		std::vector<BuildPrimitive> prims(nPrims);
+		for (int i = 0; i < nPrims; ++i)
+		{
+			BBox3f bounds;
+			if (i < nTriangles)
+			{
+				for (int j = 0; j < 3; ++j)
+					bounds = unionBounds(bounds, m_mesh->getPosition(m_mesh->getIndex(3 * i + j)));
+			}
+			else
+			{
+				for (int j = 0; j < 4; ++j)
+					bounds = unionBounds(bounds, m_mesh->getPosition(m_mesh->getQuadIndex(4 * (i - nTriangles) + j)));
+			}
+			prims[i] = { bounds, (bounds.m_pMin + bounds.m_pMax) * 0.5f, i };
+		}
+
+		std::vector<Node> nodes;
+		std::vector<int> primList;
+		nodes.reserve(2 * nPrims / maxPrimsInNode + 1);
+		primList.reserve(nPrims);
+		buildRecursive(prims, 0, nPrims, nodes, primList);
+		m_bounds = nodes[0].bounds;
+
+		m_storage.reset(new MappedGeometryBuffer({ { nodes.data(), nodes.size() * sizeof(Node) },
+			{ primList.data(), primList.size() * sizeof(int) } }, GeometryCache::instance().getDirectory()));
+		m_nodes = reinterpret_cast<const Node*>(m_storage->data());
+		m_prims = reinterpret_cast<const int*>(m_storage->data() + nodes.size() * sizeof(Node));
+
+		LOG(INFO) << "Paged out " << nodes.size() << " hierarchy nodes over " << nPrims << " primitives";
+	}
+
+	int MeshBVH::buildRecursive(std::vector<BuildPrimitive> &prims, int start, int end,
+		std::vector<Node> &nodes, std::vector<int> &primList)
+	{
+		const int index = (int)nodes.size();
+		nodes.push_back(Node());
+
+		BBox3f bounds, centroidBounds;
+		for (int i = start; i < end; ++i)
+		{
+			bounds = unionBounds(bounds, prims[i].bounds);
+			centroidBounds = unionBounds(centroidBounds, prims[i].centroid);
+		}
+		nodes[index].bounds = bounds;
+
+		const int nPrims = end - start;
+		if (nPrims <= maxPrimsInNode)
+		{
+			nodes[index].offset = (int)primList.size();
+			nodes[index].nPrims = (uint16_t)nPrims;
+			for (int i = start; i < end; ++i)
+				primList.push_back(prims[i].prim);
+			return index;
+		}
+
+		// Split along the largest extent of the centroids with the surface area heuristic
+		const int axis = centroidBounds.maximumExtent();
+		const Float cmin = centroidBounds.m_pMin[axis], cmax = centroidBounds.m_pMax[axis];
+		int mid = (start + end) / 2;
+		if (cmax > cmin)
+		{
+			constexpr int nBuckets = 12;
+			auto bucketOf = [&](const BuildPrimitive &p)
+			{
+				return glm::min((int)(nBuckets * (p.centroid[axis] - cmin) / (cmax - cmin)), nBuckets - 1);
+			};
+
+			int counts[nBuckets] = {};
+			BBox3f bucketBounds[nBuckets];
+			for (int i = start; i < end; ++i)
+			{
+				const int b = bucketOf(prims[i]);
+				++counts[b];
+				bucketBounds[b] = unionBounds(bucketBounds[b], prims[i].bounds);
+			}
+
+			// Cost of splitting after each bucket, swept from both sides
+			Float cost[nBuckets - 1];
+			BBox3f below, above;
+			int nBelow = 0, nAbove = 0;
+			for (int b = 0; b < nBuckets - 1; ++b)
+			{
+				below = unionBounds(below, bucketBounds[b]);
+				nBelow += counts[b];
+				cost[b] = nBelow * below.surfaceArea();
+			}
+			for (int b = nBuckets - 1; b > 0; --b)
+			{
+				above = unionBounds(above, bucketBounds[b]);
+				nAbove += counts[b];
+				cost[b - 1] += nAbove * above.surfaceArea();
+			}
+
+			//Note: the extreme centroids fall into the first and the last bucket, so no side is empty
+			const int split = (int)(std::min_element(cost, cost + nBuckets - 1) - cost);
+			mid = (int)(std::partition(prims.begin() + start, prims.begin() + end,
+				[&](const BuildPrimitive &p) { return bucketOf(p) <= split; }) - prims.begin());
+		}
+
+		buildRecursive(prims, start, mid, nodes, primList);
+		const int secondChild = buildRecursive(prims, mid, end, nodes, primList);
+		nodes[index].offset = secondChild;
+		nodes[index].nPrims = 0;
+		nodes[index].axis = (uint8_t)axis;
+		return index;
+	}
+
+	bool MeshBVH::hitPrimitive(int prim, const Ray &ray) const
+	{
+		const int nTriangles = (int)m_mesh->numTriangles();
+		if (prim < nTriangles)
+		{
+			ATriangleShape triangle(m_objectToWorld, m_worldToObject, { m_mesh->getIndex(3 * prim),
+				m_mesh->getIndex(3 * prim + 1), m_mesh->getIndex(3 * prim + 2) }, m_mesh);
+			return triangle.hit(ray);
+		}
+
+		const int q = 4 * (prim - nTriangles);
+		AQuadShape quad(m_objectToWorld, m_worldToObject, { m_mesh->getQuadIndex(q), m_mesh->getQuadIndex(q + 1),
+			m_mesh->getQuadIndex(q + 2), m_mesh->getQuadIndex(q + 3) }, m_mesh);
+		return quad.hit(ray);
+	}
+
+	bool MeshBVH::hitPrimitive(int prim, const Ray &ray, SurfaceInteraction &isect) const
+	{
+		const int nTriangles = (int)m_mesh->numTriangles();
+		Float tHit;
+		bool hit;
+		if (prim < nTriangles)
+		{
+			ATriangleShape triangle(m_objectToWorld, m_worldToObject, { m_mesh->getIndex(3 * prim),
+				m_mesh->getIndex(3 * prim + 1), m_mesh->getIndex(3 * prim + 2) }, m_mesh);
+			hit = triangle.hit(ray, tHit, isect);
+		}
+		else
+		{
+			const int q = 4 * (prim - nTriangles);
+			AQuadShape quad(m_objectToWorld, m_worldToObject, { m_mesh->getQuadIndex(q), m_mesh->getQuadIndex(q + 1),
+				m_mesh->getQuadIndex(q + 2), m_mesh->getQuadIndex(q + 3) }, m_mesh);
+			hit = quad.hit(ray, tHit, isect);
+		}
+		if (!hit)
+			return false;
+
+		//Note: the shape only lives for the test, the interaction refers to the hierarchy instead
+		ray.m_tMax = tHit;
+		isect.shape = nullptr;
+		isect.hitable = this;
+		return true;
+	}
+
+	bool MeshBVH::hit(const Ray &ray) const
+	{
+		const Vec3f invDir(1 / ray.m_dir.x, 1 / ray.m_dir.y, 1 / ray.m_dir.z);
+		const int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+		// Follow the ray through the nodes, the nearer child first
+		int toVisit[64];
+		int toVisitOffset = 0, current = 0;
+		while (true)
+		{
+			const Node &node = getNode(current);
+			if (node.bounds.hit(ray, invDir, dirIsNeg))
+			{
+				if (node.nPrims > 0)
+				{
+					for (int i = 0; i < node.nPrims; ++i)
+					{
+						if (hitPrimitive(getPrimitive(node.offset + i), ray))
+							return true;
+					}
+					if (toVisitOffset == 0)
+						break;
+					current = toVisit[--toVisitOffset];
+				}
+				else if (dirIsNeg[node.axis])
+				{
+					toVisit[toVisitOffset++] = current + 1;
+					current = node.offset;
+				}
+				else
+				{
+					toVisit[toVisitOffset++] = node.offset;
+					current = current + 1;
+				}
+			}
+			else
+			{
+				if (toVisitOffset == 0)
+					break;
+				current = toVisit[--toVisitOffset];
+			}
+		}
+		return false;
+	}
+
+	bool MeshBVH::hit(const Ray &ray, SurfaceInteraction &isect) const
+	{
+		const Vec3f invDir(1 / ray.m_dir.x, 1 / ray.m_dir.y, 1 / ray.m_dir.z);
+		const int dirIsNeg[3] = { invDir.x < 0, invDir.y < 0, invDir.z < 0 };
+
+		// Follow the ray through the nodes, the nearer child first, every hit shortens the ray
+		bool hit = false;
+		int toVisit[64];
+		int toVisitOffset = 0, current = 0;
+		while (true)
+		{
+			const Node &node = getNode(current);
+			if (node.bounds.hit(ray, invDir, dirIsNeg))
+			{
+				if (node.nPrims > 0)
+				{
+					for (int i = 0; i < node.nPrims; ++i)
+					{
+						if (hitPrimitive(getPrimitive(node.offset + i), ray, isect))
+							hit = true;
+					}
+					if (toVisitOffset == 0)
+						break;
+					current = toVisit[--toVisitOffset];
+				}
+				else if (dirIsNeg[node.axis])
+				{
+					toVisit[toVisitOffset++] = current + 1;
+					current = node.offset;
+				}
+				else
+				{
+					toVisit[toVisitOffset++] = node.offset;
+					current = current + 1;
+				}
+			}
+			else
+			{
+				if (toVisitOffset == 0)
+					break;
+				current = toVisit[--toVisitOffset];
+			}
+		}
+		return hit;
+	}
+
+	void MeshBVH::computeScatteringFunctions(SurfaceInteraction &isect, MemoryArena &arena,
+		TransportMode mode, bool allowMultipleLobes) const
+	{
+		if (m_material != nullptr)
+		{
+			m_material->computeScatteringFunctions(isect, arena, mode, allowMultipleLobes);
+		}
+	}
+}
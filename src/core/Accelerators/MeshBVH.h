@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Utils/Base.h"
+#include "Utils/Math.h"
+#include "Object/Hitable.h"
+#include "Shape/TriangleShape.h"
+#include "Utils/GeometryCache.h"
+
+namespace RT
+{
+	//! @brief Bounding volume hierarchy over the triangles and quads of one out-of-core mesh.
+	/**
+	 * Takes the place of the hitables of all the primitives of the mesh, so that the scene keeps a
+	 * single hitable per mesh in memory and the primitives are intersected straight from the arrays
+	 * of the mesh. The nodes and the primitive list of the leaves are written to the geometry cache
+	 * like the arrays and are paged in on demand under the same memory budget. The lights sample the
+	 * shapes of their primitives, so an emissive mesh keeps a hitable per primitive instead.
+	 */
+	class MeshBVH final : public Hitable
+	{
+	public:
+		typedef std::shared_ptr<MeshBVH> ptr;
+
+		MeshBVH(TriangleMesh *mesh, Transform *objectToWorld, Transform *worldToObject, const Material *material);
+
+		virtual bool hit(const Ray &ray) const override;
+		virtual bool hit(const Ray &ray, SurfaceInteraction &iset) const override;
+
+		virtual BBox3f worldBound() const override { return m_bounds; }
+
+		virtual const AreaLight *getAreaLight() const override { return nullptr; }
+		virtual const Material *getMaterial() const override { return m_material; }
+
+		virtual void computeScatteringFunctions(SurfaceInteraction &isect, MemoryArena &arena,
+			TransportMode mode, bool allowMultipleLobes) const override;
+
+		virtual std::string toString() const override { return "MeshBVH[]"; }
+
+	private:
+		static constexpr int maxPrimsInNode = 4;
+
+		struct Node
+		{
+			BBox3f bounds;
+			int offset;			//first entry of a leaf in the primitive list, second child of an interior node
+			uint16_t nPrims;	//zero for an interior node
+			uint8_t axis;		//split axis of an interior node
+		};
+
+		struct BuildPrimitive
+		{
+			BBox3f bounds;
+			Vec3f centroid;
+			int prim;
+		};
+
+		//Append the subtree over the primitives [start, end) in depth-first order, returns its root
+		int buildRecursive(std::vector<BuildPrimitive> &prims, int start, int end,
+			std::vector<Node> &nodes, std::vector<int> &primList);
+
+		//Note: the primitives number the triangles of the mesh first and its quads after them
+		bool hitPrimitive(int prim, const Ray &ray) const;
+		bool hitPrimitive(int prim, const Ray &ray, SurfaceInteraction &isect) const;
+
+		const Node &getNode(int index) const
+		{
+			m_storage->touch(index * sizeof(Node));
+			return m_nodes[index];
+		}
+
+		int getPrimitive(int index) const
+		{
+			m_storage->touch(reinterpret_cast<const Byte*>(m_prims + index) - m_storage->data());
+			return m_prims[index];
+		}
+
+		TriangleMesh *m_mesh;
+		Transform *m_objectToWorld, *m_worldToObject;
+		const Material *m_material;
+		BBox3f m_bounds;
+
+		//Note: the nodes come first in the block, followed by the primitive list
+		MappedGeometryBuffer::unique_ptr m_storage;
+		const Node *m_nodes = nullptr;
+		const int *m_prims = nullptr;
+	};
+}
@@ -1,5 +1,7 @@
 #include "Camera/Camera.h"
 
+#include "Render/Light.h"
+
 namespace RT
 {
 	//-------------------------------------------ACamera-------------------------------------
@@ -38,6 +40,7 @@ namespace RT
 			translate(Vec3f(-screen.m_pMin.x, -screen.m_pMax.y, 0));
 		m_rasterToScreen = inverse(m_screenToRaster);
 		m_rasterToCamera = inverse(m_cameraToScreen) * m_rasterToScreen;
+		m_cameraToRaster = inverse(m_rasterToCamera);
 	}
 }
 
@@ -73,6 +76,8 @@ namespace RT
 
 	void APerspectiveCamera::initialize()
 	{
+		AProjectiveCamera::initialize();
+
 		// Compute image plane bounds at $z=1$ for _PerspectiveCamera_
 		Vec2i res = m_film->getResolution();
 		Vec3f pMin = m_rasterToCamera(Vec3f(0, 0, 0), 1.0f);
@@ -80,8 +85,6 @@ namespace RT
 		pMin /= pMin.z;
 		pMax /= pMax.z;
 		A = glm::abs((pMax.x - pMin.x) * (pMax.y - pMin.y));
-
-		AProjectiveCamera::initialize();
 	}
 
 	Float APerspectiveCamera::castingRay(const CameraSample& sample, Ray& ray) const
@@ -93,4 +96,69 @@ namespace RT
 		ray = m_cameraToWorld(ray);
 		return 1.f;
 	}
+	Spectrum APerspectiveCamera::We(const Ray& ray, Vec2f* pRaster) const
+	{
+		// Check that the ray points along the viewing direction
+		Vec3f forward = normalize(m_cameraToWorld(Vec3f(0, 0, 1), 0.0f));
+		Float cosTheta = dot(ray.direction(), forward);
+		if (cosTheta <= 0)
+			return Spectrum(0.f);
+
+		// Map the ray onto the raster grid through its point on the plane at z = 1
+		Vec3f pFocus = ray(1 / cosTheta);
+		Vec3f pRasterH = m_cameraToRaster(inverse(m_cameraToWorld)(pFocus, 1.0f), 1.0f);
+		if (pRaster != nullptr)
+			*pRaster = Vec2f(pRasterH.x, pRasterH.y);
+
+		// Return zero importance for rays outside the sample bounds
+		BBox2i sampleBounds = m_film->getSampleBounds();
+		if (pRasterH.x < sampleBounds.m_pMin.x || pRasterH.x >= sampleBounds.m_pMax.x ||
+			pRasterH.y < sampleBounds.m_pMin.y || pRasterH.y >= sampleBounds.m_pMax.y)
+			return Spectrum(0.f);
+
+		//Note: the importance integrates to one over the image plane, and the lens area of a pinhole is one
+		Float cos2Theta = cosTheta * cosTheta;
+		return Spectrum(1 / (A * cos2Theta * cos2Theta));
+	}
+
+	void APerspectiveCamera::pdf_We(const Ray& ray, Float& pdfPos, Float& pdfDir) const
+	{
+		Vec3f forward = normalize(m_cameraToWorld(Vec3f(0, 0, 1), 0.0f));
+		Float cosTheta = dot(ray.direction(), forward);
+		pdfPos = pdfDir = 0;
+		if (cosTheta <= 0)
+			return;
+
+		Vec3f pFocus = ray(1 / cosTheta);
+		Vec3f pRaster = m_cameraToRaster(inverse(m_cameraToWorld)(pFocus, 1.0f), 1.0f);
+		BBox2i sampleBounds = m_film->getSampleBounds();
+		if (pRaster.x < sampleBounds.m_pMin.x || pRaster.x >= sampleBounds.m_pMax.x ||
+			pRaster.y < sampleBounds.m_pMin.y || pRaster.y >= sampleBounds.m_pMax.y)
+			return;
+
+		pdfPos = 1;
+		pdfDir = 1 / (A * cosTheta * cosTheta * cosTheta);
+	}
+
+	Spectrum APerspectiveCamera::sample_Wi(const Interaction& ref, const Vec2f&,
+		Vec3f& wi, Float& pdf, Vec2f& pRaster, VisibilityTester& vis) const
+	{
+		// The pinhole is the only point of the lens
+		Interaction lensIntr(m_cameraToWorld(Vec3f(0, 0, 0), 1.0f));
+		lensIntr.n = normalize(m_cameraToWorld(Vec3f(0, 0, 1), 0.0f));
+		vis = VisibilityTester(ref, lensIntr);
+
+		wi = lensIntr.p - ref.p;
+		Float dist = length(wi);
+		if (dist == 0)
+		{
+			pdf = 0;
+			return Spectrum(0.f);
+		}
+		wi /= dist;
+
+		// Convert the unit area density of the pinhole to solid angle at |ref|
+		pdf = (dist * dist) / absDot(lensIntr.n, wi);
+		return We(Ray(lensIntr.p, -wi), &pRaster);
+	}
 }
\ No newline at end of file
@@ -30,11 +30,13 @@ namespace RT
 
 		virtual Float castingRay(const CameraSample &sample, Ray &ray) const = 0;
 
-		//virtual spectrum We(const ARay &ray, APoint2f *pRaster2 = nullptr) const;
-		//virtual void pdf_We(const ARay &ray, Float *pdfPos, Float *pdfDir) const;
+		//Importance emitted along |ray|, |pRaster| receives the raster position the ray goes through
+		virtual Spectrum We(const Ray &ray, Vec2f *pRaster = nullptr) const = 0;
+		virtual void pdf_We(const Ray &ray, Float &pdfPos, Float &pdfDir) const = 0;
 
-		//virtual Spectrum Sample_Wi(const Interaction &ref, const APoint2f &u,
-		//	Vec3f *wi, Float *pdf, APoint2f *pRaster, VisibilityTester *vis) const;
+		//Sample a point on the lens that sees |ref|, |wi| points from |ref| to the lens
+		virtual Spectrum sample_Wi(const Interaction &ref, const Vec2f &u,
+			Vec3f &wi, Float &pdf, Vec2f &pRaster, VisibilityTester &vis) const = 0;
 
 		virtual ClassType getClassType() const override { return ClassType::AECamera; }
 
@@ -56,7 +58,7 @@ namespace RT
 		virtual void initialize();
 
 	protected:
-		Transform m_cameraToScreen, m_rasterToCamera;
+		Transform m_cameraToScreen, m_rasterToCamera, m_cameraToRaster;
 		Transform m_screenToRaster, m_rasterToScreen;
 	};
 
@@ -75,11 +77,10 @@ namespace RT
 
 		virtual Float castingRay(const CameraSample& sample, Ray& ray) const override;
 
-		//Spectrum We(const Ray &ray, Point2f *pRaster2 = nullptr) const;
-		//void Pdf_We(const Ray &ray, Float *pdfPos, Float *pdfDir) const;
-		//Spectrum Sample_Wi(const Interaction &ref, const Point2f &sample,
-		//	Vector3f *wi, Float *pdf, Point2f *pRaster,
-		//	VisibilityTester *vis) const;
+		virtual Spectrum We(const Ray& ray, Vec2f* pRaster = nullptr) const override;
+		virtual void pdf_We(const Ray& ray, Float& pdfPos, Float& pdfDir) const override;
+		virtual Spectrum sample_Wi(const Interaction& ref, const Vec2f& u,
+			Vec3f& wi, Float& pdf, Vec2f& pRaster, VisibilityTester& vis) const override;
 
 		virtual void activate() override { initialize(); }
 
@@ -89,7 +90,7 @@ namespace RT
 		virtual void initialize() override;
 
 	private:
-		//Vec3f dxCamera, dyCamera;
+		//Note: area of the image plane at z = 1 in camera space, the camera is a pinhole
 		Float A;
 	};
 }
\ No newline at end of file
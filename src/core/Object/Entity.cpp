@@ -1,6 +1,11 @@
 #include "Object/Entity.h"
 
 #include "Shape/Shape.h"
+#include "Shape/QuadShape.h"
+#include "Shape/CurveShape.h"
+#include "Utils/MeshSimplifier.h"
+#include "Accelerators/KDTree.h"
+#include "Accelerators/MeshBVH.h"
 
 namespace RT
 {
@@ -19,6 +24,41 @@ namespace RT
 		shape->setTransform(&m_objectToWorld, &m_worldToObject);
 
 		// 任
+		parseTransform(shapeNode);
+
+		// 
+		const auto &materialNode = node.getPropertyChild("Material");
+		m_material = Material::ptr(static_cast<Material*>(ObjectFactory::createInstance(
+				materialNode.getTypeName(), materialNode)));
+
+		//
+		AreaLight::ptr areaLight = nullptr;
+		if (node.hasPropertyChild("Light"))
+		{
+			const auto &lightNode = node.getPropertyChild("Light");
+			areaLight = AreaLight::ptr(static_cast<AreaLight*>(ObjectFactory::createInstance(
+				lightNode.getTypeName(), lightNode)));
+		}
+
+		m_hitables.push_back(std::make_shared<HitableObject>(shape, m_material.get(), areaLight));
+	}
+
+	Float Entity::getLodArea(int lodLevel) const
+	{
+		if (m_lodAreas.empty())
+			return 0;
+		return m_lodAreas[glm::clamp(lodLevel, 0, (int)m_lodAreas.size() - 1)];
+	}
+
+	size_t Entity::getLodTriangles(int lodLevel) const
+	{
+		if (m_lodTriangles.empty())
+			return 0;
+		return m_lodTriangles[glm::clamp(lodLevel, 0, (int)m_lodTriangles.size() - 1)];
+	}
+
+	void Entity::parseTransform(const PropertyTreeNode &shapeNode)
+	{
 		Transform objectToWrold;
 		const auto &shapeProps = shapeNode.getPropertyList();
 		if (shapeNode.hasProperty("Transform"))
@@ -68,13 +108,29 @@ namespace RT
 		}
 		m_objectToWorld = objectToWrold;
 		m_worldToObject = inverse(m_objectToWorld);
+	}
 
-		// 
+	//-------------------------------------------AMeshEntity-------------------------------------
+
+	AURORA_REGISTER_CLASS(MeshEntity, "MeshEntity")
+
+	MeshEntity::MeshEntity(const PropertyTreeNode &node)
+	{
+		const PropertyList& props = node.getPropertyList();
+		const std::string filename = props.getString("Filename");
+
+		// ״
+		const auto &shapeNode = node.getPropertyChild("Shape");
+
+		// 任
+		parseTransform(shapeNode);
+
+		//
 		const auto &materialNode = node.getPropertyChild("Material");
 		m_material = Material::ptr(static_cast<Material*>(ObjectFactory::createInstance(
-				materialNode.getTypeName(), materialNode)));
+			materialNode.getTypeName(), materialNode)));
 
-		//
+		//⣺һԴ
 		AreaLight::ptr areaLight = nullptr;
 		if (node.hasPropertyChild("Light"))
 		{
@@ -83,98 +139,269 @@ namespace RT
 				lightNode.getTypeName(), lightNode)));
 		}
 
-		m_hitables.push_back(std::make_shared<HitableObject>(shape, m_material.get(), areaLight));
+		//
+		//Note: the arrays of a mesh being loaded are not covered by the memory budget, so the out-of-core
+		//      meshes are loaded one at a time while the others are still loaded in parallel
+		const bool outOfCore = props.getBoolean("OutOfCore", GeometryCache::instance().isEnabled());
+		std::unique_lock<std::mutex> loadLock;
+		if (outOfCore)
+			loadLock = GeometryCache::instance().lockLoading();
+		m_mesh = TriangleMesh::unique_ptr(new TriangleMesh(&m_objectToWorld, PropertyTreeNode::m_directory + filename, outOfCore));
+
+		//Note: an out-of-core mesh is a single hitable over its own paged hierarchy, unless it is emissive
+		const bool pagedHierarchy = outOfCore && areaLight == nullptr && m_mesh->numTriangles() + m_mesh->numQuads() > 0;
+		LOG_IF(INFO, outOfCore && areaLight != nullptr) << "The primitives of the emissive mesh " << filename << " stay in memory";
+		if (pagedHierarchy)
+		{
+			m_hitables.push_back(std::make_shared<MeshBVH>(m_mesh.get(), &m_objectToWorld, &m_worldToObject, m_material.get()));
+		}
+		for (size_t i = 0; !pagedHierarchy && i < 3 * m_mesh->numTriangles(); i += 3)
+		{
+			std::array<int, 3> indices;
+			indices[0] = m_mesh->getIndex(i + 0);
+			indices[1] = m_mesh->getIndex(i + 1);
+			indices[2] = m_mesh->getIndex(i + 2);
+			ATriangleShape::ptr triangle = std::make_shared<ATriangleShape>(&m_objectToWorld, &m_worldToObject, indices, m_mesh.get());
+			m_hitables.push_back(std::make_shared<HitableObject>(triangle, m_material.get(), areaLight));
+		}
+		for (size_t i = 0; !pagedHierarchy && i < 4 * m_mesh->numQuads(); i += 4)
+		{
+			std::array<int, 4> indices;
+			for (int j = 0; j < 4; ++j)
+				indices[j] = m_mesh->getQuadIndex(i + j);
+			AQuadShape::ptr quad = std::make_shared<AQuadShape>(&m_objectToWorld, &m_worldToObject, indices, m_mesh.get());
+			m_hitables.push_back(std::make_shared<HitableObject>(quad, m_material.get(), areaLight));
+		}
+
+		//LOD
+		//Note: emissive meshes are excluded, their triangles have to stay the ones the light samples
+		const int lodLevels = props.getInteger("LodLevels", 0);
+		if (lodLevels > 0)
+		{
+			if (areaLight != nullptr)
+			{
+				LOG(WARNING) << "Level of detail is ignored for the emissive mesh " << filename;
+			}
+			else
+			{
+				buildLevelsOfDetail(PropertyTreeNode::m_directory + filename, lodLevels, props.getFloat("LodRatio", 0.25f), outOfCore);
+			}
+		}
 	}
 
-	//-------------------------------------------AMeshEntity-------------------------------------
+	void MeshEntity::buildLevelsOfDetail(const std::string &filename, int levels, Float ratio, bool outOfCore)
+	{
+		CHECK(ratio > 0 && ratio < 1);
 
-	AURORA_REGISTER_CLASS(MeshEntity, "MeshEntity")
+		//Note: the simplified levels are cached in object space and shared by the entities of the same file
+		const std::string key = filename + "|" + std::to_string(levels) + "|" + std::to_string(ratio);
+		auto lods = MeshLodCache::instance().get(key, [&](MeshLodCache::Levels &result)
+		{
+			std::vector<Vec3f> position(m_mesh->numVertices());
+			std::vector<Vec3f> normal(m_mesh->hasNormal() ? m_mesh->numVertices() : 0);
+			std::vector<Vec2f> uv(m_mesh->hasUV() ? m_mesh->numVertices() : 0);
+			std::vector<int> indices(m_mesh->numTriangles() * 3);
+			for (int i = 0; i < (int)position.size(); ++i)
+			{
+				position[i] = m_worldToObject(m_mesh->getPosition(i), 1.0f);
+				if (!normal.empty())
+					normal[i] = m_worldToObject(m_mesh->getNormal(i), 0.0f);
+				if (!uv.empty())
+					uv[i] = m_mesh->getUV(i);
+			}
+			for (size_t i = 0; i < indices.size(); ++i)
+			{
+				indices[i] = m_mesh->getIndex(i);
+			}
+			//Note: the simplifier only works on triangles, so the quads are split again
+			for (size_t i = 0; i < 4 * m_mesh->numQuads(); i += 4)
+			{
+				int q[4];
+				for (int j = 0; j < 4; ++j)
+					q[j] = m_mesh->getQuadIndex(i + j);
+				indices.insert(indices.end(), { q[0], q[1], q[2], q[0], q[2], q[3] });
+			}
 
-	MeshEntity::MeshEntity(const PropertyTreeNode &node)
+			//Note: each level is simplified from the previous one, which is much cheaper than starting
+			//      from the full resolution mesh every time.
+			MeshSimplifier simplifier(position, normal, uv, indices);
+			for (int level = 1; level <= levels; ++level)
+			{
+				const size_t prevTriangles = simplifier.numTriangles();
+				simplifier.simplify(size_t(prevTriangles * ratio));
+
+				// Stop once the border or the flip test don't let it get any coarser
+				if (simplifier.numTriangles() == 0 || simplifier.numTriangles() > prevTriangles * 0.9f)
+					break;
+
+				MeshLodCache::Level lod;
+				simplifier.getMesh(lod.position, lod.normal, lod.uv, lod.indices);
+				lod.errorBound = simplifier.errorBound();
+				result.push_back(lod);
+			}
+		});
+
+		// The error bounds grow with the largest scale of the transform
+		Float maxScale = 0;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			Vec3f v(0.f);
+			v[axis] = 1;
+			maxScale = glm::max(maxScale, length(m_objectToWorld(v, 0.0f)));
+		}
+
+		// Level 0 is the full resolution mesh, an out-of-core one is a single hierarchy already
+		std::vector<Hitable::ptr> levelHitables;
+		std::vector<Float> errorBounds;
+		levelHitables.push_back(outOfCore && !m_hitables.empty() ? m_hitables[0] : std::make_shared<KdTree>(m_hitables));
+		errorBounds.push_back(0);
+		m_lodAreas.push_back(m_mesh->area());
+		m_lodTriangles.push_back(m_mesh->numTriangles() + m_mesh->numQuads());
+
+		for (size_t level = 0; level < lods->size(); ++level)
+		{
+			const MeshLodCache::Level &lod = (*lods)[level];
+			std::vector<Vec3f> position(lod.position), normal(lod.normal);
+			for (size_t i = 0; i < position.size(); ++i)
+			{
+				position[i] = m_objectToWorld(position[i], 1.0f);
+				if (!normal.empty())
+					normal[i] = m_objectToWorld(normal[i], 0.0f);
+			}
+			m_lodMeshes.push_back(TriangleMesh::unique_ptr(new TriangleMesh(position, normal, lod.uv, lod.indices, outOfCore)));
+			TriangleMesh *mesh = m_lodMeshes.back().get();
+
+			if (outOfCore)
+			{
+				levelHitables.push_back(std::make_shared<MeshBVH>(mesh, &m_objectToWorld, &m_worldToObject, m_material.get()));
+			}
+			else
+			{
+				std::vector<Hitable::ptr> hitables;
+				for (size_t i = 0; i < 3 * mesh->numTriangles(); i += 3)
+				{
+					std::array<int, 3> triIndices = { mesh->getIndex(i + 0), mesh->getIndex(i + 1), mesh->getIndex(i + 2) };
+					ATriangleShape::ptr triangle = std::make_shared<ATriangleShape>(&m_objectToWorld, &m_worldToObject,
+						triIndices, mesh);
+					hitables.push_back(std::make_shared<HitableObject>(triangle, m_material.get(), nullptr));
+				}
+				levelHitables.push_back(std::make_shared<KdTree>(hitables));
+			}
+			errorBounds.push_back(lod.errorBound * maxScale);
+			m_lodAreas.push_back(mesh->area());
+			m_lodTriangles.push_back(mesh->numTriangles());
+
+			LOG(INFO) << "Level of detail " << level + 1 << ": " << mesh->numTriangles()
+				<< " triangles within " << errorBounds.back() << " of the mesh";
+		}
+
+		m_hitables = { std::make_shared<HitableLevelsOfDetail>(levelHitables, errorBounds) };
+	}
+
+	//-------------------------------------------CurveEntity-------------------------------------
+
+	AURORA_REGISTER_CLASS(CurveEntity, "CurveEntity")
+
+	CurveEntity::CurveEntity(const PropertyTreeNode &node)
 	{
 		const PropertyList& props = node.getPropertyList();
 		const std::string filename = props.getString("Filename");
+		const CurveType type = toCurveType(props.getString("CurveType", "Cylinder"));
+		const int splitDepth = props.getInteger("SplitDepth", 1);
 
 		// ״
 		const auto &shapeNode = node.getPropertyChild("Shape");
 
 		// 任
-		Transform objectToWrold;
-		const auto &shapeProps = shapeNode.getPropertyList();
-		if (shapeNode.hasProperty("Transform"))
+		parseTransform(shapeNode);
+
+		//
+		const auto &materialNode = node.getPropertyChild("Material");
+		m_material = Material::ptr(static_cast<Material*>(ObjectFactory::createInstance(
+			materialNode.getTypeName(), materialNode)));
+
+		if (node.hasPropertyChild("Light"))
 		{
-			std::vector<Transform> transformStack;
-			std::vector<Float> sequence = shapeProps.getVectorNf("Transform");
-			size_t it = 0;
-			bool undefined = false;
-			while (it < sequence.size() && !undefined)
-			{
-				int token = static_cast<int>(sequence[it]);
-				switch (token)
-				{
-				case 0://translate
-					CHECK_LT(it + 3, sequence.size());
-					Vec3f _trans = Vec3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-					transformStack.push_back(translate(_trans));
-					it += 4;
-					break;
-				case 1://scale
-					CHECK_LT(it + 3, sequence.size());
-					Vec3f _scale = Vec3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-					transformStack.push_back(scale(_scale.x, _scale.y, _scale.z));
-					it += 4;
-					break;
-				case 2://rotate
-					CHECK_LT(it + 4, sequence.size());
-					Vec3f axis = Vec3f(sequence[it + 1], sequence[it + 2], sequence[it + 3]);
-					transformStack.push_back(rotate(sequence[it + 4], axis));
-					it += 5;
-					break;
-				default:
-					undefined = true;
-					LOG(ERROR) << "Undefined transform action";
-					break;
-				}
-			}
+			LOG(WARNING) << "Curves can't be area lights, the light of " << filename << " is ignored";
+		}
 
-			//Note: calculate the transform matrix in a first-in-last-out manner
-			if (!undefined)
+		//ط˿
+		std::vector<std::vector<Vec3f>> strands;
+		std::vector<std::vector<Float>> widths;
+		loadHairFile(PropertyTreeNode::m_directory + filename, props.getFloat("Width", 0.1f), strands, widths);
+
+		for (size_t s = 0; s < strands.size(); ++s)
+		{
+			const auto &p = strands[s];
+			const int nPoints = (int)p.size();
+			for (int i = 0; i + 1 < nPoints; ++i)
 			{
-				for (auto it = transformStack.rbegin(); it != transformStack.rend(); ++it)
+				// Catmull-Rom to Bezier, the end points are repeated at the strand tips
+				const Vec3f &p0 = p[glm::max(i - 1, 0)];
+				const Vec3f &p3 = p[glm::min(i + 2, nPoints - 1)];
+				std::array<Vec3f, 4> cp = { p[i], p[i] + (p[i + 1] - p0) / Float(6),
+					p[i + 1] - (p3 - p[i]) / Float(6), p[i + 1] };
+
+				auto segments = ACurveShape::createCurveSegments(&m_objectToWorld, &m_worldToObject,
+					cp, widths[s][i], widths[s][i + 1], type, splitDepth);
+				for (const auto &segment : segments)
 				{
-					objectToWrold = objectToWrold * (*it);
+					m_hitables.push_back(std::make_shared<HitableObject>(segment, m_material.get(), nullptr));
 				}
 			}
 		}
-		m_objectToWorld = objectToWrold;
-		m_worldToObject = inverse(m_objectToWorld);
+	}
+
+	//-------------------------------------------SphereSetEntity-------------------------------------
+
+	AURORA_REGISTER_CLASS(SphereSetEntity, "SphereSetEntity")
+
+	SphereSetEntity::SphereSetEntity(const PropertyTreeNode &node)
+	{
+		const PropertyList& props = node.getPropertyList();
+		const std::string filename = props.getString("Filename");
+
+		// ״
+		const auto &shapeNode = node.getPropertyChild("Shape");
+
+		// 任
+		parseTransform(shapeNode);
 
 		//
 		const auto &materialNode = node.getPropertyChild("Material");
 		m_material = Material::ptr(static_cast<Material*>(ObjectFactory::createInstance(
 			materialNode.getTypeName(), materialNode)));
 
-		//
-		m_mesh = TriangleMesh::unique_ptr(new TriangleMesh(&m_objectToWorld, PropertyTreeNode::m_directory + filename));
-		const auto &meshIndices = m_mesh->getIndices();
-		for (size_t i = 0; i < meshIndices.size(); i += 3)
+		//⣺һԴ
+		AreaLight::ptr areaLight = nullptr;
+		if (node.hasPropertyChild("Light"))
 		{
-			std::array<int, 3> indices;
-			indices[0] = meshIndices[i + 0];
-			indices[1] = meshIndices[i + 1];
-			indices[2] = meshIndices[i + 2];
-			ATriangleShape::ptr triangle = std::make_shared<ATriangleShape>(&m_objectToWorld, &m_worldToObject, indices, m_mesh.get());
+			const auto &lightNode = node.getPropertyChild("Light");
+			areaLight = AreaLight::ptr(static_cast<AreaLight*>(ObjectFactory::createInstance(
+				lightNode.getTypeName(), lightNode)));
+		}
 
-			//ǷΪ
-			AreaLight::ptr areaLight = nullptr;
-			if (node.hasPropertyChild("Light"))
-			{
-				const auto &lightNode = node.getPropertyChild("Light");
-				areaLight = AreaLight::ptr(static_cast<AreaLight*>(ObjectFactory::createInstance(
-					lightNode.getTypeName(), lightNode)));
-			}
-			m_hitables.push_back(std::make_shared<HitableObject>(triangle, m_material.get(), areaLight));
+		//
+		std::vector<Vec3f> center;
+		std::vector<Float> radius;
+		loadSphereFile(PropertyTreeNode::m_directory + filename, props.getFloat("Radius", 1.0f), center, radius);
+
+		// Note: the spheres are moved to world space in advance, a non-uniform scale is not supported
+		//       and the radius is scaled by the length of the transformed x axis
+		const Float radiusScale = length(m_objectToWorld(Vec3f(1, 0, 0), 0.0f));
+		for (size_t i = 0; i < center.size(); ++i)
+		{
+			center[i] = m_objectToWorld(center[i], 1.0f);
+			radius[i] *= radiusScale;
+		}
+
+		m_spheres = SphereSet::unique_ptr(new SphereSet(center, radius));
+		for (size_t leaf = 0; leaf < m_spheres->numLeaves(); ++leaf)
+		{
+			ASphereSetShape::ptr shape = std::make_shared<ASphereSetShape>(&m_objectToWorld, &m_worldToObject,
+				m_spheres.get(), leaf);
+			m_hitables.push_back(std::make_shared<HitableObject>(shape, m_material.get(), areaLight));
 		}
 	}
 
-}
\ No newline at end of file
+}
@@ -5,6 +5,7 @@
 #include "Object/Object.h"
 #include "Object/Hitable.h"
 #include "Shape/TriangleShape.h"
+#include "Shape/SphereSetShape.h"
 
 namespace RT
 {
@@ -25,12 +26,24 @@ namespace RT
 		Material* getMaterial() const { return m_material.get(); }
 		const std::vector<Hitable::ptr>& getHitables() const { return m_hitables; }
 
+		//Note: level 0 is the full resolution, a level beyond the coarsest one falls back to it
+		int numLodLevels() const { return glm::max(1, (int)m_lodTriangles.size()); }
+
+		//Total area and number of the triangles of a level of detail, zero without levels
+		Float getLodArea(int lodLevel) const;
+		size_t getLodTriangles(int lodLevel) const;
+
 		virtual std::string toString() const override { return "Entity[]"; }
 		virtual ClassType getClassType() const override { return ClassType::AEHitable; }
 
 	protected:
+		//Parse the "Transform" sequence of the shape node into m_objectToWorld and m_worldToObject
+		void parseTransform(const PropertyTreeNode &shapeNode);
+
 		Material::ptr m_material;
 		std::vector<Hitable::ptr> m_hitables;
+		std::vector<Float> m_lodAreas;
+		std::vector<size_t> m_lodTriangles;
 		Transform m_objectToWorld, m_worldToObject;
 
 	};
@@ -45,7 +58,44 @@ namespace RT
 		virtual std::string toString() const override { return "MeshEntity[]"; }
 
 	private:
+		//Note: the levels are kept by a single hitable that takes the place of the triangles
+		void buildLevelsOfDetail(const std::string &filename, int levels, Float ratio, bool outOfCore);
+
 		TriangleMesh::unique_ptr m_mesh;
+		std::vector<TriangleMesh::unique_ptr> m_lodMeshes;
+	};
+
+	//! @brief Hair or fur loaded from a strand file.
+	/**
+	 * Every segment of a strand becomes a cubic Bezier curve through the Catmull-Rom tangents of
+	 * its neighbors, so the strand stays smooth without any tessellation.
+	 */
+	class CurveEntity : public Entity
+	{
+	public:
+		typedef std::shared_ptr<CurveEntity> ptr;
+
+		CurveEntity(const PropertyTreeNode &node);
+
+		virtual std::string toString() const override { return "CurveEntity[]"; }
+	};
+
+	//! @brief Particles or a point cloud rendered as spheres.
+	/**
+	 * The spheres are kept in world space as one sphere set and every leaf of it becomes a single
+	 * hitable, so neither a transform nor a hitable per sphere is paid for.
+	 */
+	class SphereSetEntity : public Entity
+	{
+	public:
+		typedef std::shared_ptr<SphereSetEntity> ptr;
+
+		SphereSetEntity(const PropertyTreeNode &node);
+
+		virtual std::string toString() const override { return "SphereSetEntity[]"; }
+
+	private:
+		SphereSet::unique_ptr m_spheres;
 	};
 
 }
\ No newline at end of file
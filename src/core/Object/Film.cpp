@@ -3,6 +3,9 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 
+#include <fstream>
+#include <cstdio>
+
 namespace RT
 {
 	AURORA_REGISTER_CLASS(Film, "Film")
@@ -36,6 +39,14 @@ namespace RT
 				filterNode.getTypeName(), filterNode)));
 		}
 
+		//Denoiser
+		if (node.hasPropertyChild("Denoiser"))
+		{
+			const auto &denoiserNode = node.getPropertyChild("Denoiser");
+			m_denoiser = Denoiser::unique_ptr(static_cast<Denoiser*>(ObjectFactory::createInstance(
+				denoiserNode.getTypeName(), denoiserNode)));
+		}
+
 		activate();
 	}
 
@@ -61,6 +72,8 @@ namespace RT
 	void Film::initialize()
 	{
 		m_pixels = std::unique_ptr<Pixel[]>(new Pixel[m_croppedPixelBounds.area()]);
+		if (m_denoiser)
+			m_features = std::unique_ptr<FeaturePixel[]>(new FeaturePixel[m_croppedPixelBounds.area()]);
 
 		//Ԥע⣺Ǽ˲fxy = f | x |  | y | ֻ洢˲ƫ޵ֵ
 		int offset = 0;
@@ -110,7 +123,133 @@ namespace RT
 				mergePixel.m_xyz[i] += xyz[i];
 			}
 			mergePixel.m_filterWeightSum += tilePixel.m_filterWeightSum;
+			mergePixel.m_nSamples += tilePixel.m_nSamples;
+
+			// Merge the luminance moments of the tile into those of the pixel
+			//Note: the moments are not part of the checkpoint, after a resume they cover the new samples only
+			if (m_features && tilePixel.m_nSamples > 0)
+			{
+				FeaturePixel &features = getFeaturePixel(pixel);
+				const int n = features.nSamples + tilePixel.m_nSamples;
+				const Float delta = tilePixel.m_lumMean - features.lumMean;
+				features.lumM2 += tilePixel.m_lumM2 + delta * delta * ((Float)features.nSamples * tilePixel.m_nSamples / n);
+				features.lumMean += delta * tilePixel.m_nSamples / n;
+				features.nSamples = n;
+			}
+		}
+	}
+
+	//Note: checkpoint layout is the header below, the number of tiles and the samples each of them
+	//      completed, followed by the pixels of the crop window in scanline order, each as xyz[3],
+	//      filter weight sum, splat xyz[3] and sample count
+	static constexpr char checkpointMagic[4] = { 'A', 'R', 'C', 'K' };
+	static constexpr int32_t checkpointVersion = 2;
+
+	bool Film::writeCheckpoint(const std::string &filename, const std::vector<int64_t> &tileProgress)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// Write to a temporary file first, a render killed while writing keeps the previous checkpoint
+		const std::string tmpFilename = filename + ".tmp";
+		{
+			std::ofstream out(tmpFilename, std::ios::binary | std::ios::trunc);
+			if (!out)
+			{
+				LOG(ERROR) << "Failed to write checkpoint " << tmpFilename;
+				return false;
+			}
+
+			const int32_t header[6] = { checkpointVersion, (int32_t)sizeof(Float),
+				m_croppedPixelBounds.m_pMin.x, m_croppedPixelBounds.m_pMin.y,
+				m_croppedPixelBounds.m_pMax.x, m_croppedPixelBounds.m_pMax.y };
+			out.write(checkpointMagic, sizeof(checkpointMagic));
+			out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+			const int32_t nTiles = (int32_t)tileProgress.size();
+			out.write(reinterpret_cast<const char*>(&nTiles), sizeof(nTiles));
+			out.write(reinterpret_cast<const char*>(tileProgress.data()), nTiles * sizeof(int64_t));
+
+			for (Vec2i p : m_croppedPixelBounds)
+			{
+				const Pixel &pixel = getPixel(p);
+				const Float values[7] = { pixel.m_xyz[0], pixel.m_xyz[1], pixel.m_xyz[2], pixel.m_filterWeightSum,
+					pixel.m_splatXYZ[0], pixel.m_splatXYZ[1], pixel.m_splatXYZ[2] };
+				out.write(reinterpret_cast<const char*>(values), sizeof(values));
+				out.write(reinterpret_cast<const char*>(&pixel.m_nSamples), sizeof(pixel.m_nSamples));
+			}
+
+			if (!out)
+			{
+				LOG(ERROR) << "Failed to write checkpoint " << tmpFilename;
+				return false;
+			}
+		}
+
+		if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+		{
+			LOG(ERROR) << "Failed to replace checkpoint " << filename;
+			return false;
 		}
+
+		return true;
+	}
+
+	bool Film::readCheckpoint(const std::string &filename, std::vector<int64_t> &tileProgress)
+	{
+		std::ifstream in(filename, std::ios::binary);
+		if (!in)
+			return false;
+
+		char magic[4];
+		int32_t header[6], nTiles = 0;
+		in.read(magic, sizeof(magic));
+		in.read(reinterpret_cast<char*>(header), sizeof(header));
+		in.read(reinterpret_cast<char*>(&nTiles), sizeof(nTiles));
+		if (!in || !std::equal(magic, magic + 4, checkpointMagic) || header[0] != checkpointVersion ||
+			header[1] != (int32_t)sizeof(Float) || Vec2i(header[2], header[3]) != m_croppedPixelBounds.m_pMin ||
+			Vec2i(header[4], header[5]) != m_croppedPixelBounds.m_pMax || nTiles != (int32_t)tileProgress.size())
+		{
+			LOG(ERROR) << "Checkpoint " << filename << " does not match the film, ignoring it";
+			return false;
+		}
+
+		std::vector<int64_t> progress(nTiles);
+		in.read(reinterpret_cast<char*>(progress.data()), nTiles * sizeof(int64_t));
+
+		std::unique_ptr<Pixel[]> pixels(new Pixel[m_croppedPixelBounds.area()]);
+		for (int i = 0; i < m_croppedPixelBounds.area(); ++i)
+		{
+			Float values[7];
+			Pixel &pixel = pixels[i];
+			in.read(reinterpret_cast<char*>(values), sizeof(values));
+			in.read(reinterpret_cast<char*>(&pixel.m_nSamples), sizeof(pixel.m_nSamples));
+			for (int c = 0; c < 3; ++c)
+			{
+				pixel.m_xyz[c] = values[c];
+				pixel.m_splatXYZ[c] = values[4 + c];
+			}
+			pixel.m_filterWeightSum = values[3];
+		}
+
+		if (!in)
+		{
+			LOG(ERROR) << "Checkpoint " << filename << " is truncated, ignoring it";
+			return false;
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pixels = std::move(pixels);
+		tileProgress = std::move(progress);
+		LOG(INFO) << "Resumed film from checkpoint " << filename;
+		return true;
+	}
+
+	Float Film::getMeanSampleCount() const
+	{
+		int64_t nSamples = 0;
+		for (Vec2i p : m_croppedPixelBounds)
+			nSamples += getPixel(p).m_nSamples;
+		return (Float)nSamples / glm::max(m_croppedPixelBounds.area(), 1);
 	}
 
 	void Film::writeImageToFile(Float splatScale)
@@ -148,16 +287,39 @@ namespace RT
 			rgb[3 * offset + 1] *= m_scale;
 			rgb[3 * offset + 2] *= m_scale;
 
-#define TO_BYTE(v) (uint8_t) clamp(255.f * gammaCorrect(v) + 0.5f, 0.f, 255.f)
-			dst[3 * offset + 0] = TO_BYTE(rgb[3 * offset + 0]);
-			dst[3 * offset + 1] = TO_BYTE(rgb[3 * offset + 1]);
-			dst[3 * offset + 2] = TO_BYTE(rgb[3 * offset + 2]);
-
 			++offset;
 		}
 
-		LOG(INFO) << "Writing image " << m_filename << " with bounds " << m_croppedPixelBounds;
+		// Denoise the image once the renderer has recorded the features
 		auto extent = m_croppedPixelBounds.diagonal();
+		if (m_features && m_featuresRecorded)
+		{
+			LOG(INFO) << "Denoising image with " << m_denoiser->toString();
+			std::vector<DenoiserFeatures> features(m_croppedPixelBounds.area());
+			for (int i = 0; i < m_croppedPixelBounds.area(); ++i)
+			{
+				const FeaturePixel &pixel = m_features[i];
+				if (pixel.nHits > 0)
+				{
+					for (int c = 0; c < 3; ++c)
+						features[i].albedo[c] = pixel.albedo[c] / pixel.nHits;
+					if (pixel.normal != Vec3f(0.f))
+						features[i].normal = normalize(pixel.normal);
+					features[i].depth = pixel.depth / pixel.nHits;
+				}
+
+				// Variance of the mean luminance of the pixel
+				if (pixel.nSamples >= 2)
+					features[i].variance = pixel.lumM2 / ((Float)(pixel.nSamples - 1) * pixel.nSamples) * m_scale * m_scale;
+			}
+			m_denoiser->denoise(extent, rgb.get(), features);
+		}
+
+#define TO_BYTE(v) (uint8_t) clamp(255.f * gammaCorrect(v) + 0.5f, 0.f, 255.f)
+		for (int i = 0; i < 3 * m_croppedPixelBounds.area(); ++i)
+			dst[i] = TO_BYTE(rgb[i]);
+
+		LOG(INFO) << "Writing image " << m_filename << " with bounds " << m_croppedPixelBounds;
 		stbi_write_png(m_filename.c_str(),
 			extent.x,
 			extent.y,
@@ -166,6 +328,22 @@ namespace RT
 			extent.x * 3);
 	}
 
+	void Film::addFeatureSample(const Vec2i &p, const Spectrum &albedo, const Vec3f &n, Float depth)
+	{
+		if (!m_features || n == Vec3f(0.f) || !insideExclusive(p, m_croppedPixelBounds))
+			return;
+
+		FeaturePixel &pixel = getFeaturePixel(p);
+
+		Float rgb[3];
+		albedo.toRGB(rgb);
+		for (int c = 0; c < 3; ++c)
+			pixel.albedo[c] += rgb[c];
+		pixel.normal += n;
+		pixel.depth += depth;
+		++pixel.nHits;
+	}
+
 	void Film::setImage(const Spectrum *img) const
 	{
 		int nPixels = m_croppedPixelBounds.area();
@@ -231,6 +409,14 @@ namespace RT
 				pixel.m_splatXYZ[c] = pixel.m_xyz[c] = 0;
 			}
 			pixel.m_filterWeightSum = 0;
+			pixel.m_nSamples = 0;
+
+			if (m_features)
+			{
+				FeaturePixel &features = getFeaturePixel(p);
+				features.nSamples = 0;
+				features.lumMean = features.lumM2 = 0;
+			}
 		}
 	}
 }
\ No newline at end of file
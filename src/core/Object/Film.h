@@ -5,6 +5,7 @@
 #include "Utils/Math.h"
 #include "Utils/Color.h"
 #include "Render/Filter.h"
+#include "Render/Denoiser.h"
 #include "Utils/Parallel.h"
 
 #include <memory>
@@ -25,12 +26,34 @@ namespace RT
 
 		BBox2i getSampleBounds() const;
 		const Vec2i getResolution() const { return m_resolution; }
+		const BBox2i &getCroppedPixelBounds() const { return m_croppedPixelBounds; }
 
 		std::unique_ptr<FilmTile> getFilmTile(const BBox2i &sampleBounds);
 		void mergeFilmTile(std::unique_ptr<FilmTile> tile);
 
 		void writeImageToFile(Float splatScale = 1);
 
+		//Note: a checkpoint holds the whole accumulation state of the film and the number of samples
+		//      each tile of the renderer has completed, so that an interrupted render can resume from
+		//      it. It must be written while no tile is being rendered. The file is replaced atomically.
+		bool writeCheckpoint(const std::string &filename, const std::vector<int64_t> &tileProgress);
+		//|tileProgress| holds as many tiles as the checkpoint should, it is only filled on success
+		bool readCheckpoint(const std::string &filename, std::vector<int64_t> &tileProgress);
+
+		//Mean number of samples taken per pixel of the crop window
+		Float getMeanSampleCount() const;
+
+		//Note: with a denoiser the film keeps the first-hit features of every pixel and the moments of the
+		//      luminance of its samples, writeImageToFile() filters the image once features are recorded
+		int getFeatureSamples() const { return m_denoiser ? m_denoiser->m_featureSamples : 0; }
+
+		//Record the first hit of a feature sample of the pixel, a zero |n| for a miss. The pixels of a
+		//tile are recorded by a single thread.
+		void addFeatureSample(const Vec2i &p, const Spectrum &albedo, const Vec3f &n, Float depth);
+
+		//Called once the feature samples of every pixel are recorded, the image is denoised from then on
+		void setFeaturesRecorded() { m_featuresRecorded = true; }
+
 		void setImage(const Spectrum *img) const;
 		void addSplat(const Vec2f &p, Spectrum v);
 
@@ -53,12 +76,13 @@ namespace RT
 			Pixel() 
 			{ 
 				m_xyz[0] = m_xyz[1] = m_xyz[2] = m_filterWeightSum = 0; 
+				m_nSamples = 0;
 			}
 
 			Float m_xyz[3];				//xyz color of the pixel
 			Float m_filterWeightSum;	//the sum of filter weight values
 			AAtomicFloat m_splatXYZ[3]; //unweighted sum of samples splats
-			Float m_pad;				//unused, ensure sizeof(APixel) -> 32 bytes
+			uint32_t m_nSamples;		//number of samples taken inside the pixel, ensure sizeof(APixel) -> 32 bytes
 		};
 
 		Vec2i m_resolution; //(width, height)
@@ -71,6 +95,23 @@ namespace RT
 		std::unique_ptr<Filter> m_filter;
 		std::mutex m_mutex;
 
+		//Features and luminance moments of a pixel for the denoiser
+		struct FeaturePixel
+		{
+			Float albedo[3] = { 0, 0, 0 };	//sums over the feature samples that hit
+			Vec3f normal = Vec3f(0.f);
+			Float depth = 0;
+			int nHits = 0;
+
+			//moments of the luminance of the samples, merged from the film tiles
+			int nSamples = 0;
+			Float lumMean = 0, lumM2 = 0;
+		};
+
+		Denoiser::unique_ptr m_denoiser;
+		std::unique_ptr<FeaturePixel[]> m_features;
+		bool m_featuresRecorded = false;
+
 		//Note: precomputed filter weights table
 		static constexpr int filterTableWidth = 16;
 		Float m_filterTable[filterTableWidth * filterTableWidth];
@@ -86,12 +127,34 @@ namespace RT
 			return m_pixels[index];
 		}
 
+		const Pixel &getPixel(const Vec2i &p) const
+		{
+			CHECK(insideExclusive(p, m_croppedPixelBounds));
+			int width = m_croppedPixelBounds.m_pMax.x - m_croppedPixelBounds.m_pMin.x;
+			int index = (p.x - m_croppedPixelBounds.m_pMin.x) + (p.y - m_croppedPixelBounds.m_pMin.y) * width;
+			return m_pixels[index];
+		}
+
+		FeaturePixel &getFeaturePixel(const Vec2i &p)
+		{
+			CHECK(insideExclusive(p, m_croppedPixelBounds));
+			int width = m_croppedPixelBounds.m_pMax.x - m_croppedPixelBounds.m_pMin.x;
+			int index = (p.x - m_croppedPixelBounds.m_pMin.x) + (p.y - m_croppedPixelBounds.m_pMin.y) * width;
+			return m_features[index];
+		}
+
 	};
 
 	struct FilmTilePixel
 	{
 		Spectrum m_contribSum = 0.f;		//sum of the weighted spectrum contributions
 		Float m_filterWeightSum = 0.f;		//sum of the filter weights
+
+		//Note: running mean and variance (Welford) of the luminance of the samples taken inside
+		//      the pixel, which drive adaptive sampling
+		int m_nSamples = 0;
+		Float m_lumMean = 0.f;
+		Float m_lumM2 = 0.f;
 	};
 
 	class FilmTile final
@@ -121,6 +184,18 @@ namespace RT
 			p0 = max(p0, m_pixelBounds.m_pMin);
 			p1 = min(p1, m_pixelBounds.m_pMax);
 
+			// ²صͳ
+			Vec2i pPixel = (Vec2i)floor(pFilm);
+			if (insideExclusive(pPixel, m_pixelBounds))
+			{
+				FilmTilePixel &pixel = getPixel(pPixel);
+				Float lum = L.luminance() * sampleWeight;
+				++pixel.m_nSamples;
+				Float delta = lum - pixel.m_lumMean;
+				pixel.m_lumMean += delta / pixel.m_nSamples;
+				pixel.m_lumM2 += delta * (lum - pixel.m_lumMean);
+			}
+
 			// ѭ
 
 			// Ԥڹ˱еƫ
@@ -172,6 +247,35 @@ namespace RT
 
 		BBox2i getPixelBounds() const { return m_pixelBounds; }
 
+		//Standard error of the mean luminance of the pixel relative to the mean
+		Float getRelativeError(const Vec2i &p) const
+		{
+			const FilmTilePixel &pixel = getPixel(p);
+			if (pixel.m_nSamples < 2)
+				return Infinity;
+
+			Float variance = pixel.m_lumM2 / (pixel.m_nSamples - 1);
+			Float standardError = glm::sqrt(variance / pixel.m_nSamples);
+			//Note: the floor keeps the error of black pixels finite
+			return standardError / glm::max(pixel.m_lumMean, (Float)1e-3f);
+		}
+
+		//Largest relative error of the pixel and its neighbors inside the tile
+		//Note: the pixels of the filter border around the tile take no samples of their own and are skipped
+		Float getNeighborhoodError(const Vec2i &p) const
+		{
+			Float error = 0;
+			for (int y = glm::max(p.y - 1, m_pixelBounds.m_pMin.y); y < glm::min(p.y + 2, m_pixelBounds.m_pMax.y); ++y)
+			{
+				for (int x = glm::max(p.x - 1, m_pixelBounds.m_pMin.x); x < glm::min(p.x + 2, m_pixelBounds.m_pMax.x); ++x)
+				{
+					if (getPixel(Vec2i(x, y)).m_nSamples > 0)
+						error = glm::max(error, getRelativeError(Vec2i(x, y)));
+				}
+			}
+			return error;
+		}
+
 	private:
 		const BBox2i m_pixelBounds;
 		const Vec2f m_filterRadius, m_invFilterRadius;
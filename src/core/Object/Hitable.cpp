@@ -61,4 +61,66 @@ namespace RT
 			"called";
 	}
 
+	//-------------------------------------------HitableLevelsOfDetail-------------------------------------
+
+	HitableLevelsOfDetail::HitableLevelsOfDetail(const std::vector<Hitable::ptr> &levels,
+		const std::vector<Float> &errorBounds) : m_levels(levels), m_errorBounds(errorBounds)
+	{
+		CHECK(!m_levels.empty());
+		CHECK_EQ(m_levels.size(), m_errorBounds.size());
+	}
+
+	void HitableLevelsOfDetail::selectLevels(const Ray &ray, int &originLevel, int &level, Float &tSwitch) const
+	{
+		const int coarsest = (int)m_levels.size() - 1;
+		originLevel = glm::min(ray.m_originLodLevel, coarsest);
+		level = glm::min(ray.m_lodLevel, coarsest);
+		tSwitch = (level == originLevel) ? Infinity : m_errorBounds[originLevel] + m_errorBounds[level];
+	}
+
+	bool HitableLevelsOfDetail::hit(const Ray &ray) const
+	{
+		int originLevel, level;
+		Float tSwitch;
+		selectLevels(ray, originLevel, level, tSwitch);
+
+		Ray nearRay(ray);
+		nearRay.m_tMax = glm::min(ray.m_tMax, tSwitch);
+		if (m_levels[originLevel]->hit(nearRay))
+			return true;
+		if (ray.m_tMax <= tSwitch)
+			return false;
+
+		Ray farRay(ray(tSwitch), ray.direction(), ray.m_tMax - tSwitch);
+		return m_levels[level]->hit(farRay);
+	}
+
+	bool HitableLevelsOfDetail::hit(const Ray &ray, SurfaceInteraction &isect) const
+	{
+		int originLevel, level;
+		Float tSwitch;
+		selectLevels(ray, originLevel, level, tSwitch);
+
+		// Up to the switch distance against the level of the surface the ray leaves
+		const Float tMax = ray.m_tMax;
+		ray.m_tMax = glm::min(tMax, tSwitch);
+		if (m_levels[originLevel]->hit(ray, isect))
+		{
+			isect.lodLevel = originLevel;
+			return true;
+		}
+		ray.m_tMax = tMax;
+		if (tMax <= tSwitch)
+			return false;
+
+		// Beyond it against the requested one
+		Ray farRay(ray(tSwitch), ray.direction(), tMax - tSwitch);
+		if (!m_levels[level]->hit(farRay, isect))
+			return false;
+
+		ray.m_tMax = tSwitch + farRay.m_tMax;
+		isect.lodLevel = level;
+		return true;
+	}
+
 }
\ No newline at end of file
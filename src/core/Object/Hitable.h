@@ -73,4 +73,34 @@ namespace RT
 			TransportMode mode, bool allowMultipleLobes) const override;
 
 	};
+
+	//! @brief The geometry levels of detail of one mesh behind a single hitable.
+	/**
+	 * Every level is an aggregate of its own, level 0 the full resolution one, so that the scene
+	 * keeps a single top-level structure for all the levels. A ray intersects the level of the
+	 * surface it leaves up to the error bounds of both levels and the level it asks for beyond,
+	 * so that it neither finds the proxy just in front of the surface it leaves nor slips through it.
+	 */
+	class HitableLevelsOfDetail final : public HitableAggregate
+	{
+	public:
+		typedef std::shared_ptr<HitableLevelsOfDetail> ptr;
+
+		//Note: |errorBounds| holds the distance a level may be off the full resolution surface
+		HitableLevelsOfDetail(const std::vector<Hitable::ptr> &levels, const std::vector<Float> &errorBounds);
+
+		virtual bool hit(const Ray &ray) const override;
+		virtual bool hit(const Ray &ray, SurfaceInteraction &iset) const override;
+
+		virtual BBox3f worldBound() const override { return m_levels[0]->worldBound(); }
+
+		virtual std::string toString() const override { return "HitableLevelsOfDetail[]"; }
+
+	private:
+		//Level of the surface the ray leaves, level it asks for and the distance to switch between them
+		void selectLevels(const Ray &ray, int &originLevel, int &level, Float &tSwitch) const;
+
+		std::vector<Hitable::ptr> m_levels;
+		std::vector<Float> m_errorBounds;
+	};
 }
\ No newline at end of file
@@ -212,10 +212,12 @@ namespace RT
 
 	Object *ObjectFactory::createInstance(const std::string &type, const PropertyTreeNode &node)
 	{
-		auto &constrMap = getConstrMap();
-		if (constrMap.find(type) == constrMap.end())
-			LOG(ERROR) << "A constructor for class \"" << type << "\" could not be found!";
-		return constrMap[type](node);
+		//Note: entities are created concurrently by the parser, so only read the map here
+		const auto &constrMap = getConstrMap();
+		auto it = constrMap.find(type);
+		if (it == constrMap.end())
+			LOG(FATAL) << "A constructor for class \"" << type << "\" could not be found!";
+		return it->second(node);
 	}
 
 }
\ No newline at end of file
@@ -180,6 +180,7 @@ namespace RT
 			RTFilter,
 			AEFilm,
 			AEEntity,
+			RTDenoiser,
 			EClassTypeCount
 		};
 
@@ -235,6 +236,7 @@ namespace RT
 				case RTFilter:     return "Filter";
 				case AEFilm:       return "Film";
 				case AEEntity:	   return "Entity";
+				case RTDenoiser:   return "Denoiser";
 				default:           return "Unknown";
 			}
 		}
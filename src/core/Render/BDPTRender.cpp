@@ -0,0 +1,574 @@
+#include "Render/BDPTRender.h"
+
+#include "Render/BSDF.h"
+#include "Scene/Scene.h"
+#include "Utils/Memory.h"
+#include "Utils/LightDistrib.h"
+
+namespace RT
+{
+	//-------------------------------------------Vertex-------------------------------------
+
+	enum class VertexType { Camera, Light, Surface };
+
+	struct BDPTRenderer::Vertex
+	{
+		VertexType type = VertexType::Camera;
+		Spectrum beta;				//throughput of the subpath up to the vertex
+		Interaction ei;				//position of a camera or light vertex
+		SurfaceInteraction si;		//hit point of a surface vertex
+		const Camera *camera = nullptr;
+		const Light *light = nullptr;
+		bool delta = false;			//whether the vertex scatters specularly
+		Float pdfFwd = 0;			//area density of the vertex sampled along its own subpath
+		Float pdfRev = 0;			//area density of the vertex sampled from the other end of the path
+
+		static Vertex createCamera(const Camera *camera, const Interaction &it, const Spectrum &beta)
+		{
+			Vertex v;
+			v.type = VertexType::Camera;
+			v.ei = it;
+			v.camera = camera;
+			v.beta = beta;
+			return v;
+		}
+
+		static Vertex createLight(const Light *light, const Interaction &it, const Spectrum &beta, Float pdf)
+		{
+			Vertex v;
+			v.type = VertexType::Light;
+			v.ei = it;
+			v.light = light;
+			v.beta = beta;
+			v.pdfFwd = pdf;
+			return v;
+		}
+
+		static Vertex createSurface(const SurfaceInteraction &si, const Spectrum &beta, Float pdf, const Vertex &prev)
+		{
+			Vertex v;
+			v.type = VertexType::Surface;
+			v.si = si;
+			v.beta = beta;
+			v.pdfFwd = prev.convertDensity(pdf, v);
+			return v;
+		}
+
+		const Interaction &getInteraction() const { return type == VertexType::Surface ? si : ei; }
+		const Vec3f &p() const { return getInteraction().p; }
+		const Vec3f &n() const { return getInteraction().n; }
+
+		//Note: the camera has no surface, its vertices take no cosine in the geometry term
+		bool isOnSurface() const { return n() != Vec3f(0.f); }
+
+		const Light *getLight() const
+		{
+			return type == VertexType::Light ? light :
+				type == VertexType::Surface ? si.hitable->getAreaLight() : nullptr;
+		}
+
+		bool isLight() const { return getLight() != nullptr; }
+
+		bool isDeltaLight() const { return type == VertexType::Light && RT::isDeltaLight(light->m_flags); }
+
+		bool isConnectible() const
+		{
+			switch (type)
+			{
+			case VertexType::Camera:
+				return true;
+			case VertexType::Light:
+				return (light->m_flags & (int)LightFlags::ALightDeltaDirection) == 0;
+			default:
+				return si.bsdf->numComponents(ABxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0;
+			}
+		}
+
+		//BSDF of a surface vertex towards |next|
+		Spectrum f(const Vertex &next) const
+		{
+			CHECK(type == VertexType::Surface);
+			Vec3f wi = next.p() - p();
+			if (lengthSquared(wi) == 0)
+				return Spectrum(0.f);
+			return si.bsdf->f(si.wo, normalize(wi));
+		}
+
+		//Radiance emitted towards |v| by a vertex on an area light
+		Spectrum Le(const Vertex &v) const
+		{
+			const Light *emitter = getLight();
+			if (emitter == nullptr || !(emitter->m_flags & (int)LightFlags::ALightArea))
+				return Spectrum(0.f);
+
+			Vec3f w = v.p() - p();
+			if (lengthSquared(w) == 0)
+				return Spectrum(0.f);
+			return static_cast<const AreaLight *>(emitter)->L(getInteraction(), normalize(w));
+		}
+
+		//Convert a solid angle density at this vertex to an area density at |next|
+		Float convertDensity(Float pdf, const Vertex &next) const
+		{
+			Vec3f w = next.p() - p();
+			Float dist2 = lengthSquared(w);
+			if (dist2 == 0)
+				return 0;
+
+			Float invDist2 = 1 / dist2;
+			if (next.isOnSurface())
+				pdf *= absDot(next.n(), w * glm::sqrt(invDist2));
+			return pdf * invDist2;
+		}
+
+		//Area density of sampling |next| from this vertex, reached from |prev|
+		Float pdf(const Vertex *prev, const Vertex &next) const
+		{
+			if (type == VertexType::Light)
+				return pdfLight(next);
+
+			Vec3f wn = next.p() - p();
+			if (lengthSquared(wn) == 0)
+				return 0;
+			wn = normalize(wn);
+
+			Float pdf = 0, unused;
+			if (type == VertexType::Camera)
+			{
+				camera->pdf_We(ei.spawnRay(wn), unused, pdf);
+			}
+			else
+			{
+				CHECK(prev != nullptr);
+				Vec3f wp = normalize(prev->p() - p());
+				pdf = si.bsdf->pdf(wp, wn);
+			}
+
+			return convertDensity(pdf, next);
+		}
+
+		//Area density of the light of this vertex emitting towards |v|
+		Float pdfLight(const Vertex &v) const
+		{
+			Vec3f w = v.p() - p();
+			Float dist2 = lengthSquared(w);
+			if (dist2 == 0)
+				return 0;
+
+			Float invDist2 = 1 / dist2;
+			w *= glm::sqrt(invDist2);
+
+			Float pdfPos, pdfDir;
+			getLight()->pdf_Le(Ray(p(), w), n(), pdfPos, pdfDir);
+			Float pdf = pdfDir * invDist2;
+			if (v.isOnSurface())
+				pdf *= absDot(v.n(), w);
+			return pdf;
+		}
+	};
+
+	//Note: overwrites a value for the lifetime of the assignment object
+	template <typename Type>
+	class ScopedAssignment
+	{
+	public:
+		ScopedAssignment(Type *target = nullptr, Type value = Type()) : m_target(target)
+		{
+			if (m_target != nullptr)
+			{
+				m_backup = *m_target;
+				*m_target = value;
+			}
+		}
+
+		~ScopedAssignment()
+		{
+			if (m_target != nullptr)
+				*m_target = m_backup;
+		}
+
+		ScopedAssignment(const ScopedAssignment &) = delete;
+		ScopedAssignment &operator=(const ScopedAssignment &) = delete;
+
+		ScopedAssignment &operator=(ScopedAssignment &&other)
+		{
+			if (m_target != nullptr)
+				*m_target = m_backup;
+			m_target = other.m_target;
+			m_backup = other.m_backup;
+			other.m_target = nullptr;
+			return *this;
+		}
+
+	private:
+		Type *m_target;
+		Type m_backup;
+	};
+
+	//Geometry term between two vertices, zero when they do not see each other
+	static Float G(const Scene &scene, const BDPTRenderer::Vertex &v0, const BDPTRenderer::Vertex &v1)
+	{
+		Vec3f d = v0.p() - v1.p();
+		Float g = 1 / lengthSquared(d);
+		d *= glm::sqrt(g);
+		if (v0.isOnSurface())
+			g *= absDot(v0.n(), d);
+		if (v1.isOnSurface())
+			g *= absDot(v1.n(), d);
+
+		VisibilityTester vis(v0.getInteraction(), v1.getInteraction());
+		return vis.unoccluded(scene) ? g : 0;
+	}
+
+	//-------------------------------------------BDPTRenderer-------------------------------------
+
+	AURORA_REGISTER_CLASS(BDPTRenderer, "BDPT")
+
+	BDPTRenderer::BDPTRenderer(const PropertyTreeNode &node)
+		: SamplerRenderer(nullptr, nullptr), m_maxDepth(node.getPropertyList().getInteger("Depth", 5))
+	{
+		//Sampler
+		const auto &samplerNode = node.getPropertyChild("Sampler");
+		m_sampler = Sampler::ptr(static_cast<Sampler*>(ObjectFactory::createInstance(
+			samplerNode.getTypeName(), samplerNode)));
+
+		//Camera
+		const auto &cameraNode = node.getPropertyChild("Camera");
+		m_camera = Camera::ptr(static_cast<Camera*>(ObjectFactory::createInstance(
+			cameraNode.getTypeName(), cameraNode)));
+
+		//Progressive rendering
+		m_timeLimit = node.getPropertyList().getFloat("TimeLimit", 0.f);
+		m_progressive = node.getPropertyList().getBoolean("Progressive", m_timeLimit > 0);
+
+		//Checkpoint
+		m_checkpoint = node.getPropertyList().getString("Checkpoint", "");
+		m_checkpointInterval = node.getPropertyList().getFloat("CheckpointInterval", 300.f);
+
+		activate();
+	}
+
+	void BDPTRenderer::preprocess(const Scene &scene)
+	{
+		//Note: the splats of the light subpaths are normalized by the SPP, not by the samples of their pixel
+		LOG_IF(WARNING, m_sampler->isAdaptive()) << "Adaptive sampling leaves the light tracing of BDPT unevenly weighted";
+		//Note: without the escape strategy and light subpaths leaving the environment an infinite light would
+		//      only darken the image, so such a scene is refused instead of being rendered wrong
+		LOG_IF(FATAL, !scene.m_infiniteLights.empty()) << "BDPT and MLT do not support infinite lights, "
+			<< "render the scene with the path tracer instead";
+
+		m_lightDistribution.reset();
+		m_lightIndices.clear();
+		if (scene.m_lights.empty())
+			return;
+
+		m_lightDistribution = createLightSampleDistribution("power", scene);
+		for (size_t i = 0; i < scene.m_lights.size(); ++i)
+			m_lightIndices[scene.m_lights[i].get()] = (int)i;
+	}
+
+	int BDPTRenderer::generateCameraSubpath(const Scene &scene, Sampler &sampler, MemoryArena &arena,
+		const Ray &ray, int maxVertices, Vertex *path) const
+	{
+		if (maxVertices == 0)
+			return 0;
+
+		Float pdfPos, pdfDir;
+		m_camera->pdf_We(ray, pdfPos, pdfDir);
+
+		Spectrum beta(1.f);
+		path[0] = Vertex::createCamera(m_camera.get(), Interaction(ray.origin()), beta);
+		return randomWalk(scene, ray, sampler, arena, beta, pdfDir, maxVertices - 1, TransportMode::Radiance, path + 1) + 1;
+	}
+
+	int BDPTRenderer::generateLightSubpath(const Scene &scene, Sampler &sampler, MemoryArena &arena,
+		int maxVertices, Vertex *path) const
+	{
+		if (maxVertices == 0 || m_lightDistribution == nullptr)
+			return 0;
+
+		// Pick a light by power and sample a ray leaving it
+		Float lightPdf;
+		int lightNum = m_lightDistribution->sample(Vec3f(0.f), Vec3f(0.f), sampler.get1D(), lightPdf);
+		if (lightNum < 0)
+			return 0;
+		const Light *light = scene.m_lights[lightNum].get();
+
+		Ray ray;
+		Vec3f nLight;
+		Float pdfPos, pdfDir;
+		Vec2f u1 = sampler.get2D();
+		Vec2f u2 = sampler.get2D();
+		Spectrum Le = light->sample_Le(u1, u2, ray, nLight, pdfPos, pdfDir);
+		if (pdfPos == 0 || pdfDir == 0 || Le.isBlack())
+			return 0;
+
+		Interaction pLight(ray.origin());
+		pLight.n = nLight;
+		path[0] = Vertex::createLight(light, pLight, Le, pdfPos * lightPdf);
+
+		Spectrum beta = Le * absDot(nLight, ray.direction()) / (lightPdf * pdfPos * pdfDir);
+		return randomWalk(scene, ray, sampler, arena, beta, pdfDir, maxVertices - 1, TransportMode::Importance, path + 1) + 1;
+	}
+
+	int BDPTRenderer::randomWalk(const Scene &scene, Ray ray, Sampler &sampler, MemoryArena &arena, Spectrum beta,
+		Float pdf, int maxDepth, TransportMode mode, Vertex *path) const
+	{
+		if (maxDepth == 0)
+			return 0;
+
+		int bounces = 0;
+		Float pdfFwd = pdf, pdfRev = 0;
+		while (true)
+		{
+			//Note: escaping rays end the subpath, there is no infinite light to find
+			SurfaceInteraction isect;
+			if (beta.isBlack() || !scene.hit(ray, isect))
+				break;
+
+			// Surfaces without a BSDF only bound media, pass through them
+			isect.computeScatteringFunctions(ray, arena, true, mode);
+			if (!isect.bsdf)
+			{
+				ray = isect.spawnRay(ray.direction());
+				continue;
+			}
+
+			Vertex &vertex = path[bounces], &prev = path[bounces - 1];
+			vertex = Vertex::createSurface(isect, beta, pdfFwd, prev);
+			if (++bounces >= maxDepth)
+				break;
+
+			// Sample the BSDF for the next direction and the density of the reverse one
+			Vec3f wi, wo = isect.wo;
+			ABxDFType flags;
+			Spectrum f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdfFwd, flags, BSDF_ALL);
+			if (f.isBlack() || pdfFwd == 0)
+				break;
+
+			beta *= f * absDot(wi, isect.n) / pdfFwd;
+			pdfRev = isect.bsdf->pdf(wi, wo, BSDF_ALL);
+			if (flags & BSDF_SPECULAR)
+			{
+				vertex.delta = true;
+				pdfRev = pdfFwd = 0;
+			}
+
+			ray = isect.spawnRay(wi);
+			prev.pdfRev = vertex.convertDensity(pdfRev, prev);
+		}
+
+		return bounces;
+	}
+
+	Spectrum BDPTRenderer::connect(const Scene &scene, Vertex *lightVertices, Vertex *cameraVertices, int s, int t,
+		Sampler &sampler, Vec2f &pRaster) const
+	{
+		Spectrum L(0.f);
+
+		Vertex sampled;
+		if (s == 0)
+		{
+			// The camera subpath is a whole path if it ends on a light
+			const Vertex &pt = cameraVertices[t - 1];
+			if (pt.isLight())
+				L = pt.Le(cameraVertices[t - 2]) * pt.beta;
+		}
+		else if (t == 1)
+		{
+			// Sample a point on the camera and connect it to the light subpath
+			const Vertex &qs = lightVertices[s - 1];
+			if (qs.isConnectible())
+			{
+				VisibilityTester vis;
+				Vec3f wi;
+				Float pdf;
+				Spectrum Wi = m_camera->sample_Wi(qs.getInteraction(), sampler.get2D(), wi, pdf, pRaster, vis);
+				if (pdf > 0 && !Wi.isBlack())
+				{
+					sampled = Vertex::createCamera(m_camera.get(), vis.P1(), Wi / pdf);
+					L = qs.beta * qs.f(sampled) * sampled.beta;
+					if (qs.isOnSurface())
+						L *= absDot(wi, qs.n());
+					if (!L.isBlack() && !vis.unoccluded(scene))
+						L = Spectrum(0.f);
+				}
+			}
+		}
+		else if (s == 1)
+		{
+			// Sample a point on a light and connect it to the camera subpath
+			const Vertex &pt = cameraVertices[t - 1];
+			Float lightPdf;
+			int lightNum = pt.isConnectible() ?
+				m_lightDistribution->sample(Vec3f(0.f), Vec3f(0.f), sampler.get1D(), lightPdf) : -1;
+			if (lightNum >= 0)
+			{
+				const Light *light = scene.m_lights[lightNum].get();
+				VisibilityTester vis;
+				Vec3f wi;
+				Float pdf;
+				Spectrum lightWeight = light->sample_Li(pt.getInteraction(), sampler.get2D(), wi, pdf, vis);
+				if (pdf > 0 && !lightWeight.isBlack())
+				{
+					sampled = Vertex::createLight(light, vis.P1(), lightWeight / (pdf * lightPdf), 0);
+					sampled.pdfFwd = pdfLightOrigin(sampled, pt);
+					L = pt.beta * pt.f(sampled) * sampled.beta;
+					if (pt.isOnSurface())
+						L *= absDot(wi, pt.n());
+					if (!L.isBlack() && !vis.unoccluded(scene))
+						L = Spectrum(0.f);
+				}
+			}
+		}
+		else
+		{
+			// Connect the end points of the two subpaths
+			const Vertex &qs = lightVertices[s - 1], &pt = cameraVertices[t - 1];
+			if (qs.isConnectible() && pt.isConnectible())
+			{
+				L = qs.beta * qs.f(pt) * pt.f(qs) * pt.beta;
+				if (!L.isBlack())
+					L *= G(scene, qs, pt);
+			}
+		}
+
+		if (L.isBlack())
+			return L;
+		return L * misWeight(lightVertices, cameraVertices, sampled, s, t);
+	}
+
+	Float BDPTRenderer::misWeight(Vertex *lightVertices, Vertex *cameraVertices,
+		Vertex &sampled, int s, int t) const
+	{
+		if (s + t == 2)
+			return 1;
+
+		//Note: the densities of delta vertices are stored as zero, which the ratios count as one
+		auto remap0 = [](Float f) -> Float { return f != 0 ? f : 1; };
+
+		Vertex *qs = s > 0 ? &lightVertices[s - 1] : nullptr;
+		Vertex *pt = t > 0 ? &cameraVertices[t - 1] : nullptr;
+		Vertex *qsMinus = s > 1 ? &lightVertices[s - 2] : nullptr;
+		Vertex *ptMinus = t > 1 ? &cameraVertices[t - 2] : nullptr;
+
+		// Temporarily turn the vertices into those of the connected path: the sampled end point,
+		// the connection vertices that are never delta, and the reverse densities around the connection
+		ScopedAssignment<Vertex> a1;
+		if (s == 1)
+			a1 = ScopedAssignment<Vertex>(qs, sampled);
+		else if (t == 1)
+			a1 = ScopedAssignment<Vertex>(pt, sampled);
+
+		ScopedAssignment<bool> a2, a3;
+		if (pt != nullptr)
+			a2 = ScopedAssignment<bool>(&pt->delta, false);
+		if (qs != nullptr)
+			a3 = ScopedAssignment<bool>(&qs->delta, false);
+
+		ScopedAssignment<Float> a4;
+		if (pt != nullptr)
+			a4 = ScopedAssignment<Float>(&pt->pdfRev, s > 0 ? qs->pdf(qsMinus, *pt) : pdfLightOrigin(*pt, *ptMinus));
+
+		ScopedAssignment<Float> a5;
+		if (ptMinus != nullptr)
+			a5 = ScopedAssignment<Float>(&ptMinus->pdfRev, s > 0 ? pt->pdf(qs, *ptMinus) : pt->pdfLight(*ptMinus));
+
+		ScopedAssignment<Float> a6;
+		if (qs != nullptr)
+			a6 = ScopedAssignment<Float>(&qs->pdfRev, pt->pdf(ptMinus, *qs));
+
+		ScopedAssignment<Float> a7;
+		if (qsMinus != nullptr)
+			a7 = ScopedAssignment<Float>(&qsMinus->pdfRev, qs->pdf(pt, *qsMinus));
+
+		// Sum the density ratios of the other strategies that could have made the same path,
+		// which is the balance heuristic
+		Float sumRi = 0;
+		Float ri = 1;
+		for (int i = t - 1; i > 0; --i)
+		{
+			ri *= remap0(cameraVertices[i].pdfRev) / remap0(cameraVertices[i].pdfFwd);
+			if (!cameraVertices[i].delta && !cameraVertices[i - 1].delta)
+				sumRi += ri;
+		}
+
+		ri = 1;
+		for (int i = s - 1; i >= 0; --i)
+		{
+			ri *= remap0(lightVertices[i].pdfRev) / remap0(lightVertices[i].pdfFwd);
+			bool deltaLightVertex = i > 0 ? lightVertices[i - 1].delta : lightVertices[0].isDeltaLight();
+			if (!lightVertices[i].delta && !deltaLightVertex)
+				sumRi += ri;
+		}
+
+		return 1 / (1 + sumRi);
+	}
+
+	Float BDPTRenderer::pdfLightOrigin(const Vertex &v, const Vertex &to) const
+	{
+		Vec3f w = to.p() - v.p();
+		if (lengthSquared(w) == 0)
+			return 0;
+
+		const Light *light = v.getLight();
+		auto it = m_lightIndices.find(light);
+		CHECK(it != m_lightIndices.end());
+		Float pdfChoice = m_lightDistribution->pmf(Vec3f(0.f), Vec3f(0.f), it->second);
+
+		Float pdfPos, pdfDir;
+		light->pdf_Le(Ray(v.p(), w), v.n(), pdfPos, pdfDir);
+		return pdfPos * pdfChoice;
+	}
+
+	static BDPTRenderer::Vertex *allocVertices(MemoryArena &arena, int count)
+	{
+		BDPTRenderer::Vertex *vertices = static_cast<BDPTRenderer::Vertex *>(arena.Alloc(count * sizeof(BDPTRenderer::Vertex)));
+		for (int i = 0; i < count; ++i)
+			new (&vertices[i]) BDPTRenderer::Vertex();
+		return vertices;
+	}
+
+	Spectrum BDPTRenderer::evaluateStrategy(const Scene &scene, MemoryArena &arena, const Ray &ray, int s, int t,
+		Sampler &cameraSampler, Sampler &lightSampler, Sampler &connectionSampler, Vec2f &pRaster) const
+	{
+		Vertex *cameraVertices = allocVertices(arena, t);
+		Vertex *lightVertices = allocVertices(arena, s);
+		if (generateCameraSubpath(scene, cameraSampler, arena, ray, t, cameraVertices) != t ||
+			generateLightSubpath(scene, lightSampler, arena, s, lightVertices) != s)
+			return Spectrum(0.f);
+
+		return connect(scene, lightVertices, cameraVertices, s, t, connectionSampler, pRaster);
+	}
+
+	Spectrum BDPTRenderer::Li(const Ray &ray, const Scene &scene, Sampler &sampler,
+		MemoryArena &arena, int) const
+	{
+		//Note: a camera subpath has one more vertex than a light subpath, the one on the camera
+		Vertex *cameraVertices = allocVertices(arena, m_maxDepth + 2);
+		Vertex *lightVertices = allocVertices(arena, m_maxDepth + 1);
+		const int nCamera = generateCameraSubpath(scene, sampler, arena, ray, m_maxDepth + 2, cameraVertices);
+		const int nLight = generateLightSubpath(scene, sampler, arena, m_maxDepth + 1, lightVertices);
+
+		// Run every strategy that makes a path of at most m_maxDepth bounces
+		Spectrum L(0.f);
+		for (int t = 1; t <= nCamera; ++t)
+		{
+			for (int s = 0; s <= nLight; ++s)
+			{
+				int pathDepth = t + s - 2;
+				if ((s == 1 && t == 1) || pathDepth < 0 || pathDepth > m_maxDepth)
+					continue;
+
+				Vec2f pRaster;
+				Spectrum Lpath = connect(scene, lightVertices, cameraVertices, s, t, sampler, pRaster);
+				if (t != 1)
+					L += Lpath;
+				else if (!Lpath.isBlack())
+					m_camera->m_film->addSplat(pRaster, Lpath);
+			}
+		}
+
+		return L;
+	}
+}
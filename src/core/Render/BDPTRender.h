@@ -0,0 +1,71 @@
+#ifndef ARBDPT_RENDER_H
+#define ARBDPT_RENDER_H
+
+#include "Render/Render.h"
+#include "Utils/Interaction.h"
+
+#include <unordered_map>
+
+namespace RT
+{
+	//! @brief Bidirectional path tracer.
+	/**
+	 * Every sample traces a subpath from the camera and one from a light picked by power, then
+	 * connects every prefix of the one with every prefix of the other, following Veach's thesis
+	 * and the BDPT of pbrt. The strategies are combined by multiple importance sampling with the
+	 * balance heuristic. The strategies that connect a light subpath straight to the camera land
+	 * anywhere on the film and are splatted, the others belong to the pixel of the sample.
+	 * Infinite lights are not supported, a scene with one is refused by preprocess.
+	 */
+	class BDPTRenderer : public SamplerRenderer
+	{
+	public:
+		typedef std::shared_ptr<BDPTRenderer> ptr;
+
+		BDPTRenderer(const PropertyTreeNode &node);
+
+		virtual void preprocess(const Scene &scene) override;
+
+		virtual Spectrum Li(const Ray &ray, const Scene &scene, Sampler &sampler,
+			MemoryArena &arena, int depth) const override;
+
+		virtual std::string toString() const override { return "BDPTRenderer[]"; }
+
+		//Vertex of a camera or light subpath
+		struct Vertex;
+
+	protected:
+		//Trace subpaths of at most |maxVertices| vertices, returns the number of vertices traced
+		int generateCameraSubpath(const Scene &scene, Sampler &sampler, MemoryArena &arena,
+			const Ray &ray, int maxVertices, Vertex *path) const;
+
+		int generateLightSubpath(const Scene &scene, Sampler &sampler, MemoryArena &arena, int maxVertices, Vertex *path) const;
+
+		//Extend a subpath by sampling the BSDFs, returns the number of vertices added
+		int randomWalk(const Scene &scene, Ray ray, Sampler &sampler, MemoryArena &arena, Spectrum beta,
+			Float pdf, int maxDepth, TransportMode mode, Vertex *path) const;
+
+		//Contribution of the path made of |s| light vertices and |t| camera vertices
+		Spectrum connect(const Scene &scene, Vertex *lightVertices, Vertex *cameraVertices, int s, int t,
+			Sampler &sampler, Vec2f &pRaster) const;
+
+		Float misWeight(Vertex *lightVertices, Vertex *cameraVertices, Vertex &sampled, int s, int t) const;
+
+		//Probability that the light subpath starts at the light of |v|, at its position
+		Float pdfLightOrigin(const Vertex &v, const Vertex &to) const;
+
+		//Contribution of the one strategy of |s| light and |t| camera vertices, with subpaths traced to exactly
+		//that length from the camera |ray|, black if one ends early. Each part draws from its own sampler,
+		//and |pRaster| moves to where the path reaches the film for t == 1.
+		Spectrum evaluateStrategy(const Scene &scene, MemoryArena &arena, const Ray &ray, int s, int t,
+			Sampler &cameraSampler, Sampler &lightSampler, Sampler &connectionSampler, Vec2f &pRaster) const;
+
+		int m_maxDepth;
+
+		//Note: lights are picked by power, for the light subpaths and for the strategies that sample a light
+		std::unique_ptr<LightDistribution> m_lightDistribution;
+		std::unordered_map<const Light*, int> m_lightIndices;
+	};
+}
+
+#endif
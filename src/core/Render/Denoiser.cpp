@@ -0,0 +1,181 @@
+#include "Render/Denoiser.h"
+
+#include "Utils/Parallel.h"
+
+namespace RT
+{
+	Denoiser::Denoiser(const PropertyList &props) :
+		m_featureSamples(glm::max(1, props.getInteger("FeatureSamples", 16))) {}
+}
+
+namespace RT
+{
+	//Note: the image is filtered in tiles of tileSize x tileSize pixels in parallel
+	static constexpr int tileSize = 16;
+
+	//Luminance of a linear RGB color
+	static Float rgbLuminance(const Vec3f &c) { return 0.212671f * c.x + 0.715160f * c.y + 0.072169f * c.z; }
+
+	AURORA_REGISTER_CLASS(ATrousDenoiser, "ATrous")
+
+	ATrousDenoiser::ATrousDenoiser(const PropertyTreeNode &node) : Denoiser(node.getPropertyList())
+	{
+		m_iterations = glm::max(1, node.getPropertyList().getInteger("Iterations", 3));
+		m_sigmaLuminance = node.getPropertyList().getFloat("SigmaLuminance", 4.f);
+		m_sigmaNormal = node.getPropertyList().getFloat("SigmaNormal", 128.f);
+		m_sigmaDepth = node.getPropertyList().getFloat("SigmaDepth", 1.f);
+		activate();
+	}
+
+	void ATrousDenoiser::denoise(const Vec2i &extent, Float *rgb, const std::vector<DenoiserFeatures> &features) const
+	{
+		const int width = extent.x, height = extent.y;
+		const int nPixels = width * height;
+		CHECK_EQ((int)features.size(), nPixels);
+
+		const Vec2i nTiles((width + tileSize - 1) / tileSize, (height + tileSize - 1) / tileSize);
+		auto forEachPixel = [&](const std::function<void(int, int)> &func)
+		{
+			ParallelUtils::parallelFor((size_t)0, (size_t)(nTiles.x * nTiles.y), [&](const size_t &t)
+			{
+				const int x0 = (t % nTiles.x) * tileSize, y0 = (t / nTiles.x) * tileSize;
+				for (int y = y0; y < glm::min(y0 + tileSize, height); ++y)
+				{
+					for (int x = x0; x < glm::min(x0 + tileSize, width); ++x)
+						func(x, y);
+				}
+			}, ExecutionPolicy::APARALLEL);
+		};
+
+		auto isHit = [&](int i) { return features[i].normal != Vec3f(0.f); };
+
+		// Divide the albedo out, the color left is the lighting that the filter may blur
+		//Note: black albedo keeps the color as it is, a miss or an absorbing surface has no detail to keep
+		std::vector<Vec3f> albedo(nPixels), color(nPixels), filteredColor(nPixels);
+		std::vector<Float> variance(nPixels), filteredVariance(nPixels), depthGradient(nPixels);
+		forEachPixel([&](int x, int y)
+		{
+			const int i = y * width + x;
+			for (int c = 0; c < 3; ++c)
+				albedo[i][c] = features[i].albedo[c] > 1e-3f ? features[i].albedo[c] : 1;
+			color[i] = Vec3f(rgb[3 * i + 0], rgb[3 * i + 1], rgb[3 * i + 2]) / albedo[i];
+
+			// Largest depth difference to the neighbours over a pixel, on the same kind of pixel
+			Float gradient = 0;
+			if (isHit(i))
+			{
+				for (int j : { y * width + glm::max(x - 1, 0), y * width + glm::min(x + 1, width - 1),
+					glm::max(y - 1, 0) * width + x, glm::min(y + 1, height - 1) * width + x })
+				{
+					if (isHit(j))
+						gradient = glm::max(gradient, glm::abs(features[j].depth - features[i].depth));
+				}
+			}
+			depthGradient[i] = gradient;
+		});
+
+		// Variance of the lighting, pixels without samples of their own take it from their 3x3 neighbourhood
+		forEachPixel([&](int x, int y)
+		{
+			const int i = y * width + x;
+			const Float albedoLuminance = rgbLuminance(albedo[i]);
+			if (features[i].variance >= 0)
+			{
+				variance[i] = features[i].variance / (albedoLuminance * albedoLuminance);
+				return;
+			}
+
+			Float sum = 0, sumSquares = 0;
+			int n = 0;
+			for (int v = glm::max(y - 1, 0); v <= glm::min(y + 1, height - 1); ++v)
+			{
+				for (int u = glm::max(x - 1, 0); u <= glm::min(x + 1, width - 1); ++u)
+				{
+					const int j = v * width + u;
+					if (isHit(j) != isHit(i))
+						continue;
+					const Float l = rgbLuminance(color[j]);
+					sum += l;
+					sumSquares += l * l;
+					++n;
+				}
+			}
+			variance[i] = glm::max((Float)0, sumSquares / n - (sum / n) * (sum / n));
+		});
+
+		static const Float kernel[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+		static const Float gaussian[2] = { 1.f / 2.f, 1.f / 4.f };
+		for (int iteration = 0; iteration < m_iterations; ++iteration)
+		{
+			const int step = 1 << iteration;
+			forEachPixel([&](int x, int y)
+			{
+				const int i = y * width + x;
+				const DenoiserFeatures &center = features[i];
+				const bool hit = isHit(i);
+
+				// Luminance weights use the variance blurred over 3x3, a single pixel estimates it poorly
+				Float blurredVariance = 0, blurredWeight = 0;
+				for (int dy = -1; dy <= 1; ++dy)
+				{
+					for (int dx = -1; dx <= 1; ++dx)
+					{
+						const int u = x + dx, v = y + dy;
+						if (u < 0 || u >= width || v < 0 || v >= height)
+							continue;
+						const Float w = gaussian[glm::abs(dx)] * gaussian[glm::abs(dy)];
+						blurredVariance += w * variance[v * width + u];
+						blurredWeight += w;
+					}
+				}
+				const Float luminance = rgbLuminance(color[i]);
+				const Float luminanceScale = m_sigmaLuminance * glm::sqrt(blurredVariance / blurredWeight) + 1e-6f;
+
+				Vec3f sumColor(0.f);
+				Float sumVariance = 0, sumWeight = 0;
+				for (int dy = -2; dy <= 2; ++dy)
+				{
+					for (int dx = -2; dx <= 2; ++dx)
+					{
+						const int u = x + dx * step, v = y + dy * step;
+						if (u < 0 || u >= width || v < 0 || v >= height)
+							continue;
+
+						const int j = v * width + u;
+						if (isHit(j) != hit)
+							continue;
+
+						Float w = kernel[glm::abs(dx)] * kernel[glm::abs(dy)] *
+							glm::exp(-glm::abs(rgbLuminance(color[j]) - luminance) / luminanceScale);
+						if (hit)
+						{
+							const DenoiserFeatures &neighbor = features[j];
+							const Float offset = step * glm::sqrt((Float)(dx * dx + dy * dy));
+							w *= glm::pow(glm::max((Float)0, dot(center.normal, neighbor.normal)), m_sigmaNormal);
+							w *= glm::exp(-glm::abs(neighbor.depth - center.depth) /
+								(m_sigmaDepth * depthGradient[i] * offset + 1e-3f * center.depth + 1e-6f));
+						}
+
+						sumColor += w * color[j];
+						sumVariance += w * w * variance[j];
+						sumWeight += w;
+					}
+				}
+
+				//Note: the center tap always has weight, sumWeight is positive
+				filteredColor[i] = sumColor / sumWeight;
+				filteredVariance[i] = sumVariance / (sumWeight * sumWeight);
+			});
+
+			color.swap(filteredColor);
+			variance.swap(filteredVariance);
+		}
+
+		// Multiply the albedo back in
+		for (int i = 0; i < nPixels; ++i)
+		{
+			for (int c = 0; c < 3; ++c)
+				rgb[3 * i + c] = color[i][c] * albedo[i][c];
+		}
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef ARDENOISER_H
+#define ARDENOISER_H
+
+#include "Utils/Base.h"
+#include "Utils/Math.h"
+#include "Object/Object.h"
+
+#include <vector>
+
+namespace RT
+{
+	//First-hit features of a pixel averaged over its feature samples, and the variance of its estimate
+	struct DenoiserFeatures
+	{
+		Float albedo[3] = { 0, 0, 0 };	//RGB reflectance at the first hit
+		Vec3f normal = Vec3f(0.f);		//zero where the camera rays missed the scene
+		Float depth = 0;
+		Float variance = -1;			//variance of the luminance of the pixel, negative where unknown
+	};
+
+	class Denoiser : public Object
+	{
+	public:
+		typedef std::unique_ptr<Denoiser> unique_ptr;
+
+		virtual ~Denoiser() = default;
+
+		Denoiser(const PropertyList &props);
+
+		//Filter the RGB image of |extent| pixels in scanline order in place
+		virtual void denoise(const Vec2i &extent, Float *rgb, const std::vector<DenoiserFeatures> &features) const = 0;
+
+		virtual ClassType getClassType() const override { return ClassType::RTDenoiser; }
+
+		//Number of camera rays per pixel the features are averaged over
+		const int m_featureSamples;
+	};
+}
+
+namespace RT
+{
+	//! @brief Edge-avoiding a-trous wavelet filter.
+	/**
+	 * Follows Dammertz et al., "Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination
+	 * Filtering", with the variance guided weights of Schied et al., "Spatiotemporal Variance-Guided
+	 * Filtering". The albedo is divided out before filtering so that only the lighting gets blurred,
+	 * the 5x5 kernel is applied with holes doubling every iteration, and the weights stop it at the
+	 * edges of the normals and the depth and at luminance differences beyond the noise of the pixel.
+	 */
+	class ATrousDenoiser final : public Denoiser
+	{
+	public:
+
+		ATrousDenoiser(const PropertyTreeNode &node);
+
+		virtual void denoise(const Vec2i &extent, Float *rgb, const std::vector<DenoiserFeatures> &features) const override;
+
+		virtual std::string toString() const override { return "ATrousDenoiser[]"; }
+
+	private:
+		int m_iterations;
+		Float m_sigmaLuminance;		//luminance differences in standard deviations of the noise
+		Float m_sigmaNormal;		//exponent of the cosine between the normals
+		Float m_sigmaDepth;			//depth differences relative to the local depth gradient
+	};
+}
+
+#endif
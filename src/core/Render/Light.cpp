@@ -25,9 +25,9 @@ namespace RT
 
 	//-------------------------------------------AVisibilityTester-------------------------------------
 
-	bool VisibilityTester::unoccluded(const Scene &scene) const
+	bool VisibilityTester::unoccluded(const Scene &scene, int lodLevel) const
 	{
-		return !scene.hit(m_p0.spawnRayTo(m_p1));
+		return !scene.hit(m_p0.spawnRayTo(m_p1), lodLevel);
 	}
 
 	Spectrum VisibilityTester::tr(const Scene &scene, Sampler &sampler) const
@@ -67,7 +67,7 @@ namespace RT
 	AURORA_REGISTER_CLASS(DiffuseAreaLight, "AreaDiffuse")
 
 		DiffuseAreaLight::DiffuseAreaLight(const PropertyTreeNode& node)
-		: AreaLight(node.getPropertyList()), m_shape(nullptr)
+		: AreaLight(node.getPropertyList()), m_area(0)
 	{
 		const auto& props = node.getPropertyList();
 		Vec3f _Le = props.getVector3f("Radiance");
@@ -81,7 +81,7 @@ namespace RT
 
 	DiffuseAreaLight::DiffuseAreaLight(const Transform& lightToWorld, const Spectrum& Lemit,
 		int nSamples, Shape* shape, bool twoSided)
-		: AreaLight(lightToWorld, nSamples), m_Lemit(Lemit), m_shape(shape),
+		: AreaLight(lightToWorld, nSamples), m_Lemit(Lemit), m_shapes(1, shape),
 		m_twoSided(twoSided), m_area(shape->area()) { }
 
 	void DiffuseAreaLight::setParent(Object* parent)
@@ -89,11 +89,15 @@ namespace RT
 		switch (parent->getClassType())
 		{
 		case ClassType::AEHitable:
-			m_shape = static_cast<HitableObject*>(parent)->getShape();
-			m_area = m_shape->area();
-			m_lightToWorld = *m_shape->m_objectToWorld;
-			m_worldToLight = *m_shape->m_worldToObject;
+		{
+			//Note: called once for every hitable sharing this light, e.g. each triangle of a mesh
+			Shape* shape = static_cast<HitableObject*>(parent)->getShape();
+			m_shapes.push_back(shape);
+			m_area += shape->area();
+			m_lightToWorld = *shape->m_objectToWorld;
+			m_worldToLight = *shape->m_worldToObject;
 			break;
+		}
 		default:
 			LOG(ERROR) << "ADiffuseAreaLight::setParent(" << getClassTypeName(parent->getClassType())
 				<< ") is no supported";
@@ -101,6 +105,53 @@ namespace RT
 		}
 	}
 
+	void DiffuseAreaLight::preprocess(const Scene&)
+	{
+		CHECK(!m_shapes.empty());
+		if (m_shapes.size() == 1)
+			return;
+
+		std::vector<Float> areas(m_shapes.size());
+		for (size_t i = 0; i < m_shapes.size(); ++i)
+		{
+			areas[i] = m_shapes[i]->area();
+		}
+		m_areaDistrib.reset(new Distribution1D(areas.data(), (int)areas.size()));
+	}
+
+	bool DiffuseAreaLight::getBounds(LightBounds& bounds) const
+	{
+		// Union of the bounds and normal cones of the shapes, weighted by area only to mark them as non-empty
+		bounds = LightBounds();
+		for (const Shape* shape : m_shapes)
+		{
+			LightBounds shapeBounds;
+			shapeBounds.bounds = shape->worldBound();
+			shape->normalBounds(shapeBounds.w, shapeBounds.cosTheta_o);
+			shapeBounds.phi = shape->area();
+			bounds = unionBounds(bounds, shapeBounds);
+		}
+
+		bounds.phi = power().luminance();
+		bounds.cosTheta_e = 0;
+		bounds.twoSided = m_twoSided;
+		return true;
+	}
+
+	const Shape* DiffuseAreaLight::sampleShape(Vec2f& u, Float& pmf) const
+	{
+		if (m_areaDistrib == nullptr)
+		{
+			pmf = 1;
+			return m_shapes[0];
+		}
+
+		Float uRemapped;
+		int index = m_areaDistrib->sampleDiscrete(u[0], &pmf, &uRemapped);
+		u[0] = glm::min(uRemapped, aOneMinusEpsilon);
+		return m_shapes[index];
+	}
+
 	Spectrum DiffuseAreaLight::power() const
 	{
 		return (m_twoSided ? 2 : 1) * m_Lemit * m_area * Pi;
@@ -109,7 +160,11 @@ namespace RT
 	Spectrum DiffuseAreaLight::sample_Li(const Interaction& ref, const Vec2f& u, Vec3f& wi,
 		Float& pdf, VisibilityTester& vis) const
 	{
-		Interaction pShape = m_shape->sample(ref, u, pdf);
+		Vec2f uShape = u;
+		Float pmf;
+		const Shape* shape = sampleShape(uShape, pmf);
+		Interaction pShape = shape->sample(ref, uShape, pdf);
+		pdf *= pmf;
 
 		if (pdf == 0 || lengthSquared(pShape.p - ref.p) == 0)
 		{
@@ -122,16 +177,27 @@ namespace RT
 		return L(pShape, -wi);
 	}
 
-	Float DiffuseAreaLight::pdf_Li(const Interaction& ref, const Vec3f& wi) const
+	Float DiffuseAreaLight::pdf_Li(const Interaction& ref, const Vec3f& wi, const Interaction& pLight) const
 	{
-		return m_shape->pdf(ref, wi);
+		//Note: a single shape may sample the solid angle it subtends instead of its area, as spheres do
+		if (m_shapes.size() == 1)
+			return m_shapes[0]->pdf(ref, wi);
+
+		Float pdf = distanceSquared(ref.p, pLight.p) / (absDot(pLight.n, -wi) * m_area);
+		if (std::isinf(pdf))
+			pdf = 0.f;
+		return pdf;
 	}
 
 	Spectrum DiffuseAreaLight::sample_Le(const Vec2f& u1, const Vec2f& u2, Ray& ray,
 		Vec3f& nLight, Float& pdfPos, Float& pdfDir) const
 	{
 		// Sample a point on the area light's _Shape_, _pShape_
-		Interaction pShape = m_shape->sample(u1, pdfPos);
+		Vec2f uShape = u1;
+		Float pmf;
+		const Shape* shape = sampleShape(uShape, pmf);
+		Interaction pShape = shape->sample(uShape, pdfPos);
+		pdfPos *= pmf;
 		nLight = pShape.n;
 
 		// Sample a cosine-weighted outgoing direction _w_ for area light
@@ -170,7 +236,7 @@ namespace RT
 	void DiffuseAreaLight::pdf_Le(const Ray& ray, const Vec3f& n, Float& pdfPos, Float& pdfDir) const
 	{
 		Interaction it(ray.origin(), n, Vec3f(n));
-		pdfPos = m_shape->pdf(it);
+		pdfPos = m_shapes.size() == 1 ? m_shapes[0]->pdf(it) : 1 / m_area;
 		pdfDir = m_twoSided ? (.5 * cosineHemispherePdf(absDot(n, ray.direction())))
 			: cosineHemispherePdf(dot(n, ray.direction()));
 	}
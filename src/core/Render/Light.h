@@ -7,6 +7,7 @@
 #include "Utils/Transform.h"
 #include "Utils/Interaction.h"
 #include "Object/Object.h"
+#include "Utils/LightDistrib.h"
 
 namespace RT
 {
@@ -38,6 +39,9 @@ namespace RT
 
 		virtual void preprocess(const Scene &scene) {}
 
+		//Bounds of the light for the light hierarchy, false for lights that cannot be bounded
+		virtual bool getBounds(LightBounds &) const { return false; }
+
 		virtual Spectrum sample_Li(const Interaction &ref, const Vec2f &u,
 			Vec3f &wi, Float &pdf, VisibilityTester &vis) const = 0;
 
@@ -70,7 +74,7 @@ namespace RT
 		const Interaction &P0() const { return m_p0; }
 		const Interaction &P1() const { return m_p1; }
 
-		bool unoccluded(const Scene &scene) const;
+		bool unoccluded(const Scene &scene, int lodLevel = 0) const;
 
 		Spectrum tr(const Scene &scene, Sampler &sampler) const;
 
@@ -86,6 +90,14 @@ namespace RT
 		AreaLight(const PropertyList &props);
 		AreaLight(const Transform &lightToWorld, int nSamples);
 		virtual Spectrum L(const Interaction &intr, const Vec3f &w) const = 0;
+
+		//Note: an area light is only reached through its geometry, so its pdf is taken at the point the
+		//      ray hit. A direction given without one is known to miss the light.
+		virtual Float pdf_Li(const Interaction &, const Vec3f &) const override final { return 0; }
+
+		//Note: |pLight| is the point on this light that the ray along |wi| has already hit,
+		//      which saves the light from intersecting its own geometry again.
+		virtual Float pdf_Li(const Interaction &ref, const Vec3f &wi, const Interaction &pLight) const = 0;
 	};
 
 }
@@ -112,21 +124,30 @@ namespace RT
 		virtual Spectrum sample_Li(const Interaction& ref, const Vec2f& u, Vec3f& wo,
 			Float& pdf, VisibilityTester& vis) const override;
 
-		virtual Float pdf_Li(const Interaction&, const Vec3f&) const override;
+		virtual Float pdf_Li(const Interaction& ref, const Vec3f& wi, const Interaction& pLight) const override;
 
 		virtual Spectrum sample_Le(const Vec2f& u1, const Vec2f& u2, Ray& ray,
 			Vec3f& nLight, Float& pdfPos, Float& pdfDir) const override;
 
 		virtual void pdf_Le(const Ray&, const Vec3f&, Float& pdfPos, Float& pdfDir) const override;
 
+		virtual void preprocess(const Scene& scene) override;
+
+		virtual bool getBounds(LightBounds& bounds) const override;
+
 		virtual std::string toString() const override { return "DiffuseAreaLight[]"; }
 
 		virtual void setParent(Object* parent) override;
 
 	protected:
 
+		//Pick one of the shapes proportional to its area and remap u[0] for sampling on it
+		const Shape* sampleShape(Vec2f& u, Float& pmf) const;
+
 		Spectrum m_Lemit;
-		Shape* m_shape;
+		//Note: an emissive mesh shares one light over all of its triangles
+		std::vector<Shape*> m_shapes;
+		std::unique_ptr<Distribution1D> m_areaDistrib;
 		// ǷΪ˫Դ
 		bool m_twoSided;
 		Float m_area;
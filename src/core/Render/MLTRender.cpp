@@ -0,0 +1,243 @@
+#include "Render/MLTRender.h"
+
+#include "Scene/Scene.h"
+#include "Utils/Memory.h"
+#include "Utils/Parallel.h"
+#include "Utils/LightDistrib.h"
+#include "Render/RenderReporter.h"
+
+namespace RT
+{
+	//-------------------------------------------MLTSampler-------------------------------------
+
+	void MLTSampler::startIteration()
+	{
+		++m_currentIteration;
+		m_largeStep = m_rng.uniformFloat() < m_largeStepProbability;
+	}
+
+	void MLTSampler::accept()
+	{
+		if (m_largeStep)
+			m_lastLargeStepIteration = m_currentIteration;
+	}
+
+	void MLTSampler::reject()
+	{
+		for (auto &Xi : m_X)
+		{
+			if (Xi.lastModificationIteration == m_currentIteration)
+			{
+				Xi.value = Xi.valueBackup;
+				Xi.lastModificationIteration = Xi.modifyBackup;
+			}
+		}
+		--m_currentIteration;
+	}
+
+	Float MLTSampler::get(int index)
+	{
+		if (index >= (int)m_X.size())
+			m_X.resize(index + 1);
+		PrimarySample &Xi = m_X[index];
+
+		// A number untouched since before the last large step takes the value that step gave it
+		if (Xi.lastModificationIteration < m_lastLargeStepIteration)
+		{
+			Xi.value = m_rng.uniformFloat();
+			Xi.lastModificationIteration = m_lastLargeStepIteration;
+		}
+
+		Xi.valueBackup = Xi.value;
+		Xi.modifyBackup = Xi.lastModificationIteration;
+		if (m_largeStep)
+		{
+			Xi.value = m_rng.uniformFloat();
+		}
+		else
+		{
+			//Note: the small steps missed since the last use add up to a single normal offset, sampled by Box-Muller
+			const int64_t nSmall = m_currentIteration - Xi.lastModificationIteration;
+			const Float u1 = 1 - m_rng.uniformFloat(), u2 = m_rng.uniformFloat();
+			const Float normalSample = glm::sqrt(-2 * glm::log(u1)) * glm::cos(2 * Pi * u2);
+			Xi.value += normalSample * m_sigma * glm::sqrt((Float)nSmall);
+			Xi.value = glm::min(Xi.value - glm::floor(Xi.value), aOneMinusEpsilon);
+		}
+		Xi.lastModificationIteration = m_currentIteration;
+
+		return Xi.value;
+	}
+
+	Float MLTSampler::Stream::get1D()
+	{
+		return m_sampler.get(m_index + streamCount * m_sampleIndex++);
+	}
+
+	Vec2f MLTSampler::Stream::get2D()
+	{
+		const Float u = get1D();
+		return Vec2f(u, get1D());
+	}
+
+	std::unique_ptr<Sampler> MLTSampler::Stream::clone(int)
+	{
+		//Note: the numbers belong to the state of the chain rather than to a seed, a clone goes on
+		//      reading the same stream from where this one is
+		return std::unique_ptr<Sampler>(new Stream(*this));
+	}
+
+	//-------------------------------------------MLTRenderer-------------------------------------
+
+	AURORA_REGISTER_CLASS(MLTRenderer, "MLT")
+
+	MLTRenderer::MLTRenderer(const PropertyTreeNode &node) : BDPTRenderer(node)
+	{
+		//Note: the mutations per pixel default to the samples per pixel of the sampler
+		m_bootstrapSamples = glm::max(1, node.getPropertyList().getInteger("BootstrapSamples", 100000));
+		m_chains = glm::max(1, node.getPropertyList().getInteger("Chains", 1000));
+		m_mutationsPerPixel = glm::max(1, node.getPropertyList().getInteger("MutationsPerPixel", (int)m_sampler->samplesPerPixel));
+		m_largeStepProbability = clamp(node.getPropertyList().getFloat("LargeStepProbability", 0.3f), 0, 1);
+		m_sigma = node.getPropertyList().getFloat("Sigma", 0.01f);
+
+		LOG_IF(WARNING, m_progressive || !m_checkpoint.empty()) << "MLT renders in a single pass without checkpoints";
+	}
+
+	Spectrum MLTRenderer::L(const Scene &scene, MemoryArena &arena, MLTSampler &sampler, int depth, Vec2f &pRaster) const
+	{
+		MLTSampler::Stream cameraStream(sampler, MLTSampler::cameraStreamIndex);
+		MLTSampler::Stream lightStream(sampler, MLTSampler::lightStreamIndex);
+		MLTSampler::Stream connectionStream(sampler, MLTSampler::connectionStreamIndex);
+
+		// Pick the strategy that makes the path, a path straight from the camera to a light has only one
+		int s, nStrategies;
+		if (depth == 0)
+		{
+			nStrategies = 1;
+			s = 0;
+		}
+		else
+		{
+			nStrategies = depth + 2;
+			s = glm::min((int)(cameraStream.get1D() * nStrategies), nStrategies - 1);
+		}
+		const int t = depth + 2 - s;
+
+		// Cast the camera ray through a point of the sample bounds of the film
+		const BBox2i sampleBounds = m_camera->m_film->getSampleBounds();
+		const Vec2f u = cameraStream.get2D();
+		pRaster = Vec2f(sampleBounds.m_pMin) + u * Vec2f(sampleBounds.diagonal());
+
+		CameraSample cameraSample;
+		cameraSample.pFilm = pRaster;
+		Ray ray;
+		const Float rayWeight = m_camera->castingRay(cameraSample, ray);
+		if (rayWeight == 0)
+			return Spectrum(0.f);
+
+		//Note: the path is one of |nStrategies| ways to make a path of this length
+		return evaluateStrategy(scene, arena, ray, s, t, cameraStream, lightStream, connectionStream, pRaster) *
+			(rayWeight * nStrategies);
+	}
+
+	void MLTRenderer::render(const Scene &scene)
+	{
+		renderFeatures(scene, *m_camera);
+
+		Film &film = *m_camera->m_film;
+		if (m_lightDistribution == nullptr)
+		{
+			LOG(WARNING) << "MLT found no light in the scene";
+			film.writeImageToFile();
+			return;
+		}
+
+		// Trace the bootstrap paths, every sample makes a path of each length
+		const int nDepths = m_maxDepth + 1;
+		const int nBootstrapSamples = m_bootstrapSamples * nDepths;
+		std::vector<Float> bootstrapWeights(nBootstrapSamples, 0);
+		{
+			const int chunkSize = clamp(m_bootstrapSamples / 128, 1, 8192);
+			const int nChunks = (m_bootstrapSamples + chunkSize - 1) / chunkSize;
+			AReporter reporter(nChunks, "Generating bootstrap paths");
+			ParallelUtils::parallelFor((size_t)0, (size_t)nChunks, [&](const size_t &chunk)
+			{
+				MemoryArena arena;
+				const int end = glm::min(((int)chunk + 1) * chunkSize, m_bootstrapSamples);
+				for (int i = (int)chunk * chunkSize; i < end; ++i)
+				{
+					for (int depth = 0; depth < nDepths; ++depth)
+					{
+						const int rngIndex = i * nDepths + depth;
+						MLTSampler sampler(rngIndex, m_sigma, m_largeStepProbability);
+						Vec2f pRaster;
+						bootstrapWeights[rngIndex] = glm::max((Float)0, L(scene, arena, sampler, depth, pRaster).luminance());
+						arena.Reset();
+					}
+				}
+				reporter.update();
+			}, ExecutionPolicy::APARALLEL);
+			reporter.done();
+		}
+
+		//Note: the average weight over the bootstrap paths of each length, summed over the lengths, is the
+		//      brightness of the image that normalizes the splats of the chains
+		Distribution1D bootstrap(&bootstrapWeights[0], nBootstrapSamples);
+		const Float b = bootstrap.funcInt * nDepths;
+		LOG(INFO) << "MLT bootstrap estimates the image brightness at " << b;
+
+		const int64_t nTotalMutations = (int64_t)m_mutationsPerPixel * film.getSampleBounds().area();
+		if (b > 0)
+		{
+			AReporter reporter(m_chains, "Rendering");
+			ParallelUtils::parallelFor((size_t)0, (size_t)m_chains, [&](const size_t &chain)
+			{
+				const int64_t firstMutation = (int64_t)chain * nTotalMutations / m_chains;
+				const int64_t nChainMutations = glm::min((int64_t)(chain + 1) * nTotalMutations / m_chains, nTotalMutations) - firstMutation;
+
+				// Start the chain from a bootstrap path picked by its weight
+				//Note: the sequences of the chains follow those of the bootstrap samplers
+				Rng rng((uint64_t)nBootstrapSamples + chain);
+				const int bootstrapIndex = bootstrap.sampleDiscrete(rng.uniformFloat());
+				const int depth = bootstrapIndex % nDepths;
+
+				MemoryArena arena;
+				MLTSampler sampler(bootstrapIndex, m_sigma, m_largeStepProbability);
+				Vec2f pCurrent;
+				Spectrum LCurrent = L(scene, arena, sampler, depth, pCurrent);
+				arena.Reset();
+
+				for (int64_t j = 0; j < nChainMutations; ++j)
+				{
+					sampler.startIteration();
+					Vec2f pProposed;
+					Spectrum LProposed = L(scene, arena, sampler, depth, pProposed);
+					arena.Reset();
+
+					// Splat both states by their expected share of the step, then take one of them
+					const Float yCurrent = LCurrent.luminance(), yProposed = LProposed.luminance();
+					const Float acceptance = yCurrent > 0 ? glm::clamp(yProposed / yCurrent, (Float)0, (Float)1) : 1;
+					if (acceptance > 0 && yProposed > 0)
+						film.addSplat(pProposed, LProposed * acceptance / yProposed);
+					if (acceptance < 1 && yCurrent > 0)
+						film.addSplat(pCurrent, LCurrent * (1 - acceptance) / yCurrent);
+
+					if (rng.uniformFloat() < acceptance)
+					{
+						pCurrent = pProposed;
+						LCurrent = LProposed;
+						sampler.accept();
+					}
+					else
+					{
+						sampler.reject();
+					}
+				}
+				reporter.update();
+			}, ExecutionPolicy::APARALLEL);
+			reporter.done();
+		}
+
+		//Note: every mutation splats a unit of luminance, m_mutationsPerPixel per pixel of the sample bounds
+		film.writeImageToFile(b / m_mutationsPerPixel);
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef ARMLT_RENDER_H
+#define ARMLT_RENDER_H
+
+#include "Render/BDPTRender.h"
+
+#include <vector>
+
+namespace RT
+{
+	//! @brief Replayable sampler over the primary sample space of a Markov chain.
+	/**
+	 * Keeps every random number a path drew, so that the next state of the chain can be a mutation
+	 * of them: a large step draws them all anew, a small step perturbs each by a normal offset that
+	 * wraps around [0, 1). Numbers are drawn lazily and the perturbations a number has missed since
+	 * its last use are applied at once. A rejected proposal restores the numbers it changed.
+	 */
+	class MLTSampler final
+	{
+	public:
+		MLTSampler(int rngSequenceIndex, Float sigma, Float largeStepProbability)
+			: m_rng(rngSequenceIndex), m_sigma(sigma), m_largeStepProbability(largeStepProbability) {}
+
+		//Propose the next state of the chain
+		void startIteration();
+		void accept();
+		void reject();
+
+		//! @brief View of one stream of the numbers of the sampler.
+		/**
+		 * The camera subpath, the light subpath and their connection each draw from a stream of their
+		 * own, so that a path of another length still keeps the numbers of its other parts.
+		 */
+		class Stream final : public Sampler
+		{
+		public:
+			Stream(MLTSampler &sampler, int index) : Sampler(1), m_sampler(sampler), m_index(index) {}
+
+			virtual Float get1D() override;
+			virtual Vec2f get2D() override;
+
+			virtual std::unique_ptr<Sampler> clone(int seed) override;
+
+			virtual std::string toString() const override { return "MLTSampler::Stream[]"; }
+
+		private:
+			MLTSampler &m_sampler;
+			const int m_index;
+			int m_sampleIndex = 0;
+		};
+
+		static constexpr int cameraStreamIndex = 0;
+		static constexpr int lightStreamIndex = 1;
+		static constexpr int connectionStreamIndex = 2;
+		static constexpr int streamCount = 3;
+
+	private:
+		//Bring the number to the current iteration and return it
+		Float get(int index);
+
+		struct PrimarySample
+		{
+			Float value = 0;
+			int64_t lastModificationIteration = 0;
+
+			//state before the current iteration, restored on rejection
+			Float valueBackup = 0;
+			int64_t modifyBackup = 0;
+		};
+
+		Rng m_rng;
+		const Float m_sigma, m_largeStepProbability;
+		std::vector<PrimarySample> m_X;
+		int64_t m_currentIteration = 0;
+		bool m_largeStep = true;
+		int64_t m_lastLargeStepIteration = 0;
+	};
+
+	//! @brief Multiplexed Metropolis light transport.
+	/**
+	 * Follows Hachisuka et al., "Multiplexed Metropolis Light Transport", as done in pbrt. A state of a
+	 * Markov chain is a point of the primary sample space that the bidirectional path tracer turns into
+	 * a path of a fixed length through one of its strategies, chosen by the point as well. The chains
+	 * mutate their state and splat the current and proposed paths to the film in proportion to their
+	 * luminance, which concentrates the work on the paths that carry light however hard they are to
+	 * find. A bootstrap pass of independent paths estimates the brightness of the image and picks the
+	 * starting states of the chains.
+	 */
+	class MLTRenderer final : public BDPTRenderer
+	{
+	public:
+		typedef std::shared_ptr<MLTRenderer> ptr;
+
+		MLTRenderer(const PropertyTreeNode &node);
+
+		virtual void render(const Scene &scene) override;
+
+		virtual std::string toString() const override { return "MLTRenderer[]"; }
+
+	private:
+		//Radiance of the path of |depth| bounces that the state of |sampler| maps to and its film position
+		Spectrum L(const Scene &scene, MemoryArena &arena, MLTSampler &sampler, int depth, Vec2f &pRaster) const;
+
+		int m_bootstrapSamples;
+		int m_chains;
+		int m_mutationsPerPixel;
+		Float m_largeStepProbability;
+		Float m_sigma;
+	};
+}
+
+#endif
@@ -7,100 +7,276 @@
 #include "Utils/LightDistrib.h"
 #include "Utils/Parallel.h"
 
+#include <chrono>
+#include <algorithm>
+
 namespace RT
 {
 	//-------------------------------------------SamplerRenderer-------------------------------------
 
 	void SamplerRenderer::render(const Scene &scene)
 	{
-		Vec2i resolution = m_camera->m_film->getResolution();
-
-		auto &sampler = m_sampler;
+		renderFeatures(scene, *m_camera);
 
 		// ܵƬвȾ
 		BBox2i sampleBounds = m_camera->m_film->getSampleBounds();
 		Vec2i sampleExtent = sampleBounds.diagonal();
-		//һƬΪ16*16
-		constexpr int tileSize = 16;
 		Vec2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+		const int nTotalTiles = nTiles.x * nTiles.y;
 
-		AReporter reporter(nTiles.x * nTiles.y, "Rendering");
-
-	 	ParallelUtils::parallelFor((size_t)0, (size_t)(nTiles.x * nTiles.y), [&](const size_t &t)
+		// Ƭ߽
+		auto getTileBounds = [&](int t) -> BBox2i
 		{
-			
 			Vec2i tile(t % nTiles.x, t / nTiles.x);
-			MemoryArena arena;
-
-			//Ϊÿ߳½һ
-			int seed = t;
-			std::unique_ptr<Sampler> tileSampler = sampler->clone(seed);
-
-			// Ƭ߽
 			int x0 = sampleBounds.m_pMin.x + tile.x * tileSize;
 			int x1 = glm::min(x0 + tileSize, sampleBounds.m_pMax.x);
 			int y0 = sampleBounds.m_pMin.y + tile.y * tileSize;
 			int y1 = glm::min(y0 + tileSize, sampleBounds.m_pMax.y);
-			BBox2i tileBounds(Vec2i(x0, y0), Vec2i(x1, y1));
-
-			// ȡȾƬ
-			std::unique_ptr<FilmTile> filmTile = m_camera->m_film->getFilmTile(tileBounds);
+			return BBox2i(Vec2i(x0, y0), Vec2i(x1, y1));
+		};
+
+		const int64_t spp = m_sampler->samplesPerPixel;
+
+		// ӼָÿƬɵĲ
+		std::vector<int64_t> tileProgress(nTotalTiles, 0);
+		if (!m_checkpoint.empty())
+			m_camera->m_film->readCheckpoint(m_checkpoint, tileProgress);
+
+		using Clock = std::chrono::steady_clock;
+		Clock::time_point lastCheckpoint = Clock::now();
+		//Note: splats are unweighted sums over the light subpaths, one of which starts from every sample
+		//      taken anywhere on the film. Adaptive sampling and the tiles a progressive pass skips once
+		//      out of time leave the pixels with different counts, so the splats are normalized by the mean.
+		auto writeImage = [&]()
+		{
+			const Float meanSamples = m_camera->m_film->getMeanSampleCount();
+			m_camera->m_film->writeImageToFile(meanSamples > 0 ? 1 / meanSamples : 0);
+		};
 
-			// ر
-			for (Vec2i pixel : tileBounds)
+		// д㣬|force|ʱд
+		auto checkpoint = [&](bool force)
+		{
+			if (m_checkpoint.empty() ||
+				(!force && std::chrono::duration<Float>(Clock::now() - lastCheckpoint).count() < m_checkpointInterval))
+				return;
+
+			m_camera->m_film->writeCheckpoint(m_checkpoint, tileProgress);
+			lastCheckpoint = Clock::now();
+		};
+
+		// ȾƬÿд
+		//Note: the splats of a tile reach the film while it renders, not when it is merged. A checkpoint
+		//      is only written between batches, when every splat on the film belongs to a completed tile.
+		const int batchSize = m_checkpoint.empty() ? nTotalTiles : 8 * numSystemCores();
+		auto renderTiles = [&](const std::function<void(int)> &func)
+		{
+			for (int first = 0; first < nTotalTiles; first += batchSize)
 			{
-				//ʼ
-				tileSampler->startPixel(pixel);
+				ParallelUtils::parallelFor((size_t)first, (size_t)glm::min(first + batchSize, nTotalTiles),
+					[&](const size_t &t) { func((int)t); }, ExecutionPolicy::APARALLEL);
+				checkpoint(false);
+			}
+		};
+
+		if (!m_progressive)
+		{
+			AReporter reporter(nTotalTiles, "Rendering");
+
+			//Ӧͳʵʲ
+			const bool adaptive = m_sampler->isAdaptive();
+			std::atomic<int64_t> nSamplesTaken(0);
 
-				do
+			renderTiles([&](int t)
+			{
+				if (tileProgress[t] < spp)
 				{
-					// ΪǰʼCameraSample
-					CameraSample cameraSample = tileSampler->getCameraSample(pixel);
+					//Ϊÿ߳½һ
+					nSamplesTaken += renderTile(scene, getTileBounds(t), t, tileProgress[t], spp, adaptive);
+					tileProgress[t] = spp;
+				}
+				reporter.update();
+			});
 
-					// ɵǰߣȨֵ
-					Ray ray;
-					Float rayWeight = m_camera->castingRay(cameraSample, ray);
+			reporter.done();
 
-					// й
-					Spectrum L(0.f);
-					if (rayWeight > 0)
-					{
-						L = Li(ray, scene, *tileSampler, arena);
-					}
+			checkpoint(true);
 
-					// 쳣
-					if (L.hasNaNs())
-					{
-						L = Spectrum(0.f);
-					}
-					else if (L.luminance() < -1e-5)
+			if (adaptive)
+			{
+				LOG(INFO) << "Adaptive sampling took " << (Float)nSamplesTaken / (sampleExtent.x * sampleExtent.y)
+					<< " samples per pixel on average";
+			}
+
+			writeImage();
+			return;
+		}
+
+		// ʽȾÿֲÿֽдͼ񣬳ʱԤʱֹͣ
+		//Note: the film normalizes every pixel by its own filter weights, so the tiles skipped by the
+		//      last pass once the budget ran out only leave their pixels with fewer samples.
+		LOG_IF(WARNING, m_sampler->isAdaptive()) << "Adaptive sampling is ignored by progressive rendering";
+
+		const Clock::time_point startTime = Clock::now();
+		auto outOfTime = [&]()
+		{
+			return m_timeLimit > 0 && std::chrono::duration<Float>(Clock::now() - startTime).count() >= m_timeLimit;
+		};
+
+		int64_t firstSample = 0;
+		for (int pass = 0; firstSample < spp && !outOfTime(); ++pass)
+		{
+			const int64_t endSample = glm::min(glm::max(firstSample * 2, (int64_t)1), spp);
+
+			AReporter reporter(nTotalTiles, stringPrintf("Rendering pass %d", pass + 1));
+			std::atomic<int> nSkippedTiles(0), nRenderedTiles(0);
+
+			renderTiles([&](int t)
+			{
+				// ɱֵƬ
+				const int64_t tileFirstSample = glm::max(firstSample, tileProgress[t]);
+				if (tileFirstSample < endSample)
+				{
+					if (outOfTime())
 					{
-						L = Spectrum(0.f);
+						++nSkippedTiles;
 					}
-					else if (std::isinf(L.luminance()))
+					else
 					{
-						L = Spectrum(0.f);
+						//Note: every pass seeds the samplers of its tiles differently from the previous passes
+						renderTile(scene, getTileBounds(t), pass * nTotalTiles + t, tileFirstSample, endSample, false);
+						tileProgress[t] = endSample;
+						++nRenderedTiles;
 					}
+				}
+				reporter.update();
+			});
 
-					// ǰӵfilm
-					filmTile->addSample(cameraSample.pFilm, L, rayWeight);
+			reporter.done();
 
-					// ӼͼֵͷMemoryRenaڴ
-					arena.Reset();
+			firstSample = endSample;
+			if (nRenderedTiles == 0)
+				continue;
+
+			checkpoint(true);
+
+			LOG(INFO) << "Progressive pass " << pass + 1 << " reached " << endSample << " samples per pixel"
+				<< (nSkippedTiles > 0 ? stringPrintf(" except for %d tiles out of time", (int)nSkippedTiles) : "");
+
+			writeImage();
+		}
+	}
+
+	int64_t SamplerRenderer::renderTile(const Scene &scene, const BBox2i &tileBounds, int seed,
+		int64_t firstSample, int64_t endSample, bool adaptive) const
+	{
+		MemoryArena arena;
+
+		std::unique_ptr<Sampler> tileSampler = m_sampler->clone(seed);
+
+		// ȡȾƬ
+		std::unique_ptr<FilmTile> filmTile = m_camera->m_film->getFilmTile(tileBounds);
+
+		// һķȲӵfilm
+		auto takeSample = [&](const Vec2i &pixel)
+		{
+			// ΪǰʼCameraSample
+			CameraSample cameraSample = tileSampler->getCameraSample(pixel);
+
+			// ɵǰߣȨֵ
+			Ray ray;
+			Float rayWeight = m_camera->castingRay(cameraSample, ray);
 
-					//С
-				} while (tileSampler->startNextSample());
+			// й
+			Spectrum L(0.f);
+			if (rayWeight > 0)
+			{
+				L = Li(ray, scene, *tileSampler, arena);
 			}
 
-			m_camera->m_film->mergeFilmTile(std::move(filmTile));
-			reporter.update();
-			
-		}, ExecutionPolicy::APARALLEL);
+			// 쳣
+			if (L.hasNaNs())
+			{
+				L = Spectrum(0.f);
+			}
+			else if (L.luminance() < -1e-5)
+			{
+				L = Spectrum(0.f);
+			}
+			else if (std::isinf(L.luminance()))
+			{
+				L = Spectrum(0.f);
+			}
 
-		reporter.done();
+			// ǰӵfilm
+			filmTile->addSample(cameraSample.pFilm, L, rayWeight);
+
+			// ӼͼֵͷMemoryRenaڴ
+			arena.Reset();
+		};
+
+		int64_t nSamplesTaken = 0;
+		if (!adaptive)
+		{
+			// ر
+			for (Vec2i pixel : tileBounds)
+			{
+				//ʼfirstSample
+				tileSampler->startPixel(pixel);
+				tileSampler->setSampleNumber(firstSample);
+
+				for (int64_t sampleIndex = firstSample; sampleIndex < endSample; ++sampleIndex)
+				{
+					takeSample(pixel);
+					tileSampler->startNextSample();
+				}
+			}
+			nSamplesTaken = (endSample - firstSample) * tileBounds.area();
+		}
+		else
+		{
+			// ӦֱƬÿΪԹ׷minSamplesPerPixelβ
+			//Note: a pixel is judged by the largest error of its 3x3 neighborhood, the few samples of
+			//      the first round may miss a small bright feature and report no variance at all.
+			const int64_t roundSamples = tileSampler->minSamplesPerPixel;
+			std::vector<int64_t> nPixelSamples(tileBounds.area(), firstSample);
+			std::vector<char> active(tileBounds.area(), true);
+			bool anyActive = true;
+			while (anyActive)
+			{
+				int index = 0;
+				for (Vec2i pixel : tileBounds)
+				{
+					int64_t &nSamples = nPixelSamples[index];
+					if (active[index++])
+					{
+						tileSampler->startPixel(pixel);
+						tileSampler->setSampleNumber(nSamples);
+						const int64_t end = glm::min(nSamples + roundSamples, endSample);
+						for (; nSamples < end; ++nSamples)
+						{
+							takeSample(pixel);
+							tileSampler->startNextSample();
+						}
+					}
+				}
+
+				anyActive = false;
+				index = 0;
+				for (Vec2i pixel : tileBounds)
+				{
+					const bool converged = filmTile->getNeighborhoodError(pixel) <= tileSampler->maxRelativeError;
+					active[index] = nPixelSamples[index] < endSample && !converged;
+					anyActive = anyActive || active[index++];
+				}
+			}
+
+			for (int64_t nSamples : nPixelSamples)
+				nSamplesTaken += nSamples - firstSample;
+		}
 
-		m_camera->m_film->writeImageToFile();
+		m_camera->m_film->mergeFilmTile(std::move(filmTile));
 
+		return nSamplesTaken;
 	}
 
 	Spectrum SamplerRenderer::specularReflect(const Ray &ray, const SurfaceInteraction &isect,
@@ -153,6 +329,77 @@ namespace RT
 
 	//------------------------------------------Utility functions-------------------------------------
 
+	void renderFeatures(const Scene &scene, const Camera &camera)
+	{
+		Film &film = *camera.m_film;
+		const int nSamples = film.getFeatureSamples();
+		if (nSamples == 0)
+			return;
+
+		constexpr int tileSize = 16;
+		const BBox2i pixelBounds = film.getCroppedPixelBounds();
+		const Vec2i pixelExtent = pixelBounds.diagonal();
+		const Vec2i nTiles((pixelExtent.x + tileSize - 1) / tileSize, (pixelExtent.y + tileSize - 1) / tileSize);
+
+		ParallelUtils::parallelFor((size_t)0, (size_t)(nTiles.x * nTiles.y), [&](const size_t &t)
+		{
+			const int x0 = pixelBounds.m_pMin.x + (t % nTiles.x) * tileSize;
+			const int y0 = pixelBounds.m_pMin.y + (t / nTiles.x) * tileSize;
+			const BBox2i tileBounds(Vec2i(x0, y0), glm::min(Vec2i(x0 + tileSize, y0 + tileSize), pixelBounds.m_pMax));
+
+			//Note: the features take a sampler of their own, the one of the renderer may take fewer samples
+			//      per pixel. The seeds stay apart from those of the render passes.
+			MemoryArena arena;
+			std::unique_ptr<Sampler> tileSampler(new ARandomSampler(nSamples, (1 << 28) + (int)t));
+			for (Vec2i pixel : tileBounds)
+			{
+				tileSampler->startPixel(pixel);
+				for (int i = 0; i < nSamples; ++i)
+				{
+					CameraSample cameraSample = tileSampler->getCameraSample(pixel);
+					Ray ray;
+					SurfaceInteraction isect;
+					bool hit = camera.castingRay(cameraSample, ray) > 0 && scene.hit(ray, isect);
+					const Vec3f eye = ray.origin();
+
+					// Surfaces without a BSDF only bound media, the features are those behind them
+					if (hit)
+						isect.computeScatteringFunctions(ray, arena);
+					while (hit && !isect.bsdf)
+					{
+						ray = isect.spawnRay(ray.direction());
+						hit = scene.hit(ray, isect);
+						if (hit)
+							isect.computeScatteringFunctions(ray, arena);
+					}
+
+					if (hit)
+					{
+						//Note: the albedo is the reflectance estimated by a single BSDF sample, the feature
+						//      samples of the pixel average it
+						Vec3f wi;
+						Float pdf;
+						ABxDFType sampledType;
+						Spectrum f = isect.bsdf->sample_f(isect.wo, wi, tileSampler->get2D(), pdf, sampledType);
+						Spectrum albedo = pdf > 0 ? f * absDot(wi, isect.n) / pdf : Spectrum(0.f);
+
+						const Vec3f n = dot(isect.n, isect.wo) < 0 ? -isect.n : isect.n;
+						film.addFeatureSample(pixel, albedo, n, distance(eye, isect.p));
+					}
+					else
+					{
+						film.addFeatureSample(pixel, Spectrum(0.f), Vec3f(0.f), 0);
+					}
+
+					tileSampler->startNextSample();
+					arena.Reset();
+				}
+			}
+		}, ExecutionPolicy::APARALLEL);
+
+		film.setFeaturesRecorded();
+	}
+
 	Spectrum uiformSampleAllLights(const Interaction &it, const Scene &scene,
 		MemoryArena &arena, Sampler &sampler, const std::vector<int> &nLightSamples)
 	{
@@ -187,7 +434,7 @@ namespace RT
 	}
 
 	Spectrum uniformSampleOneLight(const Interaction &it, const Scene &scene,
-		MemoryArena &arena, Sampler &sampler, const Distribution1D *lightDistrib)
+		MemoryArena &arena, Sampler &sampler, const LightDistribution *lightDistrib, int lodLevel)
 	{
 		// ѡ񵥸ƹв
 		int nLights = int(scene.m_lights.size());
@@ -200,8 +447,8 @@ namespace RT
 
 		if (lightDistrib != nullptr) 
 		{
-			lightSampledIndex = lightDistrib->sampleDiscrete(sampler.get1D(), &lightPdf);
-			if (lightPdf == 0) 
+			lightSampledIndex = lightDistrib->sample(it.p, it.n, sampler.get1D(), lightPdf);
+			if (lightSampledIndex < 0 || lightPdf == 0) 
 				return Spectrum(0.f);
 		}
 		else 
@@ -214,11 +461,12 @@ namespace RT
 		Vec2f uLight = sampler.get2D();
 		Vec2f uScattering = sampler.get2D();
 
-		return estimateDirect(it, uScattering, *light, uLight, scene, sampler, arena) / lightPdf;
+		return estimateDirect(it, uScattering, *light, uLight, scene, sampler, arena, false, lodLevel) / lightPdf;
 	}
 
 	Spectrum estimateDirect(const Interaction &it, const Vec2f &uScattering, const Light &light,
-		const Vec2f &uLight, const Scene &scene, Sampler &sampler, MemoryArena &arena, bool specular)
+		const Vec2f &uLight, const Scene &scene, Sampler &, MemoryArena &, bool specular,
+		int lodLevel)
 	{
 		ABxDFType bsdfFlags = specular ? BSDF_ALL : ABxDFType(BSDF_ALL & ~BSDF_SPECULAR);
 
@@ -242,7 +490,7 @@ namespace RT
 			if (!f.isBlack())
 			{
 				// Compute effect of visibility for light source sample
-				if (!visibility.unoccluded(scene))
+				if (!visibility.unoccluded(scene, lodLevel))
 				{
 					Li = Spectrum(0.f);
 				}
@@ -277,40 +525,155 @@ namespace RT
 
 			if (!f.isBlack() && scatteringPdf > 0)
 			{
-				// Account for light contributions along sampled direction _wi_
-				Float weight = 1;
-				if (!sampledSpecular)
-				{
-					lightPdf = light.pdf_Li(it, wi);
-					if (lightPdf == 0) 
-						return Ld;
-					weight = powerHeuristic(1, scatteringPdf, 1, lightPdf);
-				}
-
 				// Find intersection and compute transmittance
 				SurfaceInteraction lightIsect;
 				Ray ray = it.spawnRay(wi);
 				Spectrum Tr(1.f);
-				bool foundSurfaceInteraction = scene.hit(ray, lightIsect);
+				bool foundSurfaceInteraction = scene.hit(ray, lightIsect, lodLevel);
 
 				// Add light contribution from material sampling
 				Spectrum Li(0.f);
+				const AreaLight *hitLight = nullptr;
 				if (foundSurfaceInteraction)
 				{
 					if (lightIsect.hitable->getAreaLight() == &light)
+					{
+						hitLight = lightIsect.hitable->getAreaLight();
 						Li = lightIsect.Le(-wi);
+					}
 				}
 				else
 				{
 					Li = light.Le(ray);
 				}
-				if (!Li.isBlack())
-					Ld += f * Li * Tr * weight / scatteringPdf;
+				if (Li.isBlack())
+					return Ld;
+
+				// Account for light contributions along sampled direction _wi_
+				//Note: the pdf of an area light is evaluated at the point already hit, an emissive
+				//      mesh would otherwise have to intersect all of its triangles again.
+				Float weight = 1;
+				if (!sampledSpecular)
+				{
+					lightPdf = hitLight != nullptr ? hitLight->pdf_Li(it, wi, lightIsect) : light.pdf_Li(it, wi);
+					if (lightPdf == 0) 
+						return Ld;
+					weight = powerHeuristic(1, scatteringPdf, 1, lightPdf);
+				}
+				Ld += f * Li * Tr * weight / scatteringPdf;
 			}
 		}
 		return Ld;
 	}
 
+	//-------------------------------------------LightReservoir-------------------------------------
+
+	bool LightReservoir::update(const Light *candidate, const Interaction &p, Float pHat, Float weight, Float u)
+	{
+		wSum += weight;
+		M += 1;
+		if (weight > 0 && u * wSum < weight)
+		{
+			light = candidate;
+			pLight = p;
+			targetPdf = pHat;
+			return true;
+		}
+		return false;
+	}
+
+	Spectrum lightContribution(const SurfaceInteraction &it, const Light &light, const Interaction &pLight)
+	{
+		Vec3f wi = pLight.p - it.p;
+		const Float dist2 = lengthSquared(wi);
+		if (dist2 == 0)
+			return Spectrum(0.f);
+		wi /= glm::sqrt(dist2);
+
+		const Spectrum Le = static_cast<const AreaLight &>(light).L(pLight, -wi);
+		if (Le.isBlack())
+			return Spectrum(0.f);
+
+		const Spectrum f = it.bsdf->f(it.wo, wi, ABxDFType(BSDF_ALL & ~BSDF_SPECULAR));
+		return f * Le * (absDot(wi, it.n) * absDot(wi, pLight.n) / dist2);
+	}
+
+	LightReservoir resampleLights(const SurfaceInteraction &it, const Scene &scene, Sampler &sampler,
+		const LightDistribution *lightDistrib, int nCandidates)
+	{
+		LightReservoir reservoir;
+		const int nLights = int(scene.m_lights.size());
+		if (nLights == 0)
+			return reservoir;
+
+		for (int i = 0; i < nCandidates; ++i)
+		{
+			// uniformSampleOneLightͬѡƹ⼰ϵһ
+			int lightIndex;
+			Float selectionPdf;
+			if (lightDistrib != nullptr)
+			{
+				lightIndex = lightDistrib->sample(it.p, it.n, sampler.get1D(), selectionPdf);
+			}
+			else
+			{
+				lightIndex = glm::min((int)(sampler.get1D() * nLights), nLights - 1);
+				selectionPdf = Float(1) / nLights;
+			}
+			const Vec2f uLight = sampler.get2D();
+			const Float uSelect = sampler.get1D();
+
+			Vec3f wi;
+			Float lightPdf = 0;
+			VisibilityTester visibility;
+			Spectrum Li(0.f);
+			if (lightIndex >= 0 && selectionPdf > 0)
+				Li = scene.m_lights[lightIndex]->sample_Li(it, uLight, wi, lightPdf, visibility);
+			if (lightPdf == 0 || Li.isBlack())
+			{
+				reservoir.M += 1;
+				continue;
+			}
+
+			// ѡȨֵΪĿpdfµĲpdf֮
+			const Light &light = *scene.m_lights[lightIndex];
+			const Interaction &pLight = visibility.P1();
+			const Float pdfArea = selectionPdf * lightPdf * absDot(wi, pLight.n) / distanceSquared(it.p, pLight.p);
+			const Float pHat = lightContribution(it, light, pLight).luminance();
+			reservoir.update(&light, pLight, pHat, pdfArea > 0 ? pHat / pdfArea : 0, uSelect);
+		}
+		return reservoir;
+	}
+
+	void combineReservoirs(LightReservoir &reservoir, const LightReservoir &other, const SurfaceInteraction &it,
+		Float maxM, Float u)
+	{
+		if (other.light == nullptr)
+			return;
+
+		//Note: the survivor of |other| is re-evaluated here but its visibility is not, as in the biased
+		//      variant of Bitterli et al., "Spatiotemporal reservoir resampling for real-time ray tracing
+		//      with dynamic direct lighting"
+		const Float M = glm::min(other.M, maxM);
+		const Float pHat = lightContribution(it, *other.light, other.pLight).luminance();
+		reservoir.update(other.light, other.pLight, pHat, pHat * other.W() * M, u);
+		reservoir.M += M - 1;
+	}
+
+	Spectrum shadeLightReservoir(const SurfaceInteraction &it, const Scene &scene,
+		const LightReservoir &reservoir, int lodLevel)
+	{
+		const Float W = reservoir.W();
+		if (reservoir.light == nullptr || W == 0)
+			return Spectrum(0.f);
+
+		Spectrum contrib = lightContribution(it, *reservoir.light, reservoir.pLight);
+		if (contrib.isBlack() || !VisibilityTester(it, reservoir.pLight).unoccluded(scene, lodLevel))
+			return Spectrum(0.f);
+
+		return contrib * W;
+	}
+
 }
 
 namespace RT
@@ -319,7 +682,7 @@ namespace RT
 
 		PathRenderer::PathRenderer(const PropertyTreeNode& node)
 		: SamplerRenderer(nullptr, nullptr), m_maxDepth(node.getPropertyList().getInteger("Depth", 2))
-		, m_rrThreshold(1.f), m_lightSampleStrategy("spatial")
+		, m_rrThreshold(1.f), m_lightSampleStrategy(node.getPropertyList().getString("LightSampleStrategy", "spatial"))
 	{
 		//Sampler
 		const auto& samplerNode = node.getPropertyChild("Sampler");
@@ -331,6 +694,39 @@ namespace RT
 		m_camera = Camera::ptr(static_cast<Camera*>(ObjectFactory::createInstance(
 			cameraNode.getTypeName(), cameraNode)));
 
+		//Progressive rendering
+		m_timeLimit = node.getPropertyList().getFloat("TimeLimit", 0.f);
+		m_progressive = node.getPropertyList().getBoolean("Progressive", m_timeLimit > 0);
+
+		//Checkpoint
+		m_checkpoint = node.getPropertyList().getString("Checkpoint", "");
+		m_checkpointInterval = node.getPropertyList().getFloat("CheckpointInterval", 300.f);
+
+		//Path guiding
+		m_guiding = node.getPropertyList().getBoolean("Guiding", false);
+		m_guidingIterations = node.getPropertyList().getInteger("GuidingIterations", 4);
+		m_guidingFraction = clamp(node.getPropertyList().getFloat("GuidingFraction", 0.5f), 0, 1);
+
+		//Russian roulette and splitting
+		m_rouletteStrategy = node.getPropertyList().getString("RussianRoulette", "classic");
+		m_splittingIterations = node.getPropertyList().getInteger("SplittingIterations", 4);
+
+		//Radiance cache
+		m_radianceCaching = node.getPropertyList().getBoolean("RadianceCache", false);
+		m_cacheIterations = node.getPropertyList().getInteger("CacheIterations", 4);
+		m_cacheBounce = glm::max(1, node.getPropertyList().getInteger("CacheBounce", 2));
+		m_cacheResolution = node.getPropertyList().getInteger("CacheResolution", 32);
+		m_cacheError = node.getPropertyList().getFloat("CacheError", 0.2f);
+
+		//Path space filtering
+		m_pathSpaceFiltering = node.getPropertyList().getBoolean("PathSpaceFiltering", false);
+		m_filterRadius = node.getPropertyList().getFloat("FilterRadius", 0.f);
+
+		//Resampled direct lighting
+		m_directCandidates = node.getPropertyList().getInteger("DirectCandidates", 0);
+		m_temporalReuse = node.getPropertyList().getBoolean("TemporalReuse", false);
+		m_spatialReuse = node.getPropertyList().getBoolean("SpatialReuse", false);
+
 		activate();
 	}
 
@@ -342,105 +738,1007 @@ namespace RT
 	void PathRenderer::preprocess(const Scene& scene)
 	{
 		m_lightDistribution = createLightSampleDistribution(m_lightSampleStrategy, scene);
+
+		m_lightIndices.clear();
+		for (size_t i = 0; i < scene.m_lights.size(); ++i)
+			m_lightIndices[scene.m_lights[i].get()] = (int)i;
+
+		if (m_rouletteStrategy != "classic" && m_rouletteStrategy != "ears")
+		{
+			LOG(WARNING) << "Russian roulette \"" << m_rouletteStrategy << "\" unknown, using \"classic\"";
+			m_rouletteStrategy = "classic";
+		}
+
+		//Note: reservoirs keep points on area lights, the other lights cannot be re-evaluated elsewhere
+		if (m_directCandidates > 0)
+		{
+			for (const auto& light : scene.m_lights)
+			{
+				if (!(light->m_flags & (int)LightFlags::ALightArea))
+				{
+					LOG(WARNING) << "Resampled direct lighting only supports area lights, falling back to light sampling";
+					m_directCandidates = 0;
+					break;
+				}
+			}
+		}
 	}
 
+	void PathRenderer::render(const Scene& scene)
+	{
+		if (m_guiding)
+		{
+			trainGuiding(scene);
+		}
 
-	Spectrum PathRenderer::Li(const Ray& r, const Scene& scene, Sampler& sampler,
-		MemoryArena& arena, int depth) const
+		//Note: EARS learns after the cache so that its costs account for the paths the cache ends
+		if (m_radianceCaching)
+		{
+			trainRadianceCache(scene);
+		}
+
+		if (m_rouletteStrategy == "ears")
+		{
+			trainSplitting(scene);
+		}
+
+		// ÿرˮأ
+		m_reservoirs.clear();
+		if (m_directCandidates > 0 && (m_temporalReuse || m_spatialReuse))
+		{
+			m_reservoirBounds = m_camera->m_film->getSampleBounds();
+			m_reservoirs.resize(m_reservoirBounds.area(), { LightReservoir(), Vec3f(0, 0, 0), 0 });
+		}
+
+		if (m_pathSpaceFiltering)
+			renderFiltered(scene);
+		else
+			SamplerRenderer::render(scene);
+		m_reservoirs.clear();
+	}
+
+	Spectrum PathRenderer::resampledDirectLighting(const SurfaceInteraction& isect, const Scene& scene,
+		Sampler& sampler, bool cameraVertex, Float depth, int lodLevel) const
 	{
-		//ʼ
-		Spectrum L(0.f), beta(1.f);
-		Ray ray(r);
+		LightReservoir reservoir = resampleLights(isect, scene, sampler, m_lightDistribution.get(), m_directCandidates);
+
+		if (cameraVertex && !m_reservoirs.empty() && !m_guidingTraining)
+		{
+			const Vec2i pixel = sampler.currentPixel();
+			const int width = m_reservoirBounds.m_pMax.x - m_reservoirBounds.m_pMin.x;
+			auto reservoirIndex = [&](const Vec2i& p)
+			{
+				return (p.x - m_reservoirBounds.m_pMin.x) + (p.y - m_reservoirBounds.m_pMin.y) * width;
+			};
 
-		//ǷΪ淴
-		bool specularBounce = false;
-		//
-		int bounces;
+			//Note: reservoirs of a different surface would steer the samples to lights it does not see
+			auto similar = [&](const PixelReservoir& other)
+			{
+				return other.reservoir.light != nullptr && dot(other.n, isect.n) > 0.9f &&
+					glm::abs(other.depth - depth) < 0.1f * depth;
+			};
+
+			//Note: the history of a reservoir is capped relative to fresh candidates to keep adapting
+			const Float maxM = 20.f * m_directCandidates;
+			if (m_temporalReuse)
+			{
+				const PixelReservoir& previous = m_reservoirs[reservoirIndex(pixel)];
+				if (similar(previous))
+					combineReservoirs(reservoir, previous.reservoir, isect, maxM, sampler.get1D());
+			}
+
+			if (m_spatialReuse)
+			{
+				// ֻͬһƬڵأƬһ̶߳Ⱦ
+				const Vec2i tileMin = m_reservoirBounds.m_pMin + ((pixel - m_reservoirBounds.m_pMin) / tileSize) * tileSize;
+				const Vec2i tileMax(glm::min(tileMin.x + tileSize, m_reservoirBounds.m_pMax.x),
+					glm::min(tileMin.y + tileSize, m_reservoirBounds.m_pMax.y));
+				const int nNeighbors = 3, radius = 5;
+				for (int k = 0; k < nNeighbors; ++k)
+				{
+					const Vec2f u = sampler.get2D();
+					const Float uSelect = sampler.get1D();
+					const Vec2i neighbor = pixel + Vec2i((int)glm::round((2 * u.x - 1) * radius),
+						(int)glm::round((2 * u.y - 1) * radius));
+					if (neighbor == pixel || neighbor.x < tileMin.x || neighbor.y < tileMin.y ||
+						neighbor.x >= tileMax.x || neighbor.y >= tileMax.y)
+						continue;
+
+					const PixelReservoir& other = m_reservoirs[reservoirIndex(neighbor)];
+					if (similar(other))
+						combineReservoirs(reservoir, other.reservoir, isect, maxM, uSelect);
+				}
+			}
+
+			m_reservoirs[reservoirIndex(pixel)] = { reservoir, isect.n, depth };
+		}
+
+		return shadeLightReservoir(isect, scene, reservoir, lodLevel);
+	}
 
-		//
-		Float etaScale = 1;
+	Spectrum PathRenderer::sampleOneLight(const SurfaceInteraction& isect, const Scene& scene,
+		Sampler& sampler, int lodLevel) const
+	{
+		const int nLights = int(scene.m_lights.size());
+		if (nLights == 0)
+			return Spectrum(0.f);
 
-		for (bounces = 0;; ++bounces)
+		int lightIndex;
+		Float selectionPdf;
+		if (m_lightDistribution != nullptr)
 		{
-			// һ·㲢ۻ
+			lightIndex = m_lightDistribution->sample(isect.p, isect.n, sampler.get1D(), selectionPdf);
+			if (lightIndex < 0 || selectionPdf == 0)
+				return Spectrum(0.f);
+		}
+		else
+		{
+			lightIndex = glm::min((int)(sampler.get1D() * nLights), nLights - 1);
+			selectionPdf = Float(1) / nLights;
+		}
+
+		const Light& light = *scene.m_lights[lightIndex];
+		Vec3f wi;
+		Float lightPdf = 0;
+		VisibilityTester visibility;
+		Spectrum Li = light.sample_Li(isect, sampler.get2D(), wi, lightPdf, visibility);
+		if (lightPdf == 0 || Li.isBlack())
+			return Spectrum(0.f);
+
+		Spectrum f = isect.bsdf->f(isect.wo, wi) * absDot(wi, isect.n);
+		if (f.isBlack() || !visibility.unoccluded(scene, lodLevel))
+			return Spectrum(0.f);
 
-			// ray볡ཻཻ洢isect
-			SurfaceInteraction isect;
-			bool hit = scene.hit(ray, isect);
+		lightPdf *= selectionPdf;
+		Float weight = isDeltaLight(light.m_flags) ? 1 : powerHeuristic(1, lightPdf, 1, continuationPdf(isect, isect.wo, wi));
+		return f * Li * weight / lightPdf;
+	}
 
-			if (bounces == 0 || specularBounce)
+	Float PathRenderer::continuationPdf(const SurfaceInteraction& isect, const Vec3f& wo, const Vec3f& wi) const
+	{
+		Float pdf = isect.bsdf->pdf(wo, wi);
+		if (m_guidingField != nullptr && isect.bsdf->numComponents(ABxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0 &&
+			m_guidingField->canSample(isect.p))
+		{
+			pdf = m_guidingFraction * m_guidingField->pdf(isect.p, wi) + (1 - m_guidingFraction) * pdf;
+		}
+		return pdf;
+	}
+
+	Float PathRenderer::lightSelectionPdf(const Scene& scene, const Light* light, const Interaction& ref) const
+	{
+		auto it = m_lightIndices.find(light);
+		if (it == m_lightIndices.end())
+			return 0;
+
+		return m_lightDistribution != nullptr ? m_lightDistribution->pmf(ref.p, ref.n, it->second) :
+			Float(1) / scene.m_lights.size();
+	}
+
+	void PathRenderer::trainIterations(const Scene& scene, const std::string& name, int iterations, int seedBase,
+		const std::function<void()>& update)
+	{
+		BBox2i sampleBounds = m_camera->m_film->getSampleBounds();
+		Vec2i sampleExtent = sampleBounds.diagonal();
+		AReporter reporter(sampleExtent.y * iterations, name);
+
+		for (int iteration = 0; iteration < iterations; ++iteration)
+		{
+			const int64_t spp = glm::min((int64_t)1 << iteration, m_sampler->samplesPerPixel);
+			ParallelUtils::parallelFor((size_t)0, (size_t)sampleExtent.y, [&](const size_t &row)
 			{
-				// ·򻷾ӷ
-				if (hit)
+				MemoryArena arena;
+
+				int seed = seedBase + iteration * sampleExtent.y + (int)row;
+				std::unique_ptr<Sampler> rowSampler = m_sampler->clone(seed);
+
+				for (int x = sampleBounds.m_pMin.x; x < sampleBounds.m_pMax.x; ++x)
 				{
-					L += beta * isect.Le(-ray.direction());
+					Vec2i pixel(x, sampleBounds.m_pMin.y + (int)row);
+					rowSampler->startPixel(pixel);
+					for (int64_t sampleIndex = 0; sampleIndex < spp; ++sampleIndex)
+					{
+						CameraSample cameraSample = rowSampler->getCameraSample(pixel);
+						Ray ray;
+						if (m_camera->castingRay(cameraSample, ray) > 0)
+						{
+							Li(ray, scene, *rowSampler, arena, 0);
+						}
+						arena.Reset();
+						rowSampler->startNextSample();
+					}
 				}
-				else
+				reporter.update();
+
+			}, ExecutionPolicy::APARALLEL);
+
+			update();
+		}
+
+		reporter.done();
+	}
+
+	void PathRenderer::trainGuiding(const Scene& scene)
+	{
+		m_guidingField.reset(new GuidingField(scene.worldBound()));
+
+		// ѵ·ֻ¼ȣдfilm
+		//Note: training seeds lie far above the seeds of the tiles of the render
+		m_guidingTraining = true;
+		trainIterations(scene, "Training path guiding", m_guidingIterations, 1 << 30, [&]()
+		{
+			// ñּ¼ķȹһֵĲֲ
+			m_guidingField->update();
+		});
+		m_guidingTraining = false;
+	}
+
+	void PathRenderer::trainRadianceCache(const Scene& scene)
+	{
+		m_radianceCache.reset(new RadianceCache(scene.worldBound(), m_cacheResolution));
+
+		// ѵ·ֻ¼ȣдfilm
+		//Note: training seeds lie far above the seeds of the tiles of the render and below those of the features
+		m_cacheTraining = true;
+		trainIterations(scene, "Training radiance cache", m_cacheIterations, 1 << 27, [&]()
+		{
+			m_radianceCache->update(m_cacheError);
+		});
+		m_cacheTraining = false;
+	}
+
+	void PathRenderer::trainSplitting(const Scene& scene)
+	{
+		m_splittingCache.reset(new SplittingCache(scene.worldBound()));
+
+		m_pixelEstimateBounds = m_camera->m_film->getSampleBounds();
+		m_pixelEstimates.assign(m_pixelEstimateBounds.area(), PixelEstimate());
+		m_costToVariance = 0;
+
+		Vec2i sampleExtent = m_pixelEstimateBounds.diagonal();
+
+		// ѵ·ֻ¼ͳдfilmһʹþĶ˹̶ģ֮ÿһʹǰѧĹ
+		//Note: training seeds lie far above the seeds of the tiles of the render and below those of guiding
+		int iteration = 0;
+		m_splittingTraining = true;
+		trainIterations(scene, "Training Russian roulette", m_splittingIterations, 1 << 29, [&]()
+		{
+			++iteration;
+			m_splittingCache->update();
+
+			// ִεͼ
+			Float sumEstimates = 0;
+			int nPixels = 0;
+			for (const auto& pixel : m_pixelEstimates)
+			{
+				if (pixel.nSamples == 0)
+					continue;
+				sumEstimates += pixel.sum / pixel.nSamples;
+				++nPixels;
+			}
+			m_meanPixelEstimate = nPixels > 0 ? sumEstimates / nPixels : 0;
+
+			//Note: EARS relies on a denoised image, a box filter over the neighbours keeps the rare bright samples
+			//      of the training from dimming a whole pixel into heavy roulette
+			const int width = sampleExtent.x, height = sampleExtent.y, radius = 2;
+			for (int y = 0; y < height; ++y)
+			{
+				for (int x = 0; x < width; ++x)
 				{
-					for (const auto& light : scene.m_infiniteLights)
-						L += beta * light->Le(ray);
+					Float sum = 0;
+					int n = 0;
+					for (int v = glm::max(y - radius, 0); v <= glm::min(y + radius, height - 1); ++v)
+					{
+						for (int u = glm::max(x - radius, 0); u <= glm::min(x + radius, width - 1); ++u)
+						{
+							const PixelEstimate& neighbor = m_pixelEstimates[v * width + u];
+							sum += neighbor.sum;
+							n += neighbor.nSamples;
+						}
+					}
+					m_pixelEstimates[y * width + x].filtered = n > 0 ? sum / n : 0;
 				}
 			}
 
-			// ݻﵽmaxDepthֹ·
-			if (!hit || bounces >= m_maxDepth)
-				break;
+			// ɱֵƵǰ̶ͼһƽƽԷ
+			//Note: a pixel needs two samples for its variance, the first iteration leaves the classic roulette on
+			Float sumCost = 0, sumRelVariance = 0;
+			int nVariancePixels = 0;
+			for (auto& pixel : m_pixelEstimates)
+			{
+				const int n = pixel.iterationSamples;
+				const Float I = glm::max(pixel.filtered, 0.1f * m_meanPixelEstimate);
+				if (n >= 2 && I > 0)
+				{
+					const Float mean = pixel.iterationSum / n;
+					const Float variance = glm::max((Float)0, (pixel.iterationSumSquares - pixel.iterationSum * mean) / (n - 1));
+					sumRelVariance += variance / (I * I);
+					sumCost += pixel.iterationCost / n;
+					++nVariancePixels;
+				}
+				pixel.iterationSum = pixel.iterationSumSquares = pixel.iterationCost = 0;
+				pixel.iterationSamples = 0;
+			}
+			if (nVariancePixels == 0 || sumRelVariance <= 0)
+				return;
+
+			//Note: the ratio is kept from the classic roulette, the first iteration that yields it. Learning it
+			//      again under the EARS roulette feeds the fireflies of its own splitting back into the ratio.
+			const Float meanCost = sumCost / nVariancePixels, meanRelVariance = sumRelVariance / nVariancePixels;
+			if (m_costToVariance <= 0)
+				m_costToVariance = meanCost / meanRelVariance;
+			LOG(INFO) << "Russian roulette iteration " << iteration << ": average cost " << meanCost
+				<< ", relative variance " << meanRelVariance << " of a pixel sample";
+		});
+		m_splittingTraining = false;
+	}
 
-			// ɢ亯
-			isect.computeScatteringFunctions(ray, arena, true);
+	bool PathRenderer::splittingFactor(const Spectrum& beta, const Vec3f& p, const Vec2i& pixel, Float& q) const
+	{
+		Float secondMoment, variance, cost;
+		if (m_costToVariance <= 0 || !m_splittingCache->lookup(p, secondMoment, variance, cost))
+			return false;
+
+		const int width = m_pixelEstimateBounds.m_pMax.x - m_pixelEstimateBounds.m_pMin.x;
+		const PixelEstimate& estimate = m_pixelEstimates[(pixel.x - m_pixelEstimateBounds.m_pMin.x) +
+			(pixel.y - m_pixelEstimateBounds.m_pMin.y) * width];
+
+		//Note: the dark pixels are estimated relative to a fraction of the mean, as they are for the variance
+		const Float I = glm::max(estimate.filtered, 0.1f * m_meanPixelEstimate);
+		if (!(I > 0))
+			return false;
+
+		// ʹЧʣ۳˷ĵķӡ̶ӵķ·ƵĶ׾أ
+		// Ѽٵֻ䷽
+		const Float scale = beta.luminance() / I;
+		q = scale * glm::sqrt(m_costToVariance * secondMoment / cost);
+		if (q > 1)
+			q = glm::max((Float)1, scale * glm::sqrt(m_costToVariance * variance / cost));
+		q = clamp(q, 0.05f, 20.f);
+		return true;
+	}
 
-			// bsdf==nullptrʾǰԹûӰ죬ıڱʾ֮Ĺɣ߽籾ǹѧǻġ
-			if (!isect.bsdf){
-				ray = isect.spawnRay(ray.direction());
-				bounces--;
-				continue;
-			}
 
-			const Distribution1D* distrib = m_lightDistribution->lookup(isect.p);
+	void PathRenderer::renderFiltered(const Scene& scene)
+	{
+		renderFeatures(scene, *m_camera);
+
+		LOG_IF(WARNING, m_progressive || !m_checkpoint.empty() || m_sampler->isAdaptive())
+			<< "Path space filtering renders in a single pass without checkpoints or adaptive sampling";
+
+		Film& film = *m_camera->m_film;
+		BBox2i sampleBounds = film.getSampleBounds();
+		Vec2i sampleExtent = sampleBounds.diagonal();
+		Vec2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+		const int nTotalTiles = nTiles.x * nTiles.y;
+
+		auto getTileBounds = [&](int t) -> BBox2i
+		{
+			Vec2i tile(t % nTiles.x, t / nTiles.x);
+			int x0 = sampleBounds.m_pMin.x + tile.x * tileSize;
+			int x1 = glm::min(x0 + tileSize, sampleBounds.m_pMax.x);
+			int y0 = sampleBounds.m_pMin.y + tile.y * tileSize;
+			int y1 = glm::min(y0 + tileSize, sampleBounds.m_pMax.y);
+			return BBox2i(Vec2i(x0, y0), Vec2i(x1, y1));
+		};
+		auto sampleOffset = [&](const Vec2i& pixel)
+		{
+			return (pixel.x - sampleBounds.m_pMin.x) + (pixel.y - sampleBounds.m_pMin.y) * sampleExtent.x;
+		};
+
+		// ռϣĵԪ߳Ϊ˲뾶뾶ڵĶ㶼2x2x2Ԫ
+		const BBox3f sceneBounds = scene.worldBound();
+		Float radius = m_filterRadius;
+		auto cellKey = [&](const Vec3i& cell) -> uint64_t
+		{
+			return ((uint64_t)cell.z << 42) | ((uint64_t)cell.y << 21) | (uint64_t)cell.x;
+		};
+		auto cellOffset = [&](const Vec3f& p) -> Vec3f
+		{
+			return (p - sceneBounds.m_pMin) / (2 * radius);
+		};
+		auto cellOf = [&](const Vec3f& p) -> Vec3i
+		{
+			const Vec3f o = cellOffset(p);
+			return Vec3i(clamp((int)o.x, 0, (1 << 21) - 1), clamp((int)o.y, 0, (1 << 21) - 1),
+				clamp((int)o.z, 0, (1 << 21) - 1));
+		};
+
+		struct FilterSample
+		{
+			Vec2f pFilm;
+			Float rayWeight = 0;
+			Spectrum L = Spectrum(0.f);
+			FilterVertex vertex;
+		};
+		std::vector<FilterSample> samples(sampleExtent.x * sampleExtent.y);
+		std::vector<std::pair<uint64_t, int>> cells;
+
+		//Note: the normals of the vertices that share their lighting lie within about 25 degrees
+		const Float minCosNormal = 0.9f;
+
+		const int64_t spp = m_sampler->samplesPerPixel;
+		AReporter reporter(spp, "Rendering");
+		for (int64_t sampleIndex = 0; sampleIndex < spp; ++sampleIndex)
+		{
+			// Ϊÿ׷ٱֵһ
+			ParallelUtils::parallelFor((size_t)0, (size_t)nTotalTiles, [&](const size_t &t)
+			{
+				MemoryArena arena;
+
+				//Note: every pass seeds the samplers of its tiles differently from the previous passes
+				std::unique_ptr<Sampler> tileSampler = m_sampler->clone((int)sampleIndex * nTotalTiles + (int)t);
+				for (Vec2i pixel : getTileBounds((int)t))
+				{
+					tileSampler->startPixel(pixel);
+					tileSampler->setSampleNumber(sampleIndex);
+
+					FilterSample& sample = samples[sampleOffset(pixel)];
+					sample = FilterSample();
+					CameraSample cameraSample = tileSampler->getCameraSample(pixel);
+					sample.pFilm = cameraSample.pFilm;
+
+					Ray ray;
+					sample.rayWeight = m_camera->castingRay(cameraSample, ray);
+					if (sample.rayWeight > 0)
+						sample.L = tracePath(ray, scene, *tileSampler, arena, &sample.vertex);
+
+					// 쳣
+					const Float luminance = sample.L.luminance();
+					if (sample.L.hasNaNs() || luminance < -1e-5 || std::isinf(luminance))
+					{
+						sample.L = Spectrum(0.f);
+						sample.vertex.weight = Spectrum(0.f);
+					}
+					arena.Reset();
+				}
+			}, ExecutionPolicy::APARALLEL);
+
+			//Note: without a radius, the first pass measures the median distance between the vertices of
+			//      horizontally adjacent pixels on the same surface, the radius spans three such pixels
+			if (radius <= 0)
+			{
+				std::vector<Float> distances;
+				for (int i = 0; i + 1 < (int)samples.size(); ++i)
+				{
+					const FilterVertex& vertex = samples[i].vertex;
+					const FilterVertex& right = samples[i + 1].vertex;
+					if ((i + 1) % sampleExtent.x != 0 && !vertex.weight.isBlack() && !right.weight.isBlack() &&
+						dot(vertex.n, right.n) > minCosNormal)
+						distances.push_back(distance(vertex.p, right.p));
+				}
+				if (!distances.empty())
+				{
+					std::nth_element(distances.begin(), distances.begin() + distances.size() / 2, distances.end());
+					radius = 3 * distances[distances.size() / 2];
+				}
+				if (!(radius > 0))
+					radius = glm::max(0.005f * sceneBounds.diagonal()[sceneBounds.maximumExtent()], (Float)1e-4f);
+				LOG(INFO) << "Path space filtering radius " << radius;
+			}
 
-			// ӵƹвԲ·סȫ淴BSDF˲裩
-			if (isect.bsdf->numComponents(ABxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+			// Ԫ򶥵㹹ֵĿռϣ
+			cells.clear();
+			for (int i = 0; i < (int)samples.size(); ++i)
 			{
-				Spectrum Ld = beta * uniformSampleOneLight(isect, scene, arena, sampler, distrib);
-				CHECK_GE(Ld.luminance(), 0.f);
-				L += Ld;
+				if (!samples[i].vertex.weight.isBlack())
+					cells.push_back({ cellKey(cellOf(samples[i].vertex.p)), i });
 			}
+			std::sort(cells.begin(), cells.end());
+
+			// ÿļӹ滻Ϊ뾶ڷĶƽӵfilm
+			ParallelUtils::parallelFor((size_t)0, (size_t)nTotalTiles, [&](const size_t &t)
+			{
+				const BBox2i tileBounds = getTileBounds((int)t);
+				std::unique_ptr<FilmTile> filmTile = film.getFilmTile(tileBounds);
+				for (Vec2i pixel : tileBounds)
+				{
+					const FilterSample& sample = samples[sampleOffset(pixel)];
+					Spectrum L = sample.L;
+					const FilterVertex& vertex = sample.vertex;
+					if (!vertex.weight.isBlack())
+					{
+						Spectrum sum(0.f);
+						int n = 0;
+						const Vec3f o = cellOffset(vertex.p) - Vec3f(0.5f);
+						const Vec3i first((int)glm::floor(o.x), (int)glm::floor(o.y), (int)glm::floor(o.z));
+						for (int z = glm::max(first.z, 0); z <= first.z + 1; ++z)
+						{
+							for (int y = glm::max(first.y, 0); y <= first.y + 1; ++y)
+							{
+								for (int x = glm::max(first.x, 0); x <= first.x + 1; ++x)
+								{
+									const uint64_t key = cellKey(Vec3i(x, y, z));
+									auto it = std::lower_bound(cells.begin(), cells.end(), std::make_pair(key, 0));
+									for (; it != cells.end() && it->first == key; ++it)
+									{
+										const FilterVertex& other = samples[it->second].vertex;
+										if (distanceSquared(other.p, vertex.p) < radius * radius &&
+											dot(other.n, vertex.n) > minCosNormal)
+										{
+											sum += other.indirect;
+											++n;
+										}
+									}
+								}
+							}
+						}
+
+						//Note: the vertex is its own neighbour, n is positive
+						L += vertex.weight * (sum / (Float)n - vertex.indirect);
+					}
+					filmTile->addSample(sample.pFilm, L, sample.rayWeight);
+				}
+				film.mergeFilmTile(std::move(filmTile));
+			}, ExecutionPolicy::APARALLEL);
+
+			reporter.update();
+		}
+		reporter.done();
+
+		film.writeImageToFile((Float)1 / spp);
+	}
+
+	Spectrum PathRenderer::Li(const Ray& r, const Scene& scene, Sampler& sampler,
+		MemoryArena& arena, int depth) const
+	{
+		return tracePath(r, scene, sampler, arena, nullptr);
+	}
+
+	Spectrum PathRenderer::tracePath(const Ray& r, const Scene& scene, Sampler& sampler,
+		MemoryArena& arena, FilterVertex* filterVertex) const
+	{
+		//ʼ
+		Spectrum L(0.f);
+
+		//State of a path up to its next vertex
+		struct PathState
+		{
+			Ray ray;
+			Spectrum beta = Spectrum(1.f);
+
+			//ǷΪ淴
+			bool specularBounce = false;
+			//
+			int bounces = 0;
+
+			//
+			Float etaScale = 1;
+
+			//·㼣ѡ񼸺LOD
+			//Note: the footprint is a ray cone, its width at the current vertex grows with the spread
+			//      angle which is only widened by non-specular bounces.
+			Float footprint = 0, spread = 0;
+			int lodLevel = 0;
+
+			//Note: the BSDF sample that extends the path is the BSDF half of the direct lighting as well, the
+			//      emission it finds is weighted against the light sampling done at the previous vertex
+			Interaction prevVertex;
+			Float bsdfPdf = 0;
+
+			//Splitting record of the vertex the path continues from
+			int splittingRecord = -1;
+
+			//Past the filter vertex, the contributions of the path are indirect lighting there
+			bool filtered = false;
+		};
+
+		PathState s;
+		s.ray = r;
+
+		//Note: a path split by EARS continues in several directions, the pending branches wait here
+		std::vector<PathState> branches;
 
-			// Sample BSDF to get new path direction
-			Vec3f wo = -ray.direction(), wi;
+		//ѵ·ʱ¼·
+		struct GuideVertex
+		{
+			Vec3f p, wi;
+			Float pdf;
+			Spectrum throughput;	//beta after the scattering at the vertex
+			Spectrum radiance;		//estimate of the radiance arriving along wi
+		};
+		std::vector<GuideVertex> guideVertices;
+
+		//ѵ˹̶ʱ¼·ѳĸ֧Լ¼丸·
+		struct SplittingVertex
+		{
+			Vec3f p;				//vertex the path continues from
+			int parent;
+			Spectrum throughput;	//beta of the continuation before its BSDF sample
+			Spectrum radiance;		//estimate of the radiance the continuation carries back to the vertex
+			Float cost;				//rays traced by the continuation
+		};
+		std::vector<SplittingVertex> splittingVertices;
+		Float cost = 0;
+
+		//ѵȻʱ¼·
+		struct CacheVertex
+		{
+			Vec3f p, n;				//n faces the side the path arrived from
+			Spectrum throughput;	//beta of the continuation before its BSDF sample
+			Spectrum reflectance;
+			Spectrum radiance;		//estimate of the radiance the continuation carries back to the vertex
+		};
+		std::vector<CacheVertex> cacheVertices;
+
+		auto recordContribution = [&](const Spectrum &contrib, int splittingRecord)
+		{
+			for (auto &vertex : guideVertices)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					if (vertex.throughput[c] > 0)
+						vertex.radiance[c] += contrib[c] / vertex.throughput[c];
+				}
+			}
+			for (int v = splittingRecord; v >= 0; v = splittingVertices[v].parent)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					if (splittingVertices[v].throughput[c] > 0)
+						splittingVertices[v].radiance[c] += contrib[c] / splittingVertices[v].throughput[c];
+				}
+			}
+			for (auto &vertex : cacheVertices)
+			{
+				for (int c = 0; c < 3; ++c)
+				{
+					if (vertex.throughput[c] > 0)
+						vertex.radiance[c] += contrib[c] / vertex.throughput[c];
+				}
+			}
+		};
+		auto recordCost = [&](Float rays, int splittingRecord)
+		{
+			cost += rays;
+			for (int v = splittingRecord; v >= 0; v = splittingVertices[v].parent)
+				splittingVertices[v].cost += rays;
+		};
+		const bool training = m_guidingTraining || m_splittingTraining || m_cacheTraining;
+
+		// Reflectance of a BSDF of diffuse reflection only and its normal on the side of wo, false for other BSDFs
+		//Note: such a BSDF reflects a fixed fraction of the irradiance, its reflectance is f towards the
+		//      normal times Pi, which the radiance cache and path space filtering divide out
+		auto diffuseReflectance = [&](const SurfaceInteraction &isect, Vec3f &n, Spectrum &reflectance) -> bool
+		{
+			if (isect.bsdf->numComponents() == 0 ||
+				isect.bsdf->numComponents() != isect.bsdf->numComponents(ABxDFType(BSDF_DIFFUSE | BSDF_REFLECTION)))
+				return false;
+
+			n = dot(isect.wo, isect.n) < 0 ? -isect.n : isect.n;
+			reflectance = isect.bsdf->f(isect.wo, n) * Pi;
+			return true;
+		};
+
+		//Indirect lighting of the filter vertex
+		bool filterVertexFound = false;
+		int filterBounce = -1;
+		Spectrum filterIndirect(0.f);
+
+		// Sample the BSDF to get the new direction of the path |s|, false if it ends
+		auto extendPath = [&](PathState &s, const SurfaceInteraction &isect) -> bool
+		{
+			Vec3f wo = -s.ray.direction(), wi;
 			Float pdf;
 			ABxDFType flags;
-			Spectrum f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdf, flags, BSDF_ALL);
+			Spectrum f;
+			if (m_guidingField != nullptr && isect.bsdf->numComponents(ABxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0 &&
+				m_guidingField->canSample(isect.p))
+			{
+				// ·һMISѧϰȷֲBSDF
+				Float guidePdf = 0, bsdfPdf = 0;
+				if (sampler.get1D() < m_guidingFraction)
+				{
+					wi = m_guidingField->sample(isect.p, sampler.get2D(), guidePdf);
+					f = isect.bsdf->f(wo, wi);
+					bsdfPdf = isect.bsdf->pdf(wo, wi);
+					//Note: guided directions are never specular
+					flags = ABxDFType(0);
+				}
+				else
+				{
+					f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), bsdfPdf, flags, BSDF_ALL);
+					if (!(flags & BSDF_SPECULAR))
+						guidePdf = m_guidingField->pdf(isect.p, wi);
+				}
+				pdf = m_guidingFraction * guidePdf + (1 - m_guidingFraction) * bsdfPdf;
+			}
+			else
+			{
+				f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdf, flags, BSDF_ALL);
+			}
 
 			if (f.isBlack() || pdf == 0.f)
-				break;
-			beta *= f * absDot(wi, isect.n) / pdf;
+				return false;
+			s.beta *= f * absDot(wi, isect.n) / pdf;
+
+			CHECK_GE(s.beta.luminance(), 0.f);
+			DCHECK(!glm::isinf(s.beta.luminance()));
 
-			CHECK_GE(beta.luminance(), 0.f);
-			DCHECK(!glm::isinf(beta.luminance()));
+			s.specularBounce = (flags & BSDF_SPECULAR) != 0;
+			if (m_guidingTraining && !s.specularBounce)
+			{
+				guideVertices.push_back({ isect.p, wi, pdf, s.beta, Spectrum(0.f) });
+			}
 
-			specularBounce = (flags & BSDF_SPECULAR) != 0;
 			if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION))
 			{
 				Float eta = isect.bsdf->m_eta;
 				// Update the term that tracks radiance scaling for refraction
 				// depending on whether the ray is entering or leaving the
 				// medium.
-				etaScale *= (dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
+				s.etaScale *= (dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
 			}
 
-			ray = isect.spawnRay(wi);
+			s.prevVertex = isect;
+			s.bsdfPdf = pdf;
+			s.ray = isect.spawnRay(wi);
 
-			// Possibly terminate the path with Russian roulette.
-			// Factor out radiance scaling due to refraction in rrBeta.
-			Spectrum rrBeta = beta * etaScale;
-			if (rrBeta.maxComponentValue() < m_rrThreshold && bounces > 3)
+			// Widen the footprint by the solid angle of the sampled lobe, and use a coarser
+			// geometry for diffuse bounces past depth 2
+			if (!s.specularBounce)
+			{
+				s.spread = glm::min(s.spread + glm::sqrt(1 / (Pi * pdf)), (Float)1);
+			}
+			s.lodLevel = (s.bounces >= 2 && !s.specularBounce && scene.numLodLevels() > 1) ?
+				scene.selectLodLevel(s.footprint) : 0;
+			return true;
+		};
+
+		for (;;)
+		{
+			for (;; ++s.bounces)
 			{
-				Float q = glm::max((Float).05f, 1 - rrBeta.maxComponentValue());
-				if (sampler.get1D() < q)
+				// һ·㲢ۻ
+
+				// ray볡ཻཻ洢isect
+				SurfaceInteraction isect;
+				bool hit = scene.hit(s.ray, isect, s.lodLevel);
+				if (training)
+					recordCost(1, s.splittingRecord);
+				if (hit)
+				{
+					s.footprint += s.spread * distance(s.ray.origin(), isect.p);
+				}
+
+				// ·򻷾ӷ
+				Spectrum Le(0.f), weightedLe(0.f);
+				if (hit)
+				{
+					Le = isect.Le(-s.ray.direction());
+					weightedLe = Le;
+					if (!Le.isBlack() && s.bounces > 0 && !s.specularBounce)
+					{
+						const AreaLight* light = isect.hitable->getAreaLight();
+						Float lightPdf = lightSelectionPdf(scene, light, s.prevVertex) *
+							light->pdf_Li(s.prevVertex, s.ray.direction(), isect);
+						weightedLe *= powerHeuristic(1, s.bsdfPdf, 1, lightPdf);
+					}
+				}
+				else
+				{
+					for (const auto& light : scene.m_infiniteLights)
+					{
+						Spectrum lightLe = light->Le(s.ray);
+						Le += lightLe;
+						if (!lightLe.isBlack() && s.bounces > 0 && !s.specularBounce)
+						{
+							Float lightPdf = lightSelectionPdf(scene, light.get(), s.prevVertex) * light->pdf_Li(s.prevVertex, s.ray.direction());
+							lightLe *= powerHeuristic(1, s.bsdfPdf, 1, lightPdf);
+						}
+						weightedLe += lightLe;
+					}
+				}
+
+				//Note: resampled direct lighting is not weighted against the BSDF, it accounts for all the
+				//      emission of the area lights reached through a non-specular bounce
+				if (m_directCandidates > 0 && s.bounces > 0 && !s.specularBounce && hit)
+					weightedLe = Spectrum(0.f);
+
+				if (!weightedLe.isBlack())
+				{
+					L += s.beta * weightedLe;
+					if (training)
+						recordContribution(s.beta * weightedLe, s.splittingRecord);
+					//Note: the emission found right after the filter vertex is the BSDF half of its direct
+					//      lighting, which stays with the sample like the light sampling half does
+					if (s.filtered && s.bounces > filterBounce + 1)
+						filterIndirect += s.beta * weightedLe;
+				}
+				if (m_guidingTraining && s.bounces > 0 && !s.specularBounce && !guideVertices.empty())
+				{
+					// The rest of the emission is left to light sampling, but it is still radiance arriving
+					// at the previous vertex
+					guideVertices.back().radiance += Le - weightedLe;
+				}
+
+				// ݻﵽmaxDepthֹ·
+				if (!hit || s.bounces >= m_maxDepth)
 					break;
-				beta /= 1 - q;
-				DCHECK(!glm::isinf(beta.luminance()));
+
+				// ɢ亯
+				isect.computeScatteringFunctions(s.ray, arena, true);
+
+				// bsdf==nullptrʾǰԹûӰ죬ıڱʾ֮Ĺɣ߽籾ǹѧǻġ
+				if (!isect.bsdf){
+					s.ray = isect.spawnRay(s.ray.direction());
+					s.bounces--;
+					continue;
+				}
+
+				// ӵƹвԲ·סȫ淴BSDF˲裩
+				if (isect.bsdf->numComponents(ABxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+				{
+					Spectrum Ld = s.beta * (m_directCandidates > 0 ?
+						resampledDirectLighting(isect, scene, sampler, s.bounces == 0, distance(s.ray.origin(), isect.p), s.lodLevel) :
+						sampleOneLight(isect, scene, sampler, s.lodLevel));
+					CHECK_GE(Ld.luminance(), 0.f);
+					L += Ld;
+					if (training)
+					{
+						recordContribution(Ld, s.splittingRecord);
+						recordCost(1, s.splittingRecord);
+					}
+					if (s.filtered)
+						filterIndirect += Ld;
+				}
+
+				// ·ռ˲¼һǾ涥㣬Ϊ䶥ĹΪӹ
+				if (filterVertex != nullptr && !filterVertexFound &&
+					isect.bsdf->numComponents(ABxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+				{
+					filterVertexFound = true;
+					filterBounce = s.bounces;
+					Vec3f n;
+					Spectrum reflectance;
+					if (diffuseReflectance(isect, n, reflectance))
+					{
+						filterVertex->p = isect.p;
+						filterVertex->n = n;
+						filterVertex->weight = s.beta * reflectance;
+						s.filtered = true;
+					}
+				}
+
+				// 䶥ļӹտɷȻ
+				Vec3f n;
+				Spectrum reflectance;
+				if (m_radianceCache != nullptr && diffuseReflectance(isect, n, reflectance))
+				{
+					Spectrum cached;
+					if (s.bounces >= m_cacheBounce && m_radianceCache->lookup(isect.p, n, cached))
+					{
+						const Spectrum Lc = s.beta * reflectance * cached;
+						L += Lc;
+						if (training)
+							recordContribution(Lc, s.splittingRecord);
+						if (s.filtered)
+							filterIndirect += Lc;
+						break;
+					}
+
+					//Note: the training paths end in the cells learned by the previous iterations as well, the
+					//      vertices before record the cached radiance, which carries it one bounce further
+					if (m_cacheTraining)
+						cacheVertices.push_back({ isect.p, n, s.beta, reflectance, Spectrum(0.f) });
+				}
+
+				// EARS: ѧĹƾö·1ʱΪ˹̶
+				//Note: splitting is left out while guiding or the cache trains, their path vertices form a single
+				//      chain. The camera vertex keeps the classic roulette, the per-pixel estimates are too noisy
+				//      to ration it.
+				Float splitFactor = 1;
+				const bool splitting = m_splittingCache != nullptr && !m_guidingTraining && !m_cacheTraining && s.bounces > 0 &&
+					splittingFactor(s.beta, isect.p, sampler.currentPixel(), splitFactor);
+				int nContinuations = 1;
+				if (splitting)
+				{
+					nContinuations = (int)splitFactor;
+					if (sampler.get1D() < splitFactor - nContinuations)
+						++nContinuations;
+				}
+				if (nContinuations == 0)
+					break;
+
+				if (splitting)
+					s.beta /= splitFactor;
+
+				// Every continuation records its own estimate, made with the throughput left after the roulette
+				auto startRecord = [&](PathState &path)
+				{
+					if (m_splittingTraining)
+					{
+						splittingVertices.push_back({ isect.p, path.splittingRecord, path.beta, Spectrum(0.f), 0 });
+						path.splittingRecord = (int)splittingVertices.size() - 1;
+					}
+				};
+				for (int k = 1; k < nContinuations; ++k)
+				{
+					PathState branch = s;
+					startRecord(branch);
+					if (extendPath(branch, isect))
+					{
+						++branch.bounces;
+						branches.push_back(branch);
+					}
+				}
+				startRecord(s);
+				if (!extendPath(s, isect))
+					break;
+
+				// Possibly terminate the path with Russian roulette.
+				// Factor out radiance scaling due to refraction in rrBeta.
+				Spectrum rrBeta = s.beta * s.etaScale;
+				if (!splitting && rrBeta.maxComponentValue() < m_rrThreshold && s.bounces > 3)
+				{
+					Float q = glm::max((Float).05f, 1 - rrBeta.maxComponentValue());
+					if (sampler.get1D() < q)
+					{
+						if (m_splittingTraining)
+							splittingVertices.pop_back();
+						break;
+					}
+					s.beta /= 1 - q;
+					if (m_splittingTraining)
+						splittingVertices.back().throughput /= 1 - q;
+					DCHECK(!glm::isinf(s.beta.luminance()));
+				}
+			}
+
+			if (branches.empty())
+				break;
+			s = branches.back();
+			branches.pop_back();
+		}
+
+		// ·ȼ¼
+		for (const auto &vertex : guideVertices)
+		{
+			m_guidingField->record(vertex.p, vertex.wi, vertex.radiance.luminance() / vertex.pdf);
+		}
+
+		if (filterVertex != nullptr)
+		{
+			for (int c = 0; c < 3; ++c)
+			{
+				filterVertex->indirect[c] = filterVertex->weight[c] > 0 ?
+					filterIndirect[c] / filterVertex->weight[c] : 0;
+			}
+		}
+
+		// 䶥ļӷȳ䷴ʼ¼Ȼ
+		for (const auto &vertex : cacheVertices)
+		{
+			Spectrum radiance(0.f);
+			for (int c = 0; c < 3; ++c)
+			{
+				if (vertex.reflectance[c] > 0)
+					radiance[c] = vertex.radiance[c] / vertex.reflectance[c];
+			}
+			m_radianceCache->record(vertex.p, vertex.n, radiance);
+		}
+
+		// صͳ¼EARSĻ
+		if (m_splittingTraining)
+		{
+			for (const auto &vertex : splittingVertices)
+			{
+				m_splittingCache->record(vertex.p, vertex.radiance.luminance(), vertex.cost);
+			}
+
+			const Vec2i pixel = sampler.currentPixel();
+			const int width = m_pixelEstimateBounds.m_pMax.x - m_pixelEstimateBounds.m_pMin.x;
+			PixelEstimate& estimate = m_pixelEstimates[(pixel.x - m_pixelEstimateBounds.m_pMin.x) +
+				(pixel.y - m_pixelEstimateBounds.m_pMin.y) * width];
+			const Float luminance = L.luminance();
+			if (luminance >= 0 && !glm::isinf(luminance))
+			{
+				estimate.sum += luminance;
+				++estimate.nSamples;
+				estimate.iterationSum += luminance;
+				estimate.iterationSumSquares += luminance * luminance;
+				estimate.iterationCost += cost;
+				++estimate.iterationSamples;
 			}
 		}
 
@@ -467,6 +1765,14 @@ namespace RT
 		m_camera = Camera::ptr(static_cast<Camera*>(ObjectFactory::createInstance(
 			cameraNode.getTypeName(), cameraNode)));
 
+		//Progressive rendering
+		m_timeLimit = node.getPropertyList().getFloat("TimeLimit", 0.f);
+		m_progressive = node.getPropertyList().getBoolean("Progressive", m_timeLimit > 0);
+
+		//Checkpoint
+		m_checkpoint = node.getPropertyList().getString("Checkpoint", "");
+		m_checkpointInterval = node.getPropertyList().getFloat("CheckpointInterval", 300.f);
+
 		activate();
 	}
 
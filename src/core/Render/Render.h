@@ -7,6 +7,12 @@
 #include "Object/Hitable.h"
 #include "Object/Object.h"
 #include "Utils/LightDistrib.h"
+#include "Utils/PathGuiding.h"
+#include "Utils/SplittingCache.h"
+#include "Utils/RadianceCache.h"
+
+#include <functional>
+#include <unordered_map>
 
 namespace RT
 {
@@ -46,18 +52,79 @@ namespace RT
 			const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) const;
 
 	protected:
+		//Note: the image is rendered in tiles of tileSize x tileSize pixels from the corner of the sample bounds
+		static constexpr int tileSize = 16;
+
+		//Render the samples [firstSample, endSample) of every pixel of the tile into the film,
+		//returns the number of samples taken
+		int64_t renderTile(const Scene &scene, const BBox2i &tileBounds, int seed,
+			int64_t firstSample, int64_t endSample, bool adaptive) const;
+
 		Camera::ptr m_camera;
 		Sampler::ptr m_sampler;
+
+		//Note: a progressive render doubles the samples per pixel pass after pass and writes the image
+		//      after each pass, until the SPP of the sampler or the time limit (seconds, 0 for none)
+		bool m_progressive = false;
+		Float m_timeLimit = 0;
+
+		//Note: the film is saved to the checkpoint file between batches of tiles once every
+		//      |m_checkpointInterval| seconds and after every pass, a render finding the file at start
+		//      resumes from it
+		std::string m_checkpoint;
+		Float m_checkpointInterval = 300;
 	};
 
 	Spectrum uiformSampleAllLights(const Interaction &it, const Scene &scene,
 		MemoryArena &arena, Sampler &sampler, const std::vector<int> &nLightSamples);
 
+	//Trace the feature samples of the denoiser of the film to their first hit and record the albedo,
+	//normal and depth there, nothing without a denoiser
+	void renderFeatures(const Scene &scene, const Camera &camera);
+
+	//Note: a null |lightDistrib| picks the light uniformly
 	Spectrum uniformSampleOneLight(const Interaction &it, const Scene &scene,
-		MemoryArena &arena, Sampler &sampler, const Distribution1D *lightDistrib);
+		MemoryArena &arena, Sampler &sampler, const LightDistribution *lightDistrib, int lodLevel = 0);
 
 	Spectrum estimateDirect(const Interaction &it, const Vec2f &uShading, const Light &light,
-		const Vec2f &uLight, const Scene &scene, Sampler &sampler, MemoryArena &arena, bool specular = false);
+		const Vec2f &uLight, const Scene &scene, Sampler &sampler, MemoryArena &arena, bool specular = false,
+		int lodLevel = 0);
+
+	//! @brief Reservoir of resampled importance sampling that keeps one point on an area light.
+	/**
+	 * Light candidates stream through update() and one of them survives with probability proportional
+	 * to its weight. The survivor is kept as a point on the light, so that the reservoir can be
+	 * re-evaluated at another shading point, which is what temporal and spatial reuse rely on. The
+	 * target pdf is the luminance of the unshadowed contribution in area measure.
+	 */
+	struct LightReservoir
+	{
+		const Light *light = nullptr;
+		Interaction pLight;
+		Float targetPdf = 0;	//target pdf of the survivor at the shading point it was resampled for
+		Float wSum = 0;			//sum of the weights of the candidates
+		Float M = 0;			//number of candidates the reservoir has seen
+
+		bool update(const Light *candidate, const Interaction &p, Float pHat, Float weight, Float u);
+
+		//Contribution weight of the survivor, the estimate is its contribution times W()
+		Float W() const { return targetPdf > 0 ? wSum / (M * targetPdf) : 0; }
+	};
+
+	//Unshadowed contribution f * Le * G of the point |pLight| on an area light to the shading point |it|
+	Spectrum lightContribution(const SurfaceInteraction &it, const Light &light, const Interaction &pLight);
+
+	//Draw |nCandidates| light samples from |lightDistrib| and resample one by its unshadowed contribution
+	LightReservoir resampleLights(const SurfaceInteraction &it, const Scene &scene, Sampler &sampler,
+		const LightDistribution *lightDistrib, int nCandidates);
+
+	//Merge |other|, resampled at another shading point, into |reservoir| at |it|, counting at most |maxM| of its candidates
+	void combineReservoirs(LightReservoir &reservoir, const LightReservoir &other, const SurfaceInteraction &it,
+		Float maxM, Float u);
+
+	//Direct lighting of the survivor of the reservoir, traces its single shadow ray
+	Spectrum shadeLightReservoir(const SurfaceInteraction &it, const Scene &scene,
+		const LightReservoir &reservoir, int lodLevel = 0);
 
 }
 
@@ -74,17 +141,133 @@ namespace RT
 
 		virtual void preprocess(const Scene& scene) override;
 
+		virtual void render(const Scene& scene) override;
+
 		virtual Spectrum Li(const Ray& ray, const Scene& scene, Sampler& sampler,
 			MemoryArena& arena, int depth) const override;
 
 		virtual std::string toString() const override { return "PathRenderer[]"; }
 
-	private:
+	protected:
+		//Trace camera paths over iterations of doubling samples per pixel, calling update after each iteration
+		void trainIterations(const Scene& scene, const std::string& name, int iterations, int seedBase,
+			const std::function<void()>& update);
+
+		//Learn the guiding field over the training iterations before rendering
+		void trainGuiding(const Scene& scene);
+
+		//Learn the splitting cache and the pixel estimates of EARS in the same way
+		void trainSplitting(const Scene& scene);
+
+		//Learn the radiance cache in the same way
+		void trainRadianceCache(const Scene& scene);
+
+		//First diffuse vertex of a camera path, whose indirect lighting path space filtering shares
+		struct FilterVertex
+		{
+			Vec3f p, n;							//n faces the side the path arrived from
+			Spectrum weight = Spectrum(0.f);	//beta times reflectance, black where the path has no such vertex
+			Spectrum indirect = Spectrum(0.f);	//radiance its continuation carried back, over |weight|
+		};
+
+		//Radiance along the camera ray, the first diffuse vertex is stored to |filterVertex| unless null
+		Spectrum tracePath(const Ray& ray, const Scene& scene, Sampler& sampler, MemoryArena& arena,
+			FilterVertex* filterVertex) const;
+
+		//Render one sample of every pixel per pass, then filter the indirect lighting of their first
+		//diffuse vertices over the vertices of the pass within |m_filterRadius|
+		void renderFiltered(const Scene& scene);
+
+		//Number of continuations of the path at |p| with throughput |beta| chosen by EARS, its
+		//expectation |q| scales the throughput of each. False where nothing is learned yet.
+		bool splittingFactor(const Spectrum& beta, const Vec3f& p, const Vec2i& pixel, Float& q) const;
+
+		//Direct lighting by resampling light candidates, |depth| is the distance to the camera for a camera vertex
+		Spectrum resampledDirectLighting(const SurfaceInteraction& isect, const Scene& scene, Sampler& sampler,
+			bool cameraVertex, Float depth, int lodLevel) const;
+
+		//Light sampling half of the direct lighting, the BSDF half is left to the continuation of the path
+		Spectrum sampleOneLight(const SurfaceInteraction& isect, const Scene& scene, Sampler& sampler, int lodLevel) const;
+
+		//Pdf with which the continuation of the path at |isect| samples |wi|
+		Float continuationPdf(const SurfaceInteraction& isect, const Vec3f& wo, const Vec3f& wi) const;
+
+		//Probability that the light sampling at |ref| picks |light|
+		Float lightSelectionPdf(const Scene& scene, const Light* light, const Interaction& ref) const;
+
 		// PathRenderer Private Data
 		int m_maxDepth;
 		Float m_rrThreshold;
 		std::string m_lightSampleStrategy;
 		std::unique_ptr<LightDistribution> m_lightDistribution;
+		std::unordered_map<const Light*, int> m_lightIndices;
+
+		//Note: path guiding samples directions from the learned incident radiance with probability
+		//      |m_guidingFraction| and from the BSDF otherwise, combined by one-sample MIS
+		bool m_guiding = false;
+		int m_guidingIterations = 4;
+		Float m_guidingFraction = 0.5f;
+		GuidingField::unique_ptr m_guidingField;
+		bool m_guidingTraining = false;
+
+		//Note: the "ears" Russian roulette learns the cost and second moment of the radiance reflected
+		//      over the scene and the estimate of every pixel, then terminates or splits each path
+		//      vertex to maximize the efficiency of the image, the "classic" one terminates dim paths
+		//      past bounce 3. EARS leaves the camera vertex alone and falls back to the
+		//      classic roulette where it has learned nothing.
+		std::string m_rouletteStrategy = "classic";
+		int m_splittingIterations = 4;
+		SplittingCache::unique_ptr m_splittingCache;
+		bool m_splittingTraining = false;
+
+		struct PixelEstimate
+		{
+			Float sum = 0;			//luminance of the samples of all iterations
+			int nSamples = 0;
+			Float filtered = 0;		//mean luminance over the neighbouring pixels
+
+			//Samples of the current iteration, they estimate the variance and cost under the current roulette
+			Float iterationSum = 0, iterationSumSquares = 0, iterationCost = 0;
+			int iterationSamples = 0;
+		};
+		mutable std::vector<PixelEstimate> m_pixelEstimates;
+		BBox2i m_pixelEstimateBounds;
+		Float m_meanPixelEstimate = 0;
+		Float m_costToVariance = 0;	//average cost over average relative variance of a pixel sample
+
+		//Note: with the radiance cache a path ends at a diffuse vertex past |m_cacheBounce| bounces, after
+		//      its direct lighting, in the indirect radiance learned there. Only the cells whose relative
+		//      standard error is below |m_cacheError| end paths, the others keep tracing.
+		bool m_radianceCaching = false;
+		int m_cacheIterations = 4;
+		int m_cacheBounce = 2;
+		int m_cacheResolution = 32;
+		Float m_cacheError = 0.2f;
+		RadianceCache::unique_ptr m_radianceCache;
+		bool m_cacheTraining = false;
+
+		//Note: path space filtering averages the indirect lighting of the first diffuse vertex over the
+		//      vertices of neighbouring pixels closer than |m_filterRadius| with similar normals. Zero
+		//      takes a radius of three pixels, measured on the first pass.
+		bool m_pathSpaceFiltering = false;
+		Float m_filterRadius = 0;
+
+		//Note: with |m_directCandidates| > 0 the direct lighting resamples that many light candidates and
+		//      traces a single shadow ray. The reservoirs of the camera vertices are kept per pixel, temporal
+		//      reuse merges the one of the previous sample of the pixel and spatial reuse those of neighbours
+		//      within the tile, which one thread renders alone.
+		int m_directCandidates = 0;
+		bool m_temporalReuse = false;
+		bool m_spatialReuse = false;
+
+		struct PixelReservoir
+		{
+			LightReservoir reservoir;
+			Vec3f n;		//normal of the camera vertex
+			Float depth;	//distance of the camera vertex to the camera
+		};
+		mutable std::vector<PixelReservoir> m_reservoirs;
+		BBox2i m_reservoirBounds;
 	};
 
 }
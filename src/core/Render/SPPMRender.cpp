@@ -0,0 +1,411 @@
+#include "Render/SPPMRender.h"
+
+#include "Render/BSDF.h"
+#include "Scene/Scene.h"
+#include "Utils/Memory.h"
+#include "Render/RenderReporter.h"
+#include "Utils/LightDistrib.h"
+
+namespace RT
+{
+	//Note: the camera pass runs over tiles of tileSize x tileSize pixels, the photon pass over chunks of photons
+	static constexpr int tileSize = 16;
+	static constexpr int64_t photonChunkSize = 4096;
+
+	//-------------------------------------------SPPMRenderer-------------------------------------
+
+	AURORA_REGISTER_CLASS(SPPMRenderer, "SPPM")
+
+	SPPMRenderer::SPPMRenderer(const PropertyTreeNode &node)
+		: m_maxDepth(node.getPropertyList().getInteger("Depth", 5))
+		, m_iterations(node.getPropertyList().getInteger("Iterations", 64))
+		, m_photonsPerIteration(node.getPropertyList().getInteger("PhotonsPerIteration", -1))
+		, m_initialRadius(node.getPropertyList().getFloat("Radius", 0.f))
+		, m_writeFrequency(glm::max(1, node.getPropertyList().getInteger("WriteFrequency", 1)))
+	{
+		//Sampler
+		const auto &samplerNode = node.getPropertyChild("Sampler");
+		m_sampler = Sampler::ptr(static_cast<Sampler*>(ObjectFactory::createInstance(
+			samplerNode.getTypeName(), samplerNode)));
+
+		//Camera
+		const auto &cameraNode = node.getPropertyChild("Camera");
+		m_camera = Camera::ptr(static_cast<Camera*>(ObjectFactory::createInstance(
+			cameraNode.getTypeName(), cameraNode)));
+
+		activate();
+	}
+
+	void SPPMRenderer::preprocess(const Scene &scene)
+	{
+		//Note: photons leave the lights in proportion to their power, the camera paths sample them the same way
+		m_lightDistribution.reset();
+		if (!scene.m_lights.empty())
+			m_lightDistribution = createLightSampleDistribution("power", scene);
+
+		//Note: without a given radius the search starts at half a percent of the scene diagonal
+		if (m_initialRadius <= 0)
+			m_initialRadius = 0.005f * length(scene.worldBound().diagonal());
+	}
+
+	void SPPMRenderer::render(const Scene &scene)
+	{
+		renderFeatures(scene, *m_camera);
+
+		m_pixelBounds = m_camera->m_film->getCroppedPixelBounds();
+		const int nPixels = m_pixelBounds.area();
+		m_pixels.reset(new SPPMPixel[nPixels]);
+		for (int i = 0; i < nPixels; ++i)
+			m_pixels[i].radius = m_initialRadius;
+		m_gridHeads.reset(new std::atomic<int>[nPixels]);
+
+		const int64_t photonsPerIteration = m_photonsPerIteration > 0 ? m_photonsPerIteration : nPixels;
+		const int64_t nPhotonChunks = (photonsPerIteration + photonChunkSize - 1) / photonChunkSize;
+
+		// Compute the tile bounds over the pixels
+		Vec2i pixelExtent = m_pixelBounds.diagonal();
+		Vec2i nTiles((pixelExtent.x + tileSize - 1) / tileSize, (pixelExtent.y + tileSize - 1) / tileSize);
+		const int nTotalTiles = nTiles.x * nTiles.y;
+		auto getTileBounds = [&](int t) -> BBox2i
+		{
+			Vec2i tile(t % nTiles.x, t / nTiles.x);
+			int x0 = m_pixelBounds.m_pMin.x + tile.x * tileSize;
+			int x1 = glm::min(x0 + tileSize, m_pixelBounds.m_pMax.x);
+			int y0 = m_pixelBounds.m_pMin.y + tile.y * tileSize;
+			int y1 = glm::min(y0 + tileSize, m_pixelBounds.m_pMax.y);
+			return BBox2i(Vec2i(x0, y0), Vec2i(x1, y1));
+		};
+
+		//Note: the BSDFs of the visible points live in the arena of their tile until the photons are gathered
+		std::vector<std::unique_ptr<MemoryArena>> tileArenas(nTotalTiles);
+		for (auto &arena : tileArenas)
+			arena.reset(new MemoryArena());
+
+		AReporter reporter(m_iterations, "Rendering");
+		for (int iteration = 0; iteration < m_iterations; ++iteration)
+		{
+			// Leave a visible point in every pixel
+			ParallelUtils::parallelFor((size_t)0, (size_t)nTotalTiles, [&](const size_t &t)
+			{
+				tileArenas[t]->Reset();
+				traceCameraPaths(scene, getTileBounds(t), iteration * nTotalTiles + t, *tileArenas[t]);
+			}, ExecutionPolicy::APARALLEL);
+
+			buildGrid();
+
+			// Shoot the photons and gather them at the visible points
+			ParallelUtils::parallelFor((size_t)0, (size_t)nPhotonChunks, [&](const size_t &chunk)
+			{
+				const int64_t firstPhoton = chunk * photonChunkSize;
+				const int64_t endPhoton = glm::min(firstPhoton + photonChunkSize, photonsPerIteration);
+				tracePhotons(scene, iteration, firstPhoton, endPhoton);
+			}, ExecutionPolicy::APARALLEL);
+
+			// Update the pixel statistics with the photons of the iteration and shrink the radii
+			ParallelUtils::parallelFor((size_t)0, (size_t)nPixels, [&](const size_t &i)
+			{
+				SPPMPixel &pixel = m_pixels[i];
+				const int M = pixel.M;
+				if (M > 0)
+				{
+					const Float gamma = (Float)2 / (Float)3;
+					Float Nnew = pixel.N + gamma * M;
+					Float Rnew = pixel.radius * glm::sqrt(Nnew / (pixel.N + M));
+					Spectrum Phi;
+					for (int c = 0; c < Spectrum::nSamples; ++c)
+					{
+						Phi[c] = pixel.Phi[c];
+						pixel.Phi[c] = 0;
+					}
+					pixel.tau = (pixel.tau + pixel.vp.beta * Phi) * (Rnew * Rnew) / (pixel.radius * pixel.radius);
+					pixel.N = Nnew;
+					pixel.radius = Rnew;
+					pixel.M = 0;
+				}
+				pixel.vp.beta = Spectrum(0.f);
+				pixel.vp.bsdf = nullptr;
+			}, ExecutionPolicy::APARALLEL);
+
+			// Write the current estimate
+			if ((iteration + 1) % m_writeFrequency == 0 || iteration + 1 == m_iterations)
+			{
+				const int64_t Np = (int64_t)(iteration + 1) * photonsPerIteration;
+				std::unique_ptr<Spectrum[]> image(new Spectrum[nPixels]);
+				for (int i = 0; i < nPixels; ++i)
+				{
+					const SPPMPixel &pixel = m_pixels[i];
+					image[i] = pixel.Ld / (Float)(iteration + 1);
+					image[i] += pixel.tau / (Np * Pi * pixel.radius * pixel.radius);
+				}
+				m_camera->m_film->setImage(image.get());
+				m_camera->m_film->writeImageToFile();
+			}
+
+			reporter.update();
+		}
+		reporter.done();
+	}
+
+	void SPPMRenderer::traceCameraPaths(const Scene &scene, const BBox2i &tileBounds, int seed, MemoryArena &arena)
+	{
+		std::unique_ptr<Sampler> tileSampler = m_sampler->clone(seed);
+		const int width = m_pixelBounds.m_pMax.x - m_pixelBounds.m_pMin.x;
+
+		for (Vec2i pPixel : tileBounds)
+		{
+			tileSampler->startPixel(pPixel);
+			CameraSample cameraSample = tileSampler->getCameraSample(pPixel);
+			Ray ray;
+			Spectrum beta(m_camera->castingRay(cameraSample, ray));
+
+			SPPMPixel &pixel = m_pixels[(pPixel.x - m_pixelBounds.m_pMin.x) + (pPixel.y - m_pixelBounds.m_pMin.y) * width];
+			bool specularBounce = false;
+			for (int depth = 0; depth < m_maxDepth; ++depth)
+			{
+				SurfaceInteraction isect;
+				if (!scene.hit(ray, isect))
+				{
+					for (const auto &light : scene.m_infiniteLights)
+						pixel.Ld += beta * light->Le(ray);
+					break;
+				}
+
+				// Surfaces without a BSDF only bound media, pass through them
+				isect.computeScatteringFunctions(ray, arena, true);
+				if (!isect.bsdf)
+				{
+					ray = isect.spawnRay(ray.direction());
+					--depth;
+					continue;
+				}
+				const BSDF &bsdf = *isect.bsdf;
+
+				// Accumulate direct lighting, emission only counts at the camera vertex and after specular bounces
+				Vec3f wo = -ray.direction();
+				if (depth == 0 || specularBounce)
+					pixel.Ld += beta * isect.Le(wo);
+				pixel.Ld += beta * uniformSampleOneLight(isect, scene, arena, *tileSampler, m_lightDistribution.get());
+
+				// Leave the visible point on the first diffuse surface, or on a glossy one at the last vertex
+				bool isDiffuse = bsdf.numComponents(ABxDFType(BSDF_DIFFUSE | BSDF_REFLECTION | BSDF_TRANSMISSION)) > 0;
+				bool isGlossy = bsdf.numComponents(ABxDFType(BSDF_GLOSSY | BSDF_REFLECTION | BSDF_TRANSMISSION)) > 0;
+				if (isDiffuse || (isGlossy && depth == m_maxDepth - 1))
+				{
+					pixel.vp.p = isect.p;
+					pixel.vp.wo = wo;
+					pixel.vp.bsdf = &bsdf;
+					pixel.vp.beta = beta;
+					break;
+				}
+
+				// Follow the specular directions
+				if (depth < m_maxDepth - 1)
+				{
+					Vec3f wi;
+					Float pdf;
+					ABxDFType flags;
+					Spectrum f = bsdf.sample_f(wo, wi, tileSampler->get2D(), pdf, flags, BSDF_ALL);
+					if (pdf == 0 || f.isBlack())
+						break;
+
+					specularBounce = (flags & BSDF_SPECULAR) != 0;
+					beta *= f * absDot(wi, isect.n) / pdf;
+					if (beta.luminance() < 0.25f)
+					{
+						Float continueProb = glm::min((Float)1, beta.luminance());
+						if (tileSampler->get1D() > continueProb)
+							break;
+						beta /= continueProb;
+					}
+					ray = isect.spawnRay(wi);
+				}
+			}
+		}
+	}
+
+	void SPPMRenderer::buildGrid()
+	{
+		const int nPixels = m_pixelBounds.area();
+
+		// Bounds of the visible points grown by their search radius
+		m_gridBounds = BBox3f();
+		Float maxRadius = 0;
+		for (int i = 0; i < nPixels; ++i)
+		{
+			const SPPMPixel &pixel = m_pixels[i];
+			if (pixel.vp.bsdf == nullptr || pixel.vp.beta.isBlack())
+				continue;
+			Vec3f r(pixel.radius);
+			m_gridBounds = unionBounds(m_gridBounds, BBox3f(pixel.vp.p - r, pixel.vp.p + r));
+			maxRadius = glm::max(maxRadius, pixel.radius);
+		}
+
+		for (int h = 0; h < nPixels; ++h)
+			m_gridHeads[h] = -1;
+		m_gridNodes.clear();
+		if (maxRadius == 0)
+			return;
+
+		//Note: the cells are about as wide as the largest search diameter
+		Vec3f diag = m_gridBounds.diagonal();
+		Float maxDiag = maxComponent(diag);
+		int baseGridRes = (int)(maxDiag / maxRadius);
+		for (int i = 0; i < 3; ++i)
+			m_gridRes[i] = glm::max((int)(baseGridRes * diag[i] / maxDiag), 1);
+
+		// Every visible point gets a run of nodes, one per cell its search sphere overlaps
+		auto overlappedCells = [&](const SPPMPixel &pixel, Vec3i &pMin, Vec3i &pMax) -> bool
+		{
+			if (pixel.vp.bsdf == nullptr || pixel.vp.beta.isBlack())
+				return false;
+			Vec3f r(pixel.radius);
+			toGridCell(pixel.vp.p - r, pMin);
+			toGridCell(pixel.vp.p + r, pMax);
+			return true;
+		};
+
+		std::vector<int> firstNode(nPixels + 1, 0);
+		ParallelUtils::parallelFor((size_t)0, (size_t)nPixels, [&](const size_t &i)
+		{
+			Vec3i pMin, pMax;
+			if (overlappedCells(m_pixels[i], pMin, pMax))
+				firstNode[i + 1] = (pMax.x - pMin.x + 1) * (pMax.y - pMin.y + 1) * (pMax.z - pMin.z + 1);
+		}, ExecutionPolicy::APARALLEL);
+
+		for (int i = 0; i < nPixels; ++i)
+			firstNode[i + 1] += firstNode[i];
+		m_gridNodes.resize(firstNode[nPixels]);
+
+		// Push the nodes onto the lists of their cells, a failed CAS retries with the new head
+		ParallelUtils::parallelFor((size_t)0, (size_t)nPixels, [&](const size_t &i)
+		{
+			Vec3i pMin, pMax;
+			if (!overlappedCells(m_pixels[i], pMin, pMax))
+				return;
+
+			int nodeIndex = firstNode[i];
+			for (int z = pMin.z; z <= pMax.z; ++z)
+			{
+				for (int y = pMin.y; y <= pMax.y; ++y)
+				{
+					for (int x = pMin.x; x <= pMax.x; ++x, ++nodeIndex)
+					{
+						GridNode &node = m_gridNodes[nodeIndex];
+						node.pixel = (int)i;
+						std::atomic<int> &head = m_gridHeads[hashCell(Vec3i(x, y, z))];
+						node.next = head.load(std::memory_order_relaxed);
+						while (!head.compare_exchange_weak(node.next, nodeIndex));
+					}
+				}
+			}
+		}, ExecutionPolicy::APARALLEL);
+	}
+
+	void SPPMRenderer::tracePhotons(const Scene &scene, int iteration, int64_t firstPhoton, int64_t endPhoton)
+	{
+		if (m_lightDistribution == nullptr)
+			return;
+
+		//Note: every chunk of photons of every iteration draws from its own random sequence
+		MemoryArena arena;
+		Rng rng((uint64_t)iteration * 0x100000000ull + (uint64_t)firstPhoton);
+
+		for (int64_t photon = firstPhoton; photon < endPhoton; ++photon)
+		{
+			arena.Reset();
+
+			// Pick a light by power and sample a ray leaving it
+			Float lightPdf;
+			int lightNum = m_lightDistribution->sample(Vec3f(0.f), Vec3f(0.f), rng.uniformFloat(), lightPdf);
+			if (lightNum < 0)
+				continue;
+			const Light *light = scene.m_lights[lightNum].get();
+
+			Vec2f u1, u2;
+			u1.x = rng.uniformFloat();
+			u1.y = rng.uniformFloat();
+			u2.x = rng.uniformFloat();
+			u2.y = rng.uniformFloat();
+			Ray photonRay;
+			Vec3f nLight;
+			Float pdfPos, pdfDir;
+			Spectrum Le = light->sample_Le(u1, u2, photonRay, nLight, pdfPos, pdfDir);
+			if (pdfPos == 0 || pdfDir == 0 || Le.isBlack())
+				continue;
+
+			Spectrum beta = absDot(nLight, photonRay.direction()) * Le / (lightPdf * pdfPos * pdfDir);
+			if (beta.isBlack())
+				continue;
+
+			for (int depth = 0; depth < m_maxDepth; ++depth)
+			{
+				SurfaceInteraction isect;
+				if (!scene.hit(photonRay, isect))
+					break;
+
+				//Note: direct lighting is left to the camera paths, photons deposit from their second vertex on
+				Vec3i cell;
+				if (depth > 0 && toGridCell(isect.p, cell))
+				{
+					for (int node = m_gridHeads[hashCell(cell)]; node >= 0; node = m_gridNodes[node].next)
+					{
+						SPPMPixel &pixel = m_pixels[m_gridNodes[node].pixel];
+						if (distanceSquared(pixel.vp.p, isect.p) > pixel.radius * pixel.radius)
+							continue;
+
+						Spectrum Phi = beta * pixel.vp.bsdf->f(pixel.vp.wo, -photonRay.direction());
+						for (int c = 0; c < Spectrum::nSamples; ++c)
+							pixel.Phi[c].add(Phi[c]);
+						++pixel.M;
+					}
+				}
+
+				isect.computeScatteringFunctions(photonRay, arena, true, TransportMode::Importance);
+				if (!isect.bsdf)
+				{
+					photonRay = isect.spawnRay(photonRay.direction());
+					--depth;
+					continue;
+				}
+
+				// Sample the BSDF for the next direction of the photon
+				Vec3f wo = -photonRay.direction(), wi;
+				Vec2f u;
+				u.x = rng.uniformFloat();
+				u.y = rng.uniformFloat();
+				Float pdf;
+				ABxDFType flags;
+				Spectrum fr = isect.bsdf->sample_f(wo, wi, u, pdf, flags, BSDF_ALL);
+				if (fr.isBlack() || pdf == 0)
+					break;
+
+				// Russian roulette on the change of throughput keeps the photon power roughly constant
+				Spectrum bnew = beta * fr * absDot(wi, isect.n) / pdf;
+				Float q = glm::max((Float)0, 1 - bnew.luminance() / beta.luminance());
+				if (rng.uniformFloat() < q)
+					break;
+				beta = bnew / (1 - q);
+				photonRay = isect.spawnRay(wi);
+			}
+		}
+	}
+
+	bool SPPMRenderer::toGridCell(const Vec3f &p, Vec3i &cell) const
+	{
+		bool inBounds = true;
+		Vec3f pg = m_gridBounds.offset(p);
+		for (int i = 0; i < 3; ++i)
+		{
+			cell[i] = (int)(m_gridRes[i] * pg[i]);
+			inBounds &= (cell[i] >= 0 && cell[i] < m_gridRes[i]);
+			cell[i] = clamp(cell[i], 0, m_gridRes[i] - 1);
+		}
+		return inBounds;
+	}
+
+	size_t SPPMRenderer::hashCell(const Vec3i &cell) const
+	{
+		return (size_t)(((uint32_t)cell.x * 73856093u) ^ ((uint32_t)cell.y * 19349663u) ^
+			((uint32_t)cell.z * 83492791u)) % (size_t)m_pixelBounds.area();
+	}
+}
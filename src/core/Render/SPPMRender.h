@@ -0,0 +1,98 @@
+#ifndef ARSPPM_RENDER_H
+#define ARSPPM_RENDER_H
+
+#include "Render/Render.h"
+#include "Utils/Interaction.h"
+#include "Utils/Parallel.h"
+
+#include <atomic>
+#include <vector>
+
+namespace RT
+{
+	//! @brief Stochastic progressive photon mapping.
+	/**
+	 * Follows Hachisuka and Jensen, "Stochastic Progressive Photon Mapping", as done in pbrt. Every
+	 * iteration traces a camera path per pixel up to its first diffuse surface, where it leaves a
+	 * visible point, then shoots photons from the lights that are gathered by the visible points
+	 * within the search radius of their pixel. The radii shrink from iteration to iteration, which
+	 * makes the estimate consistent, and caustics seen through specular surfaces come out cleanly.
+	 */
+	class SPPMRenderer final : public Renderer
+	{
+	public:
+		typedef std::shared_ptr<SPPMRenderer> ptr;
+
+		SPPMRenderer(const PropertyTreeNode &node);
+
+		virtual void preprocess(const Scene &scene) override;
+
+		virtual void render(const Scene &scene) override;
+
+		virtual std::string toString() const override { return "SPPMRenderer[]"; }
+
+	private:
+		//Statistics of a pixel kept over the iterations
+		struct SPPMPixel
+		{
+			Float radius = 0;		//current search radius
+			Spectrum Ld;			//sum of the direct and specular lighting of the camera paths
+			Float N = 0;			//accumulated photon count
+			Spectrum tau;			//accumulated flux scaled by the radius reduction
+
+			//Visible point of the current iteration, no photons are gathered without a BSDF
+			struct VisiblePoint
+			{
+				Vec3f p;
+				Vec3f wo;
+				const BSDF *bsdf = nullptr;
+				Spectrum beta;
+			} vp;
+
+			//Photons gathered in the current iteration
+			AAtomicFloat Phi[Spectrum::nSamples];
+			std::atomic<int> M{ 0 };
+		};
+
+		//Node of the list of visible points that overlap a grid cell
+		struct GridNode
+		{
+			int pixel;
+			int next;
+		};
+
+		//Trace the camera paths of a tile and leave a visible point in each pixel
+		void traceCameraPaths(const Scene &scene, const BBox2i &tileBounds, int seed, MemoryArena &arena);
+
+		//Build the hash grid over the visible points of the iteration
+		void buildGrid();
+
+		void tracePhotons(const Scene &scene, int iteration, int64_t firstPhoton, int64_t endPhoton);
+
+		bool toGridCell(const Vec3f &p, Vec3i &cell) const;
+		size_t hashCell(const Vec3i &cell) const;
+
+		Camera::ptr m_camera;
+		Sampler::ptr m_sampler;
+
+		int m_maxDepth;
+		int m_iterations;
+		int m_photonsPerIteration;
+		Float m_initialRadius;
+		int m_writeFrequency;
+
+		std::unique_ptr<LightDistribution> m_lightDistribution;
+
+		BBox2i m_pixelBounds;
+		std::unique_ptr<SPPMPixel[]> m_pixels;
+
+		//Note: the grid hashes its cells into as many lists as pixels, the heads are swapped in by CAS
+		//      while the visible points are inserted in parallel
+		BBox3f m_gridBounds;
+		Vec3i m_gridRes;
+		std::unique_ptr<std::atomic<int>[]> m_gridHeads;
+		std::vector<GridNode> m_gridNodes;
+	};
+}
+
+#endif
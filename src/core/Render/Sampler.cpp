@@ -2,22 +2,30 @@
 
 #include "Camera/Camera.h"
 
+#include <cmath>
+
 namespace RT
 {
 	//-------------------------------------------ASampler-------------------------------------
 
 	Sampler::~Sampler() {}
 
-	Sampler::Sampler(int64_t samplesPerPixel) : samplesPerPixel(samplesPerPixel) {}
+	Sampler::Sampler(int64_t samplesPerPixel) : samplesPerPixel(samplesPerPixel),
+		minSamplesPerPixel(samplesPerPixel), maxRelativeError(0) {}
 
-	Sampler::Sampler(const PropertyList &props) : samplesPerPixel(props.getInteger("SPP", 1)) {}
+	Sampler::Sampler(const PropertyList &props) : samplesPerPixel(props.getInteger("SPP", 1)),
+		minSamplesPerPixel(glm::clamp(props.getInteger("MinSPP", (int)samplesPerPixel), 1, (int)samplesPerPixel)),
+		maxRelativeError(props.getFloat("MaxError", 0.f)) {}
 
 	CameraSample Sampler::getCameraSample(const Vec2i &pRaster)
 	{
 		CameraSample cs;
 
 		//ǰؼƫ
-		cs.pFilm = (Vec2f)pRaster + get2D();
+		//Note: the sum may round up to the next pixel, which would then count the sample as its own
+		Vec2f u = get2D();
+		cs.pFilm.x = glm::min((Float)pRaster.x + u.x, std::nextafter((Float)(pRaster.x + 1), (Float)pRaster.x));
+		cs.pFilm.y = glm::min((Float)pRaster.y + u.y, std::nextafter((Float)(pRaster.y + 1), (Float)pRaster.y));
 		return cs;
 	}
 
@@ -36,12 +36,18 @@ namespace RT
 		virtual bool setSampleNumber(int64_t sampleNum);
 
 		int64_t currentSampleNumber() const { return m_currentPixelSampleIndex; }
+		const Vec2i &currentPixel() const { return m_currentPixel; }
 
 		int64_t getSamplingNumber() const { return samplesPerPixel; }
 
+		//Note: a pixel may stop before |samplesPerPixel| once the relative error of its mean is small enough
+		bool isAdaptive() const { return maxRelativeError > 0 && minSamplesPerPixel < samplesPerPixel; }
+
 		virtual ClassType getClassType() const override { return ClassType::AESampler; }
 
 		const int64_t samplesPerPixel; //Number of sampling per pixel
+		const int64_t minSamplesPerPixel; //Number of sampling per pixel before adaptive stopping
+		const Float maxRelativeError; //Target relative error of adaptive sampling, 0 disables it
 
 	protected:
 		Vec2i m_currentPixel;
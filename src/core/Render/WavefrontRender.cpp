@@ -0,0 +1,526 @@
+#include "Render/WavefrontRender.h"
+
+#include "Render/BSDF.h"
+#include "Scene/Scene.h"
+#include "Utils/Memory.h"
+#include "Render/RenderReporter.h"
+#include "Utils/LightDistrib.h"
+#include "Utils/Parallel.h"
+
+#include <algorithm>
+
+namespace RT
+{
+	//Note: a stage is split into chunks of this many queue entries, a thread seizes one chunk at a time
+	static constexpr size_t stageChunkSize = 256;
+
+	template<typename Function>
+	static void parallelForChunks(WorkerPool &pool, size_t count, const Function &func)
+	{
+		const size_t nChunks = (count + stageChunkSize - 1) / stageChunkSize;
+		pool.parallelFor(nChunks, [&](size_t chunk)
+		{
+			const size_t begin = chunk * stageChunkSize;
+			func(begin, glm::min(begin + stageChunkSize, count));
+		});
+	}
+
+	//-------------------------------------------RayQueue-------------------------------------
+
+	void RayQueue::reserve(size_t capacity)
+	{
+		if (m_pathIndex.size() >= capacity)
+			return;
+
+		m_origin.resize(capacity);
+		m_direction.resize(capacity);
+		m_tMax.resize(capacity);
+		m_pathIndex.resize(capacity);
+		m_lodLevel.resize(capacity);
+		m_originLodLevel.resize(capacity);
+		m_Ld.resize(capacity);
+	}
+
+	void RayQueue::push(const Ray &ray, int pathIndex, int lodLevel, const Spectrum &Ld)
+	{
+		const size_t slot = m_size.fetch_add(1);
+		DCHECK_LT(slot, m_pathIndex.size());
+
+		m_origin[slot] = ray.origin();
+		m_direction[slot] = ray.direction();
+		m_tMax[slot] = ray.m_tMax;
+		m_pathIndex[slot] = pathIndex;
+		m_lodLevel[slot] = lodLevel;
+		m_originLodLevel[slot] = ray.m_originLodLevel;
+		m_Ld[slot] = Ld;
+	}
+
+	Ray RayQueue::getRay(size_t slot) const
+	{
+		Ray ray(m_origin[slot], m_direction[slot], m_tMax[slot]);
+		ray.m_originLodLevel = m_originLodLevel[slot];
+		return ray;
+	}
+
+	//-------------------------------------------WavefrontPathRenderer-------------------------------------
+
+	AURORA_REGISTER_CLASS(WavefrontPathRenderer, "WavefrontPath")
+
+	WavefrontPathRenderer::WavefrontPathRenderer(const PropertyTreeNode &node)
+		: PathRenderer(node), m_batchSize(node.getPropertyList().getInteger("BatchSize", 1 << 16))
+	{
+		//Note: the stages implement the plain estimator of PathRenderer, its other techniques are switched off
+		if (m_directCandidates > 0)
+		{
+			LOG(WARNING) << "Resampled direct lighting is ignored by the wavefront path tracer";
+			m_directCandidates = 0;
+		}
+		if (m_guiding)
+		{
+			LOG(WARNING) << "Path guiding is ignored by the wavefront path tracer";
+			m_guiding = false;
+		}
+		if (m_radianceCaching)
+		{
+			LOG(WARNING) << "Radiance caching is ignored by the wavefront path tracer";
+			m_radianceCaching = false;
+		}
+		if (m_rouletteStrategy != "classic")
+		{
+			LOG(WARNING) << "Russian roulette \"" << m_rouletteStrategy << "\" is ignored by the wavefront path tracer, using \"classic\"";
+			m_rouletteStrategy = "classic";
+		}
+		if (m_pathSpaceFiltering)
+		{
+			LOG(WARNING) << "Path space filtering is ignored by the wavefront path tracer";
+			m_pathSpaceFiltering = false;
+		}
+		LOG_IF(WARNING, m_progressive) << "Progressive rendering is ignored by the wavefront path tracer";
+		LOG_IF(WARNING, !m_checkpoint.empty()) << "Checkpoints are ignored by the wavefront path tracer";
+		LOG_IF(WARNING, m_sampler->isAdaptive()) << "Adaptive sampling is ignored by the wavefront path tracer, "
+			<< "every pixel takes " << m_sampler->samplesPerPixel << " samples";
+
+		activate();
+	}
+
+	void WavefrontPathRenderer::PathStates::resize(size_t n)
+	{
+		pixel.resize(n);
+		pFilm.resize(n);
+		rayWeight.resize(n);
+		L.resize(n);
+		beta.resize(n);
+		bounces.resize(n);
+		specularBounce.resize(n);
+		etaScale.resize(n);
+		footprint.resize(n);
+		spread.resize(n);
+		lodLevel.resize(n);
+		isect.resize(n);
+		prevVertex.resize(n);
+		bsdfPdf.resize(n);
+	}
+
+	void WavefrontPathRenderer::render(const Scene &scene)
+	{
+		renderFeatures(scene, *m_camera);
+
+		BBox2i sampleBounds = m_camera->m_film->getSampleBounds();
+		Vec2i sampleExtent = sampleBounds.diagonal();
+		constexpr int tileSize = 16;
+		Vec2i nTiles((sampleExtent.x + tileSize - 1) / tileSize, (sampleExtent.y + tileSize - 1) / tileSize);
+		const int nTotalTiles = nTiles.x * nTiles.y;
+
+		//Note: a batch is made of whole tiles, so that a tile is merged into the film only once
+		const int tilesPerBatch = glm::max(1, m_batchSize / (tileSize * tileSize));
+
+		AReporter reporter(nTotalTiles, "Rendering");
+
+		//Note: the stages of all the bounces run on the same threads
+		m_pool.reset(new WorkerPool());
+
+		PathStates paths;
+		std::vector<std::unique_ptr<Sampler>> samplers;
+		RayQueue rayQueues[2], shadowQueue;
+		std::vector<int> hits;
+
+		for (int batchBegin = 0; batchBegin < nTotalTiles; batchBegin += tilesPerBatch)
+		{
+			const int batchEnd = glm::min(batchBegin + tilesPerBatch, nTotalTiles);
+
+			// Gather the pixels of the batch tile after tile
+			std::vector<std::unique_ptr<FilmTile>> filmTiles;
+			std::vector<size_t> tileOffsets;
+			std::vector<Vec2i> pixels;
+			for (int t = batchBegin; t < batchEnd; ++t)
+			{
+				Vec2i tile(t % nTiles.x, t / nTiles.x);
+				int x0 = sampleBounds.m_pMin.x + tile.x * tileSize;
+				int x1 = glm::min(x0 + tileSize, sampleBounds.m_pMax.x);
+				int y0 = sampleBounds.m_pMin.y + tile.y * tileSize;
+				int y1 = glm::min(y0 + tileSize, sampleBounds.m_pMax.y);
+				BBox2i tileBounds(Vec2i(x0, y0), Vec2i(x1, y1));
+
+				filmTiles.push_back(m_camera->m_film->getFilmTile(tileBounds));
+				tileOffsets.push_back(pixels.size());
+				for (Vec2i pixel : tileBounds)
+					pixels.push_back(pixel);
+			}
+			tileOffsets.push_back(pixels.size());
+
+			const size_t nPaths = pixels.size();
+			paths.resize(nPaths);
+			paths.pixel = pixels;
+			rayQueues[0].reserve(nPaths);
+			rayQueues[1].reserve(nPaths);
+			shadowQueue.reserve(nPaths);
+
+			// Every path of the batch owns a sampler seeded by its pixel
+			samplers.resize(nPaths);
+			parallelForChunks(*m_pool, nPaths, [&](size_t begin, size_t end)
+			{
+				for (size_t i = begin; i < end; ++i)
+				{
+					const Vec2i &pixel = paths.pixel[i];
+					int seed = (pixel.y - sampleBounds.m_pMin.y) * sampleExtent.x + (pixel.x - sampleBounds.m_pMin.x);
+					samplers[i] = m_sampler->clone(seed);
+					samplers[i]->startPixel(pixel);
+				}
+			});
+
+			// One wave of paths per sample index
+			for (int64_t sampleIndex = 0; sampleIndex < m_sampler->samplesPerPixel; ++sampleIndex)
+			{
+				if (sampleIndex > 0)
+				{
+					parallelForChunks(*m_pool, nPaths, [&](size_t begin, size_t end)
+					{
+						for (size_t i = begin; i < end; ++i)
+							samplers[i]->startNextSample();
+					});
+				}
+
+				int current = 0;
+				rayQueues[current].clear();
+				generateCameraRays(paths, samplers, rayQueues[current]);
+
+				while (rayQueues[current].size() > 0)
+				{
+					RayQueue &rayQueue = rayQueues[current];
+					RayQueue &nextQueue = rayQueues[current ^ 1];
+					nextQueue.clear();
+					shadowQueue.clear();
+
+					intersect(scene, paths, rayQueue, hits);
+					sortHits(paths, hits);
+					shade(scene, paths, samplers, hits, shadowQueue, nextQueue);
+					traceShadowRays(scene, paths, shadowQueue);
+
+					current ^= 1;
+				}
+
+				// Add the radiance of the wave to the film tiles
+				m_pool->parallelFor(filmTiles.size(), [&](size_t t)
+				{
+					for (size_t i = tileOffsets[t]; i < tileOffsets[t + 1]; ++i)
+					{
+						Spectrum L = paths.L[i];
+
+						// Discard invalid radiance
+						if (L.hasNaNs() || L.luminance() < -1e-5 || std::isinf(L.luminance()))
+						{
+							L = Spectrum(0.f);
+						}
+
+						filmTiles[t]->addSample(paths.pFilm[i], L, paths.rayWeight[i]);
+					}
+				});
+			}
+
+			for (auto &filmTile : filmTiles)
+			{
+				m_camera->m_film->mergeFilmTile(std::move(filmTile));
+				reporter.update();
+			}
+		}
+
+		reporter.done();
+		m_pool.reset();
+
+		m_camera->m_film->writeImageToFile();
+	}
+
+	void WavefrontPathRenderer::generateCameraRays(PathStates &paths,
+		std::vector<std::unique_ptr<Sampler>> &samplers, RayQueue &rayQueue) const
+	{
+		parallelForChunks(*m_pool, paths.pixel.size(), [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				CameraSample cameraSample = samplers[i]->getCameraSample(paths.pixel[i]);
+
+				Ray ray;
+				Float rayWeight = m_camera->castingRay(cameraSample, ray);
+
+				paths.pFilm[i] = cameraSample.pFilm;
+				paths.rayWeight[i] = rayWeight;
+				paths.L[i] = Spectrum(0.f);
+				paths.beta[i] = Spectrum(1.f);
+				paths.bounces[i] = 0;
+				paths.specularBounce[i] = false;
+				paths.etaScale[i] = 1;
+				paths.footprint[i] = 0;
+				paths.spread[i] = 0;
+				paths.lodLevel[i] = 0;
+				paths.bsdfPdf[i] = 0;
+
+				if (rayWeight > 0)
+					rayQueue.push(ray, (int)i);
+			}
+		});
+	}
+
+	void WavefrontPathRenderer::intersect(const Scene &scene, PathStates &paths,
+		const RayQueue &rayQueue, std::vector<int> &hits) const
+	{
+		hits.resize(rayQueue.size());
+		parallelForChunks(*m_pool, rayQueue.size(), [&](size_t begin, size_t end)
+		{
+			for (size_t slot = begin; slot < end; ++slot)
+			{
+				const int path = rayQueue.getPathIndex(slot);
+				const Ray ray = rayQueue.getRay(slot);
+
+				SurfaceInteraction &isect = paths.isect[path];
+				isect = SurfaceInteraction();
+				if (scene.hit(ray, isect, paths.lodLevel[path]))
+				{
+					paths.footprint[path] += paths.spread[path] * distance(ray.origin(), isect.p);
+					hits[slot] = path;
+					continue;
+				}
+
+				// The path escapes, add the emission of the infinite lights
+				hits[slot] = -1;
+				const Spectrum &beta = paths.beta[path];
+				for (const auto &light : scene.m_infiniteLights)
+				{
+					Spectrum Le = light->Le(ray);
+					if (Le.isBlack())
+						continue;
+
+					if (paths.bounces[path] == 0 || paths.specularBounce[path])
+					{
+						paths.L[path] += beta * Le;
+					}
+					else
+					{
+						Float lightPdf = lightSelectionPdf(scene, light.get(), paths.prevVertex[path]) *
+							light->pdf_Li(paths.prevVertex[path], ray.direction());
+						paths.L[path] += beta * Le * powerHeuristic(1, paths.bsdfPdf[path], 1, lightPdf);
+					}
+				}
+			}
+		});
+
+		hits.erase(std::remove(hits.begin(), hits.end(), -1), hits.end());
+	}
+
+	void WavefrontPathRenderer::sortHits(const PathStates &paths, std::vector<int> &hits) const
+	{
+		struct ShadingKey
+		{
+			uintptr_t material;
+			uintptr_t hitable;
+			int path;
+		};
+
+		const size_t n = hits.size();
+		std::vector<ShadingKey> keys(n);
+		parallelForChunks(*m_pool, n, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				const Hitable *hitable = paths.isect[hits[i]].hitable;
+				keys[i] = { (uintptr_t)hitable->getMaterial(), (uintptr_t)hitable, hits[i] };
+			}
+		});
+
+		auto less = [](const ShadingKey &a, const ShadingKey &b)
+		{
+			if (a.material != b.material)
+				return a.material < b.material;
+			return a.hitable != b.hitable ? a.hitable < b.hitable : a.path < b.path;
+		};
+
+		// Sort a run per thread, then merge neighbouring runs in parallel until one is left
+		const size_t nRuns = glm::max((size_t)1, glm::min((size_t)m_pool->numThreads(), n / stageChunkSize));
+		const size_t runSize = (n + nRuns - 1) / nRuns;
+		m_pool->parallelFor(nRuns, [&](size_t run)
+		{
+			const size_t begin = glm::min(run * runSize, n);
+			std::sort(keys.begin() + begin, keys.begin() + glm::min(begin + runSize, n), less);
+		});
+		for (size_t width = runSize; width < n; width *= 2)
+		{
+			m_pool->parallelFor((n + 2 * width - 1) / (2 * width), [&](size_t pair)
+			{
+				const size_t begin = pair * 2 * width;
+				const size_t mid = glm::min(begin + width, n);
+				std::inplace_merge(keys.begin() + begin, keys.begin() + mid, keys.begin() + glm::min(mid + width, n), less);
+			});
+		}
+
+		parallelForChunks(*m_pool, n, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+				hits[i] = keys[i].path;
+		});
+	}
+
+	void WavefrontPathRenderer::shade(const Scene &scene, PathStates &paths,
+		std::vector<std::unique_ptr<Sampler>> &samplers, const std::vector<int> &hits,
+		RayQueue &shadowQueue, RayQueue &nextQueue) const
+	{
+		const int nLights = (int)scene.m_lights.size();
+
+		parallelForChunks(*m_pool, hits.size(), [&](size_t begin, size_t end)
+		{
+			MemoryArena arena;
+			for (size_t h = begin; h < end; ++h)
+			{
+				const int path = hits[h];
+				SurfaceInteraction &isect = paths.isect[path];
+				Sampler &sampler = *samplers[path];
+				Spectrum &beta = paths.beta[path];
+				const int bounces = paths.bounces[path];
+				const Vec3f wo = isect.wo;
+
+				// Add the emission found by the ray
+				Spectrum Le = isect.Le(wo);
+				if (!Le.isBlack())
+				{
+					if (bounces == 0 || paths.specularBounce[path])
+					{
+						paths.L[path] += beta * Le;
+					}
+					else
+					{
+						//Note: the light sampling strategy of the previous vertex could have sampled this light too
+						const AreaLight *light = isect.hitable->getAreaLight();
+						Float lightPdf = lightSelectionPdf(scene, light, paths.prevVertex[path]) *
+							light->pdf_Li(paths.prevVertex[path], -wo, isect);
+						paths.L[path] += beta * Le * powerHeuristic(1, paths.bsdfPdf[path], 1, lightPdf);
+					}
+				}
+
+				if (bounces >= m_maxDepth)
+					continue;
+
+				Ray ray(isect.p, -wo);
+				isect.computeScatteringFunctions(ray, arena, true);
+
+				// The surface only bounds a medium and does not scatter, the path passes through it
+				if (!isect.bsdf)
+				{
+					nextQueue.push(isect.spawnRay(-wo), path);
+					continue;
+				}
+
+				const int lodLevel = paths.lodLevel[path];
+
+				// Sample one light and queue the shadow ray that decides whether its radiance arrives
+				if (nLights > 0 && isect.bsdf->numComponents(ABxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+				{
+					int lightIndex;
+					Float selectionPdf;
+					if (m_lightDistribution != nullptr)
+					{
+						lightIndex = m_lightDistribution->sample(isect.p, isect.n, sampler.get1D(), selectionPdf);
+						if (lightIndex < 0)
+							selectionPdf = 0;
+					}
+					else
+					{
+						lightIndex = glm::min((int)(sampler.get1D() * nLights), nLights - 1);
+						selectionPdf = Float(1) / nLights;
+					}
+
+					const Light &light = *scene.m_lights[glm::max(lightIndex, 0)];
+					Vec3f wi;
+					Float lightPdf = 0;
+					VisibilityTester visibility;
+					Spectrum Li = selectionPdf > 0 ? light.sample_Li(isect, sampler.get2D(), wi, lightPdf, visibility) : Spectrum(0.f);
+					if (lightPdf > 0 && !Li.isBlack())
+					{
+						Spectrum f = isect.bsdf->f(wo, wi) * absDot(wi, isect.n);
+						if (!f.isBlack())
+						{
+							lightPdf *= selectionPdf;
+							Float weight = isDeltaLight(light.m_flags) ? 1 : powerHeuristic(1, lightPdf, 1, isect.bsdf->pdf(wo, wi));
+							Spectrum Ld = beta * f * Li * weight / lightPdf;
+							shadowQueue.push(visibility.P0().spawnRayTo(visibility.P1()), path, lodLevel, Ld);
+						}
+					}
+				}
+
+				// Sample BSDF to get new path direction, which is the BSDF sample of the light estimate as well
+				Vec3f wi;
+				Float pdf;
+				ABxDFType flags;
+				Spectrum f = isect.bsdf->sample_f(wo, wi, sampler.get2D(), pdf, flags, BSDF_ALL);
+				if (f.isBlack() || pdf == 0.f)
+					continue;
+				beta *= f * absDot(wi, isect.n) / pdf;
+
+				DCHECK(!glm::isinf(beta.luminance()));
+
+				const bool specularBounce = (flags & BSDF_SPECULAR) != 0;
+				paths.specularBounce[path] = specularBounce;
+				if ((flags & BSDF_SPECULAR) && (flags & BSDF_TRANSMISSION))
+				{
+					Float eta = isect.bsdf->m_eta;
+					paths.etaScale[path] *= (dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
+				}
+
+				paths.prevVertex[path] = isect;
+				paths.bsdfPdf[path] = pdf;
+
+				// Widen the footprint and pick the geometry level of detail as PathRenderer does
+				if (!specularBounce)
+				{
+					paths.spread[path] = glm::min(paths.spread[path] + glm::sqrt(1 / (Pi * pdf)), (Float)1);
+				}
+				paths.lodLevel[path] = (bounces >= 2 && !specularBounce && scene.numLodLevels() > 1) ?
+					scene.selectLodLevel(paths.footprint[path]) : 0;
+
+				// Possibly terminate the path with Russian roulette
+				Spectrum rrBeta = beta * paths.etaScale[path];
+				if (rrBeta.maxComponentValue() < m_rrThreshold && bounces > 3)
+				{
+					Float q = glm::max((Float).05f, 1 - rrBeta.maxComponentValue());
+					if (sampler.get1D() < q)
+						continue;
+					beta /= 1 - q;
+				}
+
+				paths.bounces[path] = bounces + 1;
+				nextQueue.push(isect.spawnRay(wi), path);
+			}
+		});
+	}
+
+	void WavefrontPathRenderer::traceShadowRays(const Scene &scene, PathStates &paths,
+		const RayQueue &shadowQueue) const
+	{
+		//Note: a path queues at most one shadow ray per bounce, so the radiance is added without races
+		parallelForChunks(*m_pool, shadowQueue.size(), [&](size_t begin, size_t end)
+		{
+			for (size_t slot = begin; slot < end; ++slot)
+			{
+				if (!scene.hit(shadowQueue.getRay(slot), shadowQueue.getLodLevel(slot)))
+					paths.L[shadowQueue.getPathIndex(slot)] += shadowQueue.getLd(slot);
+			}
+		});
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef ARWAVEFRONT_RENDER_H
+#define ARWAVEFRONT_RENDER_H
+
+#include "Render/Render.h"
+#include "Utils/Parallel.h"
+#include "Utils/Interaction.h"
+
+#include <atomic>
+#include <vector>
+
+namespace RT
+{
+	//! @brief Rays of one wavefront stage stored as structure of arrays.
+	/**
+	 * The arrays are allocated once for the whole batch and filled concurrently, a push only
+	 * seizes the next slot through an atomic counter.
+	 */
+	class RayQueue final
+	{
+	public:
+		void reserve(size_t capacity);
+		void clear() { m_size = 0; }
+		size_t size() const { return m_size; }
+
+		void push(const Ray &ray, int pathIndex, int lodLevel = 0, const Spectrum &Ld = Spectrum(0.f));
+
+		Ray getRay(size_t slot) const;
+		int getPathIndex(size_t slot) const { return m_pathIndex[slot]; }
+		int getLodLevel(size_t slot) const { return m_lodLevel[slot]; }
+		const Spectrum &getLd(size_t slot) const { return m_Ld[slot]; }
+
+	private:
+		std::vector<Vec3f> m_origin, m_direction;
+		std::vector<Float> m_tMax;
+		std::vector<int> m_pathIndex, m_lodLevel, m_originLodLevel;
+		//Note: only used by shadow rays, the unoccluded radiance they carry
+		std::vector<Spectrum> m_Ld;
+		std::atomic<size_t> m_size{ 0 };
+	};
+
+	//! @brief Path tracer that advances a whole batch of paths one stage at a time.
+	/**
+	 * Camera rays of a set of tiles are generated at once, then every bounce runs the batched
+	 * stages intersect, shade, trace shadow rays and extend over queues of rays. The hit points
+	 * are sorted by material and hitable before shading, so that the shading of a stage touches
+	 * one material after the other. The estimator is the one of PathRenderer, except that the
+	 * BSDF sample of the next event estimation is the continuation ray of the path as well.
+	 * The other techniques of PathRenderer, progressive rendering, checkpoints and adaptive
+	 * sampling are not supported and are ignored with a warning.
+	 */
+	class WavefrontPathRenderer final : public PathRenderer
+	{
+	public:
+		typedef std::shared_ptr<WavefrontPathRenderer> ptr;
+
+		WavefrontPathRenderer(const PropertyTreeNode &node);
+
+		virtual void render(const Scene &scene) override;
+
+		virtual std::string toString() const override { return "WavefrontPathRenderer[]"; }
+
+	private:
+		//State of the paths of a batch, indexed by path
+		struct PathStates
+		{
+			void resize(size_t n);
+
+			std::vector<Vec2i> pixel;
+			std::vector<Vec2f> pFilm;
+			std::vector<Float> rayWeight;
+			std::vector<Spectrum> L, beta;
+			std::vector<int> bounces;
+			std::vector<char> specularBounce;
+			std::vector<Float> etaScale;
+			std::vector<Float> footprint, spread;
+			std::vector<int> lodLevel;
+			std::vector<SurfaceInteraction> isect;
+
+			//Previous vertex and BSDF pdf for the MIS weights of emission found by the continuation ray
+			std::vector<Interaction> prevVertex;
+			std::vector<Float> bsdfPdf;
+		};
+
+		void generateCameraRays(PathStates &paths, std::vector<std::unique_ptr<Sampler>> &samplers,
+			RayQueue &rayQueue) const;
+
+		void intersect(const Scene &scene, PathStates &paths, const RayQueue &rayQueue,
+			std::vector<int> &hits) const;
+
+		void sortHits(const PathStates &paths, std::vector<int> &hits) const;
+
+		void shade(const Scene &scene, PathStates &paths, std::vector<std::unique_ptr<Sampler>> &samplers,
+			const std::vector<int> &hits, RayQueue &shadowQueue, RayQueue &nextQueue) const;
+
+		void traceShadowRays(const Scene &scene, PathStates &paths, const RayQueue &shadowQueue) const;
+
+		int m_batchSize;
+		std::unique_ptr<WorkerPool> m_pool;
+	};
+}
+
+#endif
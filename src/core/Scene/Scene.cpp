@@ -2,16 +2,46 @@
 
 namespace RT
 {
-	bool Scene::hit(const Ray &ray, SurfaceInteraction &isect) const
+	bool Scene::hit(const Ray &ray, SurfaceInteraction &isect, int lodLevel) const
 	{
 		//DCHECK_NE(ray.direction(), Vec3f(0, 0, 0));
-		return m_aggreShape->hit(ray, isect);
+		if (lodLevel <= 0)
+			return m_aggreShape->hit(ray, isect);
+
+		Ray lodRay(ray);
+		lodRay.m_lodLevel = lodLevel;
+		if (!m_aggreShape->hit(lodRay, isect))
+			return false;
+		ray.m_tMax = lodRay.m_tMax;
+		return true;
 	}
 
-	bool Scene::hit(const Ray &ray) const
+	bool Scene::hit(const Ray &ray, int lodLevel) const
 	{
 		//DCHECK_NE(ray.direction(), Vec3f(0, 0, 0));
-		return m_aggreShape->hit(ray);
+		if (lodLevel <= 0)
+			return m_aggreShape->hit(ray);
+
+		Ray lodRay(ray);
+		lodRay.m_lodLevel = lodLevel;
+		return m_aggreShape->hit(lodRay);
+	}
+
+	void Scene::setLevelsOfDetail(const std::vector<Float> &featureSizes)
+	{
+		m_lodFeatureSizes = featureSizes;
+	}
+
+	int Scene::selectLodLevel(Float footprint) const
+	{
+		int level = 0;
+		for (int i = 1; i < (int)m_lodFeatureSizes.size(); ++i)
+		{
+			if (m_lodFeatureSizes[i] > footprint)
+				break;
+			level = i;
+		}
+		return level;
 	}
 
 	bool Scene::hitTr(Ray ray, Sampler &sampler, SurfaceInteraction &isect, Spectrum &Tr) const
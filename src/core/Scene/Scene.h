@@ -30,10 +30,20 @@ namespace RT
 
 		const BBox3f &worldBound() const { return m_worldBound; }
 
-		bool hit(const Ray &ray) const;
-		bool hit(const Ray &ray, SurfaceInteraction &isect) const;
+		//Note: |lodLevel| selects the geometry level of detail, 0 is the full resolution
+		bool hit(const Ray &ray, int lodLevel = 0) const;
+		bool hit(const Ray &ray, SurfaceInteraction &isect, int lodLevel = 0) const;
 		bool hitTr(Ray ray, Sampler &sampler, SurfaceInteraction &isect, Spectrum &transmittance) const;
 
+		//Note: the levels themselves are kept by the hitables of the meshes, |featureSizes| holds the
+		//      typical triangle size per level
+		void setLevelsOfDetail(const std::vector<Float> &featureSizes);
+
+		int numLodLevels() const { return glm::max(1, (int)m_lodFeatureSizes.size()); }
+
+		//Choose the coarsest level whose triangles are still smaller than the given footprint
+		int selectLodLevel(Float footprint) const;
+
 		std::vector<Light::ptr> m_lights;
 		// 
 		std::vector<Light::ptr> m_infiniteLights;
@@ -42,6 +52,7 @@ namespace RT
 		// Scene Private Data
 		BBox3f m_worldBound;
 		HitableAggregate::ptr m_aggreShape;
+		std::vector<Float> m_lodFeatureSizes;
 		std::vector<Entity::ptr> m_entities;
 	};
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "Scene/SceneParser.h"
 
 #include <fstream>
+#include <unordered_set>
 
 #include "Object/Film.h"
 #include "Render/Sampler.h"
@@ -10,6 +11,9 @@
 #include "Material/Material.h"
 #include "Render/Light.h"
 #include "Accelerators/KDTree.h"
+#include "Utils/Parallel.h"
+#include "Utils/GeometryCache.h"
+#include "Utils/MeshSimplifier.h"
 //#include "accelerators/LinearAggregate.h"
 
 using namespace nlohmann;
@@ -130,6 +134,19 @@ namespace RT
 				rendererNode.getTypeName(), rendererNode)));
 		}
 
+		//λ棨ѡڼʵ֮ǰ
+		if (_scene_json.contains("GeometryCache"))
+		{
+			PropertyTreeNode cacheNode = build_tree_func("GeometryCache", _scene_json["GeometryCache"]);
+			const auto &cacheProps = cacheNode.getPropertyList();
+			auto &cache = GeometryCache::instance();
+			cache.setEnabled(cacheProps.getBoolean("Enable", true));
+			//Note: the memory budget is given in megabytes, 0 means unlimited
+			cache.setMemoryBudget(size_t(cacheProps.getInteger("MemoryBudget", 0)) << 20);
+			cache.setDirectory(PropertyTreeNode::m_directory + cacheProps.getString("Directory", ""));
+			LOG(INFO) << "Out-of-core geometry with a budget of " << cacheProps.getInteger("MemoryBudget", 0) << " MB";
+		}
+
 		std::vector<Light::ptr> _lights;
 		std::vector<Entity::ptr> _entities;
 		std::vector<Hitable::ptr> _hitables;
@@ -141,16 +158,28 @@ namespace RT
 				LOG(ERROR) << "There is no Entity in " << path;
 			}
 			const auto &entities_json = _scene_json["Entity"];
+
+			//ȡʵĲ
+			std::vector<PropertyTreeNode> entityNodes;
+			entityNodes.reserve(entities_json.size());
 			for (int i = 0; i < entities_json.size(); ++i)
 			{
-				//ȡʵĲ
-				PropertyTreeNode entityNode = build_tree_func("Entity", entities_json[i]);
+				entityNodes.push_back(build_tree_func("Entity", entities_json[i]));
+			}
 
-				//ʵ
-				Entity::ptr entity = Entity::ptr(static_cast<Entity*>(ObjectFactory::createInstance(
+			//йʵ壨ػ
+			//Note: each entity is written to its own slot so that the order of _hitables
+			//      and _lights stays the same as in the scene file regardless of scheduling.
+			_entities.resize(entityNodes.size());
+			ParallelUtils::parallelFor((size_t)0, entityNodes.size(), [&](const size_t &i)
+			{
+				const PropertyTreeNode &entityNode = entityNodes[i];
+				_entities[i] = Entity::ptr(static_cast<Entity*>(ObjectFactory::createInstance(
 					entityNode.getTypeName(), entityNode)));
-				_entities.push_back(entity);
-			}
+			}, ExecutionPolicy::APARALLEL);
+
+			//Note: the simplified levels are only shared while the entities are built
+			MeshLodCache::instance().clear();
 
 			//ȡʵеĿײ
 			for (auto &entity : _entities)
@@ -163,9 +192,12 @@ namespace RT
 
 
 
+			//Note: hitables of the same emissive mesh share one light, add it only once
+			std::unordered_set<const AreaLight*> _addedLights;
 			for (int i = 0; i < _hitables.size(); ++i)
 			{
-				if (_hitables[i]->getAreaLight() != nullptr)
+				const AreaLight *areaLight = _hitables[i]->getAreaLight();
+				if (areaLight != nullptr && _addedLights.insert(areaLight).second)
 				{
 					_lights.push_back(Light::ptr(dynamic_cast<HitableObject*>(_hitables[i].get())->getAreaLightPtr()));
 				}
@@ -176,6 +208,31 @@ namespace RT
 		KdTree::ptr _aggregate = std::make_shared<KdTree>(_hitables);
 		_scene = std::make_shared<Scene>(_entities, _aggregate, _lights);
 
+		//LODÿĸԼĿײУֻ¼ߴ
+		int _lodLevels = 1;
+		for (const auto &entity : _entities)
+		{
+			_lodLevels = glm::max(_lodLevels, entity->numLodLevels());
+		}
+		if (_lodLevels > 1)
+		{
+			std::vector<Float> _featureSizes;
+			for (int level = 0; level < _lodLevels; ++level)
+			{
+				//Note: the feature size only accounts for the simplified meshes
+				double _area = 0;
+				size_t _count = 0;
+				for (const auto &entity : _entities)
+				{
+					_area += entity->getLodArea(level);
+					_count += entity->getLodTriangles(level);
+				}
+				_featureSizes.push_back(_count > 0 ? (Float)glm::sqrt(2 * _area / _count) : 0);
+				LOG(INFO) << "Level of detail " << level << " with a feature size of " << _featureSizes.back();
+			}
+			_scene->setLevelsOfDetail(_featureSizes);
+		}
+
 	}
 
 }
\ No newline at end of file
@@ -0,0 +1,432 @@
+#include "Shape/CurveShape.h"
+
+#include "Utils/Interaction.h"
+
+#include <fstream>
+#include <cstring>
+
+namespace RT
+{
+	//-------------------------------------------Bezier-------------------------------------
+
+	static Vec3f blossomBezier(const Vec3f p[4], Float u0, Float u1, Float u2)
+	{
+		Vec3f a[3] = { lerp(u0, p[0], p[1]), lerp(u0, p[1], p[2]), lerp(u0, p[2], p[3]) };
+		Vec3f b[2] = { lerp(u1, a[0], a[1]), lerp(u1, a[1], a[2]) };
+		return lerp(u2, b[0], b[1]);
+	}
+
+	static void subdivideBezier(const Vec3f cp[4], Vec3f cpSplit[7])
+	{
+		cpSplit[0] = cp[0];
+		cpSplit[1] = (cp[0] + cp[1]) / Float(2);
+		cpSplit[2] = (cp[0] + Float(2) * cp[1] + cp[2]) / Float(4);
+		cpSplit[3] = (cp[0] + Float(3) * cp[1] + Float(3) * cp[2] + cp[3]) / Float(8);
+		cpSplit[4] = (cp[1] + Float(2) * cp[2] + cp[3]) / Float(4);
+		cpSplit[5] = (cp[2] + cp[3]) / Float(2);
+		cpSplit[6] = cp[3];
+	}
+
+	static Vec3f evalBezier(const Vec3f cp[4], Float u, Vec3f *deriv = nullptr)
+	{
+		Vec3f cp1[3] = { lerp(u, cp[0], cp[1]), lerp(u, cp[1], cp[2]), lerp(u, cp[2], cp[3]) };
+		Vec3f cp2[2] = { lerp(u, cp1[0], cp1[1]), lerp(u, cp1[1], cp1[2]) };
+		if (deriv != nullptr)
+		{
+			// Note: the derivative vanishes at a degenerated end point, fall back to the chord
+			if (lengthSquared(cp2[1] - cp2[0]) > 0)
+				*deriv = Float(3) * (cp2[1] - cp2[0]);
+			else
+				*deriv = cp[3] - cp[0];
+		}
+		return lerp(u, cp2[0], cp2[1]);
+	}
+
+	CurveType toCurveType(const std::string &name)
+	{
+		if (name == "Flat")
+			return CurveType::Flat;
+		if (name == "Cylinder")
+			return CurveType::Cylinder;
+		LOG(ERROR) << "Unknown curve type " << name << ", using Flat";
+		return CurveType::Flat;
+	}
+
+	//-------------------------------------------HairFile-------------------------------------
+
+	void loadHairFile(const std::string &filename, Float defaultWidth,
+		std::vector<std::vector<Vec3f>> &strands, std::vector<std::vector<Float>> &widths)
+	{
+		// Header layout of the .hair format, 128 bytes in total
+		struct HairHeader
+		{
+			char signature[4];
+			uint32_t hairCount;
+			uint32_t pointCount;
+			uint32_t arrays;
+			uint32_t defaultSegments;
+			float defaultThickness;
+			float defaultTransparency;
+			float defaultColor[3];
+			char info[88];
+		};
+		static_assert(sizeof(HairHeader) == 128, "Unexpected .hair header size");
+
+		enum { SegmentsArray = 1, PointsArray = 2, ThicknessArray = 4 };
+
+		std::ifstream infile(filename, std::ios::binary);
+		if (!infile)
+		{
+			LOG(FATAL) << "Could not open the hair file " << filename;
+		}
+
+		HairHeader header;
+		infile.read(reinterpret_cast<char*>(&header), sizeof(HairHeader));
+		if (!infile || std::strncmp(header.signature, "HAIR", 4) != 0)
+		{
+			LOG(FATAL) << filename << " is not a valid hair file";
+		}
+		if (!(header.arrays & PointsArray))
+		{
+			LOG(FATAL) << "There is no point in the hair file " << filename;
+		}
+
+		std::vector<uint16_t> segments(header.hairCount, (uint16_t)header.defaultSegments);
+		if (header.arrays & SegmentsArray)
+		{
+			infile.read(reinterpret_cast<char*>(segments.data()), segments.size() * sizeof(uint16_t));
+		}
+
+		std::vector<float> points(3 * header.pointCount);
+		infile.read(reinterpret_cast<char*>(points.data()), points.size() * sizeof(float));
+
+		// Note: the thickness is the diameter of the strand
+		std::vector<float> thickness(header.pointCount,
+			header.defaultThickness > 0 ? header.defaultThickness : (float)defaultWidth);
+		if (header.arrays & ThicknessArray)
+		{
+			infile.read(reinterpret_cast<char*>(thickness.data()), thickness.size() * sizeof(float));
+		}
+
+		if (!infile)
+		{
+			LOG(FATAL) << "The hair file " << filename << " is truncated";
+		}
+
+		strands.clear();
+		widths.clear();
+		strands.reserve(header.hairCount);
+		widths.reserve(header.hairCount);
+		size_t offset = 0;
+		for (uint32_t i = 0; i < header.hairCount; ++i)
+		{
+			const size_t nPoints = size_t(segments[i]) + 1;
+			if (offset + nPoints > header.pointCount)
+			{
+				LOG(ERROR) << "The hair file " << filename << " has fewer points than its strands need";
+				break;
+			}
+
+			std::vector<Vec3f> strand(nPoints);
+			std::vector<Float> width(nPoints);
+			for (size_t j = 0; j < nPoints; ++j)
+			{
+				const size_t k = offset + j;
+				strand[j] = Vec3f(points[3 * k + 0], points[3 * k + 1], points[3 * k + 2]);
+				width[j] = thickness[k];
+			}
+			strands.push_back(std::move(strand));
+			widths.push_back(std::move(width));
+			offset += nPoints;
+		}
+
+		LOG(INFO) << "Loaded " << strands.size() << " strands with " << offset << " points from " << filename;
+	}
+
+	//-------------------------------------------CurveCommon-------------------------------------
+
+	CurveCommon::CurveCommon(const std::array<Vec3f, 4> &cp, Float width0, Float width1, CurveType type)
+		: m_type(type), m_cpObj(cp)
+	{
+		m_width[0] = width0;
+		m_width[1] = width1;
+	}
+
+	//-------------------------------------------ACurveShape-------------------------------------
+
+	AURORA_REGISTER_CLASS(ACurveShape, "Curve")
+
+	ACurveShape::ACurveShape(const PropertyTreeNode &node)
+		: Shape(node.getPropertyList()), m_uMin(0), m_uMax(1)
+	{
+		const auto &props = node.getPropertyList();
+		std::vector<Float> p = props.getVectorNf("P");
+		CHECK_EQ(p.size(), 12);
+
+		std::array<Vec3f, 4> cp;
+		for (int i = 0; i < 4; ++i)
+		{
+			cp[i] = Vec3f(p[3 * i + 0], p[3 * i + 1], p[3 * i + 2]);
+		}
+
+		const Float width = props.getFloat("Width", 1.0f);
+		m_common = std::make_shared<CurveCommon>(cp, props.getFloat("Width0", width), props.getFloat("Width1", width),
+			toCurveType(props.getString("CurveType", "Flat")));
+
+		activate();
+	}
+
+	ACurveShape::ACurveShape(Transform *objectToWorld, Transform *worldToObject,
+		const CurveCommon::ptr &common, Float uMin, Float uMax)
+		: Shape(objectToWorld, worldToObject), m_common(common), m_uMin(uMin), m_uMax(uMax) {}
+
+	std::vector<Shape::ptr> ACurveShape::createCurveSegments(Transform *objectToWorld, Transform *worldToObject,
+		const std::array<Vec3f, 4> &cp, Float width0, Float width1, CurveType type, int splitDepth)
+	{
+		CurveCommon::ptr common = std::make_shared<CurveCommon>(cp, width0, width1, type);
+		const int nSegments = 1 << splitDepth;
+		std::vector<Shape::ptr> segments;
+		segments.reserve(nSegments);
+		for (int i = 0; i < nSegments; ++i)
+		{
+			Float uMin = i / (Float)nSegments;
+			Float uMax = (i + 1) / (Float)nSegments;
+			segments.push_back(std::make_shared<ACurveShape>(objectToWorld, worldToObject, common, uMin, uMax));
+		}
+		return segments;
+	}
+
+	BBox3f ACurveShape::objectBound() const
+	{
+		// Compute object-space control points for curve segment
+		const Vec3f *cp = m_common->m_cpObj.data();
+		Vec3f cpObj[4];
+		cpObj[0] = blossomBezier(cp, m_uMin, m_uMin, m_uMin);
+		cpObj[1] = blossomBezier(cp, m_uMin, m_uMin, m_uMax);
+		cpObj[2] = blossomBezier(cp, m_uMin, m_uMax, m_uMax);
+		cpObj[3] = blossomBezier(cp, m_uMax, m_uMax, m_uMax);
+
+		// The convex hull property of Bezier curves bounds the segment by its control points
+		BBox3f bounds = unionBounds(BBox3f(cpObj[0], cpObj[1]), BBox3f(cpObj[2], cpObj[3]));
+		Float width[2] = { lerp(m_uMin, m_common->m_width[0], m_common->m_width[1]),
+			lerp(m_uMax, m_common->m_width[0], m_common->m_width[1]) };
+		const Float halfWidth = glm::max(width[0], width[1]) * 0.5f;
+		return BBox3f(bounds.m_pMin - Vec3f(halfWidth), bounds.m_pMax + Vec3f(halfWidth));
+	}
+
+	Float ACurveShape::area() const
+	{
+		// Approximate by the length of the control polygon times the average width
+		const Vec3f *cp = m_common->m_cpObj.data();
+		Vec3f cpObj[4];
+		cpObj[0] = blossomBezier(cp, m_uMin, m_uMin, m_uMin);
+		cpObj[1] = blossomBezier(cp, m_uMin, m_uMin, m_uMax);
+		cpObj[2] = blossomBezier(cp, m_uMin, m_uMax, m_uMax);
+		cpObj[3] = blossomBezier(cp, m_uMax, m_uMax, m_uMax);
+		Float width0 = lerp(m_uMin, m_common->m_width[0], m_common->m_width[1]);
+		Float width1 = lerp(m_uMax, m_common->m_width[0], m_common->m_width[1]);
+		Float avgWidth = (width0 + width1) * 0.5f;
+		Float approxLength = 0.f;
+		for (int i = 0; i < 3; ++i)
+		{
+			approxLength += distance(cpObj[i], cpObj[i + 1]);
+		}
+		return approxLength * avgWidth;
+	}
+
+	Interaction ACurveShape::sample(const Vec2f &, Float &) const
+	{
+		LOG(FATAL) << "ACurveShape::sample() is not supported, curves can't be area lights";
+		return Interaction();
+	}
+
+	bool ACurveShape::hit(const Ray &ray) const { return intersect(ray, nullptr, nullptr); }
+
+	bool ACurveShape::hit(const Ray &ray, Float &tHit, SurfaceInteraction &isect) const
+	{
+		return intersect(ray, &tHit, &isect);
+	}
+
+	bool ACurveShape::intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect) const
+	{
+		// Transform Ray to object space
+		Ray ray = (*m_worldToObject)(r);
+
+		// Compute object-space control points for curve segment
+		const Vec3f *cp = m_common->m_cpObj.data();
+		Vec3f cpObj[4];
+		cpObj[0] = blossomBezier(cp, m_uMin, m_uMin, m_uMin);
+		cpObj[1] = blossomBezier(cp, m_uMin, m_uMin, m_uMax);
+		cpObj[2] = blossomBezier(cp, m_uMin, m_uMax, m_uMax);
+		cpObj[3] = blossomBezier(cp, m_uMax, m_uMax, m_uMax);
+
+		// Project the curve into the ray coordinate system, where the ray starts at the origin
+		// and points along +z. The y axis is chosen perpendicular to the curve's chord so that
+		// the curve is as flat as possible in y.
+		const Float rayLength = length(ray.direction());
+		if (rayLength == 0)
+			return false;
+
+		Vec3f frame[3];
+		frame[2] = ray.direction() / rayLength;
+		Vec3f dx = cross(ray.direction(), cpObj[3] - cpObj[0]);
+		if (lengthSquared(dx) == 0)
+		{
+			Vec3f dy;
+			coordinateSystem(frame[2], dx, dy);
+		}
+		frame[1] = normalize(dx);
+		frame[0] = cross(frame[1], frame[2]);
+
+		Vec3f cpRay[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			Vec3f d = cpObj[i] - ray.origin();
+			cpRay[i] = Vec3f(dot(d, frame[0]), dot(d, frame[1]), dot(d, frame[2]));
+		}
+
+		// Before going any further, see if the ray's bounding box intersects the curve's
+		Float maxWidth = glm::max(lerp(m_uMin, m_common->m_width[0], m_common->m_width[1]),
+			lerp(m_uMax, m_common->m_width[0], m_common->m_width[1]));
+		BBox3f curveBounds = unionBounds(BBox3f(cpRay[0], cpRay[1]), BBox3f(cpRay[2], cpRay[3]));
+		const Float halfWidth = 0.5f * maxWidth;
+		Float zMax = rayLength * ray.m_tMax;
+		if (curveBounds.m_pMin.x - halfWidth > 0 || curveBounds.m_pMax.x + halfWidth < 0 ||
+			curveBounds.m_pMin.y - halfWidth > 0 || curveBounds.m_pMax.y + halfWidth < 0 ||
+			curveBounds.m_pMin.z - halfWidth > zMax || curveBounds.m_pMax.z + halfWidth < 0)
+			return false;
+
+		// Compute refinement depth for curve, until the segments are flat within 5% of the width
+		Float L0 = 0;
+		for (int i = 0; i < 2; ++i)
+		{
+			L0 = glm::max(L0, glm::max(glm::max(
+				glm::abs(cpRay[i].x - 2 * cpRay[i + 1].x + cpRay[i + 2].x),
+				glm::abs(cpRay[i].y - 2 * cpRay[i + 1].y + cpRay[i + 2].y)),
+				glm::abs(cpRay[i].z - 2 * cpRay[i + 1].z + cpRay[i + 2].z)));
+		}
+
+		Float eps = glm::max(m_common->m_width[0], m_common->m_width[1]) * .05f;
+		Float r0 = 1.41421356237f * 6.f * L0 / (8.f * eps);
+		int maxDepth = r0 < 1 ? 0 : clamp((int)std::round(std::log2(r0)) / 2, 0, 10);
+
+		return recursiveIntersect(ray, tHit, isect, zMax, cpRay, frame, m_uMin, m_uMax, maxDepth);
+	}
+
+	bool ACurveShape::recursiveIntersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect, Float &zMax,
+		const Vec3f cp[4], const Vec3f frame[3], Float u0, Float u1, int depth) const
+	{
+		const Float rayLength = length(ray.direction());
+
+		if (depth > 0)
+		{
+			// Split curve segment into sub-segments and test for intersection
+			Vec3f cpSplit[7];
+			subdivideBezier(cp, cpSplit);
+
+			Float u[3] = { u0, (u0 + u1) / 2.f, u1 };
+			bool hit = false;
+			for (int seg = 0; seg < 2; ++seg)
+			{
+				const Vec3f *cps = cpSplit + 3 * seg;
+				Float maxWidth = glm::max(lerp(u[seg], m_common->m_width[0], m_common->m_width[1]),
+					lerp(u[seg + 1], m_common->m_width[0], m_common->m_width[1]));
+				const Float halfWidth = 0.5f * maxWidth;
+
+				// Skip the sub-segment if its bounds don't overlap the ray
+				if (glm::max(glm::max(cps[0].y, cps[1].y), glm::max(cps[2].y, cps[3].y)) + halfWidth < 0 ||
+					glm::min(glm::min(cps[0].y, cps[1].y), glm::min(cps[2].y, cps[3].y)) - halfWidth > 0)
+					continue;
+
+				if (glm::max(glm::max(cps[0].x, cps[1].x), glm::max(cps[2].x, cps[3].x)) + halfWidth < 0 ||
+					glm::min(glm::min(cps[0].x, cps[1].x), glm::min(cps[2].x, cps[3].x)) - halfWidth > 0)
+					continue;
+
+				if (glm::max(glm::max(cps[0].z, cps[1].z), glm::max(cps[2].z, cps[3].z)) + halfWidth < 0 ||
+					glm::min(glm::min(cps[0].z, cps[1].z), glm::min(cps[2].z, cps[3].z)) - halfWidth > zMax)
+					continue;
+
+				if (recursiveIntersect(ray, tHit, isect, zMax, cps, frame, u[seg], u[seg + 1], depth - 1))
+				{
+					hit = true;
+					// Any hit is enough for a shadow ray
+					if (tHit == nullptr)
+						return true;
+				}
+			}
+			return hit;
+		}
+
+		// Intersect ray with curve segment
+
+		// Test ray against segment endpoint boundaries
+		Float edge = (cp[1].y - cp[0].y) * -cp[0].y + cp[0].x * (cp[0].x - cp[1].x);
+		if (edge < 0)
+			return false;
+
+		edge = (cp[2].y - cp[3].y) * -cp[3].y + cp[3].x * (cp[3].x - cp[2].x);
+		if (edge < 0)
+			return false;
+
+		// Compute line w that gives minimum distance to sample point
+		Vec2f segmentDirection = Vec2f(cp[3]) - Vec2f(cp[0]);
+		Float denom = dot(segmentDirection, segmentDirection);
+		if (denom == 0)
+			return false;
+		Float w = dot(-Vec2f(cp[0]), segmentDirection) / denom;
+
+		// Compute u coordinate of curve intersection point and hitWidth
+		Float u = clamp(lerp(w, u0, u1), u0, u1);
+		Float hitWidth = lerp(u, m_common->m_width[0], m_common->m_width[1]);
+
+		// Test intersection point against curve width
+		Vec3f dpcdw;
+		Vec3f pc = evalBezier(cp, clamp(w, 0, 1), &dpcdw);
+		Float ptCurveDist2 = pc.x * pc.x + pc.y * pc.y;
+		if (ptCurveDist2 > hitWidth * hitWidth * .25f)
+			return false;
+		if (pc.z < 0 || pc.z > zMax)
+			return false;
+
+		// Keep the closest hit of all the sub-segments
+		zMax = pc.z;
+		if (tHit == nullptr)
+			return true;
+
+		// Compute v coordinate of curve intersection point
+		Float ptCurveDist = glm::sqrt(ptCurveDist2);
+		Float edgeFunc = dpcdw.x * -pc.y + pc.x * dpcdw.y;
+		Float v = (edgeFunc > 0) ? 0.5f + ptCurveDist / hitWidth : 0.5f - ptCurveDist / hitWidth;
+
+		// Compute dpdu and dpdv for curve intersection
+		Vec3f dpdu;
+		evalBezier(m_common->m_cpObj.data(), u, &dpdu);
+
+		// For flat and cylinder curves, dpdv is perpendicular to dpdu and the ray direction
+		Vec3f dpduPlane(dot(dpdu, frame[0]), dot(dpdu, frame[1]), dot(dpdu, frame[2]));
+		Vec2f dpduPlaneXY(dpduPlane.x, dpduPlane.y);
+		if (dot(dpduPlaneXY, dpduPlaneXY) == 0)
+			return false;
+		Vec3f dpdvPlane = Vec3f(normalize(Vec2f(-dpduPlane.y, dpduPlane.x)), 0) * hitWidth;
+		if (m_common->m_type == CurveType::Cylinder)
+		{
+			// Rotate dpdvPlane to give cylindrical appearance
+			Float theta = glm::radians(lerp(v, 90.f, -90.f));
+			Vec3f axis = normalize(dpduPlane);
+			dpdvPlane = dpdvPlane * glm::cos(theta) + cross(axis, dpdvPlane) * glm::sin(theta)
+				+ axis * dot(axis, dpdvPlane) * (1 - glm::cos(theta));
+		}
+		Vec3f dpdv = dpdvPlane.x * frame[0] + dpdvPlane.y * frame[1] + dpdvPlane.z * frame[2];
+
+		*tHit = pc.z / rayLength;
+		// Compute error bounds for curve intersection, the hit may lie anywhere across the width
+		SurfaceInteraction si(ray(*tHit), Vec2f(u, v), -ray.direction(), dpdu, dpdv, this);
+		si.pError = Vec3f(2 * hitWidth);
+
+		*isect = (*m_objectToWorld)(si);
+		isect->n = faceforward(isect->n, isect->wo);
+
+		return true;
+	}
+
+}
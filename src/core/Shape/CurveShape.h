@@ -0,0 +1,74 @@
+#ifndef ARCURVE_SHAPE_H
+#define ARCURVE_SHAPE_H
+
+#include "Shape/Shape.h"
+
+#include <array>
+
+namespace RT
+{
+	enum class CurveType { Flat, Cylinder };
+
+	//! @brief Control points and widths shared by all the segments of one cubic Bezier curve.
+	struct CurveCommon
+	{
+		typedef std::shared_ptr<CurveCommon> ptr;
+
+		CurveCommon(const std::array<Vec3f, 4> &cp, Float width0, Float width1, CurveType type);
+
+		const CurveType m_type;
+		std::array<Vec3f, 4> m_cpObj;
+		Float m_width[2];
+	};
+
+	//! @brief Segment [uMin, uMax] of a cubic Bezier curve with a varying width.
+	/**
+	 * Flat curves always face the ray, cylinder curves only fake a round cross section through the
+	 * shading normal. Both are intersected by recursively splitting the curve in ray space until
+	 * the segments are nearly linear, which keeps a hair strand at one primitive per segment.
+	 */
+	class ACurveShape final : public Shape
+	{
+	public:
+		typedef std::shared_ptr<ACurveShape> ptr;
+
+		ACurveShape(const PropertyTreeNode &node);
+		ACurveShape(Transform *objectToWorld, Transform *worldToObject,
+			const CurveCommon::ptr &common, Float uMin, Float uMax);
+
+		virtual ~ACurveShape() = default;
+
+		virtual Float area() const override;
+
+		virtual Interaction sample(const Vec2f &u, Float &pdf) const override;
+
+		virtual BBox3f objectBound() const override;
+
+		virtual bool hit(const Ray &ray) const override;
+		virtual bool hit(const Ray &ray, Float &tHit, SurfaceInteraction &isect) const override;
+
+		virtual std::string toString() const override { return "CurveShape[]"; }
+
+		//Split a curve into 2^splitDepth segments
+		static std::vector<Shape::ptr> createCurveSegments(Transform *objectToWorld, Transform *worldToObject,
+			const std::array<Vec3f, 4> &cp, Float width0, Float width1, CurveType type, int splitDepth);
+
+	private:
+
+		bool intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect) const;
+
+		bool recursiveIntersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect, Float &zMax,
+			const Vec3f cp[4], const Vec3f frame[3], Float u0, Float u1, int depth) const;
+
+		CurveCommon::ptr m_common;
+		Float m_uMin, m_uMax;
+	};
+
+	CurveType toCurveType(const std::string &name);
+
+	//Load the strands of a Cem Yuksel's .hair file as polylines with a width per point
+	void loadHairFile(const std::string &filename, Float defaultWidth,
+		std::vector<std::vector<Vec3f>> &strands, std::vector<std::vector<Float>> &widths);
+}
+
+#endif
@@ -0,0 +1,263 @@
+#include "Shape/QuadShape.h"
+
+#include "Render/Sampler.h"
+#include "Utils/Interaction.h"
+
+namespace RT
+{
+	//-------------------------------------------AQuadShape-------------------------------------
+
+	AQuadShape::AQuadShape(Transform *objectToWorld, Transform *worldToObject,
+		std::array<int, 4> indices, TriangleMesh *mesh) : Shape(objectToWorld, worldToObject), m_mesh(mesh), m_indices(indices) {}
+
+	BBox3f AQuadShape::objectBound() const
+	{
+		BBox3f bounds;
+		for (int i = 0; i < 4; ++i)
+			bounds = unionBounds(bounds, (*m_worldToObject)(m_mesh->getPosition(m_indices[i]), 1.0f));
+		return bounds;
+	}
+
+	BBox3f AQuadShape::worldBound() const
+	{
+		BBox3f bounds;
+		for (int i = 0; i < 4; ++i)
+			bounds = unionBounds(bounds, m_mesh->getPosition(m_indices[i]));
+		return bounds;
+	}
+
+	Float AQuadShape::area() const
+	{
+		const auto &p0 = m_mesh->getPosition(m_indices[0]);
+		const auto &p1 = m_mesh->getPosition(m_indices[1]);
+		const auto &p2 = m_mesh->getPosition(m_indices[2]);
+		const auto &p3 = m_mesh->getPosition(m_indices[3]);
+		// Half the cross product of the diagonals, exact for planar quads
+		return 0.5 * length(cross(p2 - p0, p3 - p1));
+	}
+
+	Interaction AQuadShape::sample(const Vec2f &u, Float &pdf) const
+	{
+		const auto &p0 = m_mesh->getPosition(m_indices[0]);
+		const auto &p1 = m_mesh->getPosition(m_indices[1]);
+		const auto &p2 = m_mesh->getPosition(m_indices[2]);
+		const auto &p3 = m_mesh->getPosition(m_indices[3]);
+
+		// Pick one of the two triangles (p0, p1, p2) and (p0, p2, p3) by area and sample it uniformly
+		const Float area0 = length(cross(p1 - p0, p2 - p0));
+		const Float area1 = length(cross(p2 - p0, p3 - p0));
+		const Float frac0 = area0 / (area0 + area1);
+		Vec2f uRemapped = u;
+		Vec3f q1 = p1, q2 = p2;
+		if (u[0] < frac0)
+		{
+			uRemapped[0] = glm::min(u[0] / frac0, aOneMinusEpsilon);
+		}
+		else
+		{
+			uRemapped[0] = glm::min((u[0] - frac0) / (1 - frac0), aOneMinusEpsilon);
+			q1 = p2;
+			q2 = p3;
+		}
+
+		Vec2f b = uniformSampleTriangle(uRemapped);
+		Interaction it;
+		it.p = b[0] * p0 + b[1] * q1 + (1 - b[0] - b[1]) * q2;
+		it.n = normalize(Vec3f(cross(p1 - p0, p3 - p0)));
+		it.pError = gamma(6) * (abs(b[0] * p0) + abs(b[1] * q1) + abs((1 - b[0] - b[1]) * q2));
+
+		pdf = 1 / area();
+		return it;
+	}
+
+	void AQuadShape::normalBounds(Vec3f &w, Float &cosTheta) const
+	{
+		//Note: sample() reports the normal of the corner p0 for the whole quad
+		const auto &p0 = m_mesh->getPosition(m_indices[0]);
+		const auto &p1 = m_mesh->getPosition(m_indices[1]);
+		const auto &p3 = m_mesh->getPosition(m_indices[3]);
+		w = normalize(Vec3f(cross(p1 - p0, p3 - p0)));
+		cosTheta = 1;
+	}
+
+	bool AQuadShape::intersect(const Ray &ray, Float &tHit, Float &s, Float &t) const
+	{
+		const auto &p00 = m_mesh->getPosition(m_indices[0]);
+		const auto &p10 = m_mesh->getPosition(m_indices[1]);
+		const auto &p11 = m_mesh->getPosition(m_indices[2]);
+		const auto &p01 = m_mesh->getPosition(m_indices[3]);
+		const Vec3f o = ray.origin(), d = ray.direction();
+
+		// Reject rays using the barycentric coordinates of the hit point with respect to (p00, p10, p01)
+		const Vec3f e01 = p10 - p00;
+		const Vec3f e03 = p01 - p00;
+		const Vec3f pv = cross(d, e03);
+		const Float det = dot(e01, pv);
+		if (det == 0)
+			return false;
+		const Float invDet = 1 / det;
+		const Vec3f tv = o - p00;
+		const Float alpha = dot(tv, pv) * invDet;
+		if (alpha < 0)
+			return false;
+		const Vec3f qv = cross(tv, e01);
+		const Float beta = dot(d, qv) * invDet;
+		if (beta < 0)
+			return false;
+
+		if (alpha + beta > 1)
+		{
+			// Reject rays using the barycentric coordinates of the hit point with respect to (p11, p01, p10)
+			const Vec3f e23 = p01 - p11;
+			const Vec3f e21 = p10 - p11;
+			const Vec3f pv2 = cross(d, e21);
+			const Float det2 = dot(e23, pv2);
+			if (det2 == 0)
+				return false;
+			const Float invDet2 = 1 / det2;
+			const Vec3f tv2 = o - p11;
+			const Float alpha2 = dot(tv2, pv2) * invDet2;
+			if (alpha2 < 0)
+				return false;
+			const Vec3f qv2 = cross(tv2, e23);
+			const Float beta2 = dot(d, qv2) * invDet2;
+			if (beta2 < 0)
+				return false;
+		}
+
+		// Compute the ray parameter and test it against the ray range
+		const Float tRay = dot(e03, qv) * invDet;
+		if (tRay >= ray.m_tMax)
+			return false;
+
+		// Ensure that the hit is conservatively in front of the origin, which lies on the quad itself
+		// for rays spawned from it
+		const Vec3f n = cross(e01, e03);
+		const Float cosTheta = glm::abs(dot(n, d)) / length(n);
+		if (cosTheta == 0)
+			return false;
+		const Float scale = maxComponent(abs(o)) + maxComponent(abs(p00)) + maxComponent(abs(p11));
+		const Float deltaT = gamma(7) * scale / cosTheta;
+		if (tRay <= deltaT)
+			return false;
+
+		// Barycentric coordinates of p11 with respect to (p00, p10, p01)
+		const Vec3f e02 = p11 - p00;
+		const Float invLengthSq = 1 / dot(n, n);
+		const Float alpha11 = dot(cross(e02, e03), n) * invLengthSq;
+		const Float beta11 = dot(cross(e01, e02), n) * invLengthSq;
+
+		// Compute the bilinear coordinates of the hit point
+		const Float bilinearEpsilon = 1e-6f;
+		if (glm::abs(alpha11 - 1) < bilinearEpsilon)
+		{
+			s = alpha;
+			t = glm::abs(beta11 - 1) < bilinearEpsilon ? beta : beta / (s * (beta11 - 1) + 1);
+		}
+		else if (glm::abs(beta11 - 1) < bilinearEpsilon)
+		{
+			t = beta;
+			s = alpha / (t * (alpha11 - 1) + 1);
+		}
+		else
+		{
+			const Float a = -(beta11 - 1);
+			const Float b = alpha * (beta11 - 1) - beta * (alpha11 - 1) - 1;
+			const Float c = alpha;
+			const Float discrim = glm::max(Float(0), b * b - 4 * a * c);
+			const Float q = -0.5f * (b + (b < 0 ? -1 : 1) * glm::sqrt(discrim));
+			s = q / a;
+			if (s < 0 || s > 1)
+				s = c / q;
+			t = beta / (s * (beta11 - 1) + 1);
+		}
+		s = clamp(s, 0, 1);
+		t = clamp(t, 0, 1);
+
+		tHit = tRay;
+		return true;
+	}
+
+	bool AQuadShape::hit(const Ray &ray) const
+	{
+		Float tHit, s, t;
+		return intersect(ray, tHit, s, t);
+	}
+
+	bool AQuadShape::hit(const Ray &ray, Float &tHit, SurfaceInteraction &isect) const
+	{
+		Float s, t;
+		if (!intersect(ray, tHit, s, t))
+			return false;
+
+		Vec3f p[4];
+		Vec2f uv[4];
+		for (int i = 0; i < 4; ++i)
+			p[i] = m_mesh->getPosition(m_indices[i]);
+		if (m_mesh->hasUV())
+		{
+			for (int i = 0; i < 4; ++i)
+				uv[i] = m_mesh->getUV(m_indices[i]);
+		}
+		else
+		{
+			uv[0] = Vec2f(0, 0);
+			uv[1] = Vec2f(1, 0);
+			uv[2] = Vec2f(1, 1);
+			uv[3] = Vec2f(0, 1);
+		}
+
+		// Bilinear weights of the corners (p00, p10, p11, p01)
+		const Float w[4] = { (1 - s) * (1 - t), s * (1 - t), s * t, (1 - s) * t };
+		const Vec3f pHit = w[0] * p[0] + w[1] * p[1] + w[2] * p[2] + w[3] * p[3];
+		const Vec2f uvHit = w[0] * uv[0] + w[1] * uv[1] + w[2] * uv[2] + w[3] * uv[3];
+
+		// Compute the partial derivatives with respect to the texture coordinates by the chain rule
+		const Vec3f dpds = (1 - t) * (p[1] - p[0]) + t * (p[2] - p[3]);
+		const Vec3f dpdt = (1 - s) * (p[3] - p[0]) + s * (p[2] - p[1]);
+		const Vec2f duvds = (1 - t) * (uv[1] - uv[0]) + t * (uv[2] - uv[3]);
+		const Vec2f duvdt = (1 - s) * (uv[3] - uv[0]) + s * (uv[2] - uv[1]);
+		Vec3f dpdu, dpdv;
+		Float determinant = duvds[0] * duvdt[1] - duvds[1] * duvdt[0];
+		bool degenerateUV = glm::abs(determinant) < 1e-8;
+		if (!degenerateUV)
+		{
+			Float invdet = 1 / determinant;
+			dpdu = (duvdt[1] * dpds - duvds[1] * dpdt) * invdet;
+			dpdv = (-duvdt[0] * dpds + duvds[0] * dpdt) * invdet;
+		}
+		const Vec3f ng = cross(p[1] - p[0], p[3] - p[0]);
+		if (degenerateUV || lengthSquared(cross(dpdu, dpdv)) == 0)
+		{
+			if (lengthSquared(ng) == 0)
+				return false;
+
+			coordinateSystem(normalize(ng), dpdu, dpdv);
+		}
+
+		// Fill in _SurfaceInteraction_ from quad hit
+		isect = SurfaceInteraction(pHit, uvHit, -ray.direction(), dpdu, dpdv, this);
+
+		// Compute error bounds for quad intersection
+		Vec3f pAbsSum(0.f);
+		for (int i = 0; i < 4; ++i)
+			pAbsSum += abs(w[i] * p[i]);
+		isect.pError = gamma(7) * pAbsSum;
+
+		// Override surface normal in _isect_ for quad
+		isect.n = normalize(ng);
+
+		if (m_mesh->hasNormal())
+		{
+			Vec3f ns(0.0f);
+			for (int i = 0; i < 4; ++i)
+				ns += w[i] * m_mesh->getNormal(m_indices[i]);
+			if (lengthSquared(ns) > 0)
+			{
+				isect.n = normalize(ns);
+			}
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,52 @@
+#ifndef ARQUAD_SHAPE_H
+#define ARQUAD_SHAPE_H
+
+#include "Shape/Shape.h"
+#include "Shape/TriangleShape.h"
+
+#include <array>
+
+namespace RT
+{
+	//! @brief Planar convex quad of a triangle mesh, the corners are given in winding order.
+	/**
+	 * Replaces the two triangles a quad would otherwise be split into, which halves the hitables
+	 * and the accelerator references of quad-dominant meshes. The intersection follows Lagae and
+	 * Dutre, "An Efficient Ray-Quadrilateral Intersection Test", and yields bilinear coordinates
+	 * that the vertex attributes are interpolated with.
+	 */
+	class AQuadShape final : public Shape
+	{
+	public:
+		typedef std::shared_ptr<AQuadShape> ptr;
+
+		AQuadShape(Transform *objectToWorld, Transform *worldToObject,
+			std::array<int, 4> indices, TriangleMesh *mesh);
+
+		virtual ~AQuadShape() = default;
+
+		virtual Float area() const override;
+
+		virtual Interaction sample(const Vec2f &u, Float &pdf) const override;
+
+		virtual BBox3f objectBound() const override;
+		virtual BBox3f worldBound() const override;
+
+		virtual bool hit(const Ray &ray) const override;
+		virtual bool hit(const Ray &ray, Float &tHit, SurfaceInteraction &isect) const override;
+
+		virtual void normalBounds(Vec3f &w, Float &cosTheta) const override;
+
+		virtual std::string toString() const override { return "QuadShape[]"; }
+
+	private:
+
+		//Ray parameter and bilinear coordinates (s, t) of the hit point
+		bool intersect(const Ray &ray, Float &tHit, Float &s, Float &t) const;
+
+		TriangleMesh *m_mesh;
+		std::array<int, 4> m_indices;
+	};
+}
+
+#endif
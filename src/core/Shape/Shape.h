@@ -46,6 +46,10 @@ namespace RT
 		// used in this case.
 		virtual Float solidAngle(const Vec3f &p, int nSamples = 512) const;
 
+		// Bound the normals that sample() reports by the cone of directions within acos(cosTheta)
+		// of |w|. The default covers the whole sphere.
+		virtual void normalBounds(Vec3f &w, Float &cosTheta) const { w = Vec3f(0, 0, 1); cosTheta = -1; }
+
 		virtual ClassType getClassType() const override { return ClassType::AEShape; }
 
 		Transform *m_objectToWorld = nullptr, *m_worldToObject = nullptr;
@@ -0,0 +1,364 @@
+#include "Shape/SphereSetShape.h"
+
+#include "Utils/Interaction.h"
+#include "Render/Sampler.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+
+#if !defined(AURORA_DOUBLE_AS_FLOAT) && defined(__AVX__)
+#include <immintrin.h>
+#define AURORA_SPHERE_AVX
+#elif !defined(AURORA_DOUBLE_AS_FLOAT) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define AURORA_SPHERE_SSE
+#endif
+
+namespace RT
+{
+	//-------------------------------------------SimdFloat-------------------------------------
+
+	//Note: a comparison yields a lane mask of the same type, which is what select and movemask consume
+#if defined(AURORA_SPHERE_AVX)
+	struct SimdFloat
+	{
+		static constexpr int width = 8;
+		__m256 v;
+
+		SimdFloat(__m256 v) : v(v) {}
+		explicit SimdFloat(Float f) : v(_mm256_set1_ps(f)) {}
+
+		static SimdFloat load(const Float *p) { return _mm256_loadu_ps(p); }
+		void store(Float *p) const { _mm256_storeu_ps(p, v); }
+
+		SimdFloat operator+(const SimdFloat &b) const { return _mm256_add_ps(v, b.v); }
+		SimdFloat operator-(const SimdFloat &b) const { return _mm256_sub_ps(v, b.v); }
+		SimdFloat operator*(const SimdFloat &b) const { return _mm256_mul_ps(v, b.v); }
+		SimdFloat operator>(const SimdFloat &b) const { return _mm256_cmp_ps(v, b.v, _CMP_GT_OQ); }
+		SimdFloat operator<(const SimdFloat &b) const { return _mm256_cmp_ps(v, b.v, _CMP_LT_OQ); }
+		SimdFloat operator&(const SimdFloat &b) const { return _mm256_and_ps(v, b.v); }
+		SimdFloat operator|(const SimdFloat &b) const { return _mm256_or_ps(v, b.v); }
+	};
+
+	static SimdFloat simdSqrt(const SimdFloat &a) { return _mm256_sqrt_ps(a.v); }
+	static SimdFloat simdMax(const SimdFloat &a, const SimdFloat &b) { return _mm256_max_ps(a.v, b.v); }
+	static SimdFloat simdSelect(const SimdFloat &mask, const SimdFloat &a, const SimdFloat &b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+	static int simdMovemask(const SimdFloat &mask) { return _mm256_movemask_ps(mask.v); }
+#elif defined(AURORA_SPHERE_SSE)
+	struct SimdFloat
+	{
+		static constexpr int width = 4;
+		__m128 v;
+
+		SimdFloat(__m128 v) : v(v) {}
+		explicit SimdFloat(Float f) : v(_mm_set1_ps(f)) {}
+
+		static SimdFloat load(const Float *p) { return _mm_loadu_ps(p); }
+		void store(Float *p) const { _mm_storeu_ps(p, v); }
+
+		SimdFloat operator+(const SimdFloat &b) const { return _mm_add_ps(v, b.v); }
+		SimdFloat operator-(const SimdFloat &b) const { return _mm_sub_ps(v, b.v); }
+		SimdFloat operator*(const SimdFloat &b) const { return _mm_mul_ps(v, b.v); }
+		SimdFloat operator>(const SimdFloat &b) const { return _mm_cmpgt_ps(v, b.v); }
+		SimdFloat operator<(const SimdFloat &b) const { return _mm_cmplt_ps(v, b.v); }
+		SimdFloat operator&(const SimdFloat &b) const { return _mm_and_ps(v, b.v); }
+		SimdFloat operator|(const SimdFloat &b) const { return _mm_or_ps(v, b.v); }
+	};
+
+	static SimdFloat simdSqrt(const SimdFloat &a) { return _mm_sqrt_ps(a.v); }
+	static SimdFloat simdMax(const SimdFloat &a, const SimdFloat &b) { return _mm_max_ps(a.v, b.v); }
+	static SimdFloat simdSelect(const SimdFloat &mask, const SimdFloat &a, const SimdFloat &b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+	}
+	static int simdMovemask(const SimdFloat &mask) { return _mm_movemask_ps(mask.v); }
+#else
+	// Scalar fallback for double precision builds and targets without SSE
+	struct SimdFloat
+	{
+		static constexpr int width = 1;
+		Float v;
+
+		explicit SimdFloat(Float f) : v(f) {}
+
+		static SimdFloat load(const Float *p) { return SimdFloat(*p); }
+		void store(Float *p) const { *p = v; }
+
+		SimdFloat operator+(const SimdFloat &b) const { return SimdFloat(v + b.v); }
+		SimdFloat operator-(const SimdFloat &b) const { return SimdFloat(v - b.v); }
+		SimdFloat operator*(const SimdFloat &b) const { return SimdFloat(v * b.v); }
+		SimdFloat operator>(const SimdFloat &b) const { return SimdFloat(v > b.v ? 1 : 0); }
+		SimdFloat operator<(const SimdFloat &b) const { return SimdFloat(v < b.v ? 1 : 0); }
+		SimdFloat operator&(const SimdFloat &b) const { return SimdFloat(v * b.v); }
+		SimdFloat operator|(const SimdFloat &b) const { return SimdFloat(v + b.v); }
+	};
+
+	static SimdFloat simdSqrt(const SimdFloat &a) { return SimdFloat(glm::sqrt(a.v)); }
+	static SimdFloat simdMax(const SimdFloat &a, const SimdFloat &b) { return SimdFloat(glm::max(a.v, b.v)); }
+	static SimdFloat simdSelect(const SimdFloat &mask, const SimdFloat &a, const SimdFloat &b) { return mask.v != 0 ? a : b; }
+	static int simdMovemask(const SimdFloat &mask) { return mask.v != 0 ? 1 : 0; }
+#endif
+
+	static_assert(SphereSet::leafSize % SimdFloat::width == 0, "A leaf has to be a whole number of packets");
+
+	//-------------------------------------------SphereSet-------------------------------------
+
+	SphereSet::SphereSet(const std::vector<Vec3f> &center, const std::vector<Float> &radius)
+		: m_nSpheres(center.size())
+	{
+		CHECK_EQ(center.size(), radius.size());
+
+		// Sort the spheres along the Morton curve so that a leaf is spatially compact
+		BBox3f bounds;
+		for (const auto &c : center)
+			bounds = unionBounds(bounds, c);
+		std::vector<std::pair<uint32_t, int>> codes(m_nSpheres);
+		for (size_t i = 0; i < m_nSpheres; ++i)
+		{
+			const Float mortonScale = 1 << 10;
+			codes[i] = { encodeMorton3(bounds.offset(center[i]) * mortonScale), (int)i };
+		}
+		std::sort(codes.begin(), codes.end());
+
+		const size_t nPadded = numLeaves() * leafSize;
+		m_centerX.resize(nPadded, 0);
+		m_centerY.resize(nPadded, 0);
+		m_centerZ.resize(nPadded, 0);
+		m_radius.resize(nPadded, 0);
+		for (size_t i = 0; i < m_nSpheres; ++i)
+		{
+			const int index = codes[i].second;
+			m_centerX[i] = center[index].x;
+			m_centerY[i] = center[index].y;
+			m_centerZ[i] = center[index].z;
+			m_radius[i] = radius[index];
+		}
+	}
+
+	int SphereSet::intersect(const Ray &ray, size_t leaf, Float &tHit, bool anyHit) const
+	{
+		const size_t offset = leaf * leafSize;
+		const Vec3f o = ray.origin(), d = ray.direction();
+		const Float invA = 1 / dot(d, d);
+
+		// Rays spawned from a sphere start on its surface, hits within the error of the origin are ignored
+		const Float invLength = glm::sqrt(invA);
+		const Float originError = gamma(15) * maxComponent(abs(o)) * invLength;
+
+		const SimdFloat ox(o.x), oy(o.y), oz(o.z);
+		const SimdFloat dx(d.x), dy(d.y), dz(d.z);
+		const SimdFloat invAV(invA), negInvAV(-invA), zero(0);
+		const SimdFloat originErrorV(originError), radiusErrorV(gamma(15) * invLength);
+		const SimdFloat insideScale(1 - 1e-4f);
+		SimdFloat tMaxV(ray.m_tMax);
+
+		int hitIndex = -1;
+		Float tClosest = ray.m_tMax;
+		for (int base = 0; base < leafSize; base += SimdFloat::width)
+		{
+			const size_t i = offset + base;
+			const SimdFloat radius = SimdFloat::load(&m_radius[i]);
+			const SimdFloat ocx = ox - SimdFloat::load(&m_centerX[i]);
+			const SimdFloat ocy = oy - SimdFloat::load(&m_centerY[i]);
+			const SimdFloat ocz = oz - SimdFloat::load(&m_centerZ[i]);
+
+			// Solve for the closest approach first, which avoids the cancellation of the textbook
+			// quadratic for small spheres far away from the origin
+			const SimdFloat tc = (ocx * dx + ocy * dy + ocz * dz) * negInvAV;
+			const SimdFloat lx = ocx + tc * dx;
+			const SimdFloat ly = ocy + tc * dy;
+			const SimdFloat lz = ocz + tc * dz;
+			const SimdFloat h2 = radius * radius - (lx * lx + ly * ly + lz * lz);
+			const SimdFloat q = simdSqrt(simdMax(h2, zero) * invAV);
+			const SimdFloat t0 = tc - q;
+			const SimdFloat t1 = tc + q;
+
+			const SimdFloat tMin = originErrorV + radius * radiusErrorV;
+			const SimdFloat t = simdSelect(t0 > tMin, t0, t1);
+
+			// A ray moving away from the center only hits the sphere from inside, which also rejects
+			// the grazing rays leaving the surface whose roots are too close to zero to be trusted
+			const SimdFloat ocLengthSq = ocx * ocx + ocy * ocy + ocz * ocz;
+			const SimdFloat inside = ocLengthSq < radius * radius * insideScale;
+			const int mask = simdMovemask((h2 > zero) & (t > tMin) & (t < tMaxV) & ((tc > zero) | inside));
+			if (mask == 0)
+				continue;
+
+			Float ts[SimdFloat::width];
+			t.store(ts);
+			for (int lane = 0; lane < SimdFloat::width; ++lane)
+			{
+				if ((mask & (1 << lane)) && ts[lane] < tClosest)
+				{
+					tClosest = ts[lane];
+					hitIndex = base + lane;
+				}
+			}
+			if (anyHit)
+				break;
+			tMaxV = SimdFloat(tClosest);
+		}
+
+		if (hitIndex < 0)
+			return -1;
+		tHit = tClosest;
+		return (int)offset + hitIndex;
+	}
+
+	//-------------------------------------------ASphereSetShape-------------------------------------
+
+	ASphereSetShape::ASphereSetShape(Transform *objectToWorld, Transform *worldToObject,
+		const SphereSet *set, size_t leaf) : Shape(objectToWorld, worldToObject), m_set(set), m_leaf(leaf) {}
+
+	BBox3f ASphereSetShape::worldBound() const
+	{
+		BBox3f bounds;
+		for (size_t i = begin(); i < end(); ++i)
+		{
+			const Vec3f c = m_set->getCenter(i);
+			const Float r = m_set->getRadius(i);
+			bounds = unionBounds(bounds, BBox3f(c - Vec3f(r), c + Vec3f(r)));
+		}
+		return bounds;
+	}
+
+	BBox3f ASphereSetShape::objectBound() const
+	{
+		return (*m_worldToObject)(worldBound());
+	}
+
+	Float ASphereSetShape::area() const
+	{
+		Float area = 0;
+		for (size_t i = begin(); i < end(); ++i)
+			area += 4 * Pi * m_set->getRadius(i) * m_set->getRadius(i);
+		return area;
+	}
+
+	Interaction ASphereSetShape::sample(const Vec2f &u, Float &pdf) const
+	{
+		// Pick a sphere proportional to its area and sample it uniformly
+		const Float totalArea = area();
+		Float target = u[0] * totalArea;
+		size_t index = begin();
+		Float sphereArea = 4 * Pi * m_set->getRadius(index) * m_set->getRadius(index);
+		while (target > sphereArea && index + 1 < end())
+		{
+			target -= sphereArea;
+			++index;
+			sphereArea = 4 * Pi * m_set->getRadius(index) * m_set->getRadius(index);
+		}
+		const Vec2f uRemapped(glm::min(target / sphereArea, aOneMinusEpsilon), u[1]);
+
+		Interaction it;
+		it.n = uniformSampleSphere(uRemapped);
+		it.p = m_set->getCenter(index) + m_set->getRadius(index) * it.n;
+		it.pError = gamma(5) * abs(m_set->getRadius(index) * it.n) + gamma(1) * abs(it.p);
+
+		pdf = 1 / totalArea;
+		return it;
+	}
+
+	bool ASphereSetShape::hit(const Ray &ray) const
+	{
+		Float tHit;
+		return m_set->intersect(ray, m_leaf, tHit, true) >= 0;
+	}
+
+	bool ASphereSetShape::hit(const Ray &ray, Float &tHit, SurfaceInteraction &isect) const
+	{
+		const int index = m_set->intersect(ray, m_leaf, tHit, false);
+		if (index < 0)
+			return false;
+
+		const Vec3f center = m_set->getCenter(index);
+		const Float radius = m_set->getRadius(index);
+
+		// Refine sphere intersection point relative to the center
+		Vec3f pHit = ray(tHit) - center;
+		pHit *= radius / length(pHit);
+		if (pHit.x == 0 && pHit.y == 0)
+			pHit.x = 1e-5f * radius;
+
+		Float phi = std::atan2(pHit.y, pHit.x);
+		if (phi < 0)
+			phi += 2 * Pi;
+		Float theta = std::acos(clamp(pHit.z / radius, -1, 1));
+
+		Float u = phi / (Pi * 2);
+		Float v = theta / Pi;
+
+		// Compute sphere $\dpdu$ and $\dpdv$
+		Float zRadius = glm::sqrt(pHit.x * pHit.x + pHit.y * pHit.y);
+		Float invZRadius = 1 / zRadius;
+		Float cosPhi = pHit.x * invZRadius;
+		Float sinPhi = pHit.y * invZRadius;
+		Vec3f dpdu(-2 * Pi * pHit.y, 2 * Pi * pHit.x, 0);
+		Vec3f dpdv = Pi * Vec3f(pHit.z * cosPhi, pHit.z * sinPhi, -radius * glm::sin(theta));
+
+		isect = SurfaceInteraction(center + pHit, Vec2f(u, v), -ray.direction(), dpdu, dpdv, this);
+		isect.pError = gamma(5) * abs(pHit) + gamma(1) * abs(isect.p);
+
+		isect.n = faceforward(isect.n, isect.wo);
+
+		return true;
+	}
+
+	void loadSphereFile(const std::string &filename, Float defaultRadius,
+		std::vector<Vec3f> &center, std::vector<Float> &radius)
+	{
+		std::ifstream infile(filename, std::ios::binary);
+		if (!infile)
+		{
+			LOG(FATAL) << "Could not open the sphere file " << filename;
+		}
+
+		// Read the whole file at once, going through the stream for every number is far too slow
+		// for tens of millions of spheres
+		std::stringstream buffer;
+		buffer << infile.rdbuf();
+		const std::string content = buffer.str();
+
+		const char *ptr = content.c_str();
+		const char *last = ptr + content.size();
+		size_t lineNumber = 0;
+		while (ptr < last)
+		{
+			const char *lineEnd = std::find(ptr, last, '\n');
+			++lineNumber;
+
+			Float values[4];
+			int count = 0;
+			const char *cur = ptr;
+			while (count < 4)
+			{
+				while (cur < lineEnd && (*cur == ' ' || *cur == '\t' || *cur == ',' || *cur == '\r'))
+					++cur;
+				if (cur >= lineEnd || *cur == '#')
+					break;
+				char *next = nullptr;
+				values[count] = (Float)std::strtod(cur, &next);
+				if (next == cur)
+					break;
+				cur = next;
+				++count;
+			}
+
+			if (count >= 3)
+			{
+				center.push_back(Vec3f(values[0], values[1], values[2]));
+				radius.push_back(count == 4 ? values[3] : defaultRadius);
+			}
+			else if (count > 0)
+			{
+				LOG(WARNING) << "Skipped malformed line " << lineNumber << " of " << filename;
+			}
+
+			ptr = lineEnd + 1;
+		}
+
+		LOG(INFO) << "Loaded " << center.size() << " spheres from " << filename;
+	}
+}
@@ -0,0 +1,81 @@
+#ifndef ARSPHERESET_SHAPE_H
+#define ARSPHERESET_SHAPE_H
+
+#include "Shape/Shape.h"
+
+#include <vector>
+
+namespace RT
+{
+	//! @brief Centers and radii of many spheres in world space, stored as structure of arrays.
+	/**
+	 * The spheres are sorted along the Morton curve of their centers and cut into leaves of
+	 * leafSize consecutive spheres. A leaf is intersected a SIMD packet at a time without any
+	 * transform, which is what makes particle and point cloud scenes cheap.
+	 */
+	class SphereSet final
+	{
+	public:
+		typedef std::unique_ptr<SphereSet> unique_ptr;
+
+		//Note: a leaf is one SIMD packet, larger leaves make the kd-tree cull less
+#if !defined(AURORA_DOUBLE_AS_FLOAT) && defined(__AVX__)
+		static constexpr int leafSize = 8;
+#else
+		static constexpr int leafSize = 4;
+#endif
+
+		//Note: the centers and radii are expected in world space already
+		SphereSet(const std::vector<Vec3f> &center, const std::vector<Float> &radius);
+
+		size_t numSpheres() const { return m_nSpheres; }
+		size_t numLeaves() const { return (m_nSpheres + leafSize - 1) / leafSize; }
+
+		Vec3f getCenter(size_t index) const { return Vec3f(m_centerX[index], m_centerY[index], m_centerZ[index]); }
+		Float getRadius(size_t index) const { return m_radius[index]; }
+
+		//Index of the closest sphere of the leaf hit by the ray or -1, stops at the first hit if |anyHit|
+		int intersect(const Ray &ray, size_t leaf, Float &tHit, bool anyHit) const;
+
+	private:
+		//Note: padded to whole leaves with spheres of zero radius, which are never hit
+		std::vector<Float> m_centerX, m_centerY, m_centerZ, m_radius;
+		size_t m_nSpheres;
+	};
+
+	//! @brief One leaf of a sphere set, the spheres share the material and the light of the set.
+	class ASphereSetShape final : public Shape
+	{
+	public:
+		typedef std::shared_ptr<ASphereSetShape> ptr;
+
+		ASphereSetShape(Transform *objectToWorld, Transform *worldToObject, const SphereSet *set, size_t leaf);
+
+		virtual ~ASphereSetShape() = default;
+
+		virtual Float area() const override;
+
+		virtual Interaction sample(const Vec2f &u, Float &pdf) const override;
+
+		virtual BBox3f objectBound() const override;
+		virtual BBox3f worldBound() const override;
+
+		virtual bool hit(const Ray &ray) const override;
+		virtual bool hit(const Ray &ray, Float &tHit, SurfaceInteraction &isect) const override;
+
+		virtual std::string toString() const override { return "SphereSetShape[]"; }
+
+	private:
+		size_t begin() const { return m_leaf * SphereSet::leafSize; }
+		size_t end() const { return glm::min(begin() + SphereSet::leafSize, m_set->numSpheres()); }
+
+		const SphereSet *m_set;
+		size_t m_leaf;
+	};
+
+	//Load the spheres of a text file with one "x y z [radius]" per line, '#' starts a comment
+	void loadSphereFile(const std::string &filename, Float defaultRadius,
+		std::vector<Vec3f> &center, std::vector<Float> &radius);
+}
+
+#endif
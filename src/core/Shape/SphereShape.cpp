@@ -33,7 +33,7 @@ namespace RT
 		it.n = normalize((*m_objectToWorld)(pObj, 0.0f));
 
 		pObj *= m_radius / distance(pObj, Vec3f(0, 0, 0));
-		it.p = (*m_objectToWorld)(pObj, 1.0f);
+		it.p = (*m_objectToWorld)(pObj, gamma(5) * abs(pObj), it.pError);
 
 		pdf = 1 / area();
 		return it;
@@ -104,6 +104,7 @@ namespace RT
 		// Return _Interaction_ for sampled point on sphere
 		Interaction it;
 		it.p = pWorld;
+		it.pError = gamma(5) * abs(pWorld);
 		it.n = nWorld;
 
 		// Uniform cone PDF.
@@ -224,8 +225,11 @@ namespace RT
 		Vec3f dpdu(-2 * Pi * pHit.y, 2 * Pi * pHit.x, 0);
 		Vec3f dpdv = 2 * Pi * Vec3f(pHit.z * cosPhi, pHit.z * sinPhi, -m_radius * glm::sin(theta));
 
-		isect = (*m_objectToWorld)(SurfaceInteraction(pHit, Vec2f(u, v), -ray.direction(),
-			dpdu, dpdv, this));
+		// Compute error bounds for sphere intersection
+		SurfaceInteraction si(pHit, Vec2f(u, v), -ray.direction(), dpdu, dpdv, this);
+		si.pError = gamma(5) * abs(pHit);
+
+		isect = (*m_objectToWorld)(si);
 
 		isect.n = faceforward(isect.n, isect.wo);
 
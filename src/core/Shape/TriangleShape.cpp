@@ -1,6 +1,7 @@
 #include "Shape/TriangleShape.h"
 
 #include <array>
+#include <algorithm>
 
 #include "Render/Sampler.h"
 #include "Utils/Interaction.h"
@@ -13,12 +14,118 @@ namespace RT
 {
 	//-------------------------------------------ATriangleMesh-------------------------------------
 
-	TriangleMesh::TriangleMesh(Transform *objectToWorld, const std::string &filename)
+	// Sort the triangles and the quads along the Morton curve of their centroids and renumber the
+	// vertices in first-use order, so that primitives close in space are also close in memory.
+	static void reorderForLocality(std::vector<Vec3f> &position, std::vector<Vec3f> &normal,
+		std::vector<Vec2f> &uv, std::vector<int> &indices, std::vector<int> &quadIndices)
+	{
+		const size_t nTriangles = indices.size() / 3;
+		const size_t nQuads = quadIndices.size() / 4;
+		if (nTriangles + nQuads < 2)
+			return;
+
+		auto centroid = [&](const std::vector<int> &primIndices, size_t prim, int nVerts) -> Vec3f
+		{
+			Vec3f c(0.0f);
+			for (int j = 0; j < nVerts; ++j)
+				c += position[primIndices[nVerts * prim + j]];
+			return c / Float(nVerts);
+		};
+
+		BBox3f centroidBounds;
+		for (size_t i = 0; i < nTriangles; ++i)
+			centroidBounds = unionBounds(centroidBounds, centroid(indices, i, 3));
+		for (size_t i = 0; i < nQuads; ++i)
+			centroidBounds = unionBounds(centroidBounds, centroid(quadIndices, i, 4));
+
+		auto sortByMorton = [&](const std::vector<int> &primIndices, size_t nPrims, int nVerts)
+		{
+			std::vector<std::pair<uint32_t, int>> codes(nPrims);
+			for (size_t i = 0; i < nPrims; ++i)
+			{
+				const Float mortonScale = 1 << 10;
+				codes[i] = { encodeMorton3(centroidBounds.offset(centroid(primIndices, i, nVerts)) * mortonScale), (int)i };
+			}
+			std::sort(codes.begin(), codes.end());
+			return codes;
+		};
+		const auto triCodes = sortByMorton(indices, nTriangles, 3);
+		const auto quadCodes = sortByMorton(quadIndices, nQuads, 4);
+
+		std::vector<int> remap(position.size(), -1);
+		std::vector<Vec3f> newPosition, newNormal;
+		std::vector<Vec2f> newUV;
+		newPosition.reserve(position.size());
+		newNormal.reserve(normal.size());
+		newUV.reserve(uv.size());
+		auto renumber = [&](const std::vector<int> &primIndices, const std::vector<std::pair<uint32_t, int>> &codes, int nVerts)
+		{
+			std::vector<int> newIndices(primIndices.size());
+			for (size_t i = 0; i < codes.size(); ++i)
+			{
+				const int prim = codes[i].second;
+				for (int j = 0; j < nVerts; ++j)
+				{
+					const int index = primIndices[nVerts * prim + j];
+					if (remap[index] < 0)
+					{
+						remap[index] = (int)newPosition.size();
+						newPosition.push_back(position[index]);
+						if (!normal.empty())
+							newNormal.push_back(normal[index]);
+						if (!uv.empty())
+							newUV.push_back(uv[index]);
+					}
+					newIndices[nVerts * i + j] = remap[index];
+				}
+			}
+			return newIndices;
+		};
+		std::vector<int> newIndices = renumber(indices, triCodes, 3);
+		std::vector<int> newQuadIndices = renumber(quadIndices, quadCodes, 4);
+
+		//Note: unreferenced vertices are dropped
+		position.swap(newPosition);
+		normal.swap(newNormal);
+		uv.swap(newUV);
+		indices.swap(newIndices);
+		quadIndices.swap(newQuadIndices);
+	}
+
+	// A quad is only kept when it is planar and strictly convex, everything else is split into two
+	// triangles. Both properties survive the affine object to world transform.
+	static bool isPlanarConvexQuad(const Vec3f &p0, const Vec3f &p1, const Vec3f &p2, const Vec3f &p3)
+	{
+		// Normal from the cross product of the diagonals
+		const Vec3f n = cross(p2 - p0, p3 - p1);
+		const Float nLength = length(n);
+		const Float diagonal = glm::max(length(p2 - p0), length(p3 - p1));
+		if (nLength == 0 || diagonal == 0)
+			return false;
+
+		// Planarity relative to the size of the quad
+		const Float planarEpsilon = 1e-4f;
+		if (glm::abs(dot(n / nLength, p3 - p0)) > planarEpsilon * diagonal)
+			return false;
+
+		// Every corner has to turn the same way around the normal
+		const Vec3f p[4] = { p0, p1, p2, p3 };
+		for (int i = 0; i < 4; ++i)
+		{
+			const Vec3f &a = p[i], &b = p[(i + 1) % 4], &c = p[(i + 2) % 4];
+			if (dot(cross(b - a, c - b), n) <= 0)
+				return false;
+		}
+		return true;
+	}
+
+	TriangleMesh::TriangleMesh(Transform *objectToWorld, const std::string &filename, bool outOfCore)
 	{
 		std::vector<Vec3f> gPosition;
 		std::vector<Vec3f> gNormal;
 		std::vector<Vec2f> gUV;
 		std::vector<int> gIndices;
+		std::vector<int> gQuadIndices;
 
 		auto process_mesh = [&](aiMesh *mesh, const aiScene *scene) -> void
 		{
@@ -27,6 +134,7 @@ namespace RT
 			std::vector<Vec3f> normal;
 			std::vector<Vec2f> uv;
 			std::vector<int> indices;
+			std::vector<int> quadIndices;
 			for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
 			{
 				position.push_back(Vec3f(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z));
@@ -37,14 +145,31 @@ namespace RT
 				}
 			}
 
+			const int offset = (int)gPosition.size();
 			for (unsigned int i = 0; i < mesh->mNumFaces; ++i)
 			{
-				aiFace face = mesh->mFaces[i];
+				const aiFace &face = mesh->mFaces[i];
+				const unsigned int *f = face.mIndices;
 				// Retrieve all indices of the face and store them in the indices vector
-				for (unsigned int j = 0; j < face.mNumIndices; ++j)
+				if (face.mNumIndices == 3)
+				{
+					indices.insert(indices.end(), { (int)f[0] + offset, (int)f[1] + offset, (int)f[2] + offset });
+				}
+				else if (face.mNumIndices == 4)
 				{
-					indices.push_back(face.mIndices[j] + gPosition.size());
+					if (isPlanarConvexQuad(position[f[0]], position[f[1]], position[f[2]], position[f[3]]))
+					{
+						quadIndices.insert(quadIndices.end(), { (int)f[0] + offset, (int)f[1] + offset,
+							(int)f[2] + offset, (int)f[3] + offset });
+					}
+					else
+					{
+						// Fall back to a triangle pair
+						indices.insert(indices.end(), { (int)f[0] + offset, (int)f[1] + offset, (int)f[2] + offset });
+						indices.insert(indices.end(), { (int)f[0] + offset, (int)f[2] + offset, (int)f[3] + offset });
+					}
 				}
+				// Note: points and lines are skipped
 			}
 
 			// Merge to one mesh
@@ -52,6 +177,7 @@ namespace RT
 			gNormal.insert(gNormal.end(), normal.begin(), normal.end());
 			gUV.insert(gUV.end(), uv.begin(), uv.end());
 			gIndices.insert(gIndices.end(), indices.begin(), indices.end());
+			gQuadIndices.insert(gQuadIndices.end(), quadIndices.begin(), quadIndices.end());
 		};
 
 		std::function<void(aiNode *node, const aiScene *scene)> process_node;
@@ -73,46 +199,124 @@ namespace RT
 			}
 		};
 		// Import the mesh using ASSIMP
+		// Note: quads are not triangulated so that the planar ones can be kept as one primitive
 		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(filename, aiProcess_Triangulate | aiProcess_GenSmoothNormals
+		const aiScene* scene = importer.ReadFile(filename, aiProcess_GenSmoothNormals
 			| aiProcess_FlipUVs | aiProcess_FixInfacingNormals | aiProcess_OptimizeMeshes);
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
 			LOG(FATAL) << "ERROR::ASSIMP:: " << importer.GetErrorString();
 		}
 
+		// Polygons with more than four corners are left to the triangulation of assimp
+		bool hasPolygons = false;
+		for (unsigned int i = 0; i < scene->mNumMeshes && !hasPolygons; ++i)
+		{
+			const aiMesh *mesh = scene->mMeshes[i];
+			for (unsigned int j = 0; j < mesh->mNumFaces && !hasPolygons; ++j)
+				hasPolygons = mesh->mFaces[j].mNumIndices > 4;
+		}
+		if (hasPolygons)
+		{
+			scene = importer.ApplyPostProcessing(aiProcess_Triangulate);
+			if (!scene)
+			{
+				LOG(FATAL) << "ERROR::ASSIMP:: " << importer.GetErrorString();
+			}
+		}
+
 		// Process the mesh node
 		process_node(scene->mRootNode, scene);
 
 		// Vertex data
 		// Note: we transform the vertex into world space in advance for efficient ray intersection routine
-		m_nVertices = gPosition.size();
-		m_position.reset(new Vec3f[m_nVertices]);
-		if (!gNormal.empty())
+		for (size_t i = 0; i < gPosition.size(); ++i)
 		{
-			m_normal.reset(new Vec3f[m_nVertices]);
+			gPosition[i] = (*objectToWorld)(gPosition[i], 1.0f);
+			if (!gNormal.empty())
+			{
+				gNormal[i] = (*objectToWorld)(gNormal[i], 0.0f);
+			}
 		}
-		if (!gUV.empty())
+
+		reorderForLocality(gPosition, gNormal, gUV, gIndices, gQuadIndices);
+		initialize(gPosition, gNormal, gUV, gIndices, gQuadIndices, outOfCore, filename);
+
+		LOG(INFO) << filename << ": " << numTriangles() << " triangles, " << numQuads() << " quads";
+	}
+
+	TriangleMesh::TriangleMesh(const std::vector<Vec3f> &position, const std::vector<Vec3f> &normal,
+		const std::vector<Vec2f> &uv, const std::vector<int> &indices, bool outOfCore)
+	{
+		std::vector<Vec3f> gPosition(position), gNormal(normal);
+		std::vector<Vec2f> gUV(uv);
+		std::vector<int> gIndices(indices), gQuadIndices;
+		reorderForLocality(gPosition, gNormal, gUV, gIndices, gQuadIndices);
+		initialize(gPosition, gNormal, gUV, gIndices, gQuadIndices, outOfCore, "memory");
+	}
+
+	void TriangleMesh::initialize(const std::vector<Vec3f> &gPosition, const std::vector<Vec3f> &gNormal,
+		const std::vector<Vec2f> &gUV, const std::vector<int> &gIndices, const std::vector<int> &gQuadIndices,
+		bool outOfCore, const std::string &name)
+	{
+		m_nVertices = gPosition.size();
+		m_nIndices = gIndices.size();
+		m_nQuadIndices = gQuadIndices.size();
+
+		// Layout of the storage block: positions | normals | uvs | indices | quad indices
+		const size_t positionBytes = m_nVertices * sizeof(Vec3f);
+		const size_t normalBytes = gNormal.empty() ? 0 : m_nVertices * sizeof(Vec3f);
+		const size_t uvBytes = gUV.empty() ? 0 : m_nVertices * sizeof(Vec2f);
+		const size_t indexBytes = m_nIndices * sizeof(int);
+		const size_t quadIndexBytes = m_nQuadIndices * sizeof(int);
+		const size_t storageBytes = positionBytes + normalBytes + uvBytes + indexBytes + quadIndexBytes;
+
+		// Hand the arrays over to the geometry cache and page them back in on demand
+		const Byte *base = nullptr;
+		if (outOfCore && storageBytes > 0)
 		{
-			m_uv.reset(new Vec2f[m_nVertices]);
+			m_pagedStorage.reset(new MappedGeometryBuffer({ { gPosition.data(), positionBytes }, { gNormal.data(), normalBytes },
+				{ gUV.data(), uvBytes }, { gIndices.data(), indexBytes }, { gQuadIndices.data(), quadIndexBytes } },
+				GeometryCache::instance().getDirectory()));
+			base = m_pagedStorage->data();
+			LOG(INFO) << "Paged out " << storageBytes << " bytes of geometry from " << name;
 		}
-
-		for (unsigned int i = 0; i < m_nVertices; ++i)
+		else
 		{
-			m_position[i] = (*objectToWorld)(gPosition[i], 1.0f);
-			if (m_normal != nullptr)
-			{
-				m_normal[i] = (*objectToWorld)(gNormal[i], 0.0f);
-			}
-			if (m_uv != nullptr)
-			{
-				m_uv[i] = gUV[i];
-			}
+			m_storage.reset(new Byte[storageBytes]);
+			Byte *storage = m_storage.get();
+			std::copy(gPosition.begin(), gPosition.end(), reinterpret_cast<Vec3f*>(storage));
+			std::copy(gNormal.begin(), gNormal.end(), reinterpret_cast<Vec3f*>(storage + positionBytes));
+			std::copy(gUV.begin(), gUV.end(), reinterpret_cast<Vec2f*>(storage + positionBytes + normalBytes));
+			std::copy(gIndices.begin(), gIndices.end(), reinterpret_cast<int*>(storage + positionBytes + normalBytes + uvBytes));
+			std::copy(gQuadIndices.begin(), gQuadIndices.end(), reinterpret_cast<int*>(storage + positionBytes + normalBytes + uvBytes + indexBytes));
+			base = storage;
 		}
 
-		m_indices.resize(gIndices.size());
-		m_indices.assign(gIndices.begin(), gIndices.end());
+		m_position = reinterpret_cast<const Vec3f*>(base);
+		m_normal = normalBytes == 0 ? nullptr : reinterpret_cast<const Vec3f*>(base + positionBytes);
+		m_uv = uvBytes == 0 ? nullptr : reinterpret_cast<const Vec2f*>(base + positionBytes + normalBytes);
+		m_indices = reinterpret_cast<const int*>(base + positionBytes + normalBytes + uvBytes);
+		m_quadIndices = reinterpret_cast<const int*>(base + positionBytes + normalBytes + uvBytes + indexBytes);
+	}
 
+	Float TriangleMesh::area() const
+	{
+		// A quad is planar and convex, so it is the two triangles of one of its diagonals
+		Float sum = 0;
+		auto triangleArea = [&](int i0, int i1, int i2)
+		{
+			const Vec3f &p0 = getPosition(i0);
+			return 0.5f * length(cross(getPosition(i1) - p0, getPosition(i2) - p0));
+		};
+		for (size_t i = 0; i < 3 * numTriangles(); i += 3)
+			sum += triangleArea(getIndex(i), getIndex(i + 1), getIndex(i + 2));
+		for (size_t i = 0; i < 4 * numQuads(); i += 4)
+		{
+			sum += triangleArea(getQuadIndex(i), getQuadIndex(i + 1), getQuadIndex(i + 2));
+			sum += triangleArea(getQuadIndex(i), getQuadIndex(i + 2), getQuadIndex(i + 3));
+		}
+		return sum;
 	}
 
 	//-------------------------------------------ATriangleShape-------------------------------------
@@ -170,11 +374,23 @@ namespace RT
 		it.p = b[0] * p0 + b[1] * p1 + (1 - b[0] - b[1]) * p2;
 		// Compute surface normal for sampled point on triangle
 		it.n = normalize(Vec3f(cross(p1 - p0, p2 - p0)));
+		// Compute error bounds for sampled point on triangle
+		Vec3f pAbsSum = abs(b[0] * p0) + abs(b[1] * p1) + abs((1 - b[0] - b[1]) * p2);
+		it.pError = gamma(6) * pAbsSum;
 
 		pdf = 1 / area();
 		return it;
 	}
 
+	void ATriangleShape::normalBounds(Vec3f &w, Float &cosTheta) const
+	{
+		const auto &p0 = m_mesh->getPosition(m_indices[0]);
+		const auto &p1 = m_mesh->getPosition(m_indices[1]);
+		const auto &p2 = m_mesh->getPosition(m_indices[2]);
+		w = normalize(Vec3f(cross(p1 - p0, p2 - p0)));
+		cosTheta = 1;
+	}
+
 	bool ATriangleShape::hit(const Ray &ray) const
 	{
 		// Get triangle vertices in _p0_, _p1_, and _p2_
@@ -429,6 +645,10 @@ namespace RT
 		// Fill in _SurfaceInteraction_ from triangle hit
 		isect = SurfaceInteraction(pHit, uvHit, -ray.direction(), dpdu, dpdv, this);
 
+		// Compute error bounds for triangle intersection
+		Vec3f pAbsSum = abs(b0 * p0) + abs(b1 * p1) + abs(b2 * p2);
+		isect.pError = gamma(7) * pAbsSum;
+
 		// Override surface normal in _isect_ for triangle
 		isect.n = Vec3f(normalize(cross(dp02, dp12)));
 		tHit = t;
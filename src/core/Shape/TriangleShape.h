@@ -2,6 +2,7 @@
 #define ARTRIANGLE_SHAPE_H
 
 #include "Shape/Shape.h"
+#include "Utils/GeometryCache.h"
 
 namespace RT
 {
@@ -11,27 +12,56 @@ namespace RT
 		typedef std::shared_ptr<TriangleMesh> ptr;
 		typedef std::unique_ptr<TriangleMesh> unique_ptr;
 
-		TriangleMesh(Transform *objectToWorld, const std::string &filename);
+		TriangleMesh(Transform *objectToWorld, const std::string &filename, bool outOfCore = false);
 
-		size_t numTriangles() const { return m_indices.size() / 3; }
+		//Note: the vertex data is expected in world space already
+		TriangleMesh(const std::vector<Vec3f> &position, const std::vector<Vec3f> &normal,
+			const std::vector<Vec2f> &uv, const std::vector<int> &indices, bool outOfCore = false);
+
+		size_t numTriangles() const { return m_nIndices / 3; }
+		//Note: planar convex quads of the source mesh are kept as they are instead of being split
+		size_t numQuads() const { return m_nQuadIndices / 4; }
 		size_t numVertices() const { return m_nVertices; }
 
 		bool hasUV() const { return m_uv != nullptr; }
 		bool hasNormal() const { return m_normal != nullptr; }
+		bool isOutOfCore() const { return m_pagedStorage != nullptr; }
+
+		//Total area of the triangles and the quads
+		Float area() const;
 
-		const Vec3f& getPosition(const int &index) const { return m_position[index]; }
-		const Vec3f& getNormal(const int &index) const { return m_normal[index]; }
-		const Vec2f& getUV(const int &index) const { return m_uv[index]; }
+		const Vec3f& getPosition(const int &index) const { touch(m_position + index); return m_position[index]; }
+		const Vec3f& getNormal(const int &index) const { touch(m_normal + index); return m_normal[index]; }
+		const Vec2f& getUV(const int &index) const { touch(m_uv + index); return m_uv[index]; }
 
-		const std::vector<int>& getIndices() const { return m_indices; }
+		int getIndex(const size_t &index) const { touch(m_indices + index); return m_indices[index]; }
+		int getQuadIndex(const size_t &index) const { touch(m_quadIndices + index); return m_quadIndices[index]; }
 
 	private:
 
+		void initialize(const std::vector<Vec3f> &position, const std::vector<Vec3f> &normal,
+			const std::vector<Vec2f> &uv, const std::vector<int> &indices, const std::vector<int> &quadIndices,
+			bool outOfCore, const std::string &name);
+
+		void touch(const void *ptr) const
+		{
+			if (m_pagedStorage != nullptr)
+				m_pagedStorage->touch(static_cast<const Byte*>(ptr) - m_pagedStorage->data());
+		}
+
 		// TriangleMesh Data
-		std::unique_ptr<Vec3f[]> m_position = nullptr;
-		std::unique_ptr<Vec3f[]> m_normal = nullptr;
-		std::unique_ptr<Vec2f[]> m_uv = nullptr;
-		std::vector<int> m_indices;
+		//Note: all the arrays live in one block, which is either owned by the mesh
+		//      or written to the geometry cache when the mesh is out-of-core.
+		std::unique_ptr<Byte[]> m_storage = nullptr;
+		MappedGeometryBuffer::unique_ptr m_pagedStorage = nullptr;
+
+		const Vec3f *m_position = nullptr;
+		const Vec3f *m_normal = nullptr;
+		const Vec2f *m_uv = nullptr;
+		const int *m_indices = nullptr;
+		const int *m_quadIndices = nullptr;
+		size_t m_nIndices;
+		size_t m_nQuadIndices;
 		int m_nVertices;
 	};
 
@@ -58,6 +88,8 @@ namespace RT
 
 		virtual Float solidAngle(const Vec3f &p, int nSamples = 512) const override;
 
+		virtual void normalBounds(Vec3f &w, Float &cosTheta) const override;
+
 		virtual std::string toString() const override { return "TriangleShape[]"; }
 
 	private:
@@ -0,0 +1,216 @@
+#include "Utils/GeometryCache.h"
+
+#ifdef AURORA_WINDOWS_OS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <cstring>
+
+namespace RT
+{
+	//-------------------------------------------MappedGeometryBuffer-------------------------------------
+
+	static std::string makeBackingFilename(const std::string &directory)
+	{
+		static std::atomic<int> counter(0);
+#ifdef AURORA_WINDOWS_OS
+		unsigned long pid = GetCurrentProcessId();
+#else
+		unsigned long pid = (unsigned long)getpid();
+#endif
+		std::string dir = directory;
+		if (!dir.empty() && dir.back() != '/' && dir.back() != '\\')
+			dir += '/';
+		return dir + stringPrintf("rt_geometry_%d_%d.bin", (int)pid, (int)counter.fetch_add(1));
+	}
+
+	MappedGeometryBuffer::MappedGeometryBuffer(const std::vector<Chunk> &chunks, const std::string &directory)
+	{
+		for (const auto &chunk : chunks)
+			m_size += chunk.size;
+		const size_t size = m_size;
+		CHECK_GT(size, 0);
+		const std::string filename = makeBackingFilename(directory);
+
+#ifdef AURORA_WINDOWS_OS
+		// The file is deleted by the OS once the last handle is closed
+		HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			LOG(FATAL) << "Could not create the geometry cache file " << filename;
+
+		for (const auto &chunk : chunks)
+		{
+			const Byte *src = static_cast<const Byte*>(chunk.data);
+			size_t written = 0;
+			while (written < chunk.size)
+			{
+				DWORD bytes = (DWORD)glm::min(chunk.size - written, (size_t)(1 << 30)), done = 0;
+				if (!WriteFile(file, src + written, bytes, &done, nullptr) || done == 0)
+					LOG(FATAL) << "Could not write the geometry cache file " << filename;
+				written += done;
+			}
+		}
+
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+			LOG(FATAL) << "Could not map the geometry cache file " << filename;
+		m_data = static_cast<const Byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (m_data == nullptr)
+			LOG(FATAL) << "Could not map the geometry cache file " << filename;
+		m_fileHandle = file;
+		m_mappingHandle = mapping;
+#else
+		int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0)
+			LOG(FATAL) << "Could not create the geometry cache file " << filename;
+		// The mapping keeps the data alive, unlink now so nothing is left behind on exit
+		unlink(filename.c_str());
+
+		for (const auto &chunk : chunks)
+		{
+			const Byte *src = static_cast<const Byte*>(chunk.data);
+			size_t written = 0;
+			while (written < chunk.size)
+			{
+				ssize_t done = write(fd, src + written, chunk.size - written);
+				if (done <= 0)
+					LOG(FATAL) << "Could not write the geometry cache file " << filename;
+				written += (size_t)done;
+			}
+		}
+
+		void *ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (ptr == MAP_FAILED)
+			LOG(FATAL) << "Could not map the geometry cache file " << filename;
+		m_data = static_cast<const Byte*>(ptr);
+#endif
+
+		// Nothing is resident until it is touched by the renderer
+		const size_t nBlocks = (size + blockSize - 1) >> blockShift;
+		m_blockStates.reset(new std::atomic<uint8_t>[nBlocks]);
+		for (size_t i = 0; i < nBlocks; ++i)
+			m_blockStates[i].store(NonResident, std::memory_order_relaxed);
+	}
+
+	MappedGeometryBuffer::~MappedGeometryBuffer()
+	{
+		GeometryCache::instance().release(this);
+
+#ifdef AURORA_WINDOWS_OS
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mappingHandle);
+		CloseHandle(m_fileHandle);
+#else
+		munmap(const_cast<Byte*>(m_data), m_size);
+#endif
+	}
+
+	size_t MappedGeometryBuffer::blockBytes(size_t block) const
+	{
+		return glm::min(blockSize, m_size - (block << blockShift));
+	}
+
+	void MappedGeometryBuffer::evictBlock(size_t block) const
+	{
+		void *addr = const_cast<Byte*>(m_data + (block << blockShift));
+#ifdef AURORA_WINDOWS_OS
+		// Unlocking pages that are not locked removes them from the working set
+		VirtualUnlock(addr, blockBytes(block));
+#else
+		madvise(addr, blockBytes(block), MADV_DONTNEED);
+#endif
+	}
+
+	//-------------------------------------------GeometryCache-------------------------------------
+
+	GeometryCache &GeometryCache::instance()
+	{
+		static GeometryCache cache;
+		return cache;
+	}
+
+	void GeometryCache::setMemoryBudget(size_t bytes)
+	{
+		m_budget = bytes;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		evictToBudget();
+	}
+
+	void GeometryCache::pageIn(const MappedGeometryBuffer *buffer, size_t block)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// Another thread might have paged it in while we were waiting for the lock
+		auto &state = buffer->m_blockStates[block];
+		if (state.load(std::memory_order_relaxed) != MappedGeometryBuffer::NonResident)
+		{
+			state.store(MappedGeometryBuffer::Referenced, std::memory_order_relaxed);
+			return;
+		}
+
+		state.store(MappedGeometryBuffer::Referenced, std::memory_order_relaxed);
+		m_residentBytes += buffer->blockBytes(block);
+		m_clock.push_back({ buffer, block });
+
+		evictToBudget();
+	}
+
+	void GeometryCache::evictToBudget()
+	{
+		const size_t budget = m_budget;
+		if (budget == 0)
+			return;
+
+		//Note: the most recently paged in block is at the back and is never evicted by itself
+		while (m_residentBytes > budget && m_clock.size() > 1)
+		{
+			if (m_clockHand >= m_clock.size() - 1)
+				m_clockHand = 0;
+
+			Entry &entry = m_clock[m_clockHand];
+			auto &state = entry.buffer->m_blockStates[entry.block];
+			uint8_t expected = MappedGeometryBuffer::Resident;
+			if (!state.compare_exchange_strong(expected, MappedGeometryBuffer::NonResident, std::memory_order_relaxed))
+			{
+				// Referenced since the hand last passed it, give it a second chance
+				state.store(MappedGeometryBuffer::Resident, std::memory_order_relaxed);
+				++m_clockHand;
+				continue;
+			}
+
+			entry.buffer->evictBlock(entry.block);
+			m_residentBytes -= entry.buffer->blockBytes(entry.block);
+
+			// Keep the newest block at the back
+			entry = m_clock[m_clock.size() - 2];
+			m_clock[m_clock.size() - 2] = m_clock.back();
+			m_clock.pop_back();
+		}
+	}
+
+	void GeometryCache::release(const MappedGeometryBuffer *buffer)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < m_clock.size();)
+		{
+			if (m_clock[i].buffer == buffer)
+			{
+				m_residentBytes -= buffer->blockBytes(m_clock[i].block);
+				m_clock[i] = m_clock.back();
+				m_clock.pop_back();
+			}
+			else
+			{
+				++i;
+			}
+		}
+		m_clockHand = 0;
+	}
+
+}
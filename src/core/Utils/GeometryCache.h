@@ -0,0 +1,139 @@
+#ifndef ARGEOMETRYCACHE_H
+#define ARGEOMETRYCACHE_H
+
+#include "Utils/Base.h"
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+
+namespace RT
+{
+	class GeometryCache;
+
+	//! @brief Read-only geometry block backed by a memory-mapped temporary file.
+	/**
+	 * The mapped address stays valid for the whole lifetime of the buffer, eviction only returns the
+	 * physical pages to the OS. A later access simply faults the data back in from the file, so a
+	 * reference handed out by touch() can never dangle.
+	 */
+	class MappedGeometryBuffer final
+	{
+	public:
+		typedef std::unique_ptr<MappedGeometryBuffer> unique_ptr;
+
+		//Note: residency is tracked per block of 64KB
+		static constexpr int blockShift = 16;
+		static constexpr size_t blockSize = size_t(1) << blockShift;
+
+		//A piece of the buffer, the pieces are laid out one after the other
+		struct Chunk
+		{
+			const void *data;
+			size_t size;
+		};
+
+		//Note: the pieces are written to the file straight away, no copy of the whole buffer is made
+		MappedGeometryBuffer(const std::vector<Chunk> &chunks, const std::string &directory);
+		~MappedGeometryBuffer();
+
+		const Byte *data() const { return m_data; }
+		size_t size() const { return m_size; }
+
+		//Mark the block containing |offset| as recently used, paging it in if needed
+		inline void touch(size_t offset) const;
+
+	private:
+		MappedGeometryBuffer(const MappedGeometryBuffer &) = delete;
+		MappedGeometryBuffer &operator=(const MappedGeometryBuffer &) = delete;
+
+		enum BlockState : uint8_t { NonResident = 0, Resident, Referenced };
+
+		void evictBlock(size_t block) const;
+		size_t blockBytes(size_t block) const;
+
+		const Byte *m_data = nullptr;
+		size_t m_size = 0;
+		std::unique_ptr<std::atomic<uint8_t>[]> m_blockStates;
+
+#ifdef AURORA_WINDOWS_OS
+		void *m_fileHandle = nullptr;
+		void *m_mappingHandle = nullptr;
+#endif
+
+		friend class GeometryCache;
+	};
+
+	//! @brief Process wide residency manager of the out-of-core geometry.
+	/**
+	 * Keeps the resident bytes of all mapped geometry buffers under a memory budget. Blocks are
+	 * evicted with the CLOCK (second chance) approximation of LRU, so that touching an already
+	 * resident block is a single relaxed compare-and-swap and never takes the lock.
+	 *
+	 * An out-of-core mesh pages its vertex and index arrays as well as its own bounding volume
+	 * hierarchy, and the scene only keeps one hitable per mesh in memory. The arrays of a mesh are
+	 * not covered by the budget while it is loaded, so that the meshes are loaded one at a time.
+	 */
+	class GeometryCache final
+	{
+	public:
+
+		static GeometryCache &instance();
+
+		//Note: a budget of 0 means no limit
+		void setMemoryBudget(size_t bytes);
+		size_t getMemoryBudget() const { return m_budget; }
+
+		void setEnabled(bool enabled) { m_enabled = enabled; }
+		bool isEnabled() const { return m_enabled; }
+
+		void setDirectory(const std::string &directory) { m_directory = directory; }
+		const std::string &getDirectory() const { return m_directory; }
+
+		size_t residentBytes() const { return m_residentBytes; }
+
+		//Held while an out-of-core mesh is loaded and its hierarchy built
+		std::unique_lock<std::mutex> lockLoading() { return std::unique_lock<std::mutex>(m_loadMutex); }
+
+	private:
+		GeometryCache() = default;
+
+		void pageIn(const MappedGeometryBuffer *buffer, size_t block);
+		void release(const MappedGeometryBuffer *buffer);
+		void evictToBudget();
+
+		struct Entry
+		{
+			const MappedGeometryBuffer *buffer;
+			size_t block;
+		};
+
+		bool m_enabled = false;
+		std::string m_directory;
+		std::atomic<size_t> m_budget{ 0 };
+		std::atomic<size_t> m_residentBytes{ 0 };
+
+		std::mutex m_mutex, m_loadMutex;
+		std::vector<Entry> m_clock;
+		size_t m_clockHand = 0;
+
+		friend class MappedGeometryBuffer;
+	};
+
+	inline void MappedGeometryBuffer::touch(size_t offset) const
+	{
+		DCHECK_LT(offset, m_size);
+		const size_t block = offset >> blockShift;
+
+		//Note: only a resident block is marked as referenced, the clock may evict it after the load
+		uint8_t state = m_blockStates[block].load(std::memory_order_relaxed);
+		while (state == Resident &&
+			!m_blockStates[block].compare_exchange_weak(state, Referenced, std::memory_order_relaxed)) {}
+		if (state == NonResident)
+			GeometryCache::instance().pageIn(this, block);
+	}
+
+}
+
+#endif
@@ -19,30 +19,60 @@ namespace RT
 		//ײ㷢dͬ
 		inline Ray spawnRay(const Vec3f &d) const
 		{
-			Vec3f o = p;
-			return Ray(o, d, Infinity);
+			Vec3f o = offsetRayOrigin(d);
+			Ray ray(o, d, Infinity);
+			ray.m_originLodLevel = lodLevel;
+			return ray;
 		}
 
 		//ײ㷢뵽pĹ
 		inline Ray spawnRayTo(const Vec3f &p2) const
 		{
-			Vec3f origin = p;
-			return Ray(origin, p2 - p, 1 - ShadowEpsilon);
+			//Note: the ray direction is normalized, so its extent is the distance to the target
+			Vec3f origin = offsetRayOrigin(p2 - p);
+			Ray ray(origin, p2 - origin, (1 - ShadowEpsilon) * length(p2 - origin));
+			ray.m_originLodLevel = lodLevel;
+			return ray;
 		}
 
 		// ײ㷢뵽һײĹ
 		inline Ray spawnRayTo(const Interaction &it) const
 		{
-			Vec3f origin = p;
-			Vec3f target = it.p;
+			Vec3f origin = offsetRayOrigin(it.p - p);
+			Vec3f target = it.offsetRayOrigin(origin - it.p);
 			Vec3f d = target - origin;
-			return Ray(origin, d, 1 - ShadowEpsilon);
+			Ray ray(origin, d, (1 - ShadowEpsilon) * length(d));
+			ray.m_originLodLevel = lodLevel;
+			return ray;
+		}
+
+		//Note: the origin of a spawned ray is pushed off the surface to the side of |w| by the rounding
+		//      error bound of the hit point, so that the ray cannot find the surface it leaves nor a
+		//      neighbouring one that the hit point lies on within its error
+		inline Vec3f offsetRayOrigin(const Vec3f &w) const
+		{
+			Vec3f offset = n * dot(abs(n), pError);
+			if (dot(w, n) < 0)
+				offset = -offset;
+
+			// Round the offset point away from p
+			Vec3f po = p + offset;
+			for (int i = 0; i < 3; ++i)
+			{
+				if (offset[i] > 0)
+					po[i] = std::nextafter(po[i], Infinity);
+				else if (offset[i] < 0)
+					po[i] = std::nextafter(po[i], -Infinity);
+			}
+			return po;
 		}
 
 	public:
 		Vec3f p;			//surface point
 		Vec3f wo;			//outgoing direction
-		Vec3f n;			//normal vector
+		Vec3f n = Vec3f(0.f);	//normal vector, zero away from surfaces
+		Vec3f pError = Vec3f(0.f);	//bound of the absolute rounding error of p
+		int lodLevel = 0;		//geometry level of detail of the surface, 0 is the full resolution
 	};
 
 	class SurfaceInteraction final : public Interaction
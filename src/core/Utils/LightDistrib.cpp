@@ -2,26 +2,570 @@
 
 #include "Scene/Scene.h"
 
+#include <numeric>
+#include <thread>
+#include <algorithm>
+
 namespace RT
 {
 	std::unique_ptr<LightDistribution> createLightSampleDistribution(
-		const std::string &name, const Scene &scene) 
+		const std::string &name, const Scene &scene)
 	{
+		if (name == "uniform" || scene.m_lights.size() <= 1)
 		{
 			return std::unique_ptr<LightDistribution>{
 				new UniformLightDistribution(scene)};
 		}
+		else if (name == "power")
+		{
+			return std::unique_ptr<LightDistribution>{
+				new PowerLightDistribution(scene)};
+		}
+		else if (name == "bvh")
+		{
+			return std::unique_ptr<LightDistribution>{
+				new LightBVHDistribution(scene)};
+		}
+		else if (name == "spatial")
+		{
+			return std::unique_ptr<LightDistribution>{
+				new SpatialLightDistribution(scene)};
+		}
+		else
+		{
+			LOG(ERROR) << "Light sample distribution type \"" << name << "\" unknown. Using \"spatial\".";
+			return std::unique_ptr<LightDistribution>{
+				new SpatialLightDistribution(scene)};
+		}
+	}
+
+	//-------------------------------------------LightBounds-------------------------------------
 
+	static inline Float safeSqrt(Float x) { return glm::sqrt(glm::max((Float)0, x)); }
+	static inline Float safeAcos(Float x) { return glm::acos(clamp(x, -1, 1)); }
+
+	//cos(max(0, a - b)) and sin(max(0, a - b)) from the sines and cosines of the angles
+	static inline Float cosSubClamped(Float sinA, Float cosA, Float sinB, Float cosB)
+	{
+		return cosA > cosB ? 1 : cosA * cosB + sinA * sinB;
+	}
+
+	static inline Float sinSubClamped(Float sinA, Float cosA, Float sinB, Float cosB)
+	{
+		return cosA > cosB ? 0 : sinA * cosB - cosA * sinB;
 	}
 
-	UniformLightDistribution::UniformLightDistribution(const Scene &scene) 
+	Float LightBounds::importance(const Vec3f &p, const Vec3f &n) const
+	{
+		// Distance to the center, clamped so that points inside the bounds do not blow up
+		const Vec3f pc = (bounds.m_pMin + bounds.m_pMax) * 0.5f;
+		Float d2 = distanceSquared(p, pc);
+		d2 = glm::max(d2, length(bounds.diagonal()) * 0.5f);
+
+		// Angle between the axis and the direction towards the point
+		const Vec3f wi = normalize(p - pc);
+		Float cosTheta_w = dot(w, wi);
+		if (twoSided)
+			cosTheta_w = glm::abs(cosTheta_w);
+		const Float sinTheta_w = safeSqrt(1 - cosTheta_w * cosTheta_w);
+
+		// Half angle of the cone from the point that bounds the box
+		Float cosTheta_b = -1;
+		if (!inside(p, bounds))
+		{
+			const Float r2 = distanceSquared(bounds.m_pMin, bounds.m_pMax) * 0.25f;
+			const Float dc2 = distanceSquared(p, pc);
+			if (dc2 > r2)
+				cosTheta_b = safeSqrt(1 - r2 / dc2);
+		}
+		const Float sinTheta_b = safeSqrt(1 - cosTheta_b * cosTheta_b);
+
+		// Smallest angle between the emitting normals and the point, reduced by the angle the box subtends
+		const Float sinTheta_o = safeSqrt(1 - cosTheta_o * cosTheta_o);
+		const Float cosTheta_x = cosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+		const Float sinTheta_x = sinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+		const Float cosThetap = cosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+		if (cosThetap <= cosTheta_e)
+			return 0;
+
+		Float result = phi * cosThetap / d2;
+
+		// Smallest angle between the surface normal and the box
+		if (n != Vec3f(0, 0, 0))
+		{
+			const Float cosTheta_i = glm::abs(dot(wi, n));
+			const Float sinTheta_i = safeSqrt(1 - cosTheta_i * cosTheta_i);
+			result *= cosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+		}
+
+		return glm::max(result, (Float)0);
+	}
+
+	LightBounds unionBounds(const LightBounds &a, const LightBounds &b)
+	{
+		if (a.phi == 0)
+			return b;
+		if (b.phi == 0)
+			return a;
+
+		LightBounds ret;
+		ret.bounds = unionBounds(a.bounds, b.bounds);
+		ret.phi = a.phi + b.phi;
+		ret.cosTheta_e = glm::min(a.cosTheta_e, b.cosTheta_e);
+		ret.twoSided = a.twoSided || b.twoSided;
+
+		// Smallest cone around both cones of normals
+		const Float theta_a = safeAcos(a.cosTheta_o), theta_b = safeAcos(b.cosTheta_o);
+		const Float theta_d = safeAcos(dot(a.w, b.w));
+		if (glm::min(theta_d + theta_b, Pi) <= theta_a)
+		{
+			ret.w = a.w;
+			ret.cosTheta_o = a.cosTheta_o;
+			return ret;
+		}
+		if (glm::min(theta_d + theta_a, Pi) <= theta_b)
+		{
+			ret.w = b.w;
+			ret.cosTheta_o = b.cosTheta_o;
+			return ret;
+		}
+
+		const Float theta_o = (theta_a + theta_d + theta_b) * 0.5f;
+		const Vec3f wr = cross(a.w, b.w);
+		if (theta_o >= Pi || lengthSquared(wr) == 0)
+		{
+			ret.w = a.w;
+			ret.cosTheta_o = -1;
+			return ret;
+		}
+
+		// Rotate a.w towards b.w by theta_o - theta_a
+		const Float theta_r = theta_o - theta_a;
+		const Vec3f axis = normalize(wr);
+		ret.w = normalize(a.w * glm::cos(theta_r) + cross(axis, a.w) * glm::sin(theta_r)
+			+ axis * dot(axis, a.w) * (1 - glm::cos(theta_r)));
+		ret.cosTheta_o = glm::cos(theta_o);
+		return ret;
+	}
+
+	//-------------------------------------------LightDistribution-------------------------------------
+
+	int LightDistribution::sample(const Vec3f &p, const Vec3f &, Float u, Float &pmf) const
+	{
+		const Distribution1D *distrib = lookup(p);
+		int index = distrib->sampleDiscrete(u, &pmf);
+		return pmf > 0 ? index : -1;
+	}
+
+	Float LightDistribution::pmf(const Vec3f &p, const Vec3f &, int lightIndex) const
+	{
+		return lookup(p)->discretePDF(lightIndex);
+	}
+
+	//-------------------------------------------UniformLightDistribution-------------------------------------
+
+	UniformLightDistribution::UniformLightDistribution(const Scene &scene)
 	{
 		std::vector<Float> prob(scene.m_lights.size(), Float(1));
 		distrib.reset(new Distribution1D(&prob[0], int(prob.size())));
 	}
 
-	const Distribution1D *UniformLightDistribution::lookup(const Vec3f &p) const 
+	const Distribution1D *UniformLightDistribution::lookup(const Vec3f &) const
+	{
+		return distrib.get();
+	}
+
+	//-------------------------------------------PowerLightDistribution-------------------------------------
+
+	PowerLightDistribution::PowerLightDistribution(const Scene &scene)
+	{
+		std::vector<Float> lightPower;
+		for (const auto &light : scene.m_lights)
+			lightPower.push_back(light->power().luminance());
+
+		//Note: fall back to uniform selection when no light reports any power
+		if (std::accumulate(lightPower.begin(), lightPower.end(), Float(0)) <= 0)
+			std::fill(lightPower.begin(), lightPower.end(), Float(1));
+
+		distrib.reset(new Distribution1D(&lightPower[0], int(lightPower.size())));
+	}
+
+	const Distribution1D *PowerLightDistribution::lookup(const Vec3f &) const
 	{
 		return distrib.get();
 	}
-}
\ No newline at end of file
+
+	//-------------------------------------------SpatialLightDistribution-------------------------------------
+
+	SpatialLightDistribution::SpatialLightDistribution(const Scene &scene, int maxVoxels)
+		: m_scene(scene)
+	{
+		// The voxels are roughly cubes, the longest axis of the bounds gets |maxVoxels| of them
+		const BBox3f &bounds = scene.worldBound();
+		const Vec3f diag = bounds.diagonal();
+		const Float bmax = diag[bounds.maximumExtent()];
+		for (int i = 0; i < 3; ++i)
+		{
+			m_nVoxels[i] = glm::max(1, (int)glm::round(diag[i] / bmax * maxVoxels));
+			CHECK_LT(m_nVoxels[i], 1 << 20);
+		}
+
+		//Note: a few times the voxel count keeps the probe sequences short, only a fraction of the voxels is ever visited
+		m_hashTableSize = 4 * (size_t)m_nVoxels[0] * m_nVoxels[1] * m_nVoxels[2];
+		m_hashTable.reset(new HashEntry[m_hashTableSize]);
+		for (size_t i = 0; i < m_hashTableSize; ++i)
+		{
+			m_hashTable[i].packedPos.store(invalidPackedPos);
+			m_hashTable[i].distribution.store(nullptr);
+		}
+
+		LOG(INFO) << "SpatialLightDistribution: " << m_nVoxels[0] << " x " << m_nVoxels[1] << " x "
+			<< m_nVoxels[2] << " voxels over " << scene.m_lights.size() << " lights";
+	}
+
+	SpatialLightDistribution::~SpatialLightDistribution()
+	{
+		size_t nVoxels = 0;
+		for (size_t i = 0; i < m_hashTableSize; ++i)
+		{
+			Distribution1D *distrib = m_hashTable[i].distribution.load();
+			if (distrib != nullptr)
+			{
+				++nVoxels;
+				delete distrib;
+			}
+		}
+		LOG(INFO) << "SpatialLightDistribution: computed the distributions of " << nVoxels << " voxels";
+	}
+
+	const Distribution1D *SpatialLightDistribution::lookup(const Vec3f &p) const
+	{
+		// Voxel of the point, points outside of the bounds go to the closest voxel
+		const Vec3f offset = m_scene.worldBound().offset(p);
+		Vec3i pi;
+		for (int i = 0; i < 3; ++i)
+			pi[i] = clamp((int)(offset[i] * m_nVoxels[i]), 0, m_nVoxels[i] - 1);
+
+		const uint64_t packedPos = ((uint64_t)pi[0] << 40) | ((uint64_t)pi[1] << 20) | (uint64_t)pi[2];
+		CHECK_NE(packedPos, invalidPackedPos);
+
+		// Mix the bits of the key before reducing it to a slot
+		uint64_t hash = packedPos;
+		hash ^= (hash >> 31);
+		hash *= 0x7fb5d329728ea185ull;
+		hash ^= (hash >> 27);
+		hash *= 0x81dadef4bc2dd44dull;
+		hash ^= (hash >> 33);
+		hash %= m_hashTableSize;
+
+		// Quadratic probing until the slot of the voxel or an empty slot is found
+		uint64_t step = 1;
+		while (true)
+		{
+			HashEntry &entry = m_hashTable[hash];
+			uint64_t entryPackedPos = entry.packedPos.load(std::memory_order_acquire);
+			if (entryPackedPos == packedPos)
+			{
+				//Note: another thread may have claimed the slot and still be computing the distribution
+				Distribution1D *distrib = entry.distribution.load(std::memory_order_acquire);
+				while (distrib == nullptr)
+				{
+					std::this_thread::yield();
+					distrib = entry.distribution.load(std::memory_order_acquire);
+				}
+				return distrib;
+			}
+			else if (entryPackedPos != invalidPackedPos)
+			{
+				hash = (hash + step * step) % m_hashTableSize;
+				++step;
+			}
+			else
+			{
+				// Claim the empty slot, then publish the distribution of the voxel
+				uint64_t invalid = invalidPackedPos;
+				if (entry.packedPos.compare_exchange_weak(invalid, packedPos))
+				{
+					Distribution1D *distrib = computeDistribution(pi);
+					entry.distribution.store(distrib, std::memory_order_release);
+					return distrib;
+				}
+			}
+		}
+	}
+
+	Distribution1D *SpatialLightDistribution::computeDistribution(const Vec3i &pi) const
+	{
+		// World space bounds of the voxel
+		const BBox3f &bounds = m_scene.worldBound();
+		Vec3f p0, p1;
+		for (int i = 0; i < 3; ++i)
+		{
+			p0[i] = lerp(Float(pi[i]) / m_nVoxels[i], bounds.m_pMin[i], bounds.m_pMax[i]);
+			p1[i] = lerp(Float(pi[i] + 1) / m_nVoxels[i], bounds.m_pMin[i], bounds.m_pMax[i]);
+		}
+
+		// Estimate the radiance every light delivers to points spread over the voxel, visibility is ignored.
+		// The points only depend on the voxel so that renders are reproducible whichever thread computes it.
+		static constexpr int nSamples = 128;
+		const size_t nLights = m_scene.m_lights.size();
+		std::vector<Float> lightContrib(nLights, Float(0));
+		Rng rng(((uint64_t)pi[0] << 40) | ((uint64_t)pi[1] << 20) | (uint64_t)pi[2]);
+		for (int i = 0; i < nSamples; ++i)
+		{
+			Vec3f po;
+			for (int j = 0; j < 3; ++j)
+				po[j] = lerp(rng.uniformFloat(), p0[j], p1[j]);
+			Interaction intr(po);
+
+			Vec2f u(rng.uniformFloat(), rng.uniformFloat());
+			for (size_t j = 0; j < nLights; ++j)
+			{
+				Float pdf;
+				Vec3f wi;
+				VisibilityTester vis;
+				Spectrum Li = m_scene.m_lights[j]->sample_Li(intr, u, wi, pdf, vis);
+				if (pdf > 0)
+					lightContrib[j] += Li.luminance() / pdf;
+			}
+		}
+
+		// Keep every light slightly reachable, a few points may miss a light that does reach parts of the voxel
+		const Float sumContrib = std::accumulate(lightContrib.begin(), lightContrib.end(), Float(0));
+		const Float avgContrib = sumContrib / (nSamples * nLights);
+		const Float minContrib = (avgContrib > 0) ? .001f * avgContrib : 1;
+		for (size_t j = 0; j < nLights; ++j)
+			lightContrib[j] = glm::max(lightContrib[j], minContrib);
+
+		return new Distribution1D(&lightContrib[0], (int)nLights);
+	}
+
+	//-------------------------------------------LightBVHDistribution-------------------------------------
+
+	//Cost of a split candidate after the surface area orientation heuristic of Conty Estevez and Kulla,
+	//"Importance Sampling of Many Lights with Adaptive Tree Splitting"
+	static Float evaluateCost(const LightBounds &b, const BBox3f &bounds, int dim)
+	{
+		const Float theta_o = safeAcos(b.cosTheta_o), theta_e = safeAcos(b.cosTheta_e);
+		const Float theta_w = glm::min(theta_o + theta_e, Pi);
+		const Float sinTheta_o = safeSqrt(1 - b.cosTheta_o * b.cosTheta_o);
+		const Float M_omega = 2 * Pi * (1 - b.cosTheta_o) + Pi / 2 * (2 * theta_w * sinTheta_o -
+			glm::cos(theta_o - 2 * theta_w) - 2 * theta_o * sinTheta_o + b.cosTheta_o);
+
+		//Note: favours splitting along the long axes of the node
+		const Vec3f diag = bounds.diagonal();
+		const Float Kr = diag[dim] > 0 ? maxComponent(diag) / diag[dim] : 1;
+		return b.phi * M_omega * Kr * b.bounds.surfaceArea();
+	}
+
+	LightBVHDistribution::LightBVHDistribution(const Scene &scene)
+		: m_bitTrails(scene.m_lights.size(), invalidBitTrail)
+	{
+		std::vector<std::pair<int, LightBounds>> bvhLights;
+		for (size_t i = 0; i < scene.m_lights.size(); ++i)
+		{
+			LightBounds lightBounds;
+			if (!scene.m_lights[i]->getBounds(lightBounds))
+				m_infiniteLights.push_back((int)i);
+			else if (lightBounds.phi > 0)
+				bvhLights.push_back({ (int)i, lightBounds });
+			//Note: lights without any power are never sampled
+		}
+
+		if (!bvhLights.empty())
+			buildTree(bvhLights, 0, (int)bvhLights.size(), 0, 0);
+
+		LOG(INFO) << "LightBVHDistribution: " << m_nodes.size() << " nodes over " << bvhLights.size()
+			<< " lights, " << m_infiniteLights.size() << " infinite lights";
+	}
+
+	int LightBVHDistribution::buildTree(std::vector<std::pair<int, LightBounds>> &lights, int begin, int end,
+		uint64_t bitTrail, int depth)
+	{
+		CHECK_LT(begin, end);
+		if (end - begin == 1)
+		{
+			// Leaf with a single light
+			const int nodeIndex = (int)m_nodes.size();
+			m_nodes.push_back({ lights[begin].second, lights[begin].first, true });
+			m_bitTrails[lights[begin].first] = bitTrail;
+			return nodeIndex;
+		}
+		CHECK_LT(depth, 63);
+
+		BBox3f bounds, centroidBounds;
+		for (int i = begin; i < end; ++i)
+		{
+			const BBox3f &b = lights[i].second.bounds;
+			bounds = unionBounds(bounds, b);
+			centroidBounds = unionBounds(centroidBounds, (b.m_pMin + b.m_pMax) * 0.5f);
+		}
+
+		// Pick the cheapest of the bucket boundaries along the three axes
+		static constexpr int nBuckets = 12;
+		Float minCost = Infinity;
+		int minCostSplitBucket = -1, minCostSplitDim = -1;
+		for (int dim = 0; dim < 3; ++dim)
+		{
+			if (centroidBounds.m_pMax[dim] == centroidBounds.m_pMin[dim])
+				continue;
+
+			auto bucketOf = [&](const LightBounds &b)
+			{
+				const Float pc = (b.bounds.m_pMin[dim] + b.bounds.m_pMax[dim]) * 0.5f;
+				const Float t = (pc - centroidBounds.m_pMin[dim]) / (centroidBounds.m_pMax[dim] - centroidBounds.m_pMin[dim]);
+				return clamp((int)(t * nBuckets), 0, nBuckets - 1);
+			};
+
+			LightBounds bucketBounds[nBuckets];
+			for (int i = begin; i < end; ++i)
+			{
+				const int bucket = bucketOf(lights[i].second);
+				bucketBounds[bucket] = unionBounds(bucketBounds[bucket], lights[i].second);
+			}
+
+			for (int i = 0; i < nBuckets - 1; ++i)
+			{
+				LightBounds below, above;
+				for (int j = 0; j <= i; ++j)
+					below = unionBounds(below, bucketBounds[j]);
+				for (int j = i + 1; j < nBuckets; ++j)
+					above = unionBounds(above, bucketBounds[j]);
+
+				const Float cost = evaluateCost(below, bounds, dim) + evaluateCost(above, bounds, dim);
+				if (cost > 0 && cost < minCost)
+				{
+					minCost = cost;
+					minCostSplitBucket = i;
+					minCostSplitDim = dim;
+				}
+			}
+		}
+
+		int mid;
+		if (minCostSplitDim == -1)
+		{
+			mid = (begin + end) / 2;
+		}
+		else
+		{
+			const int dim = minCostSplitDim;
+			auto pmid = std::partition(lights.begin() + begin, lights.begin() + end,
+				[&](const std::pair<int, LightBounds> &l)
+			{
+				const Float pc = (l.second.bounds.m_pMin[dim] + l.second.bounds.m_pMax[dim]) * 0.5f;
+				const Float t = (pc - centroidBounds.m_pMin[dim]) / (centroidBounds.m_pMax[dim] - centroidBounds.m_pMin[dim]);
+				return clamp((int)(t * nBuckets), 0, nBuckets - 1) <= minCostSplitBucket;
+			});
+			mid = (int)(pmid - lights.begin());
+			if (mid == begin || mid == end)
+				mid = (begin + end) / 2;
+		}
+
+		// The first child directly follows its parent
+		const int nodeIndex = (int)m_nodes.size();
+		m_nodes.push_back({ LightBounds(), -1, false });
+		const int child0 = buildTree(lights, begin, mid, bitTrail, depth + 1);
+		CHECK_EQ(child0, nodeIndex + 1);
+		const int child1 = buildTree(lights, mid, end, bitTrail | (1ull << depth), depth + 1);
+
+		m_nodes[nodeIndex].bounds = unionBounds(m_nodes[child0].bounds, m_nodes[child1].bounds);
+		m_nodes[nodeIndex].index = child1;
+		return nodeIndex;
+	}
+
+	int LightBVHDistribution::sample(const Vec3f &p, const Vec3f &n, Float u, Float &pmf) const
+	{
+		// Infinite lights are picked with the same probability as the whole hierarchy
+		const int nInfinite = (int)m_infiniteLights.size();
+		const Float pInfinite = Float(nInfinite) / Float(nInfinite + (m_nodes.empty() ? 0 : 1));
+		if (u < pInfinite)
+		{
+			const int index = glm::min((int)(u / pInfinite * nInfinite), nInfinite - 1);
+			pmf = pInfinite / nInfinite;
+			return m_infiniteLights[index];
+		}
+		if (m_nodes.empty())
+			return -1;
+
+		// Descend with probabilities proportional to the importance of the children
+		u = glm::min((u - pInfinite) / (1 - pInfinite), aOneMinusEpsilon);
+		pmf = 1 - pInfinite;
+		int nodeIndex = 0;
+		while (true)
+		{
+			const Node &node = m_nodes[nodeIndex];
+			if (node.isLeaf)
+			{
+				//Note: the importance of a leaf below the root was already part of the descent
+				if (nodeIndex > 0 || node.bounds.importance(p, n) > 0)
+					return node.index;
+				return -1;
+			}
+
+			const Float ci0 = m_nodes[nodeIndex + 1].bounds.importance(p, n);
+			const Float ci1 = m_nodes[node.index].bounds.importance(p, n);
+			if (ci0 == 0 && ci1 == 0)
+				return -1;
+
+			const Float p0 = ci0 / (ci0 + ci1);
+			if (u < p0)
+			{
+				nodeIndex = nodeIndex + 1;
+				u = glm::min(u / p0, aOneMinusEpsilon);
+				pmf *= p0;
+			}
+			else
+			{
+				nodeIndex = node.index;
+				u = glm::min((u - p0) / (1 - p0), aOneMinusEpsilon);
+				pmf *= 1 - p0;
+			}
+		}
+	}
+
+	Float LightBVHDistribution::pmf(const Vec3f &p, const Vec3f &n, int lightIndex) const
+	{
+		const int nInfinite = (int)m_infiniteLights.size();
+		const Float pInfinite = Float(nInfinite) / Float(nInfinite + (m_nodes.empty() ? 0 : 1));
+
+		uint64_t bitTrail = m_bitTrails[lightIndex];
+		if (bitTrail == invalidBitTrail)
+		{
+			// Either an infinite light or a light without power
+			if (std::find(m_infiniteLights.begin(), m_infiniteLights.end(), lightIndex) != m_infiniteLights.end())
+				return pInfinite / nInfinite;
+			return 0;
+		}
+
+		// Follow the trail of the light and multiply the probabilities of the turns
+		Float pmf = 1 - pInfinite;
+		int nodeIndex = 0;
+		while (true)
+		{
+			const Node &node = m_nodes[nodeIndex];
+			if (node.isLeaf)
+			{
+				CHECK_EQ(node.index, lightIndex);
+				return (nodeIndex > 0 || node.bounds.importance(p, n) > 0) ? pmf : 0;
+			}
+
+			const Float ci0 = m_nodes[nodeIndex + 1].bounds.importance(p, n);
+			const Float ci1 = m_nodes[node.index].bounds.importance(p, n);
+			if (ci0 == 0 && ci1 == 0)
+				return 0;
+
+			if (bitTrail & 1)
+			{
+				pmf *= ci1 / (ci0 + ci1);
+				nodeIndex = node.index;
+			}
+			else
+			{
+				pmf *= ci0 / (ci0 + ci1);
+				nodeIndex = nodeIndex + 1;
+			}
+			bitTrail >>= 1;
+		}
+	}
+}
@@ -4,6 +4,7 @@
 #include "Utils/Math.h"
 
 #include <vector>
+#include <atomic>
 
 namespace RT
 {
@@ -92,6 +93,23 @@ namespace RT
 		Float funcInt;
 	};
 
+	// ԴİΧϢռΧСⷨߵķ׶ԼʣڹƹԴһԴĳҪ
+	struct LightBounds 
+	{
+		BBox3f bounds;
+		Vec3f w = Vec3f(0, 0, 1);	//axis of the cone of the emitting normals
+		Float phi = 0;				//luminance of the emitted power, zero for no light at all
+		Float cosTheta_o = 1;		//the normals lie within acos(cosTheta_o) of w
+		Float cosTheta_e = 0;		//light leaves within acos(cosTheta_e) of a normal, 0 for a diffuse emitter
+		bool twoSided = false;
+
+		//Conservative estimate of the light arriving at |p| on a surface with normal |n|, a zero |n| for no surface
+		Float importance(const Vec3f &p, const Vec3f &n) const;
+	};
+
+	//Bounds of both, the power adds up
+	LightBounds unionBounds(const LightBounds &a, const LightBounds &b);
+
 	// LightDistributionΪඨһͨýӿڣЩΪڿռеĸԹԴвṩʷֲ
 	class LightDistribution 
 	{
@@ -100,6 +118,13 @@ namespace RT
 
 		//ռеһ|p|˷ظõԴĲֲ
 		virtual const Distribution1D *lookup(const Vec3f &p) const = 0;
+
+		//ΪΪ|n|ɫ|p|ѡһԴ±겢ѡд|pmf|ûпѡĹԴʱ-1
+		//Note: the default samples the distribution of lookup(p), |n| is a zero vector away from surfaces
+		virtual int sample(const Vec3f &p, const Vec3f &n, Float u, Float &pmf) const;
+
+		//sample()ɫ|p|ѡ±Ϊ|lightIndex|ĹԴĸ
+		virtual Float pmf(const Vec3f &p, const Vec3f &n, int lightIndex) const;
 	};
 
 	// LightDistribution򵥵Ŀʵ֣ṩĵ㣬йԴϷؾȷֲַڷǳ򵥵ĳھжԴĳЧѡ
@@ -115,6 +140,85 @@ namespace RT
 		std::unique_ptr<Distribution1D> distrib;
 	};
 
+	// Դʵȹֲɫλ޹ءۼΪ㣬ʺȲܴĶԴ
+	class PowerLightDistribution : public LightDistribution 
+	{
+	public:
+
+		PowerLightDistribution(const Scene &scene);
+
+		virtual const Distribution1D *lookup(const Vec3f &p) const override;
+
+	private:
+		std::unique_ptr<Distribution1D> distrib;
+	};
+
+	// ռԴֲΧлΪÿظݸԴڲ㴦Ĺ׹ƹֲ
+	// ʹɫ㸽ΪĹԴᱻصķֲڵһαѯʱż㣬ĲϣС
+	class SpatialLightDistribution : public LightDistribution 
+	{
+	public:
+
+		SpatialLightDistribution(const Scene &scene, int maxVoxels = 32);
+		~SpatialLightDistribution();
+
+		virtual const Distribution1D *lookup(const Vec3f &p) const override;
+
+	private:
+		//|pi|ĹԴֲ
+		Distribution1D *computeDistribution(const Vec3i &pi) const;
+
+		const Scene &m_scene;
+		int m_nVoxels[3];
+
+		//Note: the key packs the voxel coordinates into 60 bits, invalidPackedPos marks an empty slot
+		struct HashEntry 
+		{
+			std::atomic<uint64_t> packedPos;
+			std::atomic<Distribution1D *> distribution;
+		};
+		static constexpr uint64_t invalidPackedPos = 0xffffffffffffffffull;
+
+		mutable std::unique_ptr<HashEntry[]> m_hashTable;
+		size_t m_hashTableSize;
+	};
+
+	// ԴΰΧ壺ÿڵ㱣йԴİΧСⷽ׶ܹʡʱӸڵӽڵ
+	// ɫҪԹѡһֱ֧ҶڵϵĵԴʺгǧԴĳ
+	// ޷ΧĹԴ绷⣩ڲνṹ֮ѡ
+	class LightBVHDistribution : public LightDistribution 
+	{
+	public:
+
+		LightBVHDistribution(const Scene &scene);
+
+		//Note: the hierarchy has no distribution per point, sample() and pmf() traverse it instead
+		virtual const Distribution1D *lookup(const Vec3f &) const override { return nullptr; }
+
+		virtual int sample(const Vec3f &p, const Vec3f &n, Float u, Float &pmf) const override;
+		virtual Float pmf(const Vec3f &p, const Vec3f &n, int lightIndex) const override;
+
+	private:
+		//Note: the nodes are stored depth first, the first child of an interior node follows it
+		struct Node 
+		{
+			LightBounds bounds;
+			int index;		//second child of an interior node, light of a leaf
+			bool isLeaf;
+		};
+
+		//Build the subtree over |lights[begin, end)|, |bitTrail| holds the turns taken from the root
+		int buildTree(std::vector<std::pair<int, LightBounds>> &lights, int begin, int end,
+			uint64_t bitTrail, int depth);
+
+		std::vector<Node> m_nodes;
+		std::vector<int> m_infiniteLights;
+
+		//Note: per light, bit d of the trail is set when the path to its leaf takes the second child at depth d
+		std::vector<uint64_t> m_bitTrails;
+		static constexpr uint64_t invalidBitTrail = 0xffffffffffffffffull;
+	};
+
 	std::unique_ptr<LightDistribution> createLightSampleDistribution(
 		const std::string &name, const Scene &scene);
 
@@ -341,6 +341,11 @@ namespace RT
 		Vec3f m_origin;
 		Vec3f m_dir;
 		mutable Float m_tMax;
+
+		//Note: the geometry level of detail the ray intersects and the one of the surface it leaves,
+		//      0 is the full resolution
+		int m_lodLevel = 0;
+		int m_originLodLevel = 0;
 	};
 
 	//-------------------------------------------Defnition-------------------------------------
@@ -471,6 +476,23 @@ namespace RT
 		return sinTheta * glm::cos(phi) * x + sinTheta * glm::sin(phi) * y + cosTheta * z;
 	}
 
+	// Spread the lower 10 bits of x so that there are two zero bits between each of them
+	inline uint32_t leftShift3(uint32_t x)
+	{
+		if (x == (1 << 10)) --x;
+		x = (x | (x << 16)) & 0x30000ff;
+		x = (x | (x << 8)) & 0x300f00f;
+		x = (x | (x << 4)) & 0x30c30c3;
+		x = (x | (x << 2)) & 0x9249249;
+		return x;
+	}
+
+	// 30 bits Morton code of a point in [0, 1024]^3
+	inline uint32_t encodeMorton3(const Vec3f &v)
+	{
+		return (leftShift3((uint32_t)v.z) << 2) | (leftShift3((uint32_t)v.y) << 1) | leftShift3((uint32_t)v.x);
+	}
+
 	template <typename T>
 	inline BBox3<T> unionBounds(const BBox3<T> &b, const Vec3<T> &p)
 	{
@@ -622,7 +644,7 @@ namespace RT
 
 		// Check for ray intersection against $z$ slab
 		Float tzMin = (bounds[dirIsNeg[2]].z - ray.m_origin.z) * invDir.z;
-		Float tzMax = (bounds[1 - dirIsNeg[2]].z - ray.om_origin.z) * invDir.z;
+		Float tzMax = (bounds[1 - dirIsNeg[2]].z - ray.m_origin.z) * invDir.z;
 
 		// Update _tzMax_ to ensure robust bounds intersection
 		tzMax *= 1 + 2 * gamma(3);
@@ -0,0 +1,519 @@
+#include "Utils/MeshSimplifier.h"
+
+#include <map>
+#include <cmath>
+#include <array>
+#include <algorithm>
+
+namespace RT
+{
+	//-------------------------------------------Quadric-------------------------------------
+
+	MeshSimplifier::Quadric::Quadric(double a, double b, double c, double d)
+	{
+		m[0] = a * a; m[1] = a * b; m[2] = a * c; m[3] = a * d;
+		m[4] = b * b; m[5] = b * c; m[6] = b * d;
+		m[7] = c * c; m[8] = c * d;
+		m[9] = d * d;
+	}
+
+	MeshSimplifier::Quadric &MeshSimplifier::Quadric::operator+=(const Quadric &q)
+	{
+		for (int i = 0; i < 10; ++i)
+			m[i] += q.m[i];
+		return *this;
+	}
+
+	MeshSimplifier::Quadric MeshSimplifier::Quadric::operator+(const Quadric &q) const
+	{
+		Quadric ret = *this;
+		ret += q;
+		return ret;
+	}
+
+	double MeshSimplifier::Quadric::error(const Vec3<double> &p) const
+	{
+		const double x = p.x, y = p.y, z = p.z;
+		return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+			+ m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+			+ m[7] * z * z + 2 * m[8] * z + m[9];
+	}
+
+	//-------------------------------------------MeshSimplifier-------------------------------------
+
+	MeshSimplifier::MeshSimplifier(const std::vector<Vec3f> &position, const std::vector<Vec3f> &normal,
+		const std::vector<Vec2f> &uv, const std::vector<int> &indices)
+		: m_hasNormal(!normal.empty()), m_hasUV(!uv.empty())
+	{
+		CHECK_EQ(indices.size() % 3, 0);
+
+		Vec3<double> pMin(std::numeric_limits<double>::max()), pMax(-std::numeric_limits<double>::max());
+		for (const auto &p : position)
+		{
+			pMin = glm::min(pMin, Vec3<double>(p));
+			pMax = glm::max(pMax, Vec3<double>(p));
+		}
+		m_center = position.empty() ? Vec3<double>(0) : (pMin + pMax) * 0.5;
+		const double extent = position.empty() ? 0 : glm::max(pMax.x - pMin.x, glm::max(pMax.y - pMin.y, pMax.z - pMin.z));
+		m_scale = extent > 0 ? extent : 1;
+
+		// Weld the vertices with identical attributes, the mesh loader doesn't join them and
+		// otherwise every edge would be a border
+		std::map<std::array<Float, 8>, int> welded;
+		std::vector<int> remap(position.size());
+		for (size_t i = 0; i < position.size(); ++i)
+		{
+			const Vec3f n = m_hasNormal ? normal[i] : Vec3f(0);
+			const Vec2f t = m_hasUV ? uv[i] : Vec2f(0);
+			const std::array<Float, 8> key = { position[i].x, position[i].y, position[i].z, n.x, n.y, n.z, t.x, t.y };
+			auto it = welded.find(key);
+			if (it != welded.end())
+			{
+				remap[i] = it->second;
+				continue;
+			}
+
+			remap[i] = (int)m_vertices.size();
+			welded.insert({ key, remap[i] });
+
+			Vertex vertex;
+			vertex.p = (Vec3<double>(position[i]) - m_center) / m_scale;
+			vertex.normal = n;
+			vertex.uv = t;
+			m_vertices.push_back(vertex);
+		}
+
+		m_triangles.resize(indices.size() / 3);
+		for (size_t i = 0; i < m_triangles.size(); ++i)
+		{
+			for (int j = 0; j < 3; ++j)
+				m_triangles[i].v[j] = remap[indices[3 * i + j]];
+		}
+	}
+
+	void MeshSimplifier::simplify(size_t targetTriangles)
+	{
+		size_t deletedTriangles = 0;
+		const size_t triangleCount = m_triangles.size();
+		std::vector<bool> deleted0, deleted1;
+		double maxError = 0;
+
+		//Note: the threshold grows with the iteration, a higher aggressiveness gives a faster
+		//      but less accurate result.
+		const double aggressiveness = 7;
+		for (int iteration = 0; iteration < 100; ++iteration)
+		{
+			if (triangleCount - deletedTriangles <= targetTriangles)
+				break;
+
+			// Update the mesh once in a while
+			if (iteration % 5 == 0)
+				updateMesh(iteration);
+
+			for (auto &t : m_triangles)
+				t.dirty = false;
+
+			// All triangles with edges below the threshold will be removed
+			const double threshold = 0.000000001 * std::pow(double(iteration + 3), aggressiveness);
+
+			for (size_t i = 0; i < m_triangles.size(); ++i)
+			{
+				// Note: m_triangles is not resized inside this loop, so the reference stays valid
+				Triangle &t = m_triangles[i];
+				if (t.err[3] > threshold || t.deleted || t.dirty)
+					continue;
+
+				for (int j = 0; j < 3; ++j)
+				{
+					if (t.err[j] >= threshold)
+						continue;
+
+					const int i0 = t.v[j];
+					const int i1 = t.v[(j + 1) % 3];
+					Vertex &v0 = m_vertices[i0];
+					const Vertex &v1 = m_vertices[i1];
+
+					// Keep the border untouched
+					if (v0.border || v1.border)
+						continue;
+
+					// Compute the vertex to collapse to
+					Vec3<double> p;
+					double alpha;
+					const double error = calculateError(i0, i1, p, alpha);
+
+					deleted0.assign(v0.tcount, false);
+					deleted1.assign(v1.tcount, false);
+
+					// Don't remove if flipped
+					if (flipped(p, i1, v0, deleted0) || flipped(p, i0, v1, deleted1))
+						continue;
+
+					// Not flipped, so remove the edge
+					//Note: the error is the sum of the squared distances to the planes of the quadric
+					maxError = glm::max(maxError, error);
+					v0.p = p;
+					v0.q += v1.q;
+					if (m_hasNormal)
+					{
+						Vec3f n = v0.normal + Float(alpha) * (v1.normal - v0.normal);
+						v0.normal = lengthSquared(n) > 0 ? normalize(n) : v0.normal;
+					}
+					if (m_hasUV)
+					{
+						v0.uv = v0.uv + Float(alpha) * (v1.uv - v0.uv);
+					}
+
+					const int tstart = (int)m_refs.size();
+					updateTriangles(i0, v0, deleted0, deletedTriangles);
+					updateTriangles(i0, v1, deleted1, deletedTriangles);
+					const int tcount = (int)m_refs.size() - tstart;
+
+					if (tcount <= v0.tcount)
+					{
+						// Save ram
+						if (tcount > 0)
+							std::copy(m_refs.begin() + tstart, m_refs.begin() + tstart + tcount, m_refs.begin() + v0.tstart);
+					}
+					else
+					{
+						// Append
+						v0.tstart = tstart;
+					}
+					v0.tcount = tcount;
+					break;
+				}
+
+				if (triangleCount - deletedTriangles <= targetTriangles)
+					break;
+			}
+		}
+
+		compactMesh();
+		m_errorBound += std::sqrt(maxError) * m_scale;
+	}
+
+	void MeshSimplifier::getMesh(std::vector<Vec3f> &position, std::vector<Vec3f> &normal,
+		std::vector<Vec2f> &uv, std::vector<int> &indices) const
+	{
+		position.resize(m_vertices.size());
+		normal.resize(m_hasNormal ? m_vertices.size() : 0);
+		uv.resize(m_hasUV ? m_vertices.size() : 0);
+		for (size_t i = 0; i < m_vertices.size(); ++i)
+		{
+			position[i] = Vec3f(m_vertices[i].p * m_scale + m_center);
+			if (m_hasNormal)
+				normal[i] = m_vertices[i].normal;
+			if (m_hasUV)
+				uv[i] = m_vertices[i].uv;
+		}
+
+		indices.resize(m_triangles.size() * 3);
+		for (size_t i = 0; i < m_triangles.size(); ++i)
+		{
+			for (int j = 0; j < 3; ++j)
+				indices[3 * i + j] = m_triangles[i].v[j];
+		}
+	}
+
+	double MeshSimplifier::calculateError(int i0, int i1, Vec3<double> &p, double &alpha) const
+	{
+		const Vertex &v0 = m_vertices[i0];
+		const Vertex &v1 = m_vertices[i1];
+		const Quadric q = v0.q + v1.q;
+		const double *m = q.m;
+
+		// Try the optimal position first, it's the minimizer of the quadric if the matrix is invertible
+		const double det = m[0] * (m[4] * m[7] - m[5] * m[5])
+			- m[1] * (m[1] * m[7] - m[5] * m[2])
+			+ m[2] * (m[1] * m[5] - m[4] * m[2]);
+
+		double error = std::numeric_limits<double>::max();
+		if (std::abs(det) > 1e-12)
+		{
+			const double bx = -m[3], by = -m[6], bz = -m[8];
+			Vec3<double> optimal;
+			optimal.x = (bx * (m[4] * m[7] - m[5] * m[5]) - m[1] * (by * m[7] - m[5] * bz) + m[2] * (by * m[5] - m[4] * bz)) / det;
+			optimal.y = (m[0] * (by * m[7] - bz * m[5]) - bx * (m[1] * m[7] - m[5] * m[2]) + m[2] * (m[1] * bz - by * m[2])) / det;
+			optimal.z = (m[0] * (m[4] * bz - m[5] * by) - m[1] * (m[1] * bz - by * m[2]) + bx * (m[1] * m[5] - m[4] * m[2])) / det;
+
+			// Reject positions far away from the edge, they come from nearly singular quadrics
+			const Vec3<double> edge = v1.p - v0.p;
+			const double edgeLenSq = glm::dot(edge, edge);
+			const double t = edgeLenSq > 0 ? glm::clamp(glm::dot(optimal - v0.p, edge) / edgeLenSq, 0.0, 1.0) : 0.0;
+			const Vec3<double> closest = v0.p + t * edge;
+			if (glm::dot(optimal - closest, optimal - closest) <= edgeLenSq)
+			{
+				p = optimal;
+				alpha = t;
+				error = q.error(optimal);
+			}
+		}
+
+		// Otherwise pick the best one of the endpoints and the midpoint
+		const Vec3<double> candidates[3] = { v0.p, v1.p, (v0.p + v1.p) * 0.5 };
+		const double alphas[3] = { 0.0, 1.0, 0.5 };
+		for (int i = 0; i < 3; ++i)
+		{
+			const double e = q.error(candidates[i]);
+			if (e < error)
+			{
+				error = e;
+				p = candidates[i];
+				alpha = alphas[i];
+			}
+		}
+
+		return error;
+	}
+
+	bool MeshSimplifier::flipped(const Vec3<double> &p, int i1, const Vertex &v0, std::vector<bool> &deleted) const
+	{
+		for (int k = 0; k < v0.tcount; ++k)
+		{
+			const Ref &ref = m_refs[v0.tstart + k];
+			const Triangle &t = m_triangles[ref.tid];
+			if (t.deleted)
+				continue;
+
+			const int s = ref.tvertex;
+			const int id1 = t.v[(s + 1) % 3];
+			const int id2 = t.v[(s + 2) % 3];
+
+			// The triangle shares the collapsed edge and will be removed
+			if (id1 == i1 || id2 == i1)
+			{
+				deleted[k] = true;
+				continue;
+			}
+
+			Vec3<double> d1 = m_vertices[id1].p - p;
+			Vec3<double> d2 = m_vertices[id2].p - p;
+			const double len1 = glm::length(d1), len2 = glm::length(d2);
+			if (len1 == 0 || len2 == 0)
+				return true;
+			d1 /= len1;
+			d2 /= len2;
+			if (std::abs(glm::dot(d1, d2)) > 0.999)
+				return true;
+
+			const Vec3<double> n = glm::normalize(glm::cross(d1, d2));
+			deleted[k] = false;
+			if (glm::dot(n, t.n) < 0.2)
+				return true;
+		}
+		return false;
+	}
+
+	void MeshSimplifier::updateTriangles(int i0, const Vertex &v, const std::vector<bool> &deleted, size_t &deletedTriangles)
+	{
+		Vec3<double> p;
+		double alpha;
+		for (int k = 0; k < v.tcount; ++k)
+		{
+			//Note: copy the reference, m_refs might grow below
+			const Ref ref = m_refs[v.tstart + k];
+			Triangle &t = m_triangles[ref.tid];
+			if (t.deleted)
+				continue;
+
+			if (deleted[k])
+			{
+				t.deleted = true;
+				++deletedTriangles;
+				continue;
+			}
+
+			t.v[ref.tvertex] = i0;
+			t.dirty = true;
+			t.err[0] = calculateError(t.v[0], t.v[1], p, alpha);
+			t.err[1] = calculateError(t.v[1], t.v[2], p, alpha);
+			t.err[2] = calculateError(t.v[2], t.v[0], p, alpha);
+			t.err[3] = glm::min(t.err[0], glm::min(t.err[1], t.err[2]));
+			m_refs.push_back(ref);
+		}
+	}
+
+	void MeshSimplifier::updateMesh(int iteration)
+	{
+		if (iteration > 0)
+		{
+			// Compact the triangles
+			size_t dst = 0;
+			for (size_t i = 0; i < m_triangles.size(); ++i)
+			{
+				if (!m_triangles[i].deleted)
+					m_triangles[dst++] = m_triangles[i];
+			}
+			m_triangles.resize(dst);
+		}
+
+		// Init the reference ids
+		for (auto &v : m_vertices)
+		{
+			v.tstart = 0;
+			v.tcount = 0;
+		}
+		for (const auto &t : m_triangles)
+		{
+			for (int j = 0; j < 3; ++j)
+				++m_vertices[t.v[j]].tcount;
+		}
+		int tstart = 0;
+		for (auto &v : m_vertices)
+		{
+			v.tstart = tstart;
+			tstart += v.tcount;
+			v.tcount = 0;
+		}
+
+		// Write the references
+		m_refs.resize(m_triangles.size() * 3);
+		for (size_t i = 0; i < m_triangles.size(); ++i)
+		{
+			const Triangle &t = m_triangles[i];
+			for (int j = 0; j < 3; ++j)
+			{
+				Vertex &v = m_vertices[t.v[j]];
+				m_refs[v.tstart + v.tcount].tid = (int)i;
+				m_refs[v.tstart + v.tcount].tvertex = j;
+				++v.tcount;
+			}
+		}
+
+		if (iteration != 0)
+			return;
+
+		// Identify the boundary: an edge that belongs to only one triangle
+		std::vector<int> vcount, vids;
+		for (auto &v : m_vertices)
+			v.border = false;
+
+		for (auto &v : m_vertices)
+		{
+			vcount.clear();
+			vids.clear();
+			for (int k = 0; k < v.tcount; ++k)
+			{
+				const Triangle &t = m_triangles[m_refs[v.tstart + k].tid];
+				for (int j = 0; j < 3; ++j)
+				{
+					const int id = t.v[j];
+					size_t ofs = 0;
+					while (ofs < vids.size() && vids[ofs] != id)
+						++ofs;
+					if (ofs == vids.size())
+					{
+						vids.push_back(id);
+						vcount.push_back(1);
+					}
+					else
+					{
+						++vcount[ofs];
+					}
+				}
+			}
+			for (size_t j = 0; j < vcount.size(); ++j)
+			{
+				if (vcount[j] == 1)
+					m_vertices[vids[j]].border = true;
+			}
+		}
+
+		// Initialize the quadrics by the plane of the adjacent triangles
+		for (auto &v : m_vertices)
+			v.q = Quadric();
+
+		for (auto &t : m_triangles)
+		{
+			const Vec3<double> &p0 = m_vertices[t.v[0]].p;
+			const Vec3<double> n = glm::cross(m_vertices[t.v[1]].p - p0, m_vertices[t.v[2]].p - p0);
+			const double len = glm::length(n);
+			t.n = len > 0 ? n / len : Vec3<double>(0);
+			const Quadric q(t.n.x, t.n.y, t.n.z, -glm::dot(t.n, p0));
+			for (int j = 0; j < 3; ++j)
+				m_vertices[t.v[j]].q += q;
+		}
+
+		Vec3<double> p;
+		double alpha;
+		for (auto &t : m_triangles)
+		{
+			for (int j = 0; j < 3; ++j)
+				t.err[j] = calculateError(t.v[j], t.v[(j + 1) % 3], p, alpha);
+			t.err[3] = glm::min(t.err[0], glm::min(t.err[1], t.err[2]));
+		}
+	}
+
+	void MeshSimplifier::compactMesh()
+	{
+		size_t dst = 0;
+		for (size_t i = 0; i < m_triangles.size(); ++i)
+		{
+			if (!m_triangles[i].deleted)
+				m_triangles[dst++] = m_triangles[i];
+		}
+		m_triangles.resize(dst);
+
+		// Drop the vertices no longer referenced, tcount is reused as the used flag
+		for (auto &v : m_vertices)
+			v.tcount = 0;
+		for (const auto &t : m_triangles)
+		{
+			for (int j = 0; j < 3; ++j)
+				m_vertices[t.v[j]].tcount = 1;
+		}
+
+		//Note: tstart holds the new index, it's never overwritten since dst <= i
+		dst = 0;
+		for (size_t i = 0; i < m_vertices.size(); ++i)
+		{
+			if (m_vertices[i].tcount == 0)
+				continue;
+			m_vertices[i].tstart = (int)dst;
+			m_vertices[dst].p = m_vertices[i].p;
+			m_vertices[dst].normal = m_vertices[i].normal;
+			m_vertices[dst].uv = m_vertices[i].uv;
+			++dst;
+		}
+
+		for (auto &t : m_triangles)
+		{
+			for (int j = 0; j < 3; ++j)
+				t.v[j] = m_vertices[t.v[j]].tstart;
+		}
+		m_vertices.resize(dst);
+	}
+
+	//-------------------------------------------MeshLodCache-------------------------------------
+
+	MeshLodCache &MeshLodCache::instance()
+	{
+		static MeshLodCache cache;
+		return cache;
+	}
+
+	std::shared_ptr<const MeshLodCache::Levels> MeshLodCache::get(const std::string &key,
+		const std::function<void(Levels&)> &build)
+	{
+		std::shared_ptr<Entry> entry;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			auto &slot = m_entries[key];
+			if (slot == nullptr)
+				slot = std::make_shared<Entry>();
+			entry = slot;
+		}
+
+		//Note: the lock is not held while building, entities of other files go on meanwhile
+		std::call_once(entry->built, [&]() { build(entry->levels); });
+		return std::shared_ptr<const Levels>(entry, &entry->levels);
+	}
+
+	void MeshLodCache::clear()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_entries.clear();
+	}
+
+}
@@ -0,0 +1,143 @@
+#ifndef ARMESHSIMPLIFIER_H
+#define ARMESHSIMPLIFIER_H
+
+#include "Utils/Base.h"
+#include "Utils/Math.h"
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <functional>
+
+namespace RT
+{
+	//! @brief Triangle mesh decimation by quadric error metric edge collapse.
+	/**
+	 * Follows Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics". Edges are
+	 * collapsed in rounds with a growing error threshold instead of a priority queue, which keeps the
+	 * memory footprint at a few arrays. Border edges are never collapsed, so seams where the vertices
+	 * are split for uv or normal discontinuities stay watertight.
+	 */
+	class MeshSimplifier final
+	{
+	public:
+
+		MeshSimplifier(const std::vector<Vec3f> &position, const std::vector<Vec3f> &normal,
+			const std::vector<Vec2f> &uv, const std::vector<int> &indices);
+
+		//Collapse edges until at most |targetTriangles| are left or no more edge could be collapsed
+		void simplify(size_t targetTriangles);
+
+		size_t numTriangles() const { return m_triangles.size(); }
+
+		//Bound of the distance between the simplified surface and the input one, in the input units
+		Float errorBound() const { return Float(m_errorBound); }
+
+		void getMesh(std::vector<Vec3f> &position, std::vector<Vec3f> &normal,
+			std::vector<Vec2f> &uv, std::vector<int> &indices) const;
+
+	private:
+
+		//Symmetric 4x4 matrix of the plane quadric
+		struct Quadric
+		{
+			double m[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+			Quadric() = default;
+			Quadric(double a, double b, double c, double d);
+
+			Quadric &operator+=(const Quadric &q);
+			Quadric operator+(const Quadric &q) const;
+
+			double error(const Vec3<double> &p) const;
+		};
+
+		struct Triangle
+		{
+			int v[3];
+			double err[4];
+			bool deleted = false;
+			bool dirty = false;
+			Vec3<double> n;
+		};
+
+		struct Vertex
+		{
+			Vec3<double> p;
+			Vec3f normal;
+			Vec2f uv;
+			Quadric q;
+			int tstart = 0;
+			int tcount = 0;
+			bool border = false;
+		};
+
+		//Reference from a vertex to one of its triangles
+		struct Ref
+		{
+			int tid;
+			int tvertex;
+		};
+
+		double calculateError(int i0, int i1, Vec3<double> &p, double &alpha) const;
+		bool flipped(const Vec3<double> &p, int i1, const Vertex &v0, std::vector<bool> &deleted) const;
+		void updateTriangles(int i0, const Vertex &v, const std::vector<bool> &deleted, size_t &deletedTriangles);
+		void updateMesh(int iteration);
+		void compactMesh();
+
+		std::vector<Triangle> m_triangles;
+		std::vector<Vertex> m_vertices;
+		std::vector<Ref> m_refs;
+		bool m_hasNormal, m_hasUV;
+
+		//Note: positions are normalized to a unit box so that the error threshold is scale free
+		Vec3<double> m_center;
+		double m_scale;
+
+		//Note: the quadrics start from the planes of the mesh left by the previous simplify(), so the
+		//      bounds of the successive calls add up
+		double m_errorBound = 0;
+	};
+
+	//! @brief Simplified levels of detail of the mesh files, shared by the entities that load them.
+	/**
+	 * The levels are kept in object space, so that a file placed several times in a scene is only
+	 * simplified once whatever its transforms. An entry is built by the first entity asking for it
+	 * while the others wait, and the cache is cleared once all the entities are built.
+	 */
+	class MeshLodCache final
+	{
+	public:
+		struct Level
+		{
+			std::vector<Vec3f> position, normal;
+			std::vector<Vec2f> uv;
+			std::vector<int> indices;
+			Float errorBound;
+		};
+		typedef std::vector<Level> Levels;
+
+		static MeshLodCache &instance();
+
+		//Levels of |key|, made by |build| on the first request
+		std::shared_ptr<const Levels> get(const std::string &key, const std::function<void(Levels&)> &build);
+
+		void clear();
+
+	private:
+		struct Entry
+		{
+			std::once_flag built;
+			Levels levels;
+		};
+
+		MeshLodCache() = default;
+
+		std::mutex m_mutex;
+		std::map<std::string, std::shared_ptr<Entry>> m_entries;
+	};
+
+}
+
+#endif
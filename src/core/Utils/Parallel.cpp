@@ -16,4 +16,88 @@ namespace RT
 			m_cv.wait(lock, [this] { return m_count == 0; });
 		}
 	}
+
+	//-------------------------------------------WorkerPool-------------------------------------
+
+	WorkerPool::WorkerPool(int nThreads)
+	{
+		for (int i = 1; i < nThreads; ++i)
+		{
+			m_workers.push_back(std::thread(&WorkerPool::workerLoop, this));
+		}
+	}
+
+	WorkerPool::~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_shutdown = true;
+		}
+		m_jobCv.notify_all();
+		for (auto &worker : m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	void WorkerPool::parallelFor(size_t count, const std::function<void(size_t)> &func)
+	{
+		if (count == 0)
+			return;
+
+		if (m_workers.empty())
+		{
+			for (size_t i = 0; i < count; ++i)
+				func(i);
+			return;
+		}
+
+		{
+			//Note: a worker that woke up late for the previous loop has to leave it before the index is reset
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_doneCv.wait(lock, [this] { return m_active == 0; });
+			m_job = &func;
+			m_count = count;
+			m_next = 0;
+			++m_generation;
+		}
+		m_jobCv.notify_all();
+
+		size_t index;
+		while ((index = m_next.fetch_add(1)) < count)
+		{
+			func(index);
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_doneCv.wait(lock, [this] { return m_active == 0; });
+	}
+
+	void WorkerPool::workerLoop()
+	{
+		uint64_t generation = 0;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_jobCv.wait(lock, [&] { return m_shutdown || m_generation != generation; });
+			if (m_shutdown)
+				return;
+
+			generation = m_generation;
+			const std::function<void(size_t)> &job = *m_job;
+			const size_t count = m_count;
+			++m_active;
+			lock.unlock();
+
+			size_t index;
+			while ((index = m_next.fetch_add(1)) < count)
+			{
+				job(index);
+			}
+
+			lock.lock();
+			if (--m_active == 0)
+				m_doneCv.notify_all();
+		}
+	}
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "Utils/Base.h"
 
 #include <mutex>
+#include <vector>
 #include <atomic>
 #include <thread>
 #include <functional>
@@ -66,6 +67,43 @@ namespace RT
 
 	inline int numSystemCores() { return glm::max(1u, std::thread::hardware_concurrency()); }
 
+	//! @brief Threads that stay alive between parallel loops.
+	/**
+	 * ParallelUtils::parallelFor starts and joins its threads on every call, which is too costly
+	 * for loops that are short but run many times. The pool starts its workers once and hands
+	 * every loop to them, the calling thread takes part in the loop too. Loops are issued from
+	 * one thread at a time and must not be nested.
+	 */
+	class WorkerPool
+	{
+	public:
+		WorkerPool(int nThreads = numSystemCores());
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		int numThreads() const { return (int)m_workers.size() + 1; }
+
+		//Run func(i) for i in [0, count), returns when all of them are done
+		void parallelFor(size_t count, const std::function<void(size_t)> &func);
+
+	private:
+		void workerLoop();
+
+		std::vector<std::thread> m_workers;
+		std::mutex m_mutex;
+		std::condition_variable m_jobCv, m_doneCv;
+
+		//Note: the loop being run, a new one is published by bumping the generation
+		const std::function<void(size_t)> *m_job = nullptr;
+		size_t m_count = 0;
+		std::atomic<size_t> m_next{ 0 };
+		uint64_t m_generation = 0;
+		int m_active = 0;
+		bool m_shutdown = false;
+	};
+
 	class ParallelUtils
 	{
 	public:
@@ -0,0 +1,149 @@
+#include "Utils/PathGuiding.h"
+
+namespace RT
+{
+	//-------------------------------------------GuidingField-------------------------------------
+
+	GuidingField::GuidingField(const BBox3f &bounds) : m_iteration(0)
+	{
+		m_nodes.push_back({ -1, 0, { 0, 0 } });
+		m_leaves.emplace_back(new Leaf());
+		m_leaves[0]->bounds = bounds;
+	}
+
+	int GuidingField::findLeaf(const Vec3f &p) const
+	{
+		int node = 0;
+		while (m_nodes[node].axis >= 0)
+			node = m_nodes[node].children[p[m_nodes[node].axis] < m_nodes[node].split ? 0 : 1];
+		return m_nodes[node].children[0];
+	}
+
+	int GuidingField::directionToBin(const Vec3f &w)
+	{
+		// Equal-area mapping of the sphere to (cos(theta), phi)
+		Float cosTheta = clamp(w.z, -1, 1);
+		Float phi = std::atan2(w.y, w.x);
+		if (phi < 0)
+			phi += 2 * Pi;
+
+		int u = glm::min((int)((cosTheta + 1) * 0.5f * dirResolution), dirResolution - 1);
+		int v = glm::min((int)(phi * Inv2Pi * dirResolution), dirResolution - 1);
+		return v * dirResolution + u;
+	}
+
+	Vec3f GuidingField::sample(const Vec3f &p, const Vec2f &u, Float &pdf) const
+	{
+		const Leaf &leaf = *m_leaves[findLeaf(p)];
+		CHECK(leaf.distrib != nullptr);
+
+		Float binPdf, uRemapped;
+		int bin = leaf.distrib->sampleDiscrete(u[0], &binPdf, &uRemapped);
+		uRemapped = glm::min(uRemapped, aOneMinusEpsilon);
+
+		Float cosTheta = ((bin % dirResolution) + uRemapped) / dirResolution * 2 - 1;
+		Float phi = ((bin / dirResolution) + u[1]) / dirResolution * 2 * Pi;
+		Float sinTheta = glm::sqrt(glm::max((Float)0, 1 - cosTheta * cosTheta));
+
+		// Every bin covers the same solid angle 4Pi / nDirBins
+		pdf = binPdf * nDirBins * Inv4Pi;
+		return Vec3f(sinTheta * glm::cos(phi), sinTheta * glm::sin(phi), cosTheta);
+	}
+
+	Float GuidingField::pdf(const Vec3f &p, const Vec3f &w) const
+	{
+		const Leaf &leaf = *m_leaves[findLeaf(p)];
+		if (leaf.distrib == nullptr)
+			return 0;
+
+		return leaf.distrib->discretePDF(directionToBin(w)) * nDirBins * Inv4Pi;
+	}
+
+	void GuidingField::record(const Vec3f &p, const Vec3f &w, Float radiance)
+	{
+		if (!(radiance > 0) || glm::isinf(radiance))
+			return;
+
+		Leaf &leaf = *m_leaves[findLeaf(p)];
+		leaf.records[directionToBin(w)].add(radiance);
+		++leaf.nSamples;
+	}
+
+	void GuidingField::update()
+	{
+		// Build the distributions of the leaves that recorded anything, the others keep their previous one
+		std::vector<Float> func(nDirBins);
+		for (auto &leaf : m_leaves)
+		{
+			Float sum = 0;
+			for (int b = 0; b < nDirBins; ++b)
+			{
+				func[b] = leaf->records[b];
+				sum += func[b];
+			}
+			if (sum <= 0)
+				continue;
+
+			//Note: a small uniform floor keeps the directions that no training path took reachable
+			for (int b = 0; b < nDirBins; ++b)
+				func[b] += 0.01f * sum / nDirBins;
+			leaf->distrib = std::make_shared<Distribution1D>(func.data(), nDirBins);
+		}
+
+		// Split the leaves that collected more samples than the threshold of the paper, which grows
+		// with the square root of the samples per iteration. The children of a leaf start from its
+		// distribution and are assumed to share its samples evenly.
+		const Float splitThreshold = 12000.f * glm::sqrt(glm::pow((Float)2, (Float)m_iteration));
+		std::vector<std::pair<int, Float>> stack;
+		const int nNodes = (int)m_nodes.size();
+		for (int n = 0; n < nNodes; ++n)
+		{
+			if (m_nodes[n].axis < 0)
+				stack.push_back({ n, (Float)m_leaves[m_nodes[n].children[0]]->nSamples });
+		}
+
+		while (!stack.empty())
+		{
+			const int node = stack.back().first;
+			const Float nSamples = stack.back().second;
+			stack.pop_back();
+			if (nSamples <= splitThreshold)
+				continue;
+
+			const int leafIndex = m_nodes[node].children[0];
+			const BBox3f bounds = m_leaves[leafIndex]->bounds;
+			const int axis = bounds.maximumExtent();
+			const Float split = (bounds.m_pMin[axis] + bounds.m_pMax[axis]) * 0.5f;
+
+			BBox3f lower = bounds, upper = bounds;
+			lower.m_pMax[axis] = split;
+			upper.m_pMin[axis] = split;
+
+			// The leaf stays with the lower child, the upper child gets a new leaf
+			const int upperLeafIndex = (int)m_leaves.size();
+			m_leaves.emplace_back(new Leaf());
+			m_leaves[upperLeafIndex]->distrib = m_leaves[leafIndex]->distrib;
+			m_leaves[upperLeafIndex]->bounds = upper;
+			m_leaves[leafIndex]->bounds = lower;
+
+			const int lowerNode = (int)m_nodes.size();
+			m_nodes.push_back({ -1, 0, { leafIndex, 0 } });
+			m_nodes.push_back({ -1, 0, { upperLeafIndex, 0 } });
+			m_nodes[node] = { axis, split, { lowerNode, lowerNode + 1 } };
+
+			stack.push_back({ lowerNode, nSamples * 0.5f });
+			stack.push_back({ lowerNode + 1, nSamples * 0.5f });
+		}
+
+		// Start the records of the next iteration from scratch
+		for (auto &leaf : m_leaves)
+		{
+			for (int b = 0; b < nDirBins; ++b)
+				leaf->records[b] = 0;
+			leaf->nSamples = 0;
+		}
+
+		++m_iteration;
+		LOG(INFO) << "Path guiding iteration " << m_iteration << " refined the field to " << m_leaves.size() << " leaves";
+	}
+}
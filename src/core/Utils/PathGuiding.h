@@ -0,0 +1,73 @@
+#ifndef ARPATH_GUIDING_H
+#define ARPATH_GUIDING_H
+
+#include "Utils/Base.h"
+#include "Utils/Math.h"
+#include "Utils/Parallel.h"
+#include "Utils/LightDistrib.h"
+
+#include <vector>
+
+namespace RT
+{
+	//! @brief Learned distribution of incident radiance over position and direction.
+	/**
+	 * Follows the spatial half of the SD-tree of Mueller et al., "Practical Path Guiding for Efficient
+	 * Light-Transport Simulation": a binary tree over the scene bounds whose leaves are split once they
+	 * collect enough samples. A leaf holds a histogram of incident radiance over an equal-area
+	 * (cos(theta), phi) parameterization of the sphere. Paths record their radiance estimates into the
+	 * histograms during a training iteration, and update() turns them into the sampling distributions
+	 * of the next iteration.
+	 */
+	class GuidingField final
+	{
+	public:
+		typedef std::unique_ptr<GuidingField> unique_ptr;
+
+		GuidingField(const BBox3f &bounds);
+
+		//Whether the leaf around |p| has learned a distribution, nothing is guided otherwise
+		bool canSample(const Vec3f &p) const { return m_leaves[findLeaf(p)]->distrib != nullptr; }
+
+		Vec3f sample(const Vec3f &p, const Vec2f &u, Float &pdf) const;
+		Float pdf(const Vec3f &p, const Vec3f &w) const;
+
+		//Record a radiance estimate arriving at |p| from |w|, divided by the pdf of sampling |w|
+		void record(const Vec3f &p, const Vec3f &w, Float radiance);
+
+		//Build the sampling distributions from the records of the iteration, then refine the leaves
+		void update();
+
+	private:
+		//Note: the directional histogram has dirResolution x dirResolution bins of equal solid angle
+		static constexpr int dirResolution = 16;
+		static constexpr int nDirBins = dirResolution * dirResolution;
+
+		struct Node
+		{
+			int axis;			//split axis, -1 for a leaf
+			Float split;		//split position along the axis
+			int children[2];	//child nodes, or the leaf index in children[0]
+		};
+
+		struct Leaf
+		{
+			Leaf() : records(new AAtomicFloat[nDirBins]), nSamples(0) {}
+
+			std::unique_ptr<AAtomicFloat[]> records;
+			std::atomic<int> nSamples;
+			std::shared_ptr<Distribution1D> distrib;
+			BBox3f bounds;
+		};
+
+		int findLeaf(const Vec3f &p) const;
+
+		static int directionToBin(const Vec3f &w);
+
+		std::vector<Node> m_nodes;
+		std::vector<std::unique_ptr<Leaf>> m_leaves;
+		int m_iteration;
+	};
+}
+
+#endif
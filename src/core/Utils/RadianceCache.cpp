@@ -0,0 +1,130 @@
+#include "Utils/RadianceCache.h"
+
+namespace RT
+{
+	//-------------------------------------------RadianceCache-------------------------------------
+
+	RadianceCache::RadianceCache(const BBox3f &bounds, int resolution) : m_bounds(bounds)
+	{
+		//Note: the cell coordinates are packed into 20 bits each
+		resolution = clamp(resolution, 1, 1 << 20);
+		const Vec3f diag = bounds.diagonal();
+		const Float cellSize = glm::max(diag[bounds.maximumExtent()], (Float)1e-4f) / resolution;
+		for (int axis = 0; axis < 3; ++axis)
+			m_resolution[axis] = clamp((int)glm::ceil(diag[axis] / cellSize), 1, resolution);
+
+		m_cells.reset(new Cell[tableSize]);
+	}
+
+	uint64_t RadianceCache::cellKey(const Vec3f &p, const Vec3f &n) const
+	{
+		const Vec3f o = m_bounds.offset(p);
+		uint64_t key = 0;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			const int cell = clamp((int)(o[axis] * m_resolution[axis]), 0, m_resolution[axis] - 1);
+			key = (key << 20) | (uint64_t)cell;
+		}
+
+		// Dominant axis of the normal and its sign
+		const Vec3f an = glm::abs(n);
+		const int axis = (an.x > an.y && an.x > an.z) ? 0 : (an.y > an.z ? 1 : 2);
+		const int bucket = 2 * axis + (n[axis] < 0 ? 1 : 0);
+
+		//Note: the bucket starts from one so that no key is zero
+		return (key << 3) | (uint64_t)(bucket + 1);
+	}
+
+	int RadianceCache::findCell(uint64_t key, bool insert) const
+	{
+		uint64_t hash = key * 0x9E3779B97F4A7C15ull;
+		hash ^= hash >> 29;
+		for (int probe = 0; probe < maxProbes; ++probe)
+		{
+			const int slot = (int)((hash + probe) & (tableSize - 1));
+			Cell &cell = m_cells[slot];
+			uint64_t slotKey = cell.key.load(std::memory_order_relaxed);
+			if (slotKey == key)
+				return slot;
+			if (slotKey == 0)
+			{
+				if (!insert)
+					return -1;
+
+				// Another thread may take the free slot first, for this very key or another one
+				if (cell.key.compare_exchange_strong(slotKey, key) || slotKey == key)
+					return slot;
+			}
+		}
+		return -1;
+	}
+
+	bool RadianceCache::lookup(const Vec3f &p, const Vec3f &n, Spectrum &radiance) const
+	{
+		const int slot = findCell(cellKey(p, n), false);
+		if (slot < 0 || !m_cells[slot].isLearned)
+			return false;
+
+		radiance = m_cells[slot].learned;
+		return true;
+	}
+
+	void RadianceCache::record(const Vec3f &p, const Vec3f &n, const Spectrum &radiance)
+	{
+		const Float luminance = radiance.luminance();
+		if (!(luminance >= 0) || glm::isinf(luminance))
+			return;
+
+		const int slot = findCell(cellKey(p, n), true);
+		if (slot < 0)
+			return;
+
+		Cell &cell = m_cells[slot];
+		for (int c = 0; c < 3; ++c)
+			cell.sum[c].add(radiance[c]);
+		cell.sumSquares.add(luminance * luminance);
+		++cell.nRecords;
+	}
+
+	void RadianceCache::update(Float maxRelativeError)
+	{
+		//Note: the training paths end in the cells learned before, so the records of an iteration carry the
+		//      estimates of the previous one a bounce further. Every iteration starts the records anew and a
+		//      cell that collected too few keeps its previous estimate.
+		int nCells = 0, nLearned = 0;
+		for (int i = 0; i < tableSize; ++i)
+		{
+			Cell &cell = m_cells[i];
+			if (cell.key == 0)
+				continue;
+			++nCells;
+
+			const int nRecords = cell.nRecords;
+			if (nRecords >= minRecords)
+			{
+				Spectrum mean;
+				for (int c = 0; c < 3; ++c)
+					mean[c] = cell.sum[c] / nRecords;
+
+				// Relative standard error of the mean luminance, a dark cell is left to the path tracer
+				const Float meanLuminance = mean.luminance();
+				cell.isLearned = false;
+				if (meanLuminance > 0)
+				{
+					const Float variance = glm::max((Float)0, cell.sumSquares / nRecords - meanLuminance * meanLuminance);
+					cell.isLearned = glm::sqrt(variance / nRecords) <= maxRelativeError * meanLuminance;
+				}
+				cell.learned = mean;
+			}
+			if (cell.isLearned)
+				++nLearned;
+
+			for (int c = 0; c < 3; ++c)
+				cell.sum[c] = 0;
+			cell.sumSquares = 0;
+			cell.nRecords = 0;
+		}
+
+		LOG(INFO) << "Radiance cache learned " << nLearned << " of " << nCells << " cells";
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef ARRADIANCE_CACHE_H
+#define ARRADIANCE_CACHE_H
+
+#include "Utils/Base.h"
+#include "Utils/Math.h"
+#include "Utils/Color.h"
+#include "Utils/Parallel.h"
+
+#include <atomic>
+
+namespace RT
+{
+	//! @brief World-space cache of the indirect radiance reflected by diffuse surfaces.
+	/**
+	 * A hash grid of radiance probes: the cells of a uniform grid over the scene bounds, split by the
+	 * dominant axis of the normal so that the two sides of a wall or a corner are kept apart, are
+	 * stored in a fixed-size hash table and only allocated where a path vertex records into them.
+	 * Every record is the radiance that the continuation of a path carried back to a diffuse vertex
+	 * divided by the reflectance there, so that a cell is shared by surfaces of different colors.
+	 * update() publishes the mean of the records of the cells whose relative standard error fell below
+	 * the bound and starts the records of the next training iteration, and lookup() returns them.
+	 */
+	class RadianceCache final
+	{
+	public:
+		typedef std::unique_ptr<RadianceCache> unique_ptr;
+
+		RadianceCache(const BBox3f &bounds, int resolution);
+
+		//Learned radiance over reflectance of the cell around |p| facing |n|, false if it is not learned yet
+		bool lookup(const Vec3f &p, const Vec3f &n, Spectrum &radiance) const;
+
+		void record(const Vec3f &p, const Vec3f &n, const Spectrum &radiance);
+
+		void update(Float maxRelativeError);
+
+	private:
+		//Note: a cell that finds no free slot within maxProbes of its hash is neither recorded nor learned
+		static constexpr int tableSize = 1 << 18;
+		static constexpr int maxProbes = 16;
+		static constexpr int minRecords = 16;
+
+		struct Cell
+		{
+			std::atomic<uint64_t> key{ 0 };		//zero for a free slot
+			AAtomicFloat sum[3], sumSquares;	//sum of the radiance and of the square of its luminance
+			std::atomic<int> nRecords{ 0 };
+
+			Spectrum learned = Spectrum(0.f);
+			bool isLearned = false;
+		};
+
+		uint64_t cellKey(const Vec3f &p, const Vec3f &n) const;
+
+		//Slot of the cell with |key|, claimed if |insert| and not found. -1 if there is none.
+		int findCell(uint64_t key, bool insert) const;
+
+		BBox3f m_bounds;
+		Vec3i m_resolution;
+		std::unique_ptr<Cell[]> m_cells;
+	};
+}
+
+#endif
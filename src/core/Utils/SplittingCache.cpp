@@ -0,0 +1,93 @@
+#include "Utils/SplittingCache.h"
+
+namespace RT
+{
+	//-------------------------------------------SplittingCache-------------------------------------
+
+	SplittingCache::SplittingCache(const BBox3f &bounds) : m_bounds(bounds)
+	{
+		const Vec3f diag = bounds.diagonal();
+		for (int resolution = maxResolution; resolution >= 1; resolution /= 2)
+		{
+			Level level;
+			const Float cellSize = glm::max(diag[bounds.maximumExtent()], (Float)1e-4f) / resolution;
+			for (int axis = 0; axis < 3; ++axis)
+				level.resolution[axis] = clamp((int)glm::ceil(diag[axis] / cellSize), 1, resolution);
+
+			level.cells.reset(new Cell[level.resolution.x * level.resolution.y * level.resolution.z]);
+			m_levels.push_back(std::move(level));
+		}
+	}
+
+	SplittingCache::Cell &SplittingCache::cellAt(const Level &level, const Vec3f &p) const
+	{
+		const Vec3f o = m_bounds.offset(p);
+		Vec3i cell;
+		for (int axis = 0; axis < 3; ++axis)
+			cell[axis] = clamp((int)(o[axis] * level.resolution[axis]), 0, level.resolution[axis] - 1);
+		return level.cells[(cell.z * level.resolution.y + cell.y) * level.resolution.x + cell.x];
+	}
+
+	bool SplittingCache::lookup(const Vec3f &p, Float &secondMoment, Float &variance, Float &cost) const
+	{
+		for (const auto &level : m_levels)
+		{
+			const Cell &cell = cellAt(level, p);
+			if (!cell.learned)
+				continue;
+
+			secondMoment = cell.learnedMoment;
+			variance = cell.learnedVariance;
+			cost = cell.learnedCost;
+			return true;
+		}
+		return false;
+	}
+
+	void SplittingCache::record(const Vec3f &p, Float radiance, Float cost)
+	{
+		if (!(radiance >= 0) || glm::isinf(radiance))
+			return;
+
+		for (const auto &level : m_levels)
+		{
+			Cell &cell = cellAt(level, p);
+			cell.sum.add(radiance);
+			cell.sumSquares.add(radiance * radiance);
+			cell.cost.add(cost);
+			++cell.nRecords;
+		}
+	}
+
+	void SplittingCache::update()
+	{
+		//Note: the records depend on the roulette they were traced with, every iteration starts them anew
+		//      and the cells that collected too few keep their previous estimates
+		int nCells = 0, nLearned = 0;
+		for (const auto &level : m_levels)
+		{
+			const int n = level.resolution.x * level.resolution.y * level.resolution.z;
+			nCells += n;
+			for (int i = 0; i < n; ++i)
+			{
+				Cell &cell = level.cells[i];
+				const int nRecords = cell.nRecords;
+				if (nRecords >= minRecords && cell.cost > 0)
+				{
+					const Float mean = cell.sum / nRecords;
+					cell.learnedMoment = cell.sumSquares / nRecords;
+					cell.learnedVariance = glm::max((Float)0, cell.learnedMoment - mean * mean);
+					cell.learnedCost = cell.cost / nRecords;
+					cell.learned = true;
+				}
+				if (cell.learned)
+					++nLearned;
+
+				cell.sum = cell.sumSquares = cell.cost = 0;
+				cell.nRecords = 0;
+			}
+		}
+
+		LOG(INFO) << "Splitting cache learned " << nLearned << " of " << nCells << " cells";
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef ARSPLITTING_CACHE_H
+#define ARSPLITTING_CACHE_H
+
+#include "Utils/Base.h"
+#include "Utils/Math.h"
+#include "Utils/Parallel.h"
+
+#include <atomic>
+#include <vector>
+
+namespace RT
+{
+	//! @brief Learned cost and moments of the radiance reflected over the regions of the scene.
+	/**
+	 * Backs the efficiency-aware Russian roulette and splitting of Rath et al., "EARS: Efficiency-Aware
+	 * Russian Roulette and Splitting". A pyramid of uniform grids over the scene bounds collects, for
+	 * every path vertex of the training iterations, the estimate of the radiance that the continuation
+	 * of the path carried back to the vertex, its square and the number of rays that continuation
+	 * traced. Every level halves the resolution of the one below down to a single cell, and a lookup
+	 * takes the finest cell around the point that has learned anything. Like the adaptive octree of
+	 * EARS, the cache resolves the scene only as finely as the training paths allow.
+	 * update() turns the records collected so far into the estimates that lookup() returns.
+	 */
+	class SplittingCache final
+	{
+	public:
+		typedef std::unique_ptr<SplittingCache> unique_ptr;
+
+		SplittingCache(const BBox3f &bounds);
+
+		//Learned estimates of the cell around |p|, false if the cell has too few records yet
+		bool lookup(const Vec3f &p, Float &secondMoment, Float &variance, Float &cost) const;
+
+		void record(const Vec3f &p, Float radiance, Float cost);
+
+		void update();
+
+	private:
+		//Note: the longest axis of the scene is divided into this many cells at the finest level, the
+		//      others keep cubic cells
+		static constexpr int maxResolution = 32;
+		static constexpr int minRecords = 128;
+
+		struct Cell
+		{
+			AAtomicFloat sum, sumSquares, cost;
+			std::atomic<int> nRecords{ 0 };
+
+			Float learnedMoment = 0, learnedVariance = 0, learnedCost = 0;
+			bool learned = false;
+		};
+
+		struct Level
+		{
+			Vec3i resolution;
+			std::unique_ptr<Cell[]> cells;
+		};
+
+		Cell &cellAt(const Level &level, const Vec3f &p) const;
+
+		BBox3f m_bounds;
+		std::vector<Level> m_levels;	//from the finest to a single cell
+	};
+}
+
+#endif
@@ -94,11 +94,28 @@ namespace RT
 		return ret;
 	}
 
+	Vec3f Transform::operator()(const Vec3f &p, const Vec3f &pError, Vec3f &pTransError) const
+	{
+		//Note: the bound assumes an affine transform, which is all the shapes are placed with
+		const AMatrix4x4 &m = m_trans;
+		for (int i = 0; i < 3; ++i)
+		{
+			Float absSum = glm::abs(m[3][i]), errorSum = 0;
+			for (int j = 0; j < 3; ++j)
+			{
+				absSum += glm::abs(m[j][i] * p[j]);
+				errorSum += glm::abs(m[j][i]) * pError[j];
+			}
+			pTransError[i] = (gamma(3) + 1) * errorSum + gamma(3) * absSum;
+		}
+		return (*this)(p, 1.0f);
+	}
+
 	SurfaceInteraction Transform::operator()(const SurfaceInteraction &si) const
 	{
 		SurfaceInteraction ret;
 		// Transform _p_ and _pError_ in _SurfaceInteraction_
-		ret.p = (*this)(si.p, 1.0f);
+		ret.p = (*this)(si.p, si.pError, ret.pError);
 
 		// Transform remaining members of _SurfaceInteraction_
 		const Transform &trans = *this;
@@ -43,6 +43,8 @@ namespace RT
 		//Vector
 		template <typename T>
 		inline Vec3<T> operator()(const Vec3<T> &p, const Float &w) const;
+		//Point carrying the rounding error bound |pError|, |pTransError| receives the bound of the result
+		Vec3f operator()(const Vec3f &p, const Vec3f &pError, Vec3f &pTransError) const;
 
 		bool isIdentity() const
 		{